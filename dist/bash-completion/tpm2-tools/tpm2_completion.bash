@@ -435,11 +435,14 @@ _tpm2_checkquote()
             -F | --format)
                 COMPREPLY=($(compgen -W "${format_methods[*]}" -- "$cur"))
                 return;;
+            --batch)
+                _filedir
+                return;;
         esac
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        -u -g -m -s -f -l -q -F --public --hash-algorithm --message --signature --pcr --pcr-list --qualification --format " \
+        -u -g -m -s -f -l -q -F --public --hash-algorithm --message --signature --pcr --pcr-list --qualification --format --batch --jobs " \
         -- "$cur"))
     } &&
     complete -F _tpm2_checkquote tpm2_checkquote
@@ -1695,7 +1698,7 @@ _tpm2_getrandom()
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        -o -f -S --output --force --session --hex --cphash --rphash " \
+        -o -f -S --output --force --session --hex --bulk --cphash --rphash " \
         -- "$cur"))
     } &&
     complete -F _tpm2_getrandom tpm2_getrandom
@@ -4748,7 +4751,7 @@ _tpm2_sign()
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        -c -p -g -s -d -t -o -f --key-context --auth --hash-algorithm --scheme --digest --ticket --signature --format --cphash " \
+        -c -p -g -s -d -t -o -f --key-context --auth --hash-algorithm --scheme --digest --ticket --signature --format --cphash --batch --local-hash " \
         -- "$cur"))
     } &&
     complete -F _tpm2_sign tpm2_sign
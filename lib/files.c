@@ -10,6 +10,9 @@
 #include <string.h>
 #include <strings.h>
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 #include <tss2/tss2_mu.h>
 
 #include "files.h"
@@ -574,6 +577,97 @@ bool files_read_bytes_chunk(FILE *out, UINT8 bytes[], size_t len, size_t *read_l
     return (chunk_len == len);
 }
 
+#define MAP_READ_CHUNK_SIZE 16384
+
+static bool read_whole_file(FILE *f, const char *path, files_mapping *mapping) {
+
+    UINT8 *data = NULL;
+    size_t size = 0;
+    size_t capacity = 0;
+    bool is_chunk_full;
+    do {
+        if (capacity - size < MAP_READ_CHUNK_SIZE) {
+            capacity = capacity ? capacity * 2 : MAP_READ_CHUNK_SIZE;
+            UINT8 *tmp = realloc(data, capacity);
+            if (!tmp) {
+                LOG_ERR("oom");
+                free(data);
+                return false;
+            }
+            data = tmp;
+        }
+
+        is_chunk_full = files_read_bytes_chunk(f, data + size,
+                MAP_READ_CHUNK_SIZE, &size);
+    } while (is_chunk_full);
+
+    if (ferror(f)) {
+        LOG_ERR("Error reading file \"%s\"", path);
+        free(data);
+        return false;
+    }
+
+    mapping->data = data;
+    mapping->size = size;
+    mapping->is_mapped = false;
+
+    return true;
+}
+
+bool files_map_path(const char *path, files_mapping *mapping) {
+
+    BAIL_ON_NULL("path", path);
+    BAIL_ON_NULL("mapping", mapping);
+
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        LOG_ERR("Could not open file \"%s\" error: %s", path, strerror(errno));
+        return false;
+    }
+
+    bool result = false;
+    struct stat st;
+    if (fstat(fileno(f), &st)) {
+        LOG_ERR("Could not stat file \"%s\" error: %s", path, strerror(errno));
+        goto out;
+    }
+
+    if (S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(f),
+                0);
+        if (map != MAP_FAILED) {
+            mapping->data = map;
+            mapping->size = st.st_size;
+            mapping->is_mapped = true;
+            result = true;
+            goto out;
+        }
+        LOG_INFO("Could not map file \"%s\", reading it instead", path);
+    }
+
+    result = read_whole_file(f, path, mapping);
+
+out:
+    fclose(f);
+    return result;
+}
+
+void files_unmap_path(files_mapping *mapping) {
+
+    if (!mapping || !mapping->data) {
+        return;
+    }
+
+    if (mapping->is_mapped) {
+        munmap(mapping->data, mapping->size);
+    } else {
+        free(mapping->data);
+    }
+
+    mapping->data = NULL;
+    mapping->size = 0;
+}
+
 bool files_write_bytes(FILE *out, uint8_t bytes[], size_t len) {
 
     BAIL_ON_NULL("FILE", out);
@@ -586,6 +586,34 @@ bool files_read_bytes(FILE *out, UINT8 data[], size_t size);
  */
 bool files_read_bytes_chunk(FILE *out, UINT8 data[], size_t size, size_t *read_size);
 
+typedef struct files_mapping files_mapping;
+struct files_mapping {
+    UINT8 *data;
+    size_t size;
+    bool is_mapped;
+};
+
+/**
+ * Makes the whole content of a file available in memory. Regular files are
+ * mapped read-only so nothing gets copied. Files that cannot be mapped, like
+ * pipes or securityfs files which report no size, are read in chunks into a
+ * heap buffer instead.
+ * @param path
+ *  The path of the file.
+ * @param mapping
+ *  The mapping to populate, release it with files_unmap_path().
+ * @return
+ *  True on success, False otherwise.
+ */
+bool files_map_path(const char *path, files_mapping *mapping);
+
+/**
+ * Releases the memory of a mapping set up by files_map_path().
+ * @param mapping
+ *  The mapping to release.
+ */
+void files_unmap_path(files_mapping *mapping);
+
 /**
  * Converts a TPM2B_ATTEST to a TPMS_ATTEST using libmu.
  * @param quoted
@@ -1,5 +1,6 @@
 
 #include <stdio.h>
+#include <string.h>
 
 #include "files.h"
 #include "log.h"
@@ -7,11 +8,14 @@
 #include "tool_rc.h"
 #include "tpm2.h"
 #include "tpm2_auth_util.h"
+#include "tpm2_capability.h"
 #include "tpm2_util.h"
 
 #define NULL_OBJECT "null"
 #define NULL_OBJECT_LEN (sizeof(NULL_OBJECT) - 1)
 
+#define SRK_CACHE_ENTRY "srk"
+
 TPM2B_PRIVATE tpm2_util_object_tsspem_priv = { 0 };
 TPM2B_PUBLIC tpm2_util_object_tsspem_pub = { 0 };
 
@@ -63,6 +67,156 @@ ret:
     return rc;
 }
 
+/*
+ * The unique field of a primary is the public key the TPM derived, compare
+ * everything else against the template.
+ */
+static bool tpm2_util_object_srk_matches(ESYS_CONTEXT *esys_ctx,
+    ESYS_TR handle, const TPM2B_PUBLIC *template) {
+
+    TPM2B_PUBLIC *public = NULL;
+    TSS2_RC r = Esys_ReadPublic(esys_ctx, handle, ESYS_TR_NONE, ESYS_TR_NONE,
+        ESYS_TR_NONE, &public, NULL, NULL);
+    if (r != TSS2_RC_SUCCESS) {
+        return false;
+    }
+
+    public->publicArea.unique = template->publicArea.unique;
+
+    UINT8 expected[sizeof(TPMT_PUBLIC)];
+    UINT8 actual[sizeof(TPMT_PUBLIC)];
+    size_t expected_size = 0;
+    size_t actual_size = 0;
+    bool is_match =
+        Tss2_MU_TPMT_PUBLIC_Marshal(&template->publicArea, expected,
+            sizeof(expected), &expected_size) == TSS2_RC_SUCCESS &&
+        Tss2_MU_TPMT_PUBLIC_Marshal(&public->publicArea, actual,
+            sizeof(actual), &actual_size) == TSS2_RC_SUCCESS &&
+        expected_size == actual_size &&
+        !memcmp(expected, actual, actual_size);
+
+    Esys_Free(public);
+    return is_match;
+}
+
+static bool tpm2_util_object_is_persist_srk(void) {
+
+    const char *persist = tpm2_util_getenv(TPM2TOOLS_ENV_PERSIST_SRK);
+    return persist && strcmp(persist, "0");
+}
+
+/*
+ * The public area does not tell whether the key has an authValue, a key at the
+ * well known handle is only trusted to be the tools' SRK when the user opted
+ * into persisting it there.
+ */
+static bool tpm2_util_object_load_persistent_srk(ESYS_CONTEXT *esys_ctx,
+    const TPM2B_PUBLIC *template, ESYS_TR *parent) {
+
+    if (!tpm2_util_object_is_persist_srk()) {
+        return false;
+    }
+
+    TPMS_CAPABILITY_DATA *capability_data = NULL;
+    tool_rc rc = tpm2_capability_get_ex(esys_ctx, TPM2_CAP_HANDLES,
+        TPM2_SRK_HANDLE, 1, true, &capability_data);
+    if (rc != tool_rc_success) {
+        return false;
+    }
+
+    bool is_present = capability_data->data.handles.count &&
+        capability_data->data.handles.handle[0] == TPM2_SRK_HANDLE;
+    free(capability_data);
+    if (!is_present) {
+        return false;
+    }
+
+    ESYS_TR handle = ESYS_TR_NONE;
+    TSS2_RC r = Esys_TR_FromTPMPublic(esys_ctx, TPM2_SRK_HANDLE, ESYS_TR_NONE,
+        ESYS_TR_NONE, ESYS_TR_NONE, &handle);
+    if (r != TSS2_RC_SUCCESS) {
+        return false;
+    }
+
+    if (!tpm2_util_object_srk_matches(esys_ctx, handle, template)) {
+        LOG_INFO("Persistent handle 0x%x does not hold the SRK template",
+            TPM2_SRK_HANDLE);
+        Esys_TR_Close(esys_ctx, &handle);
+        return false;
+    }
+
+    LOG_INFO("Using persistent SRK 0x%x", TPM2_SRK_HANDLE);
+    *parent = handle;
+    return true;
+}
+
+static bool tpm2_util_object_load_cached_srk(ESYS_CONTEXT *esys_ctx,
+    const TPM2B_PUBLIC *template, ESYS_TR *parent) {
+
+    UINT8 buffer[sizeof(TPMS_CONTEXT)];
+    size_t size = sizeof(buffer);
+    if (!tpm2_capability_cache_read(esys_ctx, SRK_CACHE_ENTRY, buffer,
+        &size)) {
+        return false;
+    }
+
+    TPMS_CONTEXT context;
+    size_t offset = 0;
+    TSS2_RC r = Tss2_MU_TPMS_CONTEXT_Unmarshal(buffer, size, &offset,
+        &context);
+    if (r != TSS2_RC_SUCCESS || offset != size) {
+        return false;
+    }
+
+    /* saved contexts of transient objects do not survive a TPM reset */
+    ESYS_TR handle = ESYS_TR_NONE;
+    r = Esys_ContextLoad(esys_ctx, &context, &handle);
+    if (r != TSS2_RC_SUCCESS) {
+        LOG_INFO("Cached SRK context is stale, recreating the SRK");
+        return false;
+    }
+
+    if (!tpm2_util_object_srk_matches(esys_ctx, handle, template)) {
+        Esys_FlushContext(esys_ctx, handle);
+        return false;
+    }
+
+    *parent = handle;
+    return true;
+}
+
+static void tpm2_util_object_keep_srk(ESYS_CONTEXT *esys_ctx,
+    ESYS_TR parent) {
+
+    if (tpm2_util_object_is_persist_srk()) {
+        ESYS_TR persistent = ESYS_TR_NONE;
+        TSS2_RC r = Esys_EvictControl(esys_ctx, ESYS_TR_RH_OWNER, parent,
+            ESYS_TR_PASSWORD, ESYS_TR_NONE, ESYS_TR_NONE, TPM2_SRK_HANDLE,
+            &persistent);
+        if (r == TSS2_RC_SUCCESS) {
+            Esys_TR_Close(esys_ctx, &persistent);
+            return;
+        }
+
+        LOG_WARN("Could not persist the SRK at 0x%x", TPM2_SRK_HANDLE);
+    }
+
+    TPMS_CONTEXT *context = NULL;
+    TSS2_RC r = Esys_ContextSave(esys_ctx, parent, &context);
+    if (r != TSS2_RC_SUCCESS) {
+        return;
+    }
+
+    UINT8 buffer[sizeof(*context)];
+    size_t size = 0;
+    r = Tss2_MU_TPMS_CONTEXT_Marshal(context, buffer, sizeof(buffer), &size);
+    Esys_Free(context);
+    if (r == TSS2_RC_SUCCESS) {
+        tpm2_capability_cache_write(esys_ctx, SRK_CACHE_ENTRY, buffer,
+            size);
+    }
+}
+
 static tool_rc tpm2_util_object_setup_primary(ESYS_CONTEXT *esys_ctx,
     ESYS_TR *parent) {
 
@@ -161,6 +315,19 @@ static tool_rc tpm2_util_object_setup_primary(ESYS_CONTEXT *esys_ctx,
         primary_template = &primary_rsa_template;
     }
 
+    /*
+     * Generating the primary, RSA in particular, is slow. Reuse an SRK made
+     * persistent at the well known handle when opted in or, with the
+     * capability cache enabled, the saved context of the one created by a
+     * previous run on the same TPM.
+     */
+    if (tpm2_util_object_load_persistent_srk(esys_ctx, primary_template,
+            parent) ||
+        tpm2_util_object_load_cached_srk(esys_ctx, primary_template,
+            parent)) {
+        goto ret;
+    }
+
     TSS2_RC r = Esys_CreatePrimary(esys_ctx, ESYS_TR_RH_OWNER, ESYS_TR_PASSWORD,
         ESYS_TR_NONE, ESYS_TR_NONE, &primary_sensitive, primary_template,
         &all_outside_info, &all_creation_PCR, parent, NULL, NULL, NULL, NULL);
@@ -170,6 +337,8 @@ static tool_rc tpm2_util_object_setup_primary(ESYS_CONTEXT *esys_ctx,
         goto ret;
     }
 
+    tpm2_util_object_keep_srk(esys_ctx, *parent);
+
 ret:
     return rc;
 }
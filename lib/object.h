@@ -34,6 +34,21 @@ DECLARE_ASN1_FUNCTIONS(TSSPRIVKEY_OBJ);
 DECLARE_PEM_write_bio(TSSPRIVKEY_OBJ, TSSPRIVKEY_OBJ);
 DECLARE_PEM_read_bio(TSSPRIVKEY_OBJ, TSSPRIVKEY_OBJ);
 
+/*
+ * The persistent handle of the storage root key per the TCG provisioning
+ * guidance. A key here with the SRK template parents TSS PEM keys that do not
+ * name a persistent parent.
+ */
+#define TPM2_SRK_HANDLE 0x81000001
+
+/*
+ * When set, the SRK created for loading a TSS PEM key is made persistent at
+ * TPM2_SRK_HANDLE so later loads skip the primary generation. Only then is a
+ * key found at TPM2_SRK_HANDLE used as the SRK, it must have an empty
+ * authValue.
+ */
+#define TPM2TOOLS_ENV_PERSIST_SRK "TPM2TOOLS_PERSIST_SRK"
+
 /*
  * TPM2B_PRIVATE and TPM2B_PUBLIC parsed from a TSSPEM/ tssprivkey
  */
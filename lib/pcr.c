@@ -9,6 +9,8 @@
 #include "log.h"
 #include "pcr.h"
 #include "tpm2.h"
+#include "tpm2_capability.h"
+#include "tpm2_queue.h"
 #include "tpm2_systemdeps.h"
 #include "tpm2_tool.h"
 #include "tpm2_alg_util.h"
@@ -510,12 +512,9 @@ bool pcr_parse_selections(const char *arg, TPML_PCR_SELECTION *pcr_select,
 tool_rc pcr_get_banks(ESYS_CONTEXT *esys_context,
         TPMS_CAPABILITY_DATA *capability_data, tpm2_algorithm *algs) {
 
-    TPMI_YES_NO more_data;
     TPMS_CAPABILITY_DATA *capdata_ret;
 
-    tool_rc rc = tpm2_get_capability(esys_context, ESYS_TR_NONE, ESYS_TR_NONE,
-            ESYS_TR_NONE, TPM2_CAP_PCRS, no_argument, required_argument,
-            &more_data, &capdata_ret);
+    tool_rc rc = tpm2_capability_get_pcrs(esys_context, &capdata_ret);
     if (rc != tool_rc_success) {
         return rc;
     }
@@ -603,7 +602,7 @@ bool pcr_check_pcr_selection(TPMS_CAPABILITY_DATA *cap_data,
     return true;
 }
 
-tool_rc pcr_read_pcr_values(ESYS_CONTEXT *esys_context,
+static tool_rc pcr_read_sequential(ESYS_CONTEXT *esys_context,
         TPML_PCR_SELECTION *pcr_select, tpm2_pcrs *pcrs, TPM2B_DIGEST *cp_hash,
         TPMI_ALG_HASH parameter_hash_algorithm) {
 
@@ -647,3 +646,163 @@ tool_rc pcr_read_pcr_values(ESYS_CONTEXT *esys_context,
 
     return tool_rc_success;
 }
+
+/*
+ * Splits a selection into the PCR_Read commands needed to read it, each
+ * selecting at most as many PCRs as a response can carry digests. The chunks
+ * keep the order of the selection, so the digests of all responses line up
+ * with it.
+ */
+static bool pcr_read_plan(const TPML_PCR_SELECTION *pcr_select,
+        TPML_PCR_SELECTION *plan, size_t max_chunks, size_t *chunks) {
+
+    const UINT32 max_digests = ARRAY_LEN(((TPML_DIGEST *) 0)->digests);
+
+    TPML_PCR_SELECTION *chunk = NULL;
+    UINT32 digests = max_digests;
+    UINT32 i, pcr;
+
+    *chunks = 0;
+    for (i = 0; i < pcr_select->count; i++) {
+        const TPMS_PCR_SELECTION *bank = &pcr_select->pcrSelections[i];
+        TPMS_PCR_SELECTION *dst = NULL;
+
+        for (pcr = 0; pcr < bank->sizeofSelect * 8u; pcr++) {
+            if (!(bank->pcrSelect[pcr / 8] & (1 << (pcr % 8)))) {
+                continue;
+            }
+
+            if (digests == max_digests) {
+                if (*chunks == max_chunks) {
+                    return false;
+                }
+                chunk = &plan[(*chunks)++];
+                memset(chunk, 0, sizeof(*chunk));
+                digests = 0;
+                dst = NULL;
+            }
+
+            if (!dst) {
+                dst = &chunk->pcrSelections[chunk->count++];
+                dst->hash = bank->hash;
+                dst->sizeofSelect = bank->sizeofSelect;
+            }
+
+            dst->pcrSelect[pcr / 8] |= 1 << (pcr % 8);
+            digests++;
+        }
+    }
+
+    return *chunks > 0;
+}
+
+typedef enum pcr_read_status pcr_read_status;
+enum pcr_read_status {
+    pcr_read_done,
+    /* the PCRs changed between two chunks, the values are not a snapshot */
+    pcr_read_changed,
+    /* the TPM returned less than a chunk selected */
+    pcr_read_partial,
+};
+
+/*
+ * Issues the PCR_Read commands of a plan back to back, the next command is
+ * sent before the response of the previous one is processed.
+ */
+static tool_rc pcr_read_pipelined(ESYS_CONTEXT *esys_context,
+        const TPML_PCR_SELECTION *plan, size_t chunks, tpm2_pcrs *pcrs,
+        pcr_read_status *status) {
+
+    UINT32 first_update_counter = 0;
+    size_t i;
+
+    *status = pcr_read_done;
+    pcrs->count = 0;
+
+    tpm2_queue *queue = tpm2_queue_new(esys_context);
+    if (!queue) {
+        return tool_rc_general_error;
+    }
+
+    tool_rc rc = tpm2_queue_pcr_read(queue, &plan[0], NULL);
+
+    for (i = 0; i < chunks && rc == tool_rc_success; i++) {
+        if (i + 1 < chunks) {
+            rc = tpm2_queue_pcr_read(queue, &plan[i + 1], NULL);
+            if (rc != tool_rc_success) {
+                break;
+            }
+        }
+
+        tpm2_queue_result result;
+        rc = tpm2_queue_wait(queue, &result);
+        if (rc != tool_rc_success) {
+            break;
+        }
+
+        TPML_PCR_SELECTION unread = plan[i];
+        pcr_update_pcr_selections(&unread, result.pcr_selection);
+        if (!pcr_unset_pcr_sections(&unread)) {
+            *status = pcr_read_partial;
+        }
+
+        if (i == 0) {
+            first_update_counter = result.pcr_update_counter;
+        } else if (result.pcr_update_counter != first_update_counter
+                && *status == pcr_read_done) {
+            *status = pcr_read_changed;
+        }
+
+        pcrs->pcr_values[pcrs->count++] = *result.pcr_values;
+
+        free(result.pcr_selection);
+        free(result.pcr_values);
+    }
+
+    tpm2_queue_free(queue);
+
+    return rc;
+}
+
+#define PCR_READ_MAX_ATTEMPTS 3
+
+tool_rc pcr_read_pcr_values(ESYS_CONTEXT *esys_context,
+        TPML_PCR_SELECTION *pcr_select, tpm2_pcrs *pcrs, TPM2B_DIGEST *cp_hash,
+        TPMI_ALG_HASH parameter_hash_algorithm) {
+
+    TPML_PCR_SELECTION plan[ARRAY_LEN(pcrs->pcr_values)];
+    size_t chunks;
+
+    bool is_pipelined = !(cp_hash && cp_hash->size)
+            && pcr_read_plan(pcr_select, plan, ARRAY_LEN(plan), &chunks);
+    if (!is_pipelined) {
+        return pcr_read_sequential(esys_context, pcr_select, pcrs, cp_hash,
+                parameter_hash_algorithm);
+    }
+
+    unsigned attempt;
+    for (attempt = 0; attempt < PCR_READ_MAX_ATTEMPTS; attempt++) {
+        pcr_read_status status;
+        tool_rc rc = pcr_read_pipelined(esys_context, plan, chunks, pcrs,
+                &status);
+        if (rc != tool_rc_success) {
+            return rc;
+        }
+
+        if (status == pcr_read_done) {
+            return tool_rc_success;
+        }
+
+        if (status == pcr_read_partial) {
+            LOG_INFO("TPM returned a partial PCR selection, reading in turns");
+            return pcr_read_sequential(esys_context, pcr_select, pcrs, cp_hash,
+                    parameter_hash_algorithm);
+        }
+    }
+
+    /* the sequential read never checked the counter, don't fail where it read */
+    LOG_WARN("PCRs kept changing while being read, reading in turns after %u "
+            "attempts", PCR_READ_MAX_ATTEMPTS);
+    return pcr_read_sequential(esys_context, pcr_select, pcrs, cp_hash,
+            parameter_hash_algorithm);
+}
@@ -312,6 +312,46 @@ tpm2_nvread_skip_esapi_call:
     return rc;
 }
 
+tool_rc tpm2_nv_read_async(ESYS_CONTEXT *esys_context,
+    tpm2_loaded_object *auth_hierarchy_obj, ESYS_TR nv_handle, UINT16 size,
+    UINT16 offset, ESYS_TR shandle2, ESYS_TR shandle3) {
+
+    ESYS_TR auth_hierarchy_obj_session_handle = ESYS_TR_NONE;
+    tool_rc rc = tpm2_auth_util_get_shandle(esys_context,
+            auth_hierarchy_obj->tr_handle, auth_hierarchy_obj->session,
+            &auth_hierarchy_obj_session_handle);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Failed to get shandle");
+        return rc;
+    }
+
+    TSS2_RC rval = Esys_NV_Read_Async(esys_context,
+        auth_hierarchy_obj->tr_handle, nv_handle,
+        auth_hierarchy_obj_session_handle, shandle2, shandle3, size, offset);
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Esys_NV_Read_Async, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
+tool_rc tpm2_nv_read_finish(ESYS_CONTEXT *esys_context,
+    TPM2B_MAX_NV_BUFFER **data) {
+
+    TSS2_RC rval;
+    do {
+        rval = Esys_NV_Read_Finish(esys_context, data);
+    } while (rval == TSS2_ESYS_RC_TRY_AGAIN);
+
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Esys_NV_Read_Finish, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
 tool_rc tpm2_context_save(ESYS_CONTEXT *esys_context, ESYS_TR save_handle,
         TPMS_CONTEXT **context) {
 
@@ -653,6 +693,37 @@ tpm2_pcrread_skip_esapi_call:
     return rc;
 }
 
+tool_rc tpm2_pcr_read_async(ESYS_CONTEXT *esys_context,
+        const TPML_PCR_SELECTION *pcr_selection_in) {
+
+    TSS2_RC rval = Esys_PCR_Read_Async(esys_context, ESYS_TR_NONE,
+            ESYS_TR_NONE, ESYS_TR_NONE, pcr_selection_in);
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Esys_PCR_Read_Async, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
+tool_rc tpm2_pcr_read_finish(ESYS_CONTEXT *esys_context,
+        UINT32 *pcr_update_counter, TPML_PCR_SELECTION **pcr_selection_out,
+        TPML_DIGEST **pcr_values) {
+
+    TSS2_RC rval;
+    do {
+        rval = Esys_PCR_Read_Finish(esys_context, pcr_update_counter,
+                pcr_selection_out, pcr_values);
+    } while (rval == TSS2_ESYS_RC_TRY_AGAIN);
+
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Esys_PCR_Read_Finish, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
 tool_rc tpm2_policy_authorize(ESYS_CONTEXT *esys_context, ESYS_TR policy_session,
         ESYS_TR shandle1, ESYS_TR shandle2, ESYS_TR shandle3,
         const TPM2B_DIGEST *approved_policy, const TPM2B_NONCE *policy_ref,
@@ -1822,6 +1893,34 @@ tool_rc tpm2_sequence_update(ESYS_CONTEXT *esys_context, ESYS_TR sequence_handle
     return tool_rc_success;
 }
 
+tool_rc tpm2_sequence_update_async(ESYS_CONTEXT *esys_context,
+        ESYS_TR sequence_handle, const TPM2B_MAX_BUFFER *buffer) {
+
+    TSS2_RC rval = Esys_SequenceUpdate_Async(esys_context, sequence_handle,
+            ESYS_TR_PASSWORD, ESYS_TR_NONE, ESYS_TR_NONE, buffer);
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Esys_SequenceUpdate_Async, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
+tool_rc tpm2_sequence_update_finish(ESYS_CONTEXT *esys_context) {
+
+    TSS2_RC rval;
+    do {
+        rval = Esys_SequenceUpdate_Finish(esys_context);
+    } while (rval == TSS2_ESYS_RC_TRY_AGAIN);
+
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Esys_SequenceUpdate_Finish, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
 tool_rc tpm2_sequence_complete(ESYS_CONTEXT *esys_context,
         ESYS_TR sequence_handle, const TPM2B_MAX_BUFFER *buffer,
         TPMI_RH_HIERARCHY hierarchy, TPM2B_DIGEST **result,
@@ -2947,6 +3046,93 @@ tpm2_encryptdecrypt_skip_esapi_call:
     return rc;
 }
 
+/*
+ * Set once the TPM rejected EncryptDecrypt2, later async requests go straight
+ * to EncryptDecrypt instead of paying for the failed attempt every block.
+ */
+static bool is_encryptdecrypt2_unsupported;
+
+tool_rc tpm2_encryptdecrypt_async(ESYS_CONTEXT *esys_context,
+    tpm2_loaded_object *encryption_key_obj, TPMI_YES_NO decrypt,
+    TPMI_ALG_SYM_MODE mode, const TPM2B_IV *iv_in,
+    const TPM2B_MAX_BUFFER *input_data) {
+
+    ESYS_TR shandle1 = ESYS_TR_NONE;
+    tool_rc rc = tpm2_auth_util_get_shandle(esys_context,
+    encryption_key_obj->tr_handle, encryption_key_obj->session, &shandle1);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Failed to get shandle");
+        return rc;
+    }
+
+    TSS2_RC rval;
+    if (is_encryptdecrypt2_unsupported) {
+        rval = Esys_EncryptDecrypt_Async(esys_context,
+                encryption_key_obj->tr_handle, shandle1, ESYS_TR_NONE,
+                ESYS_TR_NONE, decrypt, mode, iv_in, input_data);
+        if (rval != TSS2_RC_SUCCESS) {
+            LOG_PERR(Esys_EncryptDecrypt_Async, rval);
+            return tool_rc_from_tpm(rval);
+        }
+
+        return tool_rc_success;
+    }
+
+    rval = Esys_EncryptDecrypt2_Async(esys_context,
+            encryption_key_obj->tr_handle, shandle1, ESYS_TR_NONE, ESYS_TR_NONE,
+            input_data, decrypt, mode, iv_in);
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Esys_EncryptDecrypt2_Async, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
+tool_rc tpm2_encryptdecrypt_finish(ESYS_CONTEXT *esys_context,
+    tpm2_loaded_object *encryption_key_obj, TPMI_YES_NO decrypt,
+    TPMI_ALG_SYM_MODE mode, const TPM2B_IV *iv_in,
+    const TPM2B_MAX_BUFFER *input_data, TPM2B_MAX_BUFFER **output_data,
+    TPM2B_IV **iv_out) {
+
+    TSS2_RC rval;
+    if (is_encryptdecrypt2_unsupported) {
+        do {
+            rval = Esys_EncryptDecrypt_Finish(esys_context, output_data,
+                    iv_out);
+        } while (rval == TSS2_ESYS_RC_TRY_AGAIN);
+
+        if (rval != TSS2_RC_SUCCESS) {
+            LOG_PERR(Esys_EncryptDecrypt_Finish, rval);
+            return tool_rc_from_tpm(rval);
+        }
+
+        return tool_rc_success;
+    }
+
+    do {
+        rval = Esys_EncryptDecrypt2_Finish(esys_context, output_data, iv_out);
+    } while (rval == TSS2_ESYS_RC_TRY_AGAIN);
+
+    /*
+     * The inputs are still around, redo the block with EncryptDecrypt like
+     * tpm2_encryptdecrypt() does.
+     */
+    if (tpm2_error_get(rval) == TPM2_RC_COMMAND_CODE) {
+        is_encryptdecrypt2_unsupported = true;
+        return tpm2_encryptdecrypt(esys_context, encryption_key_obj, decrypt,
+                mode, iv_in, input_data, output_data, iv_out, NULL,
+                TPM2_ALG_ERROR);
+    }
+
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Esys_EncryptDecrypt2_Finish, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
 tool_rc tpm2_hierarchycontrol(ESYS_CONTEXT *esys_context,
     tpm2_loaded_object *auth_hierarchy, TPMI_RH_ENABLES enable,
     TPMI_YES_NO state, TPM2B_DIGEST *cp_hash,
@@ -4313,6 +4499,46 @@ tpm2_nvwrite_skip_esapi_call:
     return rc;
 }
 
+tool_rc tpm2_nvwrite_async(ESYS_CONTEXT *esys_context,
+    tpm2_loaded_object *auth_hierarchy_obj, ESYS_TR nv_handle,
+    const TPM2B_MAX_NV_BUFFER *data, UINT16 offset, ESYS_TR shandle2,
+    ESYS_TR shandle3) {
+
+    ESYS_TR auth_hierarchy_obj_session_handle = ESYS_TR_NONE;
+    tool_rc rc = tpm2_auth_util_get_shandle(esys_context,
+            auth_hierarchy_obj->tr_handle, auth_hierarchy_obj->session,
+            &auth_hierarchy_obj_session_handle);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Failed to get shandle");
+        return rc;
+    }
+
+    TSS2_RC rval = Esys_NV_Write_Async(esys_context,
+        auth_hierarchy_obj->tr_handle, nv_handle,
+        auth_hierarchy_obj_session_handle, shandle2, shandle3, data, offset);
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Esys_NV_Write_Async, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
+tool_rc tpm2_nvwrite_finish(ESYS_CONTEXT *esys_context) {
+
+    TSS2_RC rval;
+    do {
+        rval = Esys_NV_Write_Finish(esys_context);
+    } while (rval == TSS2_ESYS_RC_TRY_AGAIN);
+
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Esys_NV_Write_Finish, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
 tool_rc tpm2_pcr_allocate(ESYS_CONTEXT *esys_context,
         tpm2_loaded_object *auth_hierarchy_obj,
         const TPML_PCR_SELECTION *pcr_allocation, TPM2B_DIGEST *cp_hash,
@@ -4453,6 +4679,45 @@ tpm2_sign_skip_esapi_call:
     return rc;
 }
 
+tool_rc tpm2_sign_async(ESYS_CONTEXT *esys_context,
+    tpm2_loaded_object *signingkey_obj, const TPM2B_DIGEST *digest,
+    const TPMT_SIG_SCHEME *in_scheme, const TPMT_TK_HASHCHECK *validation) {
+
+    ESYS_TR signingkey_obj_session_handle = ESYS_TR_NONE;
+    tool_rc rc = tpm2_auth_util_get_shandle(esys_context,
+            signingkey_obj->tr_handle, signingkey_obj->session,
+            &signingkey_obj_session_handle);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    TSS2_RC rval = Esys_Sign_Async(esys_context, signingkey_obj->tr_handle,
+            signingkey_obj_session_handle, ESYS_TR_NONE, ESYS_TR_NONE, digest,
+            in_scheme, validation);
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Esys_Sign_Async, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
+tool_rc tpm2_sign_finish(ESYS_CONTEXT *esys_context,
+    TPMT_SIGNATURE **signature) {
+
+    TSS2_RC rval;
+    do {
+        rval = Esys_Sign_Finish(esys_context, signature);
+    } while (rval == TSS2_ESYS_RC_TRY_AGAIN);
+
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Esys_Sign_Finish, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
 tool_rc tpm2_nvcertify(ESYS_CONTEXT *esys_context,
     tpm2_loaded_object *signingkey_obj, tpm2_loaded_object *nvindex_authobj,
     TPM2_HANDLE nv_index, TPM2B_NAME *precalc_nvname,
@@ -5224,6 +5489,35 @@ tpm2_getrandom_skip_esapi_call:
     return rc;
 }
 
+tool_rc tpm2_getrandom_async(ESYS_CONTEXT *ectx, UINT16 count,
+        ESYS_TR session_handle_1, ESYS_TR session_handle_2,
+        ESYS_TR session_handle_3) {
+
+    TSS2_RC rval = Esys_GetRandom_Async(ectx, session_handle_1,
+        session_handle_2, session_handle_3, count);
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Esys_GetRandom_Async, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
+tool_rc tpm2_getrandom_finish(ESYS_CONTEXT *ectx, TPM2B_DIGEST **random) {
+
+    TSS2_RC rval;
+    do {
+        rval = Esys_GetRandom_Finish(ectx, random);
+    } while (rval == TSS2_ESYS_RC_TRY_AGAIN);
+
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Esys_GetRandom_Finish, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
 tool_rc tpm2_startup(ESYS_CONTEXT *ectx, TPM2_SU startup_type) {
 
     TSS2_RC rval = Esys_Startup(ectx, startup_type);
@@ -40,6 +40,13 @@ tool_rc tpm2_nv_read(ESYS_CONTEXT *esys_context,
     TPM2B_MAX_NV_BUFFER **data, TPM2B_DIGEST *cp_hash,  TPM2B_DIGEST *rp_hash,
     TPMI_ALG_HASH parameter_hash_algorithm, ESYS_TR shandle2, ESYS_TR shandle3);
 
+tool_rc tpm2_nv_read_async(ESYS_CONTEXT *esys_context,
+    tpm2_loaded_object *auth_hierarchy_obj, ESYS_TR nv_handle, UINT16 size,
+    UINT16 offset, ESYS_TR shandle2, ESYS_TR shandle3);
+
+tool_rc tpm2_nv_read_finish(ESYS_CONTEXT *esys_context,
+    TPM2B_MAX_NV_BUFFER **data);
+
 tool_rc tpm2_context_save(ESYS_CONTEXT *esys_context, ESYS_TR save_handle,
         TPMS_CONTEXT **context);
 
@@ -87,6 +94,13 @@ tool_rc tpm2_pcr_read(ESYS_CONTEXT *esys_context, ESYS_TR shandle1,
         TPML_PCR_SELECTION **pcr_selection_out, TPML_DIGEST **pcr_values,
         TPM2B_DIGEST *cp_hash, TPMI_ALG_HASH parameter_hash_algorithm);
 
+tool_rc tpm2_pcr_read_async(ESYS_CONTEXT *esys_context,
+        const TPML_PCR_SELECTION *pcr_selection_in);
+
+tool_rc tpm2_pcr_read_finish(ESYS_CONTEXT *esys_context,
+        UINT32 *pcr_update_counter, TPML_PCR_SELECTION **pcr_selection_out,
+        TPML_DIGEST **pcr_values);
+
 tool_rc tpm2_policy_authorize(ESYS_CONTEXT *esys_context, ESYS_TR policy_session,
         ESYS_TR shandle1, ESYS_TR shandle2, ESYS_TR shandle3,
         const TPM2B_DIGEST *approved_policy, const TPM2B_NONCE *policy_ref,
@@ -181,6 +195,11 @@ tool_rc tpm2_hash_sequence_start(ESYS_CONTEXT *esys_context, const TPM2B_AUTH *a
 tool_rc tpm2_sequence_update(ESYS_CONTEXT *esys_context, ESYS_TR sequence_handle,
         const TPM2B_MAX_BUFFER *buffer);
 
+tool_rc tpm2_sequence_update_async(ESYS_CONTEXT *esys_context,
+        ESYS_TR sequence_handle, const TPM2B_MAX_BUFFER *buffer);
+
+tool_rc tpm2_sequence_update_finish(ESYS_CONTEXT *esys_context);
+
 tool_rc tpm2_sequence_complete(ESYS_CONTEXT *esys_context,
         ESYS_TR sequence_handle, const TPM2B_MAX_BUFFER *buffer,
         TPMI_RH_HIERARCHY hierarchy, TPM2B_DIGEST **result,
@@ -292,6 +311,17 @@ tool_rc tpm2_encryptdecrypt(ESYS_CONTEXT *esys_context,
     TPM2B_IV **iv_out, TPM2B_DIGEST *cp_hash,
     TPMI_ALG_HASH parameter_hash_algorithm);
 
+tool_rc tpm2_encryptdecrypt_async(ESYS_CONTEXT *esys_context,
+    tpm2_loaded_object *encryption_key_obj, TPMI_YES_NO decrypt,
+    TPMI_ALG_SYM_MODE mode, const TPM2B_IV *iv_in,
+    const TPM2B_MAX_BUFFER *input_data);
+
+tool_rc tpm2_encryptdecrypt_finish(ESYS_CONTEXT *esys_context,
+    tpm2_loaded_object *encryption_key_obj, TPMI_YES_NO decrypt,
+    TPMI_ALG_SYM_MODE mode, const TPM2B_IV *iv_in,
+    const TPM2B_MAX_BUFFER *input_data, TPM2B_MAX_BUFFER **output_data,
+    TPM2B_IV **iv_out);
+
 tool_rc tpm2_hierarchycontrol(ESYS_CONTEXT *esys_context,
     tpm2_loaded_object *auth_hierarchy, TPMI_RH_ENABLES enable,
     TPMI_YES_NO state, TPM2B_DIGEST *cp_hash,
@@ -378,6 +408,13 @@ tool_rc tpm2_nvwrite(ESYS_CONTEXT *esys_context,
     TPM2B_DIGEST *cp_hash, TPM2B_DIGEST *rp_hash,
     TPMI_ALG_HASH parameter_hash_algorithm, ESYS_TR shandle2, ESYS_TR shandle3);
 
+tool_rc tpm2_nvwrite_async(ESYS_CONTEXT *esys_context,
+    tpm2_loaded_object *auth_hierarchy_obj, ESYS_TR nv_handle,
+    const TPM2B_MAX_NV_BUFFER *data, UINT16 offset, ESYS_TR shandle2,
+    ESYS_TR shandle3);
+
+tool_rc tpm2_nvwrite_finish(ESYS_CONTEXT *esys_context);
+
 tool_rc tpm2_pcr_allocate(ESYS_CONTEXT *esys_context,
         tpm2_loaded_object *auth_hierarchy_obj,
         const TPML_PCR_SELECTION *pcr_allocation, TPM2B_DIGEST *cp_hash,
@@ -388,6 +425,13 @@ tool_rc tpm2_sign(ESYS_CONTEXT *esys_context, tpm2_loaded_object *signingkey_obj
     TPMT_TK_HASHCHECK *validation, TPMT_SIGNATURE **signature,
     TPM2B_DIGEST *cp_hash, TPMI_ALG_HASH parameter_hash_algorithm);
 
+tool_rc tpm2_sign_async(ESYS_CONTEXT *esys_context,
+    tpm2_loaded_object *signingkey_obj, const TPM2B_DIGEST *digest,
+    const TPMT_SIG_SCHEME *in_scheme, const TPMT_TK_HASHCHECK *validation);
+
+tool_rc tpm2_sign_finish(ESYS_CONTEXT *esys_context,
+    TPMT_SIGNATURE **signature);
+
 tool_rc tpm2_quote(ESYS_CONTEXT *esys_context, tpm2_loaded_object *quote_obj,
     TPMT_SIG_SCHEME *in_scheme, TPM2B_DATA *qualifying_data,
     TPML_PCR_SELECTION *pcr_select, TPM2B_ATTEST **quoted,
@@ -441,6 +485,12 @@ tool_rc tpm2_getrandom(ESYS_CONTEXT *ectx, UINT16 count,
         ESYS_TR session_handle_1, ESYS_TR session_handle_2,
         ESYS_TR session_handle_3, TPMI_ALG_HASH param_hash_algorithm) ;
 
+tool_rc tpm2_getrandom_async(ESYS_CONTEXT *ectx, UINT16 count,
+        ESYS_TR session_handle_1, ESYS_TR session_handle_2,
+        ESYS_TR session_handle_3);
+
+tool_rc tpm2_getrandom_finish(ESYS_CONTEXT *ectx, TPM2B_DIGEST **random);
+
 tool_rc tpm2_startup(ESYS_CONTEXT *ectx, TPM2_SU startup_type);
 
 tool_rc tpm2_pcr_reset(ESYS_CONTEXT *ectx, ESYS_TR pcr_handle,
@@ -1,12 +1,23 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <tss2/tss2_mu.h>
 
 #include "log.h"
 #include "tpm2.h"
 #include "tpm2_capability.h"
+#include "tpm2_util.h"
+
+#define CACHE_KEY_MAX 128
 
 #define APPEND_CAPABILITY_INFORMATION(capability, field, subfield, max_count) \
     if (fetched_data->data.capability.count > max_count - property_count) { \
@@ -194,3 +205,294 @@ out:
     free(capability_data);
     return handle_found ? tool_rc_success : tool_rc_general_error;
 }
+
+/*
+ * The fixed properties never change for a given TPM firmware, yet most tools
+ * ask for them on every run. They are kept for the lifetime of the ESAPI
+ * context and, when enabled, on disk per TCTI configuration. Telling TPMs
+ * apart by their manufacturer and firmware version would cost the very round
+ * trip the cache saves, so a firmware update or another TPM behind the same
+ * TCTI needs an explicit refresh. The PCR allocation changes with
+ * PCR_Allocate or a firmware setting, from any tool, so it is only kept for
+ * the lifetime of the context.
+ */
+static struct {
+    bool is_disk_enabled;
+    bool is_refresh;
+    char key[CACHE_KEY_MAX];
+    ESYS_CONTEXT *ectx;
+    TPMS_CAPABILITY_DATA *fixed;
+    TPMS_CAPABILITY_DATA *pcrs;
+} cache;
+
+static bool cache_path(const char *name, char *path, size_t size) {
+
+    char dir[PATH_MAX];
+    const char *xdg_cache = tpm2_util_getenv("XDG_CACHE_HOME");
+    const char *home = tpm2_util_getenv("HOME");
+    int len;
+    if (xdg_cache && xdg_cache[0]) {
+        len = snprintf(dir, sizeof(dir), "%s/tpm2-tools", xdg_cache);
+    } else if (home && home[0]) {
+        len = snprintf(dir, sizeof(dir), "%s/.cache/tpm2-tools", home);
+    } else {
+        return false;
+    }
+
+    if (len < 0 || (size_t) len >= sizeof(dir)) {
+        return false;
+    }
+
+    len = snprintf(path, size, "%s/%s-%s", dir, cache.key, name);
+    return len > 0 && (size_t) len < size;
+}
+
+static bool cache_mkdir(const char *path) {
+
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", path);
+
+    /* create every missing component of the directory holding path */
+    char *p;
+    for (p = strchr(dir + 1, '/'); p; p = strchr(p + 1, '/')) {
+        *p = '\0';
+        if (mkdir(dir, 0700) && errno != EEXIST) {
+            LOG_WARN("Could not create capability cache directory \"%s\", "
+                    "error: %s", dir, strerror(errno));
+            return false;
+        }
+        *p = '/';
+    }
+
+    return true;
+}
+
+static void cache_drop(void) {
+
+    free(cache.fixed);
+    free(cache.pcrs);
+    cache.fixed = NULL;
+    cache.pcrs = NULL;
+    cache.ectx = NULL;
+}
+
+static void cache_select(ESYS_CONTEXT *ectx) {
+
+    /* a new context may talk to a different TPM */
+    if (cache.ectx != ectx) {
+        cache_drop();
+        cache.ectx = ectx;
+    }
+}
+
+bool tpm2_capability_cache_read(ESYS_CONTEXT *ectx, const char *name,
+        UINT8 *buffer, size_t *size) {
+
+    cache_select(ectx);
+
+    char path[PATH_MAX];
+    if (!cache.is_disk_enabled || cache.is_refresh ||
+            !cache_path(name, path, sizeof(path))) {
+        return false;
+    }
+
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return false;
+    }
+
+    *size = fread(buffer, 1, *size, f);
+    fclose(f);
+
+    LOG_INFO("Capability cache hit: %s", path);
+
+    return true;
+}
+
+void tpm2_capability_cache_write(ESYS_CONTEXT *ectx, const char *name,
+        const UINT8 *buffer, size_t size) {
+
+    cache_select(ectx);
+
+    char path[PATH_MAX];
+    if (!cache.is_disk_enabled || !cache_path(name, path, sizeof(path)) ||
+            !cache_mkdir(path)) {
+        return;
+    }
+
+    /* concurrent tools may store the same entry, publish it atomically */
+    char tmp_path[PATH_MAX + 8];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path);
+    int fd = mkstemp(tmp_path);
+    if (fd < 0) {
+        LOG_WARN("Could not write capability cache entry \"%s\", error: %s",
+                path, strerror(errno));
+        return;
+    }
+
+    bool is_written = write(fd, buffer, size) == (ssize_t) size;
+    close(fd);
+    if (!is_written || rename(tmp_path, path)) {
+        LOG_WARN("Could not write capability cache entry \"%s\"", path);
+        unlink(tmp_path);
+    }
+}
+
+static TPMS_CAPABILITY_DATA *cache_load(ESYS_CONTEXT *ectx,
+        const char *name) {
+
+    UINT8 buffer[sizeof(TPMS_CAPABILITY_DATA)];
+    size_t size = sizeof(buffer);
+    if (!tpm2_capability_cache_read(ectx, name, buffer, &size)) {
+        return NULL;
+    }
+
+    TPMS_CAPABILITY_DATA *data = calloc(1, sizeof(*data));
+    if (!data) {
+        LOG_ERR("oom");
+        return NULL;
+    }
+
+    size_t offset = 0;
+    TSS2_RC rc = Tss2_MU_TPMS_CAPABILITY_DATA_Unmarshal(buffer, size, &offset,
+            data);
+    if (rc != TSS2_RC_SUCCESS || offset != size) {
+        LOG_WARN("Ignoring corrupted capability cache entry \"%s\"", name);
+        free(data);
+        return NULL;
+    }
+
+    return data;
+}
+
+static void cache_store(ESYS_CONTEXT *ectx, const char *name,
+        const TPMS_CAPABILITY_DATA *data) {
+
+    UINT8 buffer[sizeof(*data)];
+    size_t size = 0;
+    TSS2_RC rc = Tss2_MU_TPMS_CAPABILITY_DATA_Marshal(data, buffer,
+            sizeof(buffer), &size);
+    if (rc == TSS2_RC_SUCCESS) {
+        tpm2_capability_cache_write(ectx, name, buffer, size);
+    }
+}
+
+static void cache_remove(const char *name) {
+
+    char path[PATH_MAX];
+    if (cache.is_disk_enabled && cache_path(name, path, sizeof(path))) {
+        unlink(path);
+    }
+}
+
+void tpm2_capability_cache_init(const char *tcti_conf) {
+
+    const char *mode = tpm2_util_getenv(TPM2TOOLS_ENV_CAPABILITY_CACHE);
+    cache.is_disk_enabled = mode && strcmp(mode, "0");
+    cache.is_refresh = mode && !strcmp(mode, "refresh");
+
+    if (!tcti_conf || !tcti_conf[0]) {
+        tcti_conf = "default";
+    }
+
+    /* keep the key usable as a file name */
+    size_t i;
+    for (i = 0; tcti_conf[i] && i < sizeof(cache.key) - 1; i++) {
+        char c = tcti_conf[i];
+        cache.key[i] = isalnum((unsigned char) c) || c == '-' ? c : '_';
+    }
+    cache.key[i] = '\0';
+
+    cache_drop();
+}
+
+void tpm2_capability_cache_flush(void) {
+
+    cache_remove("fixed");
+    cache_drop();
+}
+
+tool_rc tpm2_capability_get_fixed(ESYS_CONTEXT *ectx,
+        const TPMS_CAPABILITY_DATA **capability_data) {
+
+    cache_select(ectx);
+
+    if (!cache.fixed) {
+        cache.fixed = cache_load(ectx, "fixed");
+    }
+
+    if (!cache.fixed) {
+        TPMS_CAPABILITY_DATA *fixed = NULL;
+        tool_rc rc = tpm2_capability_get(ectx, TPM2_CAP_TPM_PROPERTIES,
+                TPM2_PT_FIXED, TPM2_MAX_TPM_PROPERTIES, &fixed);
+        if (rc != tool_rc_success) {
+            return rc;
+        }
+
+        /* the TPM continues into the variable group, which must not be kept */
+        TPML_TAGGED_TPM_PROPERTY *properties = &fixed->data.tpmProperties;
+        UINT32 i;
+        for (i = 0; i < properties->count; i++) {
+            if (properties->tpmProperty[i].property >= TPM2_PT_VAR) {
+                properties->count = i;
+                break;
+            }
+        }
+
+        cache.fixed = fixed;
+        cache_store(ectx, "fixed", fixed);
+    }
+
+    *capability_data = cache.fixed;
+
+    return tool_rc_success;
+}
+
+tool_rc tpm2_capability_get_fixed_property(ESYS_CONTEXT *ectx,
+        TPM2_PT property, UINT32 *value) {
+
+    const TPMS_CAPABILITY_DATA *fixed = NULL;
+    tool_rc rc = tpm2_capability_get_fixed(ectx, &fixed);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    const TPML_TAGGED_TPM_PROPERTY *properties = &fixed->data.tpmProperties;
+    UINT32 i;
+    for (i = 0; i < properties->count; i++) {
+        if (properties->tpmProperty[i].property == property) {
+            *value = properties->tpmProperty[i].value;
+            return tool_rc_success;
+        }
+    }
+
+    return tool_rc_general_error;
+}
+
+tool_rc tpm2_capability_get_pcrs(ESYS_CONTEXT *ectx,
+        TPMS_CAPABILITY_DATA **capability_data) {
+
+    cache_select(ectx);
+
+    if (!cache.pcrs) {
+        TPMI_YES_NO more_data;
+        TPMS_CAPABILITY_DATA *pcrs = NULL;
+        tool_rc rc = tpm2_get_capability(ectx, ESYS_TR_NONE, ESYS_TR_NONE,
+                ESYS_TR_NONE, TPM2_CAP_PCRS, 0, 1, &more_data, &pcrs);
+        if (rc != tool_rc_success) {
+            return rc;
+        }
+
+        cache.pcrs = pcrs;
+    }
+
+    *capability_data = malloc(sizeof(**capability_data));
+    if (!*capability_data) {
+        LOG_ERR("oom");
+        return tool_rc_general_error;
+    }
+
+    **capability_data = *cache.pcrs;
+
+    return tool_rc_success;
+}
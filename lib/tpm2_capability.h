@@ -6,6 +6,8 @@
 
 #include <tss2/tss2_esys.h>
 
+#include "tool_rc.h"
+
 /**
  * Invokes GetCapability to retrieve the current value of a capability from the
  * TPM.
@@ -62,4 +64,102 @@ tool_rc tpm2_capability_get_ex(ESYS_CONTEXT *ectx, TPM2_CAP capability,
 tool_rc tpm2_capability_find_vacant_persistent_handle(ESYS_CONTEXT *ctx,
         bool is_platform, TPMI_DH_PERSISTENT *vacant);
 
+/*
+ * When set, the fixed TPM properties are cached on disk below
+ * $XDG_CACHE_HOME/tpm2-tools, keyed by the TCTI configuration. The value
+ * "refresh" ignores and replaces the cached entries, e.g. after a firmware
+ * update.
+ */
+#define TPM2TOOLS_ENV_CAPABILITY_CACHE "TPM2TOOLS_CAPABILITY_CACHE"
+
+/**
+ * Selects the on-disk capability cache entry for the TPM behind a TCTI. Tools
+ * that never call this only cache within the process.
+ * @param tcti_conf
+ *  The TCTI configuration string used to reach the TPM, NULL for the default
+ *  TCTI.
+ */
+void tpm2_capability_cache_init(const char *tcti_conf);
+
+/**
+ * Drops the cached capabilities, both in-process and the on-disk entry for the
+ * current TCTI, so the next lookup queries the TPM.
+ */
+void tpm2_capability_cache_flush(void);
+
+/**
+ * Looks up a property of the TPM2_PT_FIXED group. The group is read from the
+ * TPM once and then served from the capability cache.
+ * @param ectx
+ *  Enhanced System API (ESAPI) context
+ * @param property
+ *  The TPM2_PT_FIXED property to look up.
+ * @param value
+ *  The value of the property.
+ * @return
+ *  tool_rc_success if the TPM reports the property, an error otherwise.
+ */
+tool_rc tpm2_capability_get_fixed_property(ESYS_CONTEXT *ectx,
+        TPM2_PT property, UINT32 *value);
+
+/**
+ * Gets all the properties of the TPM2_PT_FIXED group, see
+ * tpm2_capability_get_fixed_property().
+ * @param ectx
+ *  Enhanced System API (ESAPI) context
+ * @param capability_data
+ *  The cached capability data, owned by the cache and valid until the next
+ *  flush.
+ * @return
+ *  tool_rc indicating status.
+ */
+tool_rc tpm2_capability_get_fixed(ESYS_CONTEXT *ectx,
+        const TPMS_CAPABILITY_DATA **capability_data);
+
+/**
+ * Gets the current PCR allocation (TPM2_CAP_PCRS), served from memory after
+ * the first query for the ESAPI context. It is never kept on disk, another
+ * process may change it.
+ * @param ectx
+ *  Enhanced System API (ESAPI) context
+ * @param capability_data
+ *  A copy of the PCR allocation, the caller must free it.
+ * @return
+ *  tool_rc indicating status.
+ */
+tool_rc tpm2_capability_get_pcrs(ESYS_CONTEXT *ectx,
+        TPMS_CAPABILITY_DATA **capability_data);
+
+/**
+ * Reads a raw entry of the on-disk cache of the current TCTI, so other
+ * modules can keep their own data about the TPM next to the capabilities.
+ * @param ectx
+ *  Enhanced System API (ESAPI) context the entry is used with.
+ * @param name
+ *  The entry name, unique per module.
+ * @param buffer
+ *  The buffer to read the entry into.
+ * @param size
+ *  On input the size of buffer, on output the size of the entry.
+ * @return
+ *  true if the disk cache is enabled and the entry was found.
+ */
+bool tpm2_capability_cache_read(ESYS_CONTEXT *ectx, const char *name,
+        UINT8 *buffer, size_t *size);
+
+/**
+ * Atomically replaces a raw entry of the on-disk cache of the current TCTI,
+ * does nothing when the disk cache is disabled.
+ * @param ectx
+ *  Enhanced System API (ESAPI) context the entry is used with.
+ * @param name
+ *  The entry name, unique per module.
+ * @param buffer
+ *  The entry data.
+ * @param size
+ *  The size of the entry data.
+ */
+void tpm2_capability_cache_write(ESYS_CONTEXT *ectx, const char *name,
+        const UINT8 *buffer, size_t size);
+
 #endif /* LIB_TPM2_CAPABILITY_H_ */
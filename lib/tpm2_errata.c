@@ -125,16 +125,17 @@ void tpm2_errata_fixup(tpm2_errata_index_t index, ...) {
     LOG_INFO("Errata %s applied", errata->name);
 }
 
-static void process(TPMS_CAPABILITY_DATA *capability_data) {
+static void process(const TPMS_CAPABILITY_DATA *capability_data) {
     /* Distinguish current spec level 0 */
     UINT32 spec_level = -1;
     UINT32 spec_rev = 0;
     UINT32 day_of_year = 0;
     UINT32 year = 0;
-    TPML_TAGGED_TPM_PROPERTY *properties = &capability_data->data.tpmProperties;
+    const TPML_TAGGED_TPM_PROPERTY *properties =
+            &capability_data->data.tpmProperties;
     size_t i;
     for (i = 0; i < properties->count; ++i) {
-        TPMS_TAGGED_PROPERTY *property = properties->tpmProperty + i;
+        const TPMS_TAGGED_PROPERTY *property = properties->tpmProperty + i;
 
         if (property->property == TPM2_PT_LEVEL) {
             spec_level = property->value;
@@ -179,17 +180,15 @@ static void process(TPMS_CAPABILITY_DATA *capability_data) {
 
 void tpm2_errata_init(ESYS_CONTEXT *ctx) {
 
-    TPMS_CAPABILITY_DATA *capability_data;
-    tool_rc rc = tpm2_capability_get(ctx, TPM2_CAP_TPM_PROPERTIES,
-            TPM2_PT_LEVEL, TPM2_PT_YEAR - TPM2_PT_LEVEL + 1, &capability_data);
+    const TPMS_CAPABILITY_DATA *capability_data;
+    tool_rc rc = tpm2_capability_get_fixed(ctx, &capability_data);
     if (rc != tool_rc_success) {
         LOG_ERR("Failed to GetCapability: capability: 0x%x, property: 0x%x, ",
-                TPM2_CAP_TPM_PROPERTIES, TPM2_PT_LEVEL);
+                TPM2_CAP_TPM_PROPERTIES, TPM2_PT_FIXED);
         return;
     }
 
     process(capability_data);
-    free(capability_data);
 }
 
 static void fixup_sign_decrypt_attribute_encoding(va_list *ap) {
@@ -1,6 +1,8 @@
 #include <inttypes.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <tss2/tss2_tpm2_types.h>
 
@@ -9,6 +11,369 @@
 #include "tpm2_alg_util.h"
 #include "tpm2_eventlog.h"
 #include "tpm2_openssl.h"
+#include "tpm2_sha256_mb.h"
+
+#define REPLAY_BANKS 5
+#define REPLAY_MAX_THREADS 16
+#define VERIFY_MAX_THREADS 16
+#define VERIFY_CHUNK_JOBS 32
+
+/*
+ * A single step of a (bank, PCR) chain, either an extend with digest or, when
+ * digest is NULL, setting the startup locality in the last byte of the PCR.
+ */
+typedef struct replay_op replay_op;
+struct replay_op {
+    const BYTE *digest;
+    uint8_t locality;
+};
+
+typedef struct replay_chain replay_chain;
+struct replay_chain {
+    TPMI_ALG_HASH alg;
+    size_t alg_size;
+    unsigned pcr_index;
+    uint8_t *pcr;
+    replay_op *ops;
+    size_t count;
+    size_t capacity;
+};
+
+/*
+ * The chains a worker replays together, SHA-256 chains are run in lockstep so
+ * independent extends share the lanes of the multi-buffer kernel.
+ */
+typedef struct replay_task replay_task;
+struct replay_task {
+    replay_chain *chains[TPM2_SHA256_MB_LANES];
+    unsigned count;
+};
+
+struct eventlog_replay {
+    replay_chain chains[REPLAY_BANKS][TPM2_MAX_PCRS];
+    pthread_mutex_t lock;
+    replay_chain *pending[REPLAY_BANKS * TPM2_MAX_PCRS];
+    size_t pending_count;
+    replay_task tasks[REPLAY_BANKS * TPM2_MAX_PCRS];
+    size_t task_count;
+    size_t next;
+    bool is_failed;
+};
+
+eventlog_replay *eventlog_replay_new(void) {
+
+    eventlog_replay *replay = calloc(1, sizeof(*replay));
+    if (!replay) {
+        LOG_ERR("oom");
+        return NULL;
+    }
+
+    int rc = pthread_mutex_init(&replay->lock, NULL);
+    if (rc) {
+        LOG_ERR("Could not initialize replay lock: %s", strerror(rc));
+        free(replay);
+        return NULL;
+    }
+
+    return replay;
+}
+
+void eventlog_replay_free(eventlog_replay *replay) {
+
+    if (!replay) {
+        return;
+    }
+
+    unsigned bank, pcr_index;
+    for (bank = 0; bank < REPLAY_BANKS; bank++) {
+        for (pcr_index = 0; pcr_index < TPM2_MAX_PCRS; pcr_index++) {
+            free(replay->chains[bank][pcr_index].ops);
+        }
+    }
+
+    pthread_mutex_destroy(&replay->lock);
+    free(replay);
+}
+
+static bool replay_record(eventlog_replay *replay, unsigned bank,
+        TPMI_ALG_HASH alg, size_t alg_size, unsigned pcr_index, uint8_t *pcr,
+        const BYTE *digest, uint8_t locality) {
+
+    replay_chain *chain = &replay->chains[bank][pcr_index];
+    if (chain->count == chain->capacity) {
+        size_t capacity = chain->capacity ? chain->capacity * 2 : 64;
+        replay_op *ops = realloc(chain->ops, capacity * sizeof(*ops));
+        if (!ops) {
+            LOG_ERR("oom");
+            return false;
+        }
+        chain->ops = ops;
+        chain->capacity = capacity;
+    }
+
+    chain->alg = alg;
+    chain->alg_size = alg_size;
+    chain->pcr_index = pcr_index;
+    chain->pcr = pcr;
+    chain->ops[chain->count].digest = digest;
+    chain->ops[chain->count].locality = locality;
+    chain->count++;
+
+    return true;
+}
+
+static bool replay_chain_run(replay_chain *chain) {
+
+    size_t i;
+    for (i = 0; i < chain->count; i++) {
+        replay_op *op = &chain->ops[i];
+        if (!op->digest) {
+            chain->pcr[chain->alg_size - 1] = op->locality;
+        } else if (!tpm2_openssl_pcr_extend(chain->alg, chain->pcr, op->digest,
+                chain->alg_size)) {
+            LOG_ERR("PCR%d extend failed", chain->pcr_index);
+            return false;
+        }
+    }
+
+    chain->count = 0;
+
+    return true;
+}
+
+static bool replay_task_run(replay_task *task) {
+
+    unsigned min_lanes = tpm2_sha256_mb_min_lanes();
+    if (task->count == 1 || !min_lanes) {
+        unsigned i;
+        for (i = 0; i < task->count; i++) {
+            if (!replay_chain_run(task->chains[i])) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    size_t next[TPM2_SHA256_MB_LANES] = { 0 };
+    while (true) {
+        BYTE *pcrs[TPM2_SHA256_MB_LANES];
+        const BYTE *digests[TPM2_SHA256_MB_LANES];
+        unsigned lanes = 0, i;
+        for (i = 0; i < task->count; i++) {
+            replay_chain *chain = task->chains[i];
+            /* apply the locality steps up to the next extend of the chain */
+            while (next[i] < chain->count && !chain->ops[next[i]].digest) {
+                chain->pcr[chain->alg_size - 1] = chain->ops[next[i]].locality;
+                next[i]++;
+            }
+            if (next[i] < chain->count) {
+                pcrs[lanes] = chain->pcr;
+                digests[lanes++] = chain->ops[next[i]++].digest;
+            }
+        }
+
+        if (!lanes) {
+            break;
+        }
+
+        bool result = true;
+        if (lanes >= min_lanes) {
+            result = tpm2_sha256_mb_pcr_extend(pcrs, digests, lanes);
+        } else {
+            for (i = 0; i < lanes && result; i++) {
+                result = tpm2_openssl_pcr_extend(TPM2_ALG_SHA256, pcrs[i],
+                        digests[i], TPM2_SHA256_DIGEST_SIZE);
+            }
+        }
+        if (!result) {
+            LOG_ERR("SHA-256 PCR extend failed");
+            return false;
+        }
+    }
+
+    unsigned i;
+    for (i = 0; i < task->count; i++) {
+        task->chains[i]->count = 0;
+    }
+
+    return true;
+}
+
+static void *replay_worker(void *arg) {
+
+    eventlog_replay *replay = (eventlog_replay *)arg;
+
+    while (true) {
+        replay_task *task = NULL;
+
+        pthread_mutex_lock(&replay->lock);
+        if (!replay->is_failed && replay->next < replay->task_count) {
+            task = &replay->tasks[replay->next++];
+        }
+        pthread_mutex_unlock(&replay->lock);
+
+        if (!task) {
+            break;
+        }
+
+        if (!replay_task_run(task)) {
+            pthread_mutex_lock(&replay->lock);
+            replay->is_failed = true;
+            pthread_mutex_unlock(&replay->lock);
+        }
+    }
+
+    return NULL;
+}
+
+static int replay_chain_cmp(const void *a, const void *b) {
+
+    const replay_chain *x = *(replay_chain * const *)a;
+    const replay_chain *y = *(replay_chain * const *)b;
+
+    return (x->count < y->count) - (x->count > y->count);
+}
+
+/*
+ * Every chain is a task of its own, except for the SHA-256 chains, which are
+ * split into groups of similar length when the multi-buffer kernel pays off.
+ * The groups are spread over the threads before they fill the lanes.
+ */
+static void replay_tasks_build(eventlog_replay *replay, unsigned threads) {
+
+    replay->task_count = 0;
+
+    size_t sha256_count = 0, i;
+    for (i = 0; i < replay->pending_count; i++) {
+        sha256_count += replay->pending[i]->alg == TPM2_ALG_SHA256;
+    }
+
+    unsigned min_lanes = tpm2_sha256_mb_min_lanes();
+    size_t groups = 0, lanes = 1;
+    if (min_lanes && sha256_count >= min_lanes) {
+        groups = (sha256_count + TPM2_SHA256_MB_LANES - 1) /
+                TPM2_SHA256_MB_LANES;
+        if (groups < threads && sha256_count / threads >= min_lanes) {
+            groups = threads;
+        }
+        lanes = (sha256_count + groups - 1) / groups;
+    }
+
+    replay_task *group = NULL;
+    for (i = 0; i < replay->pending_count; i++) {
+        replay_chain *chain = replay->pending[i];
+        if (lanes > 1 && chain->alg == TPM2_ALG_SHA256) {
+            if (!group || group->count == lanes) {
+                group = &replay->tasks[replay->task_count++];
+                group->count = 0;
+            }
+            group->chains[group->count++] = chain;
+            continue;
+        }
+
+        replay_task *task = &replay->tasks[replay->task_count++];
+        task->chains[0] = chain;
+        task->count = 1;
+    }
+}
+
+bool eventlog_replay_run(eventlog_replay *replay, unsigned threads) {
+
+    if (!replay) {
+        return false;
+    }
+
+    replay->pending_count = 0;
+    replay->next = 0;
+    replay->is_failed = false;
+
+    unsigned bank, pcr_index;
+    for (bank = 0; bank < REPLAY_BANKS; bank++) {
+        for (pcr_index = 0; pcr_index < TPM2_MAX_PCRS; pcr_index++) {
+            replay_chain *chain = &replay->chains[bank][pcr_index];
+            if (chain->count) {
+                replay->pending[replay->pending_count++] = chain;
+            }
+        }
+    }
+
+    /* hand out the longest chains first so they don't finish last */
+    qsort(replay->pending, replay->pending_count, sizeof(replay->pending[0]),
+            replay_chain_cmp);
+
+    if (!threads) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? cpus : 1;
+    }
+
+    if (threads > REPLAY_MAX_THREADS) {
+        threads = REPLAY_MAX_THREADS;
+    }
+
+    replay_tasks_build(replay, threads);
+
+    if (threads > replay->task_count) {
+        threads = replay->task_count;
+    }
+
+    /* the calling thread is a worker as well */
+    pthread_t workers[REPLAY_MAX_THREADS];
+    unsigned started = 0;
+    while (started + 1 < threads) {
+        int rc = pthread_create(&workers[started], NULL, replay_worker,
+                replay);
+        if (rc) {
+            LOG_WARN("Could not start replay thread: %s", strerror(rc));
+            break;
+        }
+        started++;
+    }
+
+    replay_worker(replay);
+
+    while (started) {
+        pthread_join(workers[--started], NULL);
+    }
+
+    return !replay->is_failed;
+}
+
+static bool pcr_extend(tpm2_eventlog_context *ctx, unsigned bank,
+        TPMI_ALG_HASH alg, size_t alg_size, unsigned pcr_index, uint8_t *pcr,
+        const BYTE *digest) {
+
+    if (ctx->replay) {
+        /* fail on unusable algorithms now, like the direct extend would */
+        if (!tpm2_openssl_md_from_tpmhalg(alg)) {
+            LOG_ERR("PCR%d extend failed", pcr_index);
+            return false;
+        }
+
+        return replay_record(ctx->replay, bank, alg, alg_size, pcr_index, pcr,
+                digest, 0);
+    }
+
+    if (!tpm2_openssl_pcr_extend(alg, pcr, digest, alg_size)) {
+        LOG_ERR("PCR%d extend failed", pcr_index);
+        return false;
+    }
+
+    return true;
+}
+
+static bool pcr_set_locality(tpm2_eventlog_context *ctx, unsigned bank,
+        TPMI_ALG_HASH alg, size_t alg_size, unsigned pcr_index, uint8_t *pcr,
+        uint8_t locality) {
+
+    if (ctx->replay) {
+        return replay_record(ctx->replay, bank, alg, alg_size, pcr_index, pcr,
+                NULL, locality);
+    }
+
+    pcr[alg_size - 1] = locality;
+
+    return true;
+}
 
 bool digest2_accumulator_callback(TCG_DIGEST2 const *digest, size_t size,
                                   void *data) {
@@ -23,6 +388,27 @@ bool digest2_accumulator_callback(TCG_DIGEST2 const *digest, size_t size,
 
     return true;
 }
+static bool refdb_is_bank_checked(tpm2_eventlog_context const *ctx,
+        TPMI_ALG_HASH alg) {
+
+    return !ctx->refdb_banks ||
+            (alg < 32 && (ctx->refdb_banks & (1u << alg)));
+}
+
+static tpm2_refdb_verdict refdb_verdict_combine(tpm2_refdb_verdict a,
+        tpm2_refdb_verdict b) {
+
+    if (a == tpm2_refdb_verdict_deny || b == tpm2_refdb_verdict_deny) {
+        return tpm2_refdb_verdict_deny;
+    }
+
+    if (a == tpm2_refdb_verdict_unknown || b == tpm2_refdb_verdict_unknown) {
+        return tpm2_refdb_verdict_unknown;
+    }
+
+    return tpm2_refdb_verdict_allow;
+}
+
 /*
  * Invoke callback function for each TCG_DIGEST2 structure in the provided
  * TCG_EVENT_HEADER2. The callback function is only invoked if this function
@@ -47,6 +433,9 @@ bool foreach_digest2(tpm2_eventlog_context *ctx, UINT32 eventType, unsigned pcr_
     }
 
     bool ret = true;
+    /* an event without a digest of the checked banks is unknown */
+    bool is_refdb_checked = false;
+    tpm2_refdb_verdict refdb_verdict = tpm2_refdb_verdict_allow;
     size_t i;
     for (i = 0; i < count; ++i) {
         if (size < sizeof(*digest)) {
@@ -62,38 +451,64 @@ bool foreach_digest2(tpm2_eventlog_context *ctx, UINT32 eventType, unsigned pcr_
         }
 
         uint8_t *pcr = NULL;
+        unsigned bank = 0;
         if (alg == TPM2_ALG_SHA1) {
             pcr = ctx->sha1_pcrs[pcr_index];
             ctx->sha1_used |= (1 << pcr_index);
         } else if (alg == TPM2_ALG_SHA256) {
             pcr = ctx->sha256_pcrs[pcr_index];
             ctx->sha256_used |= (1 << pcr_index);
+            bank = 1;
         } else if (alg == TPM2_ALG_SHA384) {
             pcr = ctx->sha384_pcrs[pcr_index];
             ctx->sha384_used |= (1 << pcr_index);
+            bank = 2;
         } else if (alg == TPM2_ALG_SHA512) {
             pcr = ctx->sha512_pcrs[pcr_index];
             ctx->sha512_used |= (1 << pcr_index);
+            bank = 3;
         } else if (alg == TPM2_ALG_SM3_256) {
             pcr = ctx->sm3_256_pcrs[pcr_index];
             ctx->sm3_256_used |= (1 << pcr_index);
+            bank = 4;
         } else {
             LOG_WARN("PCR%d algorithm %d unsupported", pcr_index, alg);
         }
 
+        bool res = true;
         if (eventType == EV_EFI_HCRTM_EVENT && pcr && pcr_index == 0) {
             /* Trusted Platform Module Library Part 1 section 34.3 */
-            pcr[alg_size - 1] = 0x04;
+            res = pcr_set_locality(ctx, bank, alg, alg_size, pcr_index, pcr,
+                    0x04);
         } else if (eventType == EV_NO_ACTION && pcr && pcr_index == 0 && locality > 0 ) {
-            pcr[alg_size - 1] = locality;
+            res = pcr_set_locality(ctx, bank, alg, alg_size, pcr_index, pcr,
+                    locality);
+        }
+        if (!res) {
+            return false;
         }
 
         if (eventType != EV_NO_ACTION && pcr &&
-            !tpm2_openssl_pcr_extend(alg, pcr, digest->Digest, alg_size)) {
-            LOG_ERR("PCR%d extend failed", pcr_index);
+            !pcr_extend(ctx, bank, alg, alg_size, pcr_index, pcr,
+                    digest->Digest)) {
             return false;
         }
 
+        if (ctx->refdb) {
+            const char *label = NULL;
+            tpm2_refdb_verdict verdict = tpm2_refdb_lookup(ctx->refdb, alg,
+                    digest->Digest, &label);
+            if (refdb_is_bank_checked(ctx, alg)) {
+                refdb_verdict = refdb_verdict_combine(refdb_verdict, verdict);
+                is_refdb_checked = true;
+            }
+            if (ctx->refdb_cb != NULL &&
+                !ctx->refdb_cb(digest, alg_size, verdict, label, ctx->data)) {
+                LOG_ERR("callback failed for digest at %p with size %zu", digest, alg_size);
+                return false;
+            }
+        }
+
         if (ctx->digest2_cb != NULL) {
             ret = ctx->digest2_cb(digest, alg_size, ctx->data);
             if (!ret) {
@@ -106,6 +521,9 @@ bool foreach_digest2(tpm2_eventlog_context *ctx, UINT32 eventType, unsigned pcr_
         digest = (TCG_DIGEST2*)((uintptr_t)digest->Digest + alg_size);
     }
 
+    ctx->refdb_verdict = is_refdb_checked ? refdb_verdict :
+            tpm2_refdb_verdict_unknown;
+
     return ret;
 }
 
@@ -308,12 +726,123 @@ bool foreach_sha1_log_event(tpm2_eventlog_context *ctx, TCG_EVENT const *eventhd
 }
 
 /*
- * For event types where digest can be verified from their event payload,
- * perform verification to ensure event payload was not tempered
+ * Verifying a digest of an event against its payload. The status of the jobs
+ * whose event is malformed is known when they are recorded, they are only
+ * reported.
  */
-bool verify_digests(size_t eventnum, TCG_EVENT_HEADER2 const *eventhdr, TCG_EVENT2 *event) {
+typedef enum verify_status verify_status;
+enum verify_status {
+    verify_status_pending,
+    verify_status_ok,
+    verify_status_hash_failed,
+    verify_status_mismatch,
+    verify_status_bad_format,
+    verify_status_bad_pcr,
+};
+
+typedef struct verify_job verify_job;
+struct verify_job {
+    size_t eventnum;
+    TPMI_ALG_HASH alg;
+    size_t alg_size;
+    const BYTE *digest;
+    const BYTE *data;
+    size_t size;
+    /* the payload may or may not include the byte following data */
+    bool is_nul_optional;
+    verify_status status;
+};
+
+struct eventlog_verify {
+    pthread_mutex_t lock;
+    verify_job *jobs;
+    size_t count;
+    size_t capacity;
+    size_t next;
+};
+
+eventlog_verify *eventlog_verify_new(void) {
+
+    eventlog_verify *verify = calloc(1, sizeof(*verify));
+    if (!verify) {
+        LOG_ERR("oom");
+        return NULL;
+    }
+
+    int rc = pthread_mutex_init(&verify->lock, NULL);
+    if (rc) {
+        LOG_ERR("Could not initialize verify lock: %s", strerror(rc));
+        free(verify);
+        return NULL;
+    }
+
+    return verify;
+}
+
+void eventlog_verify_free(eventlog_verify *verify) {
+
+    if (!verify) {
+        return;
+    }
+
+    pthread_mutex_destroy(&verify->lock);
+    free(verify->jobs);
+    free(verify);
+}
+
+static verify_job *verify_job_add(eventlog_verify *verify, size_t eventnum,
+        verify_status status) {
+
+    if (verify->count == verify->capacity) {
+        size_t capacity = verify->capacity ? verify->capacity * 2 : 64;
+        verify_job *jobs = realloc(verify->jobs, capacity * sizeof(*jobs));
+        if (!jobs) {
+            LOG_ERR("oom");
+            return NULL;
+        }
+        verify->jobs = jobs;
+        verify->capacity = capacity;
+    }
+
+    verify_job *job = &verify->jobs[verify->count++];
+    memset(job, 0, sizeof(*job));
+    job->eventnum = eventnum;
+    job->status = status;
+
+    return job;
+}
+
+static bool verify_digests_add(eventlog_verify *verify, size_t eventnum,
+        TCG_DIGEST2 const *digest, UINT32 digest_count, const BYTE *data,
+        size_t size, bool is_nul_optional) {
+
+    size_t i;
+    for (i = 0; i < digest_count; i++) {
+        verify_job *job = verify_job_add(verify, eventnum,
+                verify_status_pending);
+        if (!job) {
+            return false;
+        }
 
-size_t i;
+        job->alg = digest->AlgorithmId;
+        job->alg_size = tpm2_alg_util_get_hash_size(job->alg);
+        job->digest = digest->Digest;
+        job->data = data;
+        job->size = size;
+        job->is_nul_optional = is_nul_optional;
+
+        digest = (TCG_DIGEST2*)((uintptr_t)digest->Digest + job->alg_size);
+    }
+
+    return true;
+}
+
+/*
+ * For event types where digest can be verified from their event payload,
+ * record a job per digest to ensure event payload was not tempered
+ */
+static bool verify_record(eventlog_verify *verify, size_t eventnum,
+        TCG_EVENT_HEADER2 const *eventhdr, TCG_EVENT2 const *event) {
 
     TCG_DIGEST2 const *digest = eventhdr->Digests;
     UINT32 digest_count = eventhdr->DigestCount;
@@ -324,26 +853,8 @@ size_t i;
     case EV_SEPARATOR:
     case EV_EFI_VARIABLE_DRIVER_CONFIG:
     case EV_EFI_GPT_EVENT:
-        for (i = 0; i < digest_count; i++) {
-            TPMI_ALG_HASH alg = digest->AlgorithmId;
-            TPM2B_DIGEST calc_digest;
-
-            bool result = tpm2_openssl_hash_compute_data(alg, event->Event,
-            event->EventSize, &calc_digest);
-            if (!result) {
-                LOG_WARN("Event %zu: Cannot calculate hash value from data", eventnum - 1);
-                return false;
-            }
-
-            size_t alg_size = tpm2_alg_util_get_hash_size(alg);
-            if (memcmp(calc_digest.buffer, digest->Digest, alg_size) != 0) {
-                LOG_WARN("Event %zu's digest does not match its payload", eventnum - 1);
-                return false;
-            }
-
-            digest = (TCG_DIGEST2*)((uintptr_t)digest->Digest + alg_size);
-        }
-        break;
+        return verify_digests_add(verify, eventnum, digest, digest_count,
+                event->Event, event->EventSize, false);
 
     /* Shim, grub & sd-boot use this event type for various tasks */
     case EV_IPL:
@@ -359,82 +870,211 @@ size_t i;
             return true;
 
         /* PCR8: used to measure grub and kernel command line */
-	case 8:
+        case 8: {
+            if (!digest_count) {
+                return true;
+            }
+
             /* Digest is applied on the string between "^[a-zA-Z_]+:? " and EOL,
              * including or excluding the trailing NULL character */
-            for (i = 0; i < digest_count; i++) {
-                size_t j;
-
-                for (j = 0; j < event->EventSize; j++) {
-                    if (event->Event[j] == ' ')
-                        break;
-                }
-
-                if (j + 1 >= event->EventSize || event->Event[event->EventSize - 1] != '\0') {
-                    LOG_WARN("Event %zu's event data is in unexpected format", eventnum - 1);
-                    return false;
-                }
-
-                TPM2B_DIGEST calc_digest;
-                TPMI_ALG_HASH alg = digest->AlgorithmId;
-                /* First try to calculate the hash excluding the trailing \0 */
-                bool result = tpm2_openssl_hash_compute_data(alg,
-                event->Event + (j + 1), event->EventSize - (j + 2), &calc_digest);
-                if (!result) {
-                    LOG_WARN("Event %zu: Cannot calculate hash value from data", eventnum - 1);
-                    return false;
-                }
+            size_t j;
+            for (j = 0; j < event->EventSize; j++) {
+                if (event->Event[j] == ' ')
+                    break;
+            }
 
-                size_t alg_size = tpm2_alg_util_get_hash_size(alg);
-                if (memcmp(calc_digest.buffer, digest->Digest, alg_size) != 0) {
-                    /* Next try to calculate the hash including the trailing \0 */
-                    bool result = tpm2_openssl_hash_compute_data(alg,
-                    event->Event + (j + 1), event->EventSize - (j + 1), &calc_digest);
-                    if (!result) {
-                        LOG_WARN("Event %zu: Cannot calculate hash value from data", eventnum - 1);
-                        return false;
-                    }
-
-                    if (memcmp(calc_digest.buffer, digest->Digest, alg_size) != 0) {
-                        LOG_WARN("Event %zu's digest does not match its payload", eventnum - 1);
-                        return false;
-                    }
-                }
-                digest = (TCG_DIGEST2*)((uintptr_t)digest->Digest + alg_size);
+            if (j + 1 >= event->EventSize || event->Event[event->EventSize - 1] != '\0') {
+                return verify_job_add(verify, eventnum,
+                        verify_status_bad_format) != NULL;
             }
-            break;
+
+            return verify_digests_add(verify, eventnum, digest, digest_count,
+                    event->Event + (j + 1), event->EventSize - (j + 2), true);
+        }
 
         /* PCR12: used by measure kernel command line (sd-boot >= 251) */
         case 12:
-            for (i = 0; i < digest_count; i++) {
-                TPM2B_DIGEST calc_digest;
-                TPMI_ALG_HASH alg = digest->AlgorithmId;
-                bool result = tpm2_openssl_hash_compute_data(alg,
-                event->Event, event->EventSize, &calc_digest);
-
-                if (!result) {
-                    LOG_WARN("Event %zu: Cannot calculate hash value from data", eventnum - 1);
-                    return false;
-                }
+            return verify_digests_add(verify, eventnum, digest, digest_count,
+                    event->Event, event->EventSize, false);
 
-                size_t alg_size = tpm2_alg_util_get_hash_size(alg);
-                if (memcmp(calc_digest.buffer, digest->Digest, alg_size) != 0) {
-                    LOG_WARN("Event %zu's digest does not match its payload", eventnum - 1);
-                    return false;
-                }
-                digest = (TCG_DIGEST2*)((uintptr_t)digest->Digest + alg_size);
-            }
+        default:
+            return verify_job_add(verify, eventnum,
+                    verify_status_bad_pcr) != NULL;
+        }
+    }
+
+    return true;
+}
+
+static verify_status verify_job_run(verify_job const *job) {
+
+    TPM2B_DIGEST calc_digest;
+    /* First try to calculate the hash excluding the trailing \0 */
+    bool result = tpm2_openssl_hash_compute_data(job->alg, (BYTE *)job->data,
+            job->size, &calc_digest);
+    if (!result) {
+        return verify_status_hash_failed;
+    }
+
+    if (!memcmp(calc_digest.buffer, job->digest, job->alg_size)) {
+        return verify_status_ok;
+    }
+
+    if (!job->is_nul_optional) {
+        return verify_status_mismatch;
+    }
+
+    /* Next try to calculate the hash including the trailing \0 */
+    result = tpm2_openssl_hash_compute_data(job->alg, (BYTE *)job->data,
+            job->size + 1, &calc_digest);
+    if (!result) {
+        return verify_status_hash_failed;
+    }
+
+    return memcmp(calc_digest.buffer, job->digest, job->alg_size) ?
+            verify_status_mismatch : verify_status_ok;
+}
+
+static void *verify_worker(void *arg) {
+
+    eventlog_verify *verify = (eventlog_verify *)arg;
+
+    while (true) {
+        /* take a few jobs at once, most payloads are a handful of bytes */
+        pthread_mutex_lock(&verify->lock);
+        size_t first = verify->next;
+        size_t last = first + VERIFY_CHUNK_JOBS;
+        if (last > verify->count) {
+            last = verify->count;
+        }
+        verify->next = last;
+        pthread_mutex_unlock(&verify->lock);
+
+        if (first == last) {
             break;
+        }
+
+        size_t i;
+        for (i = first; i < last; i++) {
+            verify_job *job = &verify->jobs[i];
+            if (job->status == verify_status_pending) {
+                job->status = verify_job_run(job);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Reports the first failed digest of every event, in log order, like the
+ * events were verified while parsing.
+ */
+static bool verify_report(eventlog_verify const *verify) {
 
+    bool result = true;
+    bool is_reported = false;
+    size_t i;
+    for (i = 0; i < verify->count; i++) {
+        verify_job const *job = &verify->jobs[i];
+        if (i > 0 && job->eventnum != verify->jobs[i - 1].eventnum) {
+            is_reported = false;
+        }
+        if (job->status == verify_status_ok || is_reported) {
+            continue;
+        }
+
+        switch (job->status) {
+        case verify_status_hash_failed:
+            LOG_WARN("Event %zu: Cannot calculate hash value from data", job->eventnum - 1);
+            break;
+        case verify_status_mismatch:
+            LOG_WARN("Event %zu's digest does not match its payload", job->eventnum - 1);
+            break;
+        case verify_status_bad_format:
+            LOG_WARN("Event %zu's event data is in unexpected format", job->eventnum - 1);
+            break;
         default:
-            LOG_WARN("Event %zu is unexectedly not extending either PCR 8, 9, 12 or 14", eventnum - 1);
-            return false;
+            LOG_WARN("Event %zu is unexectedly not extending either PCR 8, 9, 12 or 14", job->eventnum - 1);
+            break;
         }
 
-        break;
+        is_reported = true;
+        result = false;
     }
 
-    return true;
+    return result;
+}
+
+bool eventlog_verify_run(eventlog_verify *verify, unsigned threads) {
+
+    if (!verify) {
+        return false;
+    }
+
+    verify->next = 0;
+
+    if (!threads) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? cpus : 1;
+    }
+
+    if (threads > VERIFY_MAX_THREADS) {
+        threads = VERIFY_MAX_THREADS;
+    }
+
+    size_t chunks = (verify->count + VERIFY_CHUNK_JOBS - 1) / VERIFY_CHUNK_JOBS;
+    if (threads > chunks) {
+        threads = chunks;
+    }
+
+    /* the calling thread is a worker as well */
+    pthread_t workers[VERIFY_MAX_THREADS];
+    unsigned started = 0;
+    while (started + 1 < threads) {
+        int rc = pthread_create(&workers[started], NULL, verify_worker,
+                verify);
+        if (rc) {
+            LOG_WARN("Could not start verify thread: %s", strerror(rc));
+            break;
+        }
+        started++;
+    }
+
+    verify_worker(verify);
+
+    while (started) {
+        pthread_join(workers[--started], NULL);
+    }
+
+    bool result = verify_report(verify);
+    verify->count = 0;
+
+    return result;
+}
+
+/*
+ * Verifies the digests of a single event while parsing, the batched
+ * verification of eventlog_verify_run() does not pay off for a few events.
+ */
+bool verify_digests(size_t eventnum, TCG_EVENT_HEADER2 const *eventhdr, TCG_EVENT2 *event) {
+
+    eventlog_verify verify = { 0 };
+    bool result = verify_record(&verify, eventnum, eventhdr, event);
+    if (result) {
+        size_t i;
+        for (i = 0; i < verify.count; i++) {
+            verify_job *job = &verify.jobs[i];
+            if (job->status == verify_status_pending) {
+                job->status = verify_job_run(job);
+            }
+        }
+        result = verify_report(&verify);
+    }
+
+    free(verify.jobs);
+
+    return result;
 }
 
 bool foreach_event2(tpm2_eventlog_context *ctx, TCG_EVENT_HEADER2 const *eventhdr_start, size_t size) {
@@ -502,6 +1142,11 @@ bool foreach_event2(tpm2_eventlog_context *ctx, TCG_EVENT_HEADER2 const *eventhd
             return false;
         }
 
+        /* EV_NO_ACTION events are informational, they extend no PCR */
+        if (ctx->refdb && eventhdr->EventType != EV_NO_ACTION) {
+            ctx->refdb_events[ctx->refdb_verdict]++;
+        }
+
         ret = parse_event2body(event, eventhdr->EventType);
         if (ret != true) {
             return ret;
@@ -509,7 +1154,15 @@ bool foreach_event2(tpm2_eventlog_context *ctx, TCG_EVENT_HEADER2 const *eventhd
 
         /* digest verification */
         if (ctx->data != 0) {
-            verify_digests(*(size_t*)ctx->data, eventhdr, event);
+            if (ctx->verify) {
+                ret = verify_record(ctx->verify, *(size_t*)ctx->data,
+                        eventhdr, event);
+                if (ret != true) {
+                    return false;
+                }
+            } else {
+                verify_digests(*(size_t*)ctx->data, eventhdr, event);
+            }
         }
 
         /* event data callback */
@@ -630,9 +1283,160 @@ bool parse_eventlog(tpm2_eventlog_context *ctx, BYTE const *eventlog, size_t siz
             }
         }
 
-        return foreach_event2(ctx, next, size);
+        /* collect the extends while parsing and replay the banks in parallel */
+        eventlog_replay *replay = eventlog_replay_new();
+        if (!replay) {
+            return false;
+        }
+
+        /* verify the event payloads once parsed, spread over threads too */
+        eventlog_verify *verify = eventlog_verify_new();
+        if (!verify) {
+            eventlog_replay_free(replay);
+            return false;
+        }
+
+        ctx->replay = replay;
+        ctx->verify = verify;
+        ret = foreach_event2(ctx, next, size);
+        ctx->replay = NULL;
+        ctx->verify = NULL;
+        if (ret) {
+            ret = eventlog_replay_run(replay, 0);
+        }
+
+        /* the payloads parsed before a malformed event are reported too */
+        eventlog_verify_run(verify, 0);
+
+        eventlog_verify_free(verify);
+        eventlog_replay_free(replay);
+
+        return ret;
     }
 
     /* No specid event found. sha1 log format will be parsed. */
     return foreach_sha1_log_event(ctx, event, size);
 }
+
+/*
+ * Gets the size of the event at the start of eventhdr, false if the event is
+ * not completely contained in size bytes yet.
+ */
+static bool event2_complete_size(TCG_EVENT_HEADER2 const *eventhdr,
+        size_t size, size_t *event_size) {
+
+    if (size < sizeof(*eventhdr)) {
+        return false;
+    }
+
+    size_t offset = sizeof(*eventhdr);
+    UINT32 i;
+    for (i = 0; i < eventhdr->DigestCount; i++) {
+        if (size < offset + sizeof(TCG_DIGEST2)) {
+            return false;
+        }
+
+        TCG_DIGEST2 const *digest =
+            (TCG_DIGEST2 const *)((uintptr_t)eventhdr + offset);
+        offset += sizeof(*digest) +
+            tpm2_alg_util_get_hash_size(digest->AlgorithmId);
+    }
+
+    if (size < offset + sizeof(TCG_EVENT2)) {
+        return false;
+    }
+
+    TCG_EVENT2 const *event = (TCG_EVENT2 const *)((uintptr_t)eventhdr + offset);
+    offset += sizeof(*event);
+    if (size - offset < event->EventSize) {
+        return false;
+    }
+
+    *event_size = offset + event->EventSize;
+
+    return true;
+}
+
+static bool sha1_log_event_complete_size(TCG_EVENT const *event, size_t size,
+        size_t *event_size) {
+
+    if (size < sizeof(*event)
+            || size - sizeof(*event) < event->eventDataSize) {
+        return false;
+    }
+
+    *event_size = sizeof(*event) + event->eventDataSize;
+
+    return true;
+}
+
+bool parse_eventlog_incremental(tpm2_eventlog_context *ctx,
+        BYTE const *eventlog, size_t size, size_t *consumed) {
+
+    *consumed = 0;
+
+    if (!eventlog) {
+        return false;
+    }
+
+    if (!ctx->is_header_parsed) {
+        /* wait for the first event to decide on the log format */
+        TCG_EVENT const *event = (TCG_EVENT const *)eventlog;
+        size_t event_size;
+        if (!sha1_log_event_complete_size(event, size, &event_size)) {
+            return true;
+        }
+
+        ctx->is_sha1_log = event->eventType != EV_NO_ACTION;
+        if (!ctx->is_sha1_log) {
+            TCG_EVENT_HEADER2 *next;
+            bool ret = specid_event(event, event_size, &next);
+            if (!ret) {
+                return false;
+            }
+
+            if (ctx->specid_cb) {
+                ret = ctx->specid_cb(event, ctx->data);
+                if (!ret) {
+                    return false;
+                }
+            }
+
+            *consumed = (uintptr_t)next - (uintptr_t)eventlog;
+        }
+
+        ctx->is_header_parsed = true;
+    }
+
+    /* find the complete events, the tail may still be written */
+    BYTE const *start = eventlog + *consumed;
+    size_t available = size - *consumed;
+    size_t complete = 0;
+    for (;;) {
+        size_t event_size;
+        bool is_complete = ctx->is_sha1_log ?
+            sha1_log_event_complete_size(
+                (TCG_EVENT const *)(start + complete), available - complete,
+                &event_size) :
+            event2_complete_size(
+                (TCG_EVENT_HEADER2 const *)(start + complete),
+                available - complete, &event_size);
+        if (!is_complete) {
+            break;
+        }
+        complete += event_size;
+    }
+
+    /* the events are few, extend directly instead of replaying in threads */
+    ctx->replay = NULL;
+    bool ret = ctx->is_sha1_log ?
+        foreach_sha1_log_event(ctx, (TCG_EVENT const *)start, complete) :
+        foreach_event2(ctx, (TCG_EVENT_HEADER2 const *)start, complete);
+    if (!ret) {
+        return false;
+    }
+
+    *consumed += complete;
+
+    return true;
+}
@@ -8,6 +8,7 @@
 #include <tss2/tss2_tpm2_types.h>
 
 #include "efi_event.h"
+#include "tpm2_refdb.h"
 
 typedef bool (*DIGEST2_CALLBACK)(TCG_DIGEST2 const *digest, size_t size,
                                  void *data);
@@ -18,15 +19,43 @@ typedef bool (*EVENT2DATA_CALLBACK)(TCG_EVENT2 const *event, UINT32 type,
 typedef bool (*SPECID_CALLBACK)(TCG_EVENT const *event, void *data);
 typedef bool (*LOG_EVENT_CALLBACK)(TCG_EVENT const *event_hdr, size_t size,
                                    void *data);
+typedef bool (*REFDB_CALLBACK)(TCG_DIGEST2 const *digest, size_t size,
+                               tpm2_refdb_verdict verdict, const char *label,
+                               void *data);
 
 
+typedef struct eventlog_replay eventlog_replay;
+typedef struct eventlog_verify eventlog_verify;
+
 typedef struct {
     void *data;
+    /* when set, PCR extends are recorded and performed by eventlog_replay_run */
+    eventlog_replay *replay;
+    /* when set, event payloads are recorded and verified by eventlog_verify_run */
+    eventlog_verify *verify;
     SPECID_CALLBACK specid_cb;
     LOG_EVENT_CALLBACK log_eventhdr_cb;
     EVENT2_CALLBACK event2hdr_cb;
     DIGEST2_CALLBACK digest2_cb;
     EVENT2DATA_CALLBACK event2_cb;
+    /*
+     * when set, every digest of a crypto agile log is looked up, refdb_cb is
+     * invoked with the result before digest2_cb
+     */
+    tpm2_refdb const *refdb;
+    REFDB_CALLBACK refdb_cb;
+    /*
+     * the banks whose digests make the verdict of an event, bit 1 << alg is
+     * set for every TPM2_ALG_ID, all banks when 0
+     */
+    uint32_t refdb_banks;
+    /*
+     * the verdict of the current event, deny wins over unknown and unknown
+     * over allow: an event is only allowed when all its digests are
+     */
+    tpm2_refdb_verdict refdb_verdict;
+    /* the number of events extending a PCR per verdict */
+    size_t refdb_events[tpm2_refdb_verdict_deny + 1];
     uint32_t sha1_used;
     uint32_t sha256_used;
     uint32_t sha384_used;
@@ -38,6 +67,9 @@ typedef struct {
     uint8_t sha512_pcrs[TPM2_MAX_PCRS][TPM2_SHA512_DIGEST_SIZE];
     uint8_t sm3_256_pcrs[TPM2_MAX_PCRS][TPM2_SM3_256_DIGEST_SIZE];
     uint32_t eventlog_version;
+    /* parse_eventlog_incremental() state, zero before the first call */
+    bool is_header_parsed;
+    bool is_sha1_log;
 } tpm2_eventlog_context;
 
 bool digest2_accumulator_callback(TCG_DIGEST2 const *digest, size_t size,
@@ -49,7 +81,92 @@ bool foreach_digest2(tpm2_eventlog_context *ctx, UINT32 eventType, unsigned pcr_
 bool parse_event2(TCG_EVENT_HEADER2 const *eventhdr, size_t buf_size,
                   size_t *event_size, size_t *digests_size);
 bool foreach_event2(tpm2_eventlog_context *ctx, TCG_EVENT_HEADER2 const *eventhdr_start, size_t size);
+bool foreach_sha1_log_event(tpm2_eventlog_context *ctx, TCG_EVENT const *eventhdr_start, size_t size);
 bool specid_event(TCG_EVENT const *event, size_t size, TCG_EVENT_HEADER2 **next);
 bool parse_eventlog(tpm2_eventlog_context *ctx, BYTE const *eventlog, size_t size);
 
+/**
+ * Parses the events appended to a growing log since the previous call. The
+ * replayed PCRs, the event count of the callbacks and the log format are kept
+ * in the context, so the cost of a call only depends on the new events. A
+ * trailing event that is not completely written yet is left for the next call.
+ * @param ctx
+ *  The context, kept between calls.
+ * @param eventlog
+ *  The bytes of the log following the ones consumed by the previous calls, the
+ *  start of the log for the first call.
+ * @param size
+ *  The number of bytes in eventlog.
+ * @param consumed
+ *  The number of bytes parsed, the next call starts after them.
+ * @return
+ *  true on success, false if the log is malformed.
+ */
+bool parse_eventlog_incremental(tpm2_eventlog_context *ctx,
+        BYTE const *eventlog, size_t size, size_t *consumed);
+
+/**
+ * Creates an empty replay engine. Assign it to tpm2_eventlog_context.replay
+ * to have foreach_digest2() record the extend chain of every (bank, PCR)
+ * pair instead of extending the context PCRs directly.
+ * @return
+ *  The replay engine or NULL on allocation failure.
+ */
+eventlog_replay *eventlog_replay_new(void);
+
+/**
+ * Performs the recorded extend chains. Chains of different (bank, PCR) pairs
+ * are independent and are spread over a pool of threads, each chain is
+ * replayed in log order, so the results are identical to extending while
+ * parsing.
+ * @param replay
+ *  The replay engine holding the recorded chains. The event log buffer the
+ *  chains were recorded from, and the context they extend, must still be
+ *  valid.
+ * @param threads
+ *  The number of threads to use, 0 uses one per online CPU.
+ * @return
+ *  true on success, false if any extend failed.
+ */
+bool eventlog_replay_run(eventlog_replay *replay, unsigned threads);
+
+/**
+ * Frees a replay engine created with eventlog_replay_new().
+ * @param replay
+ *  The replay engine, may be NULL.
+ */
+void eventlog_replay_free(eventlog_replay *replay);
+
+/**
+ * Creates an empty payload verifier. Assign it to
+ * tpm2_eventlog_context.verify to have foreach_event2() record a job for every
+ * digest that can be verified from its event payload, instead of verifying it
+ * while parsing.
+ * @return
+ *  The verifier or NULL on allocation failure.
+ */
+eventlog_verify *eventlog_verify_new(void);
+
+/**
+ * Verifies the recorded digests against their event payloads. The jobs are
+ * independent and are spread over a pool of threads, the failures are then
+ * reported in log order, one per event, like verifying while parsing does.
+ * The recorded jobs are dropped afterwards.
+ * @param verify
+ *  The verifier holding the recorded jobs. The event log buffer the jobs were
+ *  recorded from must still be valid.
+ * @param threads
+ *  The number of threads to use, 0 uses one per online CPU.
+ * @return
+ *  true if every digest matches its payload, false otherwise.
+ */
+bool eventlog_verify_run(eventlog_verify *verify, unsigned threads);
+
+/**
+ * Frees a payload verifier created with eventlog_verify_new().
+ * @param verify
+ *  The verifier, may be NULL.
+ */
+void eventlog_verify_free(eventlog_verify *verify);
+
 #endif
@@ -0,0 +1,713 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <tss2/tss2_tpm2_types.h>
+
+#include "files.h"
+#include "log.h"
+#include "efi_event.h"
+#include "tpm2_alg_util.h"
+#include "tpm2_eventlog_index.h"
+#include "tpm2_openssl.h"
+
+/*
+ * The index file starts with the common header, followed by the size and
+ * SHA-256 digest of the indexed log, the flags, the snapshot interval and the
+ * entries, one per event. A snapshot follows for every interval, each holding
+ * the used mask of every bank and, for the banks with a non zero mask, the
+ * PCR values. All numbers are big endian.
+ */
+#define INDEX_FILE_VERSION 1
+#define INDEX_FLAG_SHA1_LOG 0x1
+
+#define INDEX_BANKS 5
+#define INDEX_PCRS_SIZE (TPM2_MAX_PCRS * (TPM2_SHA1_DIGEST_SIZE + \
+        TPM2_SHA256_DIGEST_SIZE + TPM2_SHA384_DIGEST_SIZE + \
+        TPM2_SHA512_DIGEST_SIZE + TPM2_SM3_256_DIGEST_SIZE))
+
+typedef struct index_bank index_bank;
+struct index_bank {
+    TPMI_ALG_HASH alg;
+    size_t size;
+    size_t pcrs_offset;
+    size_t used_offset;
+};
+
+#define INDEX_BANK(alg, size, pcrs, used) \
+    { alg, size, offsetof(tpm2_eventlog_context, pcrs), \
+      offsetof(tpm2_eventlog_context, used) }
+
+/* the banks of tpm2_eventlog_context */
+static const index_bank index_banks[INDEX_BANKS] = {
+    INDEX_BANK(TPM2_ALG_SHA1, TPM2_SHA1_DIGEST_SIZE, sha1_pcrs, sha1_used),
+    INDEX_BANK(TPM2_ALG_SHA256, TPM2_SHA256_DIGEST_SIZE, sha256_pcrs,
+            sha256_used),
+    INDEX_BANK(TPM2_ALG_SHA384, TPM2_SHA384_DIGEST_SIZE, sha384_pcrs,
+            sha384_used),
+    INDEX_BANK(TPM2_ALG_SHA512, TPM2_SHA512_DIGEST_SIZE, sha512_pcrs,
+            sha512_used),
+    INDEX_BANK(TPM2_ALG_SM3_256, TPM2_SM3_256_DIGEST_SIZE, sm3_256_pcrs,
+            sm3_256_used),
+};
+
+typedef struct index_entry index_entry;
+struct index_entry {
+    UINT64 offset;
+    UINT32 size;
+    UINT32 type;
+    UINT32 pcr_index;
+    /* relative to the start of the event, 0 if the event extends no bank */
+    UINT32 digest_offsets[INDEX_BANKS];
+};
+
+/* the replayed PCRs before the first event of an interval */
+typedef struct index_snapshot index_snapshot;
+struct index_snapshot {
+    UINT32 used[INDEX_BANKS];
+    BYTE pcrs[INDEX_PCRS_SIZE];
+};
+
+struct tpm2_eventlog_index {
+    bool is_sha1_log;
+    size_t log_size;
+    BYTE log_digest[TPM2_SHA256_DIGEST_SIZE];
+    size_t interval;
+    index_entry *entries;
+    size_t count;
+    size_t capacity;
+    index_snapshot *snapshots;
+};
+
+static uint8_t *index_bank_pcrs(tpm2_eventlog_context *ctx, unsigned bank) {
+
+    return (uint8_t *)ctx + index_banks[bank].pcrs_offset;
+}
+
+static uint32_t *index_bank_used(tpm2_eventlog_context *ctx, unsigned bank) {
+
+    return (uint32_t *)((uint8_t *)ctx + index_banks[bank].used_offset);
+}
+
+static unsigned index_bank_find(TPMI_ALG_HASH alg) {
+
+    unsigned bank;
+    for (bank = 0; bank < INDEX_BANKS; bank++) {
+        if (index_banks[bank].alg == alg) {
+            break;
+        }
+    }
+
+    return bank;
+}
+
+static void index_snapshot_save(index_snapshot *snapshot,
+        tpm2_eventlog_context *ctx) {
+
+    BYTE *pcrs = snapshot->pcrs;
+    unsigned bank;
+    for (bank = 0; bank < INDEX_BANKS; bank++) {
+        size_t size = TPM2_MAX_PCRS * index_banks[bank].size;
+        snapshot->used[bank] = *index_bank_used(ctx, bank);
+        memcpy(pcrs, index_bank_pcrs(ctx, bank), size);
+        pcrs += size;
+    }
+}
+
+static void index_snapshot_restore(tpm2_eventlog_context *ctx,
+        index_snapshot const *snapshot) {
+
+    BYTE const *pcrs = snapshot->pcrs;
+    unsigned bank;
+    for (bank = 0; bank < INDEX_BANKS; bank++) {
+        size_t size = TPM2_MAX_PCRS * index_banks[bank].size;
+        *index_bank_used(ctx, bank) = snapshot->used[bank];
+        memcpy(index_bank_pcrs(ctx, bank), pcrs, size);
+        pcrs += size;
+    }
+}
+
+static size_t index_snapshot_count(tpm2_eventlog_index const *index) {
+
+    return (index->count + index->interval - 1) / index->interval;
+}
+
+static bool index_log_digest(BYTE const *eventlog, size_t size,
+        BYTE digest[TPM2_SHA256_DIGEST_SIZE]) {
+
+    EVP_MD_CTX *mdctx = tpm2_openssl_digest_init(TPM2_ALG_SHA256);
+    if (!mdctx) {
+        return false;
+    }
+
+    unsigned digest_size;
+    if (!EVP_DigestUpdate(mdctx, eventlog, size)
+            || !EVP_DigestFinal_ex(mdctx, digest, &digest_size)) {
+        LOG_ERR("%s", tpm2_openssl_get_err());
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Adds the entry of the next event, preceded by a snapshot of the PCRs when
+ * the event starts an interval.
+ */
+static bool index_event_add(tpm2_eventlog_index *index,
+        tpm2_eventlog_context *ctx, index_entry const *entry) {
+
+    if (index->count == index->capacity) {
+        size_t capacity = index->capacity ? index->capacity * 2 :
+                index->interval;
+        index_entry *entries = realloc(index->entries,
+                capacity * sizeof(*entries));
+        if (!entries) {
+            LOG_ERR("oom");
+            return false;
+        }
+        index->entries = entries;
+
+        /* there is one snapshot per interval of entries */
+        index_snapshot *snapshots = realloc(index->snapshots,
+                capacity / index->interval * sizeof(*snapshots));
+        if (!snapshots) {
+            LOG_ERR("oom");
+            return false;
+        }
+        index->snapshots = snapshots;
+        index->capacity = capacity;
+    }
+
+    if (index->count % index->interval == 0) {
+        index_snapshot_save(&index->snapshots[index->count / index->interval],
+                ctx);
+    }
+
+    index->entries[index->count++] = *entry;
+
+    return true;
+}
+
+static bool index_event2(TCG_EVENT_HEADER2 const *eventhdr, size_t size,
+        index_entry *entry) {
+
+    size_t event_size;
+    size_t digests_size = 0;
+    bool ret = parse_event2(eventhdr, size, &event_size, &digests_size);
+    if (!ret) {
+        return false;
+    }
+
+    if (event_size > UINT32_MAX) {
+        LOG_ERR("event of %zu bytes is too large to be indexed", event_size);
+        return false;
+    }
+
+    entry->size = event_size;
+    entry->type = eventhdr->EventType;
+    entry->pcr_index = eventhdr->PCRIndex;
+
+    size_t offset = sizeof(*eventhdr);
+    UINT32 i;
+    for (i = 0; i < eventhdr->DigestCount; i++) {
+        TCG_DIGEST2 const *digest =
+            (TCG_DIGEST2 const *)((uintptr_t)eventhdr + offset);
+        unsigned bank = index_bank_find(digest->AlgorithmId);
+        offset += sizeof(*digest);
+        if (bank < INDEX_BANKS) {
+            entry->digest_offsets[bank] = offset;
+        }
+        offset += tpm2_alg_util_get_hash_size(digest->AlgorithmId);
+    }
+
+    return true;
+}
+
+static bool index_sha1_log_event(TCG_EVENT const *event, size_t size,
+        index_entry *entry) {
+
+    if (size < sizeof(*event) || size - sizeof(*event) < event->eventDataSize) {
+        LOG_ERR("insufficient size for SHA1 log event");
+        return false;
+    }
+
+    if (event->pcrIndex > TPM2_MAX_PCRS - 1) {
+        LOG_ERR("PCR Index %d is out of bounds for max available PCRS %d",
+                event->pcrIndex, TPM2_MAX_PCRS);
+        return false;
+    }
+
+    entry->size = sizeof(*event) + event->eventDataSize;
+    entry->type = event->eventType;
+    entry->pcr_index = event->pcrIndex;
+    /* like parse_sha1_log_event(), EV_NO_ACTION events extend nothing */
+    if (event->eventType != EV_NO_ACTION) {
+        entry->digest_offsets[0] = offsetof(TCG_EVENT, digest);
+    }
+
+    return true;
+}
+
+tpm2_eventlog_index *tpm2_eventlog_index_build(BYTE const *eventlog,
+        size_t size) {
+
+    if (!eventlog || size < sizeof(TCG_EVENT)) {
+        LOG_ERR("eventlog is too small to be indexed");
+        return NULL;
+    }
+
+    tpm2_eventlog_index *index = calloc(1, sizeof(*index));
+    if (!index) {
+        LOG_ERR("oom");
+        return NULL;
+    }
+
+    index->log_size = size;
+    index->interval = EVENTLOG_INDEX_SNAPSHOT_INTERVAL;
+    if (!index_log_digest(eventlog, size, index->log_digest)) {
+        goto error;
+    }
+
+    /* the events are parsed one by one to snapshot the PCRs in between */
+    tpm2_eventlog_context ctx = { 0 };
+    TCG_EVENT const *first = (TCG_EVENT const *)eventlog;
+    size_t offset = 0;
+    index->is_sha1_log = first->eventType != EV_NO_ACTION;
+    if (!index->is_sha1_log) {
+        TCG_EVENT_HEADER2 *next;
+        if (!specid_event(first, size, &next)) {
+            goto error;
+        }
+
+        offset = (uintptr_t)next - (uintptr_t)eventlog;
+        index_entry entry = {
+            .size = offset,
+            .type = EV_NO_ACTION,
+        };
+        if (!index_event_add(index, &ctx, &entry)) {
+            goto error;
+        }
+    }
+
+    while (offset < size) {
+        BYTE const *event = eventlog + offset;
+        index_entry entry = {
+            .offset = offset,
+        };
+
+        bool ret = index->is_sha1_log ?
+            index_sha1_log_event((TCG_EVENT const *)event, size - offset,
+                    &entry) :
+            index_event2((TCG_EVENT_HEADER2 const *)event, size - offset,
+                    &entry);
+        if (!ret || !index_event_add(index, &ctx, &entry)) {
+            goto error;
+        }
+
+        ret = index->is_sha1_log ?
+            foreach_sha1_log_event(&ctx, (TCG_EVENT const *)event,
+                    entry.size) :
+            foreach_event2(&ctx, (TCG_EVENT_HEADER2 const *)event,
+                    entry.size);
+        if (!ret) {
+            goto error;
+        }
+
+        offset += entry.size;
+    }
+
+    return index;
+
+error:
+    tpm2_eventlog_index_free(index);
+    return NULL;
+}
+
+/*
+ * Checks that a loaded entry describes an event within the log, so the
+ * queries never read outside of it.
+ */
+static bool index_entry_check(tpm2_eventlog_index const *index,
+        BYTE const *eventlog, index_entry const *entry, size_t number) {
+
+    if (entry->offset > index->log_size
+            || entry->size > index->log_size - entry->offset
+            || entry->pcr_index > TPM2_MAX_PCRS - 1) {
+        return false;
+    }
+
+    BYTE const *event = eventlog + entry->offset;
+    if (index->is_sha1_log) {
+        TCG_EVENT const *hdr = (TCG_EVENT const *)event;
+        if (entry->size < sizeof(*hdr) || hdr->eventType != entry->type
+                || hdr->pcrIndex != entry->pcr_index) {
+            return false;
+        }
+    } else if (number > 0) {
+        TCG_EVENT_HEADER2 const *hdr = (TCG_EVENT_HEADER2 const *)event;
+        if (entry->size < sizeof(*hdr) || hdr->EventType != entry->type
+                || hdr->PCRIndex != entry->pcr_index) {
+            return false;
+        }
+    }
+
+    unsigned bank;
+    for (bank = 0; bank < INDEX_BANKS; bank++) {
+        UINT32 digest_offset = entry->digest_offsets[bank];
+        if (digest_offset && (digest_offset > entry->size
+                || entry->size - digest_offset < index_banks[bank].size)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool index_entry_read(FILE *f, index_entry *entry) {
+
+    bool result = files_read_64(f, &entry->offset)
+            && files_read_32(f, &entry->size)
+            && files_read_32(f, &entry->type)
+            && files_read_32(f, &entry->pcr_index);
+
+    unsigned bank;
+    for (bank = 0; bank < INDEX_BANKS && result; bank++) {
+        result = files_read_32(f, &entry->digest_offsets[bank]);
+    }
+
+    return result;
+}
+
+static bool index_snapshot_read(FILE *f, index_snapshot *snapshot) {
+
+    BYTE *pcrs = snapshot->pcrs;
+    unsigned bank;
+    for (bank = 0; bank < INDEX_BANKS; bank++) {
+        size_t size = TPM2_MAX_PCRS * index_banks[bank].size;
+        if (!files_read_32(f, &snapshot->used[bank])) {
+            return false;
+        }
+
+        if (snapshot->used[bank]) {
+            if (!files_read_bytes(f, pcrs, size)) {
+                return false;
+            }
+        } else {
+            memset(pcrs, 0, size);
+        }
+        pcrs += size;
+    }
+
+    return true;
+}
+
+tpm2_eventlog_index *tpm2_eventlog_index_load(const char *path,
+        BYTE const *eventlog, size_t size) {
+
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        if (errno != ENOENT) {
+            LOG_WARN("Could not open file \"%s\" error: %s", path,
+                    strerror(errno));
+        }
+        return NULL;
+    }
+
+    tpm2_eventlog_index *index = calloc(1, sizeof(*index));
+    if (!index) {
+        LOG_ERR("oom");
+        fclose(f);
+        return NULL;
+    }
+
+    UINT32 version, flags, interval;
+    UINT64 log_size, count;
+    bool result = files_read_header(f, &version)
+            && version == INDEX_FILE_VERSION
+            && files_read_64(f, &log_size)
+            && files_read_bytes(f, index->log_digest,
+                    sizeof(index->log_digest))
+            && files_read_32(f, &flags)
+            && files_read_32(f, &interval)
+            && files_read_64(f, &count);
+    /* every event holds at least an event header */
+    if (!result || !interval || !count
+            || count > log_size / sizeof(TCG_EVENT_HEADER2)) {
+        LOG_WARN("Index file \"%s\" is malformed", path);
+        goto error;
+    }
+
+    BYTE digest[TPM2_SHA256_DIGEST_SIZE];
+    if (log_size != size || !index_log_digest(eventlog, size, digest)
+            || memcmp(digest, index->log_digest, sizeof(digest))) {
+        LOG_WARN("Index file \"%s\" does not match the eventlog", path);
+        goto error;
+    }
+
+    index->is_sha1_log = flags & INDEX_FLAG_SHA1_LOG;
+    index->log_size = log_size;
+    index->interval = interval;
+    index->count = index->capacity = count;
+    index->entries = calloc(count, sizeof(*index->entries));
+    index->snapshots = calloc(index_snapshot_count(index),
+            sizeof(*index->snapshots));
+    if (!index->entries || !index->snapshots) {
+        LOG_ERR("oom");
+        goto error;
+    }
+
+    size_t i;
+    for (i = 0; i < count && result; i++) {
+        result = index_entry_read(f, &index->entries[i])
+                && index_entry_check(index, eventlog, &index->entries[i], i);
+    }
+
+    for (i = 0; i < index_snapshot_count(index) && result; i++) {
+        result = index_snapshot_read(f, &index->snapshots[i]);
+    }
+
+    if (!result) {
+        LOG_WARN("Index file \"%s\" is malformed", path);
+        goto error;
+    }
+
+    fclose(f);
+    return index;
+
+error:
+    fclose(f);
+    tpm2_eventlog_index_free(index);
+    return NULL;
+}
+
+static bool index_entry_write(FILE *f, index_entry const *entry) {
+
+    bool result = files_write_64(f, entry->offset)
+            && files_write_32(f, entry->size)
+            && files_write_32(f, entry->type)
+            && files_write_32(f, entry->pcr_index);
+
+    unsigned bank;
+    for (bank = 0; bank < INDEX_BANKS && result; bank++) {
+        result = files_write_32(f, entry->digest_offsets[bank]);
+    }
+
+    return result;
+}
+
+static bool index_snapshot_write(FILE *f, index_snapshot const *snapshot) {
+
+    BYTE const *pcrs = snapshot->pcrs;
+    unsigned bank;
+    for (bank = 0; bank < INDEX_BANKS; bank++) {
+        size_t size = TPM2_MAX_PCRS * index_banks[bank].size;
+        if (!files_write_32(f, snapshot->used[bank])) {
+            return false;
+        }
+
+        /* banks the log does not use are left out */
+        if (snapshot->used[bank] && !files_write_bytes(f, (BYTE *)pcrs, size)) {
+            return false;
+        }
+        pcrs += size;
+    }
+
+    return true;
+}
+
+bool tpm2_eventlog_index_save(tpm2_eventlog_index const *index,
+        const char *path) {
+
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        LOG_ERR("Could not open file \"%s\" error: %s", path, strerror(errno));
+        return false;
+    }
+
+    bool result = files_write_header(f, INDEX_FILE_VERSION)
+            && files_write_64(f, index->log_size)
+            && files_write_bytes(f, (BYTE *)index->log_digest,
+                    sizeof(index->log_digest))
+            && files_write_32(f, index->is_sha1_log ? INDEX_FLAG_SHA1_LOG : 0)
+            && files_write_32(f, index->interval)
+            && files_write_64(f, index->count);
+
+    size_t i;
+    for (i = 0; i < index->count && result; i++) {
+        result = index_entry_write(f, &index->entries[i]);
+    }
+
+    for (i = 0; i < index_snapshot_count(index) && result; i++) {
+        result = index_snapshot_write(f, &index->snapshots[i]);
+    }
+
+    if (fclose(f) != 0) {
+        result = false;
+    }
+
+    if (!result) {
+        LOG_ERR("Could not write index file \"%s\"", path);
+    }
+
+    return result;
+}
+
+size_t tpm2_eventlog_index_count(tpm2_eventlog_index const *index) {
+
+    return index->count;
+}
+
+/*
+ * Replays an event the query does not print from its indexed digests. Only
+ * the EV_NO_ACTION and H-CRTM events of PCR 0 are parsed, they set the
+ * locality of the PCR from their event data.
+ */
+static bool index_replay_event(tpm2_eventlog_index const *index,
+        tpm2_eventlog_context *ctx, BYTE const *eventlog,
+        index_entry const *entry, size_t number) {
+
+    unsigned bank;
+    if (!index->is_sha1_log && number > 0 && entry->pcr_index == 0
+            && (entry->type == EV_NO_ACTION
+                    || entry->type == EV_EFI_HCRTM_EVENT)) {
+        tpm2_eventlog_context silent = {
+            .eventlog_version = ctx->eventlog_version,
+        };
+        for (bank = 0; bank < INDEX_BANKS; bank++) {
+            memcpy(index_bank_pcrs(&silent, bank), index_bank_pcrs(ctx, bank),
+                    TPM2_MAX_PCRS * index_banks[bank].size);
+            *index_bank_used(&silent, bank) = *index_bank_used(ctx, bank);
+        }
+
+        if (!foreach_event2(&silent,
+                (TCG_EVENT_HEADER2 const *)(eventlog + entry->offset),
+                entry->size)) {
+            return false;
+        }
+
+        for (bank = 0; bank < INDEX_BANKS; bank++) {
+            memcpy(index_bank_pcrs(ctx, bank), index_bank_pcrs(&silent, bank),
+                    TPM2_MAX_PCRS * index_banks[bank].size);
+            *index_bank_used(ctx, bank) = *index_bank_used(&silent, bank);
+        }
+
+        return true;
+    }
+
+    for (bank = 0; bank < INDEX_BANKS; bank++) {
+        UINT32 digest_offset = entry->digest_offsets[bank];
+        if (!digest_offset) {
+            continue;
+        }
+
+        /* like foreach_digest2(), EV_NO_ACTION events mark the PCR used */
+        *index_bank_used(ctx, bank) |= 1u << entry->pcr_index;
+        if (entry->type == EV_NO_ACTION) {
+            continue;
+        }
+
+        const index_bank *b = &index_banks[bank];
+        uint8_t *pcr = index_bank_pcrs(ctx, bank) + entry->pcr_index * b->size;
+        if (!tpm2_openssl_pcr_extend(b->alg, pcr,
+                eventlog + entry->offset + digest_offset, b->size)) {
+            LOG_ERR("PCR%u extend failed", entry->pcr_index);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool index_parse_event(tpm2_eventlog_index const *index,
+        tpm2_eventlog_context *ctx, BYTE const *eventlog,
+        index_entry const *entry, size_t number) {
+
+    BYTE const *event = eventlog + entry->offset;
+    if (index->is_sha1_log) {
+        return foreach_sha1_log_event(ctx, (TCG_EVENT const *)event,
+                entry->size);
+    }
+
+    if (number > 0) {
+        return foreach_event2(ctx, (TCG_EVENT_HEADER2 const *)event,
+                entry->size);
+    }
+
+    TCG_EVENT_HEADER2 *next;
+    if (!specid_event((TCG_EVENT const *)event, entry->size, &next)) {
+        return false;
+    }
+
+    return !ctx->specid_cb || ctx->specid_cb((TCG_EVENT const *)event,
+            ctx->data);
+}
+
+bool tpm2_eventlog_index_query(tpm2_eventlog_index const *index,
+        tpm2_eventlog_context *ctx, BYTE const *eventlog, size_t first,
+        size_t last, uint32_t pcrs, size_t *count) {
+
+    if (first > last || last >= index->count) {
+        LOG_ERR("Event range %zu:%zu is out of the %zu events of the log",
+                first, last, index->count);
+        return false;
+    }
+
+    size_t snapshot = first / index->interval;
+    index_snapshot_restore(ctx, &index->snapshots[snapshot]);
+    ctx->replay = NULL;
+
+    /* like parse_eventlog(), the printed payloads are verified in threads */
+    eventlog_verify *verify = eventlog_verify_new();
+    if (!verify) {
+        return false;
+    }
+    ctx->verify = verify;
+
+    bool ret = true;
+    size_t i;
+    for (i = snapshot * index->interval; i <= last && ret; i++) {
+        index_entry const *entry = &index->entries[i];
+        if (!(pcrs & (1u << entry->pcr_index))) {
+            continue;
+        }
+
+        if (i < first) {
+            ret = index_replay_event(index, ctx, eventlog, entry, i);
+        } else {
+            if (count) {
+                *count = i;
+            }
+            ret = index_parse_event(index, ctx, eventlog, entry, i);
+        }
+    }
+
+    ctx->verify = NULL;
+    eventlog_verify_run(verify, 0);
+    eventlog_verify_free(verify);
+    if (!ret) {
+        return false;
+    }
+
+    /* the other PCRs were not replayed up to the end of the range */
+    unsigned bank;
+    for (bank = 0; bank < INDEX_BANKS; bank++) {
+        *index_bank_used(ctx, bank) &= pcrs;
+    }
+
+    return true;
+}
+
+void tpm2_eventlog_index_free(tpm2_eventlog_index *index) {
+
+    if (!index) {
+        return;
+    }
+
+    free(index->entries);
+    free(index->snapshots);
+    free(index);
+}
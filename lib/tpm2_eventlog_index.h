@@ -0,0 +1,111 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+#ifndef TPM2_EVENTLOG_INDEX_H
+#define TPM2_EVENTLOG_INDEX_H
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include <tss2/tss2_tpm2_types.h>
+
+#include "tpm2_eventlog.h"
+
+/* The replayed PCRs are kept for every this many events */
+#define EVENTLOG_INDEX_SNAPSHOT_INTERVAL 128
+
+/*
+ * A random access index of an event log: the offset, type and PCR of every
+ * event, the offsets of its digests per bank and the replayed PCRs every
+ * EVENTLOG_INDEX_SNAPSHOT_INTERVAL events. Queries use it to parse only the
+ * events they print, instead of walking the whole log.
+ */
+typedef struct tpm2_eventlog_index tpm2_eventlog_index;
+
+/**
+ * Indexes an event log, both crypto agile and SHA1 logs are supported.
+ * @param eventlog
+ *  The event log.
+ * @param size
+ *  The size of the event log.
+ * @return
+ *  The index or NULL if the log is malformed or on allocation failure.
+ */
+tpm2_eventlog_index *tpm2_eventlog_index_build(BYTE const *eventlog,
+        size_t size);
+
+/**
+ * Loads an index saved by tpm2_eventlog_index_save().
+ * @param path
+ *  The path of the index file.
+ * @param eventlog
+ *  The event log the index has to belong to.
+ * @param size
+ *  The size of the event log.
+ * @return
+ *  The index, or NULL if the file does not exist, is malformed or was made
+ *  for a different log, like an earlier state of a growing log. The index
+ *  needs to be rebuilt then.
+ */
+tpm2_eventlog_index *tpm2_eventlog_index_load(const char *path,
+        BYTE const *eventlog, size_t size);
+
+/**
+ * Saves an index to a file, along with the size and SHA-256 digest of the
+ * event log it was built from.
+ * @param index
+ *  The index to save.
+ * @param path
+ *  The path of the index file.
+ * @return
+ *  true on success, false on error.
+ */
+bool tpm2_eventlog_index_save(tpm2_eventlog_index const *index,
+        const char *path);
+
+/**
+ * Gets the number of events of the indexed log, including the SpecID event
+ * of crypto agile logs.
+ * @param index
+ *  The index.
+ * @return
+ *  The number of events.
+ */
+size_t tpm2_eventlog_index_count(tpm2_eventlog_index const *index);
+
+/**
+ * Parses the events of a range whose PCR is selected. The callbacks of the
+ * context are invoked for them like parse_eventlog() would, the events of
+ * the range that are not selected are skipped. The PCRs of the context start
+ * from the snapshot preceding the range, the events between the snapshot and
+ * the range are replayed from their indexed digests without being parsed.
+ * @param index
+ *  The index of the event log.
+ * @param ctx
+ *  The context holding the callbacks, its PCRs are the selected PCRs after
+ *  the last event of the range on success.
+ * @param eventlog
+ *  The event log the index was built from.
+ * @param first
+ *  The number of the first event of the range.
+ * @param last
+ *  The number of the last event of the range.
+ * @param pcrs
+ *  The bit mask of the selected PCRs.
+ * @param count
+ *  Set to the number of each event before its callbacks are invoked, may be
+ *  NULL.
+ * @return
+ *  true on success, false if the range is out of bounds or the log is
+ *  malformed.
+ */
+bool tpm2_eventlog_index_query(tpm2_eventlog_index const *index,
+        tpm2_eventlog_context *ctx, BYTE const *eventlog, size_t first,
+        size_t last, uint32_t pcrs, size_t *count);
+
+/**
+ * Frees an index.
+ * @param index
+ *  The index, may be NULL.
+ */
+void tpm2_eventlog_index_free(tpm2_eventlog_index *index);
+
+#endif
@@ -14,7 +14,7 @@
 #include "tpm2_eventlog.h"
 #include "tpm2_eventlog_yaml.h"
 #include "tpm2_tool.h"
-#include "tpm2_tool_output.h"
+#include "tpm2_writer.h"
 
 #ifdef HAVE_CONFIG_H
 #include <config.h>
@@ -124,25 +124,16 @@ char const *eventtype_to_string (UINT32 event_type) {
         return "Unknown event type";
     }
 }
-void bytes_to_str(uint8_t const *buf, size_t size, char *dest, size_t dest_size) {
-
-    size_t i, j;
-
-    for(i = 0, j = 0; i < size && j < dest_size - 2; ++i, j+=2) {
-        sprintf(&dest[j], "%02x", buf[i]);
-    }
-    dest[j] = '\0';
-}
 void yaml_event2hdr(TCG_EVENT_HEADER2 const *eventhdr, size_t size) {
 
     (void)size;
 
-    tpm2_tool_output("  PCRIndex: %d\n"
-                     "  EventType: %s\n"
-                     "  DigestCount: %d\n",
-                     eventhdr->PCRIndex,
-                     eventtype_to_string(eventhdr->EventType),
-                     eventhdr->DigestCount);
+    tpm2_writer *w = tpm2_writer_stdout();
+    tpm2_writer_uint(w, "PCRIndex", eventhdr->PCRIndex);
+    tpm2_writer_string(w, "EventType",
+                       eventtype_to_string(eventhdr->EventType),
+                       tpm2_writer_style_plain);
+    tpm2_writer_uint(w, "DigestCount", eventhdr->DigestCount);
 
     return;
 }
@@ -150,39 +141,38 @@ void yaml_sha1_log_eventhdr(TCG_EVENT const *eventhdr, size_t size) {
 
     (void)size;
 
-    tpm2_tool_output("  PCRIndex: %d\n"
-                     "  EventType: %s\n",
-                     eventhdr->pcrIndex,
-                     eventtype_to_string(eventhdr->eventType));
+    tpm2_writer *w = tpm2_writer_stdout();
+    tpm2_writer_uint(w, "PCRIndex", eventhdr->pcrIndex);
+    tpm2_writer_string(w, "EventType",
+                       eventtype_to_string(eventhdr->eventType),
+                       tpm2_writer_style_plain);
 
     return;
 }
-/* converting byte buffer to hex string requires 2x, plus 1 for '\0' */
-#define BYTES_TO_HEX_STRING_SIZE(byte_count) ((byte_count) * 2 + 1)
-#define DIGEST_HEX_STRING_MAX BYTES_TO_HEX_STRING_SIZE(TPM2_MAX_DIGEST_BUFFER)
 bool yaml_digest2(TCG_DIGEST2 const *digest, size_t size) {
 
-    char hexstr[DIGEST_HEX_STRING_MAX] = { 0, };
-    bytes_to_str(digest->Digest, size, hexstr, sizeof(hexstr));
-
-    tpm2_tool_output("  - AlgorithmId: %s\n"
-                     "    Digest: \"%s\"\n",
-                     tpm2_alg_util_algtostr(digest->AlgorithmId, tpm2_alg_util_flags_hash),
-                     hexstr);
+    tpm2_writer *w = tpm2_writer_stdout();
+    tpm2_writer_map_begin(w, NULL);
+    tpm2_writer_string(w, "AlgorithmId",
+                       tpm2_alg_util_algtostr(digest->AlgorithmId, tpm2_alg_util_flags_hash),
+                       tpm2_writer_style_plain);
+    tpm2_writer_bytes(w, "Digest", digest->Digest, size,
+                      tpm2_writer_style_double_quoted);
+    tpm2_writer_end(w);
 
     return true;
 }
-static char *yaml_utf16_to_str(UTF16_CHAR *data, size_t len) {
+/* The string is kept in the scratch buffer of the writer */
+static char *yaml_utf16_to_str(tpm2_writer *w, UTF16_CHAR *data, size_t len) {
 
     int ret = 0;
     mbstate_t st;
 
     memset(&st, '\0', sizeof(st));
 
-    char *mbstr = calloc(len + 1, MB_CUR_MAX);
+    char *mbstr = tpm2_writer_scratch(w, (len + 1) * MB_CUR_MAX);
     char *tmp = mbstr;
     if (mbstr == NULL) {
-        LOG_ERR("failed to allocate data: %s\n", strerror(errno));
         return NULL;
     }
 
@@ -190,31 +180,23 @@ static char *yaml_utf16_to_str(UTF16_CHAR *data, size_t len) {
         ret = c16rtomb(tmp, data[i].c, &st);
         if (ret < 0) {
             LOG_ERR("c16rtomb failed: %s", strerror(errno));
-            free(mbstr);
             return NULL;
         }
     }
+    *tmp = '\0';
     return mbstr;
 }
-#define VAR_DATA_HEX_SIZE(data) BYTES_TO_HEX_STRING_SIZE(data->VariableDataLength)
-static bool yaml_uefi_var_data(UEFI_VARIABLE_DATA *data) {
+static bool yaml_uefi_var_data(tpm2_writer *w, UEFI_VARIABLE_DATA *data) {
 
     if (data->VariableDataLength == 0) {
         return true;
     }
 
-    char *var_data = calloc (1, VAR_DATA_HEX_SIZE(data));
     uint8_t *variable_data = (uint8_t*)&data->UnicodeName[
         data->UnicodeNameLength];
-    if (var_data == NULL) {
-        LOG_ERR("failled to allocate data: %s\n", strerror(errno));
-        return false;
-    }
-    bytes_to_str(variable_data, data->VariableDataLength, var_data,
-                 VAR_DATA_HEX_SIZE(data));
-
-    tpm2_tool_output("    VariableData: \"%s\"\n", var_data);
-    free(var_data);
+    tpm2_writer_bytes(w, "VariableData", variable_data,
+                      data->VariableDataLength,
+                      tpm2_writer_style_double_quoted);
 
     return true;
 }
@@ -239,21 +221,20 @@ static bool yaml_uefi_var_data(UEFI_VARIABLE_DATA *data) {
 
 static bool yaml_uefi_post_code(const TCG_EVENT2* const event) {
     const size_t len = event->EventSize;
+    tpm2_writer *w = tpm2_writer_stdout();
 
     /* if length is 16, we treat it as EV_EFI_PLATFORM_FIRMWARE_BLOB */
     if (len == 16) {
         const UEFI_PLATFORM_FIRMWARE_BLOB * const blob = \
             (const UEFI_PLATFORM_FIRMWARE_BLOB*) event->Event;
-        tpm2_tool_output("  Event:\n"
-                         "    BlobBase: 0x%" PRIx64 "\n"
-                         "    BlobLength: 0x%" PRIx64 "\n",
-                         blob->BlobBase,
-                         blob->BlobLength);
+        tpm2_writer_map_begin(w, "Event");
+        tpm2_writer_hex(w, "BlobBase", blob->BlobBase);
+        tpm2_writer_hex(w, "BlobLength", blob->BlobLength);
+        tpm2_writer_end(w);
     } else { // otherwise, we treat it as an ASCII string
         const char* const data = (const char *) event->Event;
-        tpm2_tool_output("  Event: |-\n"
-                         "    %.*s\n", (int) len, data);
-
+        tpm2_writer_string_len(w, "Event", data, strnlen(data, len),
+                               tpm2_writer_style_literal);
     }
     return true;
 }
@@ -263,8 +244,8 @@ static bool yaml_uefi_hcrtm(const TCG_EVENT2* const event) {
     const size_t len = event->EventSize;
 
     const char* const data = (const char *) event->Event;
-    tpm2_tool_output("  Event: |-\n"
-                     "    %.*s\n", (int) len, data);
+    tpm2_writer_string_len(tpm2_writer_stdout(), "Event", data,
+                           strnlen(data, len), tpm2_writer_style_literal);
 
     return true;
 }
@@ -273,203 +254,111 @@ static bool yaml_uefi_hcrtm(const TCG_EVENT2* const event) {
  * Parses Device Path field using the efivar library if present, otherwise,
  * print the field in raw byte format
  */
+static void yaml_devicepath(tpm2_writer *w, const char *key, BYTE *dp,
+                            size_t dp_len) {
 #ifdef HAVE_EFIVAR_EFIVAR_H
-char *yaml_devicepath(BYTE* dp, UINT64 dp_len) {
     int ret;
     ret = efidp_format_device_path(NULL, 0, (const_efidp)dp, dp_len);
     if (ret < 0) {
         LOG_ERR("failed to allocate memory: %s\n", strerror(errno));
-        return NULL;
+        goto raw;
     }
 
     int text_path_len;
     char *text_path;
     text_path_len = ret + 1;
-    text_path = (char*)malloc(text_path_len);
+    text_path = tpm2_writer_scratch(w, text_path_len);
     if (!text_path) {
-        LOG_ERR("failed to allocate memory: %s\n", strerror(errno));
-        return NULL;
+        goto raw;
     }
-  
+
     /* The void* cast is a hack to support efivar versions < 38 */
     ret = efidp_format_device_path((void *)text_path,
             text_path_len, (const_efidp)dp, dp_len);
     if (ret < 0) {
-        free(text_path);
         LOG_ERR("cannot parse device path\n");
-        return NULL;
+        goto raw;
     }
 
-    return text_path; 
-}
+    tpm2_writer_string(w, key, text_path, tpm2_writer_style_single_quoted);
+    return;
+
+raw:
+    /* fallback to printing the raw bytes if devicepath cannot be parsed */
 #endif
+    tpm2_writer_bytes(w, key, dp, dp_len, tpm2_writer_style_single_quoted);
+}
 /*
- * The yaml_ipl description is received as raw bytes, but the
- * data will represent a printable string. Unfortunately we
- * are not told its encoding, and this can vary. For example,
- * grub will use UTF8, while sd-boot will UTF16LE.
- *
- * We need to emit YAML with some rules:
- *
- *  - No leading ' ' or \t without escaping it
- *  - Escape non-printable ascii chars
- *  - Double quotes to enable use of escape sequences
- *  - Valid UTF8 string
- *
- * This method will ignore the question of original data
- * encoding and apply a few simple rules to make the data
- * mostly YAML compliant. Where it falls down is not
- * guaranteeing valid UTF8, if the input was not already
- * valid UTF8. In practice this limitation shouldn't be
- * a problem given expected measured data.
- *
- * Note: one consequence of this approach is that most
- * UTF16LE data will be rendered with lots of \0 bytes
- * escaped.
- *
- * For ease of output reading, the data is also split on newlines
+ * Prints the keys of an EFI_SIGNATURE_LIST, returns false if the list is
+ * malformed and the following lists cannot be found.
  */
-char **yaml_split_escape_string(UINT8 const *description, size_t size)
-{
-    char **lines = NULL, **tmp;
-    size_t nlines = 0;
-    size_t i, j, k;
-    size_t len;
-    UINT8 *nl;
-
-    i = 0;
-    do {
-        bool leadingSpace = true;
-        nl = memchr(description + i, '\n', size - i);
-        if (nl) {
-            nl++;
-            len = (size_t)(nl - (description + i));
-        } else {
-            len = size - i;
-        }
+static bool yaml_signature_list_keys(tpm2_writer *w, EFI_SIGNATURE_LIST *slist,
+                                     size_t *start, size_t size) {
 
-        tmp = realloc(lines, sizeof(char *) * (nlines + 2));
-        if (!tmp) {
-            LOG_ERR("failed to allocate memory for description lines: %s\n",
-                    strerror(errno));
-            goto error;
-        }
-        lines = tmp;
-        lines[nlines + 1] = NULL;
-        k = 0;
-
-        /* Worst case: every byte is a space that needs escaping to a 4 byte
-         * sequence, plus a line continuation, plus nul. We're overallocating
-         * here, but the caller is going to free all these strings immediately
-         * after printing, so this is fairly harmless */
-        lines[nlines] = calloc(1, (len * 4) + 1 + 1);
-        if (!lines[nlines]) {
-            LOG_ERR("failed to allocate memory for escaped string: %s\n",
-                    strerror(errno));
-            goto error;
-        }
+    char uuidstr[37] = { 0 };
 
-        for (j = i; j < (i + len); j++) {
-            const char *escape = NULL;
-
-            switch (description[j]) {
-            case '\0':
-              escape = "\\0";
-              break;
-            case '\a':
-              escape = "\\a";
-              break;
-            case '\b':
-              escape = "\\b";
-              break;
-            case '\t':
-              if (leadingSpace)
-                  escape = "\\t";
-              break;
-            case '\v':
-              escape = "\\v";
-              break;
-            case '\f':
-              escape = "\\f";
-              break;
-            case '\n':
-              escape = "\\n";
-              break;
-            case '\r':
-              escape = "\\r";
-              break;
-            case '\e':
-              escape = "\\e";
-              break;
-            case '\\':
-              escape = "\\\\";
-              break;
-            case '"':
-              escape = "\\\"";
-              break;
-            case ' ':
-              if (leadingSpace)
-                  escape = "\\x20";
-              break;
-            }
+    *start += (sizeof(*slist) + slist->SignatureHeaderSize);
+    if (*start + slist->SignatureSize > size) {
+        LOG_ERR("EventSize is inconsistent with actual data\n");
+        return false;
+    }
 
-            if (description[j] != ' ' &&
-                description[j] != '\t') {
-                leadingSpace = false;
-            }
+    int signature_size = slist->SignatureListSize -
+        sizeof(*slist) - slist->SignatureHeaderSize;
+    if (signature_size < 0 || signature_size % slist->SignatureSize != 0) {
+        LOG_ERR("Malformed EFI_SIGNATURE_LIST\n");
+        return false;
+    }
 
-            if (escape == NULL) {
-                lines[nlines][k++] = description[j];
-            } else {
-                while (*escape) {
-                    lines[nlines][k++] = *escape;
-                    escape++;
-                }
-            }
+    uint8_t *signature = (uint8_t *)slist +
+        sizeof(*slist) + slist->SignatureHeaderSize;
+    int signatures = signature_size / slist->SignatureSize;
+    /* iterate through each EFI_SIGNATURE on the list */
+    int i;
+    for (i = 0; i < signatures; i++) {
+        EFI_SIGNATURE_DATA *s = (EFI_SIGNATURE_DATA *)signature;
+        guid_unparse_lower(s->SignatureOwner, uuidstr);
+        tpm2_writer_map_begin(w, NULL);
+        tpm2_writer_string(w, "SignatureOwner", uuidstr,
+                           tpm2_writer_style_plain);
+        tpm2_writer_bytes(w, "SignatureData", s->SignatureData,
+                          slist->SignatureSize - sizeof(EFI_GUID),
+                          tpm2_writer_style_plain);
+        tpm2_writer_end(w);
+
+        signature += slist->SignatureSize;
+        *start += slist->SignatureSize;
+        if (*start > size) {
+            LOG_ERR("Malformed EFI_SIGNATURE_DATA\n");
+            break;
         }
-        nlines++;
-        i += len;
-    } while (i < size);
-
-    return lines;
-
- error:
-    for (i = 0; lines != NULL && lines[i] != NULL; i++) {
-      free(lines[i]);
     }
-    free(lines);
-    return NULL;
-}
-
-static bool yaml_split_print_string(const char *indent,
-                                    const char *field,
-                                    UINT8 const *description, size_t size)
-{
-    char **lines = NULL;
-    size_t i;
-    tpm2_tool_output("%s%s: \"", indent, field);
 
-    lines = yaml_split_escape_string(description, size);
-    if (!lines) {
-        return false;
-    }
+    return true;
+}
 
-    for (i = 0; lines[i] != NULL; i++) {
-        if (i == 0)
-            tpm2_tool_output("%s", lines[i]);
-        else
-            tpm2_tool_output("%s  %s", indent, lines[i]);
+/* Prints a boolean variable like SecureBoot */
+static bool yaml_uefi_var_enabled(tpm2_writer *w, UEFI_VARIABLE_DATA *data,
+                                  const char *name) {
 
-        if (lines[i+1] == NULL) {
-            tpm2_tool_output("\"\n");
-        } else {
-            tpm2_tool_output("\\\n");
-        }
+    bool result = true;
 
-        free(lines[i]);
+    tpm2_writer_map_begin(w, "VariableData");
+    if (data->VariableDataLength == 0) {
+        tpm2_writer_string(w, "Enabled", "No", tpm2_writer_style_single_quoted);
+    } else if (data->VariableDataLength > 1) {
+        LOG_ERR("%s value length %" PRIu64 " is unexpectedly > 1\n",
+                name, data->VariableDataLength);
+        result = false;
+    } else {
+        uint8_t *variable_data = (uint8_t *)&data->UnicodeName[
+            data->UnicodeNameLength];
+        tpm2_writer_string(w, "Enabled", *variable_data == 0 ? "No" : "Yes",
+                           tpm2_writer_style_single_quoted);
     }
-    free(lines);
-    return true;
+    tpm2_writer_end(w);
+
+    return result;
 }
 
 /*
@@ -477,25 +366,18 @@ static bool yaml_split_print_string(const char *indent,
  * The tpm2_eventlog module validates the event structure but nothing within
  * the event data buffer so we must do that here.
  */
-static bool yaml_uefi_var(UEFI_VARIABLE_DATA *data, size_t size, UINT32 type,
-                          uint32_t eventlog_version) {
+static bool yaml_uefi_var_fields(tpm2_writer *w, UEFI_VARIABLE_DATA *data,
+                                 size_t size, UINT32 type,
+                                 uint32_t eventlog_version) {
 
     char uuidstr[37] = { 0 };
     size_t start = 0;
 
-    if (size < sizeof(*data)) {
-        LOG_ERR("EventSize is too small\n");
-        return false;
-    }
-
     guid_unparse_lower(data->VariableName, uuidstr);
 
-    tpm2_tool_output("  Event:\n"
-                     "    VariableName: %s\n"
-                     "    UnicodeNameLength: %"PRIu64"\n"
-                     "    VariableDataLength: %" PRIu64 "\n",
-                     uuidstr, data->UnicodeNameLength,
-                     data->VariableDataLength);
+    tpm2_writer_string(w, "VariableName", uuidstr, tpm2_writer_style_plain);
+    tpm2_writer_uint(w, "UnicodeNameLength", data->UnicodeNameLength);
+    tpm2_writer_uint(w, "VariableDataLength", data->VariableDataLength);
 
     start += sizeof(*data);
     if (start + data->UnicodeNameLength*2 > size) {
@@ -503,11 +385,13 @@ static bool yaml_uefi_var(UEFI_VARIABLE_DATA *data, size_t size, UINT32 type,
         return false;
     }
 
-    char *ret = yaml_utf16_to_str(data->UnicodeName, data->UnicodeNameLength);
+    /* the name lives in the scratch buffer, until the next conversion */
+    char *ret = yaml_utf16_to_str(w, data->UnicodeName,
+                                  data->UnicodeNameLength);
     if (!ret) {
         return false;
     }
-    tpm2_tool_output("    UnicodeName: %s\n", ret);
+    tpm2_writer_string(w, "UnicodeName", ret, tpm2_writer_style_plain);
 
     start += data->UnicodeNameLength*2;
     /* Try to parse as much as we can without fail-stop. Bugs in firmware, shim,
@@ -530,8 +414,7 @@ static bool yaml_uefi_var(UEFI_VARIABLE_DATA *data, size_t size, UINT32 type,
                 (strlen(ret) == NAME_DB_LEN && strncmp(ret, NAME_DB, NAME_DB_LEN) == 0) ||
                 (strlen(ret) == NAME_DBX_LEN && strncmp(ret, NAME_DBX, NAME_DBX_LEN) == 0)) {
 
-                free(ret);
-                tpm2_tool_output("    VariableData:\n");
+                tpm2_writer_seq_begin(w, "VariableData");
                 uint8_t *variable_data = (uint8_t *)&data->UnicodeName[
                     data->UnicodeNameLength];
                 /* iterate through each EFI_SIGNATURE_LIST */
@@ -548,152 +431,86 @@ static bool yaml_uefi_var(UEFI_VARIABLE_DATA *data, size_t size, UINT32 type,
                     }
 
                     guid_unparse_lower(slist->SignatureType, uuidstr);
-                    tpm2_tool_output("    - SignatureType: %s\n"
-                                     "      SignatureListSize: %" PRIu32 "\n"
-                                     "      SignatureHeaderSize: %" PRIu32 "\n"
-                                     "      SignatureSize: %" PRIu32 "\n"
-                                     "      Keys:\n",
-                                     uuidstr, slist->SignatureListSize,
-                                     slist->SignatureHeaderSize,
-                                     slist->SignatureSize);
-
-                    start += (sizeof(*slist) + slist->SignatureHeaderSize);
-                    if (start + slist->SignatureSize > size) {
-                        LOG_ERR("EventSize is inconsistent with actual data\n");
+                    tpm2_writer_map_begin(w, NULL);
+                    tpm2_writer_string(w, "SignatureType", uuidstr,
+                                       tpm2_writer_style_plain);
+                    tpm2_writer_uint(w, "SignatureListSize",
+                                     slist->SignatureListSize);
+                    tpm2_writer_uint(w, "SignatureHeaderSize",
+                                     slist->SignatureHeaderSize);
+                    tpm2_writer_uint(w, "SignatureSize", slist->SignatureSize);
+
+                    tpm2_writer_seq_begin(w, "Keys");
+                    bool is_valid = yaml_signature_list_keys(w, slist, &start,
+                                                             size);
+                    tpm2_writer_end(w);
+                    tpm2_writer_end(w);
+                    if (!is_valid) {
                         break;
                     }
-
-                    int signature_size = slist->SignatureListSize -
-                        sizeof(*slist) - slist->SignatureHeaderSize;
-                    if (signature_size < 0 || signature_size % slist->SignatureSize != 0) {
-                        LOG_ERR("Malformed EFI_SIGNATURE_LIST\n");
-                        break;
-                    }
-
-                    uint8_t *signature = (uint8_t *)slist +
-                        sizeof(*slist) + slist->SignatureHeaderSize;
-                    int signatures = signature_size / slist->SignatureSize;
-                    /* iterate through each EFI_SIGNATURE on the list */
-                    int i;
-                    for (i = 0; i < signatures; i++) {
-                        EFI_SIGNATURE_DATA *s = (EFI_SIGNATURE_DATA *)signature;
-                        char *sdata = calloc (1,
-                            BYTES_TO_HEX_STRING_SIZE(slist->SignatureSize - sizeof(EFI_GUID)));
-                        if (sdata == NULL) {
-                            LOG_ERR("Failled to allocate data: %s\n", strerror(errno));
-                            return false;
-                        }
-                        bytes_to_str(s->SignatureData, slist->SignatureSize - sizeof(EFI_GUID),
-                            sdata, BYTES_TO_HEX_STRING_SIZE(slist->SignatureSize - sizeof(EFI_GUID)));
-                        guid_unparse_lower(s->SignatureOwner, uuidstr);
-                        tpm2_tool_output("      - SignatureOwner: %s\n"
-                                         "        SignatureData: %s\n",
-                                         uuidstr, sdata);
-                        free(sdata);
-
-                        signature += slist->SignatureSize;
-                        start += slist->SignatureSize;
-                        if (start > size) {
-                            LOG_ERR("Malformed EFI_SIGNATURE_DATA\n");
-                            break;
-                        }
-                    }
                     variable_data += slist->SignatureListSize;
                 }
+                tpm2_writer_end(w);
                 return true;
             } else if ((strlen(ret) == NAME_SECUREBOOT_LEN && strncmp(ret, NAME_SECUREBOOT, NAME_SECUREBOOT_LEN) == 0)) {
-                free(ret);
-                tpm2_tool_output("    VariableData:\n"
-                                 "      Enabled: ");
-                if (data->VariableDataLength == 0) {
-                    tpm2_tool_output("'No'\n");
-                } else if (data->VariableDataLength > 1) {
-                    LOG_ERR("SecureBoot value length %" PRIu64 " is unexpectedly > 1\n",
-                            data->VariableDataLength);
-                    return false;
-                } else {
-                    uint8_t *variable_data = (uint8_t *)&data->UnicodeName[
-                        data->UnicodeNameLength];
-                    if (*variable_data == 0) {
-                        tpm2_tool_output("'No'\n");
-                    } else {
-                        tpm2_tool_output("'Yes'\n");
-                    }
-                }
-                return true;
+                return yaml_uefi_var_enabled(w, data, NAME_SECUREBOOT);
             }
         } else if (type == EV_EFI_VARIABLE_AUTHORITY) {
             /* The MokListTrusted is boolean option, not a EFI_SIGNATURE_DATA*/
             if ((strlen(ret) == NAME_MOKLISTTRUSTED_LEN && strncmp(ret, NAME_MOKLISTTRUSTED, NAME_MOKLISTTRUSTED_LEN) == 0)) {
-                free(ret);
-                tpm2_tool_output("    VariableData:\n"
-                                 "      Enabled: ");
-                if (data->VariableDataLength == 0) {
-                    tpm2_tool_output("'No'\n");
-                } else if (data->VariableDataLength > 1) {
-                    LOG_ERR("MokListTrusted value length %" PRIu64 " is unexpectedly > 1\n",
-                            data->VariableDataLength);
-                    return false;
-                } else {
-                    uint8_t *variable_data = (uint8_t *)&data->UnicodeName[
-                        data->UnicodeNameLength];
-                    if (*variable_data == 0) {
-                        tpm2_tool_output("'No'\n");
-                    } else {
-                        tpm2_tool_output("'Yes'\n");
-                    }
-                }
-                return true;
+                return yaml_uefi_var_enabled(w, data, NAME_MOKLISTTRUSTED);
             } else if ((strlen(ret) == NAME_DB_LEN && strncmp(ret, NAME_DB, NAME_DB_LEN) == 0) ||
                        (strlen(ret) == NAME_SHIM_LEN && strncmp(ret, NAME_SHIM, NAME_SHIM_LEN) == 0)) {
                 /* db and Shim will be parsed as EFI_SIGNATURE_DATA */
-                free(ret);
-                tpm2_tool_output("    VariableData:\n");
+                tpm2_writer_seq_begin(w, "VariableData");
                 EFI_SIGNATURE_DATA *s= (EFI_SIGNATURE_DATA *)&data->UnicodeName[
                     data->UnicodeNameLength];
                 if (data->VariableDataLength < sizeof(EFI_SIGNATURE_DATA)) {
                     LOG_ERR("VariableDataLength is too short for EFI_SIGNATURE_DATA");
+                    tpm2_writer_end(w);
                     return false;
                 }
-                char *sdata = calloc (1,
-                    BYTES_TO_HEX_STRING_SIZE(data->VariableDataLength - sizeof(EFI_GUID)));
-                if (sdata == NULL) {
-                    LOG_ERR("Failled to allocate data: %s\n", strerror(errno));
-                    return false;
-                }
-                bytes_to_str(s->SignatureData, data->VariableDataLength - sizeof(EFI_GUID),
-                    sdata, BYTES_TO_HEX_STRING_SIZE(data->VariableDataLength - sizeof(EFI_GUID)));
                 guid_unparse_lower(s->SignatureOwner, uuidstr);
-                tpm2_tool_output("    - SignatureOwner: %s\n"
-                                 "      SignatureData: %s\n",
-                                uuidstr, sdata);
-                free(sdata);
+                tpm2_writer_map_begin(w, NULL);
+                tpm2_writer_string(w, "SignatureOwner", uuidstr,
+                                   tpm2_writer_style_plain);
+                tpm2_writer_bytes(w, "SignatureData", s->SignatureData,
+                                  data->VariableDataLength - sizeof(EFI_GUID),
+                                  tpm2_writer_style_plain);
+                tpm2_writer_end(w);
+                tpm2_writer_end(w);
                 return true;
             } else if (strlen(ret) == NAME_SBATLEVEL_LEN && strncmp(ret, NAME_SBATLEVEL, NAME_SBATLEVEL_LEN) == 0)  {
-                free(ret);
-                tpm2_tool_output("    VariableData:\n");
+                tpm2_writer_map_begin(w, "VariableData");
 
-                UINT8 *description = (UINT8 *)&data->UnicodeName[
+                const char *description = (const char *)&data->UnicodeName[
                     data->UnicodeNameLength];
-                return yaml_split_print_string("      ", "String",
-                                               description, data->VariableDataLength);
+                tpm2_writer_string_len(w, "String", description,
+                                       data->VariableDataLength,
+                                       tpm2_writer_style_double_quoted);
+                tpm2_writer_end(w);
+                return true;
             }
         } else if (type == EV_EFI_VARIABLE_BOOT || type == EV_EFI_VARIABLE_BOOT2) {
             if ((strlen(ret) == NAME_BOOTORDER_LEN && strncmp(ret, NAME_BOOTORDER, NAME_BOOTORDER_LEN) == 0)) {
-                free(ret);
-                tpm2_tool_output("    VariableData:\n");
-                
+                tpm2_writer_seq_begin(w, "VariableData");
+
                 if (data->VariableDataLength % 2 != 0) {
                     LOG_ERR("BootOrder value length %" PRIu64 " is not divisible by 2\n",
                             data->VariableDataLength);
+                    tpm2_writer_end(w);
                     return false;
                 }
 
                 uint8_t *variable_data = (uint8_t *)&data->UnicodeName[
                     data->UnicodeNameLength];
                 for (uint64_t i = 0; i < data->VariableDataLength / 2; i++) {
-                    tpm2_tool_output("    - Boot%04x\n", *((uint16_t*)variable_data + i));
+                    char boot[sizeof("Boot0000")];
+                    snprintf(boot, sizeof(boot), "Boot%04x",
+                             *((uint16_t*)variable_data + i));
+                    tpm2_writer_string(w, NULL, boot, tpm2_writer_style_plain);
                 }
+                tpm2_writer_end(w);
                 return true;
             }
 
@@ -702,73 +519,64 @@ static bool yaml_uefi_var(UEFI_VARIABLE_DATA *data, size_t size, UINT32 type,
                 isxdigit((int)ret[4]) && isxdigit((int)ret[5]) &&
                 isxdigit((int)ret[6]) && isxdigit((int)ret[7])) {
 
-                free(ret);
-                tpm2_tool_output("    VariableData:\n"
-                                 "      Enabled: ");
+                tpm2_writer_map_begin(w, "VariableData");
                 EFI_LOAD_OPTION *loadopt = (EFI_LOAD_OPTION*)&data->UnicodeName[
                     data->UnicodeNameLength];
 
-                if (loadopt->Attributes & 1) {
-                    tpm2_tool_output("'Yes'\n");
-                } else {
-                    tpm2_tool_output("'No'\n");
-                }
-
-                tpm2_tool_output("      FilePathListLength: %" PRIu16 "\n",
-                    loadopt->FilePathListLength);
+                tpm2_writer_string(w, "Enabled",
+                                   (loadopt->Attributes & 1) ? "Yes" : "No",
+                                   tpm2_writer_style_single_quoted);
+                tpm2_writer_uint(w, "FilePathListLength",
+                                 loadopt->FilePathListLength);
 
-                tpm2_tool_output("      Description: \"");
                 int i;
-                for (i = 0; (wchar_t)loadopt->Description[i] != 0; i++) {
-                    char16_t c = (char16_t)loadopt->Description[i];
-                    tpm2_tool_output("%lc", c);
-                }
-                tpm2_tool_output("\"\n");
-
-                uint8_t *devpath = (uint8_t*)&loadopt->Description[++i];
-                size_t devpath_len =  (data->VariableDataLength -
-                    sizeof(EFI_LOAD_OPTION) - sizeof(UINT16) * i) * 2 + 1;
-
-                char *buf = calloc(1, devpath_len);
-                if (!buf) {
-                    LOG_ERR("failed to allocate memory: %s\n", strerror(errno));
+                for (i = 0; loadopt->Description[i] != 0; i++);
+                char *description = yaml_utf16_to_str(w,
+                    (UTF16_CHAR *)loadopt->Description, i);
+                if (!description) {
+                    tpm2_writer_end(w);
                     return false;
                 }
+                tpm2_writer_string(w, "Description", description,
+                                   tpm2_writer_style_double_quoted);
 
-#ifdef HAVE_EFIVAR_EFIVAR_H
-                char *dp = yaml_devicepath(devpath, devpath_len);
-                if (dp) {
-                    tpm2_tool_output("      DevicePath: '%s'\n", dp);
-                    free(dp);
-                } else {
-                    /* fallback to printing the raw bytes if devicepath cannot be parsed */
-                    bytes_to_str(devpath, data->VariableDataLength -
-                        sizeof(EFI_LOAD_OPTION) - sizeof(UINT16) * i, buf, devpath_len);
-                    tpm2_tool_output("      DevicePath: '%s'\n", buf);
-                }
-#else
-                bytes_to_str(devpath, data->VariableDataLength -
-                    sizeof(EFI_LOAD_OPTION) - sizeof(UINT16) * i, buf, devpath_len);
-                tpm2_tool_output("      DevicePath: '%s'\n", buf);
-#endif
-                free(buf);
+                uint8_t *devpath = (uint8_t*)&loadopt->Description[++i];
+                size_t devpath_len = data->VariableDataLength -
+                    sizeof(EFI_LOAD_OPTION) - sizeof(UINT16) * i;
+                yaml_devicepath(w, "DevicePath", devpath, devpath_len);
+                tpm2_writer_end(w);
                 return true;
             }
         }
         /* Other event types will be printed as a hex string */
     }
 
-    free(ret);
-    return yaml_uefi_var_data(data);
+    return yaml_uefi_var_data(w, data);
+}
+
+static bool yaml_uefi_var(UEFI_VARIABLE_DATA *data, size_t size, UINT32 type,
+                          uint32_t eventlog_version) {
+
+    if (size < sizeof(*data)) {
+        LOG_ERR("EventSize is too small\n");
+        return false;
+    }
+
+    tpm2_writer *w = tpm2_writer_stdout();
+    tpm2_writer_map_begin(w, "Event");
+    bool result = yaml_uefi_var_fields(w, data, size, type, eventlog_version);
+    tpm2_writer_end(w);
+
+    return result;
 }
 /* TCG PC Client FPF section 9.2.5 */
 bool yaml_uefi_platfwblob(UEFI_PLATFORM_FIRMWARE_BLOB *data) {
 
-    tpm2_tool_output("  Event:\n"
-                     "    BlobBase: 0x%" PRIx64 "\n"
-                     "    BlobLength: 0x%" PRIx64 "\n",
-                     data->BlobBase,
-                     data->BlobLength);
+    tpm2_writer *w = tpm2_writer_stdout();
+    tpm2_writer_map_begin(w, "Event");
+    tpm2_writer_hex(w, "BlobBase", data->BlobBase);
+    tpm2_writer_hex(w, "BlobLength", data->BlobLength);
+    tpm2_writer_end(w);
     return true;
 }
 
@@ -777,26 +585,15 @@ bool yaml_uefi_platfwblob2(UEFI_PLATFORM_FIRMWARE_BLOB2 *data) {
   UINT8 blobdescsize = data->BlobDescriptionSize;
   UEFI_PLATFORM_FIRMWARE_BLOB * data2 = (UEFI_PLATFORM_FIRMWARE_BLOB *)((UINT8 *)data + sizeof(data->BlobDescriptionSize) + blobdescsize);
 
-  char * eventdesc = (char *)calloc (1, 2*blobdescsize+1);
-  if (!eventdesc) {
-    LOG_ERR("failed to allocate memory: %s\n", strerror(errno));
-    return false;
-  }
-
-  bytes_to_str (data->BlobDescription, blobdescsize, eventdesc, 2*blobdescsize);
-
-  tpm2_tool_output("  Event:\n"
-                   "    BlobDescriptionSize: %d\n"
-                   "    BlobDescription: \"%.*s\"\n"
-                   "    BlobBase: 0x%" PRIx64 "\n"
-                   "    BlobLength: 0x%" PRIx64 "\n",
-                   blobdescsize,
-                   2*blobdescsize,
-                   eventdesc,
-                   data2->BlobBase,
-                   data2->BlobLength);
-
-  free(eventdesc);
+  tpm2_writer *w = tpm2_writer_stdout();
+  tpm2_writer_map_begin(w, "Event");
+  tpm2_writer_uint(w, "BlobDescriptionSize", blobdescsize);
+  tpm2_writer_bytes(w, "BlobDescription", data->BlobDescription, blobdescsize,
+                    tpm2_writer_style_double_quoted);
+  tpm2_writer_hex(w, "BlobBase", data2->BlobBase);
+  tpm2_writer_hex(w, "BlobLength", data2->BlobLength);
+  tpm2_writer_end(w);
+
   return true;
 }
 
@@ -805,8 +602,9 @@ bool yaml_uefi_platfwblob2(UEFI_PLATFORM_FIRMWARE_BLOB2 *data) {
 /* TCG PC Client PFP section 9.4.4 */
 bool yaml_uefi_action(UINT8 const *action, size_t size) {
 
-    tpm2_tool_output("  Event: |-\n"
-                     "    %.*s\n", (int) size, action);
+    const char *data = (const char *) action;
+    tpm2_writer_string_len(tpm2_writer_stdout(), "Event", data,
+                           strnlen(data, size), tpm2_writer_style_literal);
 
     return true;
 }
@@ -818,48 +616,30 @@ bool yaml_uefi_action(UINT8 const *action, size_t size) {
  * the loading of grub, kernel, and initrd images.
  */
 bool yaml_ipl(UINT8 const *description, size_t size) {
-    tpm2_tool_output("  Event:\n");
+    tpm2_writer *w = tpm2_writer_stdout();
+
+    /* the data is text of an unknown encoding, see tpm2_writer_string_len() */
+    tpm2_writer_map_begin(w, "Event");
+    tpm2_writer_string_len(w, "String", (const char *) description, size,
+                           tpm2_writer_style_double_quoted);
+    tpm2_writer_end(w);
 
-    return yaml_split_print_string("    ", "String",
-                                   description, size);
+    return true;
 }
 /* TCG PC Client PFP section 9.2.3 */
 bool yaml_uefi_image_load(UEFI_IMAGE_LOAD_EVENT *data, size_t size) {
 
-    size_t devpath_len = (size - sizeof(*data)) * 2 + 1;
-    char *buf = calloc(1, devpath_len);
-    if (!buf) {
-        LOG_ERR("failed to allocate memory: %s\n", strerror(errno));
-        return false;
-    }
+    tpm2_writer *w = tpm2_writer_stdout();
+    tpm2_writer_map_begin(w, "Event");
+    tpm2_writer_hex(w, "ImageLocationInMemory", data->ImageLocationInMemory);
+    tpm2_writer_uint(w, "ImageLengthInMemory", data->ImageLengthInMemory);
+    tpm2_writer_hex(w, "ImageLinkTimeAddress", data->ImageLinkTimeAddress);
+    tpm2_writer_uint(w, "LengthOfDevicePath", data->LengthOfDevicePath);
+    yaml_devicepath(w, "DevicePath", data->DevicePath, size - sizeof(*data));
+    tpm2_writer_end(w);
 
-    tpm2_tool_output("  Event:\n"
-                     "    ImageLocationInMemory: 0x%" PRIx64 "\n"
-                     "    ImageLengthInMemory: %" PRIu64 "\n"
-                     "    ImageLinkTimeAddress: 0x%" PRIx64 "\n"
-                     "    LengthOfDevicePath: %" PRIu64 "\n",
-                     data->ImageLocationInMemory, data->ImageLengthInMemory,
-                     data->ImageLinkTimeAddress, data->LengthOfDevicePath);
-
-#ifdef HAVE_EFIVAR_EFIVAR_H
-    char *dp = yaml_devicepath(data->DevicePath, data->LengthOfDevicePath); 
-    if (dp) {
-        tpm2_tool_output("    DevicePath: '%s'\n", dp);
-        free(dp);
-    } else {
-        /* fallback to printing the raw bytes if devicepath cannot be parsed */
-        bytes_to_str(data->DevicePath, size - sizeof(*data), buf, devpath_len);
-        tpm2_tool_output("    DevicePath: '%s'\n", buf);
-    }
-#else
-    bytes_to_str(data->DevicePath, size - sizeof(*data), buf, devpath_len);
-    tpm2_tool_output("    DevicePath: '%s'\n", buf);
-#endif
-
-    free(buf);
     return true;
 }
-#define EVENT_BUF_MAX BYTES_TO_HEX_STRING_SIZE(1024)
 /* TCG PC Client PFP section 9.2.6 */
 bool yaml_gpt(UEFI_GPT_DATA *data, size_t size, uint32_t eventlog_version) {
 
@@ -868,107 +648,107 @@ bool yaml_gpt(UEFI_GPT_DATA *data, size_t size, uint32_t eventlog_version) {
         return false;
     }
 
+    tpm2_writer *w = tpm2_writer_stdout();
+
     if (eventlog_version == 2) {
         UEFI_PARTITION_TABLE_HEADER *header = &data->UEFIPartitionHeader;
         char guid[37] = { 0 };
 
         guid_unparse_lower(header->DiskGUID, guid);
 
-        tpm2_tool_output("  Event:\n"
-                         "    Header:\n"
-                         "      Signature: \"%.*s\"\n"
-                         "      Revision: 0x%" PRIx32 "\n"
-                         "      HeaderSize: %" PRIu32 "\n"
-                         "      HeaderCRC32: 0x%" PRIx32 "\n"
-                         "      MyLBA: 0x%" PRIx64 "\n"
-                         "      AlternateLBA: 0x%" PRIx64 "\n"
-                         "      FirstUsableLBA: 0x%" PRIx64 "\n"
-                         "      LastUsableLBA: 0x%" PRIx64 "\n"
-                         "      DiskGUID: %s\n"
-                         "      PartitionEntryLBA: 0x%" PRIx64 "\n"
-                         "      NumberOfPartitionEntry: %" PRIu32 "\n"
-                         "      SizeOfPartitionEntry: %" PRIu32 "\n"
-                         "      PartitionEntryArrayCRC32: 0x%" PRIx32 "\n"
-                         "    NumberOfPartitions: %" PRIu64 "\n"
-                         "    Partitions:\n",
-                         8, (char*)&header->Signature, /* 8-char ASCII string */
-                         header->Revision,
-                         header->HeaderSize,
-                         header->HeaderCRC32,
-                         header->MyLBA,
-                         header->AlternateLBA,
-                         header->FirstUsableLBA,
-                         header->LastUsableLBA,
-                         guid,
-                         header->PartitionEntryLBA,
-                         header->NumberOfPartitionEntries,
-                         header->SizeOfPartitionEntry,
-                         header->PartitionEntryArrayCRC32,
-                         data->NumberOfPartitions);
+        tpm2_writer_map_begin(w, "Event");
+        tpm2_writer_map_begin(w, "Header");
+        /* 8-char ASCII string */
+        const char *signature = (const char *)&header->Signature;
+        tpm2_writer_string_len(w, "Signature", signature,
+                               strnlen(signature, 8),
+                               tpm2_writer_style_double_quoted);
+        tpm2_writer_hex(w, "Revision", header->Revision);
+        tpm2_writer_uint(w, "HeaderSize", header->HeaderSize);
+        tpm2_writer_hex(w, "HeaderCRC32", header->HeaderCRC32);
+        tpm2_writer_hex(w, "MyLBA", header->MyLBA);
+        tpm2_writer_hex(w, "AlternateLBA", header->AlternateLBA);
+        tpm2_writer_hex(w, "FirstUsableLBA", header->FirstUsableLBA);
+        tpm2_writer_hex(w, "LastUsableLBA", header->LastUsableLBA);
+        tpm2_writer_string(w, "DiskGUID", guid, tpm2_writer_style_plain);
+        tpm2_writer_hex(w, "PartitionEntryLBA", header->PartitionEntryLBA);
+        tpm2_writer_uint(w, "NumberOfPartitionEntry",
+                         header->NumberOfPartitionEntries);
+        tpm2_writer_uint(w, "SizeOfPartitionEntry",
+                         header->SizeOfPartitionEntry);
+        tpm2_writer_hex(w, "PartitionEntryArrayCRC32",
+                        header->PartitionEntryArrayCRC32);
+        tpm2_writer_end(w);
+        tpm2_writer_uint(w, "NumberOfPartitions", data->NumberOfPartitions);
+        tpm2_writer_seq_begin(w, "Partitions");
 
         size -= (sizeof(data->UEFIPartitionHeader) + sizeof(data->NumberOfPartitions));
 
+        bool result = true;
         UINT64 i;
         for (i = 0; i < data->NumberOfPartitions; i++) {
             UEFI_PARTITION_ENTRY *partition = &data->Partitions[i];
             if (size < sizeof(*partition)) {
                 LOG_ERR("Cannot parse GPT partition entry: insufficient data (%zu)\n", size);
-                return false;
+                result = false;
+                break;
             }
 
+            tpm2_writer_map_begin(w, NULL);
             guid_unparse_lower(partition->PartitionTypeGUID, guid);
-            tpm2_tool_output("    - PartitionTypeGUID: %s\n", guid);
+            tpm2_writer_string(w, "PartitionTypeGUID", guid,
+                               tpm2_writer_style_plain);
             guid_unparse_lower(partition->UniquePartitionGUID, guid);
+            tpm2_writer_string(w, "UniquePartitionGUID", guid,
+                               tpm2_writer_style_plain);
+            tpm2_writer_hex(w, "StartingLBA", partition->StartingLBA);
+            tpm2_writer_hex(w, "EndingLBA", partition->EndingLBA);
+            tpm2_writer_hex(w, "Attributes", partition->Attributes);
             size_t len = sizeof(partition->PartitionName) / sizeof(UTF16_CHAR);
-            char *part_name = yaml_utf16_to_str(partition->PartitionName, len);
-            tpm2_tool_output("      UniquePartitionGUID: %s\n"
-                             "      StartingLBA: 0x%" PRIx64 "\n"
-                             "      EndingLBA: 0x%" PRIx64 "\n"
-                             "      Attributes: 0x%" PRIx64 "\n"
-                             "      PartitionName: \"%s\"\n",
-                             guid,
-                             partition->StartingLBA,
-                             partition->EndingLBA,
-                             partition->Attributes,
-                             part_name);
-            free(part_name);
+            char *part_name = yaml_utf16_to_str(w, partition->PartitionName, len);
+            tpm2_writer_string(w, "PartitionName", part_name,
+                               tpm2_writer_style_double_quoted);
+            tpm2_writer_end(w);
             size -= sizeof(*partition);
         }
 
-        if (size != 0) {
+        tpm2_writer_end(w);
+        tpm2_writer_end(w);
+
+        if (result && size != 0) {
             LOG_ERR("EventSize is inconsistent with actual data\n");
-            return false;
+            result = false;
         }
+        return result;
     } else {
-        char hexstr[EVENT_BUF_MAX] = { 0, };
-        bytes_to_str((UINT8*)data, size, hexstr, sizeof(hexstr));
-        tpm2_tool_output("  Event: \"%s\"\n", hexstr);
+        tpm2_writer_bytes(w, "Event", (UINT8*)data, size,
+                          tpm2_writer_style_double_quoted);
     }
     return true;
 }
 
 /* TCG PC Client PFP section 9.2.6 */
 bool yaml_no_action(EV_NO_ACTION_STRUCT *data, size_t size, uint32_t eventlog_version) {
+    tpm2_writer *w = tpm2_writer_stdout();
     if (eventlog_version == 2) {
         if (size > sizeof(STARTUP_LOCALITY_SIGNATURE) &&
             memcmp(data->Signature, STARTUP_LOCALITY_SIGNATURE, sizeof(STARTUP_LOCALITY_SIGNATURE)) == 0) {
-            tpm2_tool_output("  Event:\n"
-                             "    StartupLocality: %u\n",
+            tpm2_writer_map_begin(w, "Event");
+            tpm2_writer_uint(w, "StartupLocality",
                              data->Cases.StartupLocality);
+            tpm2_writer_end(w);
             return true;
         }
     }
-    char hexstr[EVENT_BUF_MAX] = { 0, };
-    bytes_to_str((UINT8*)data, size, hexstr, sizeof(hexstr));
-    tpm2_tool_output("  Event: \"%s\"\n", hexstr);
+    tpm2_writer_bytes(w, "Event", (UINT8*)data, size,
+                      tpm2_writer_style_double_quoted);
     return true;
 }
 
 bool yaml_event2data(TCG_EVENT2 const *event, UINT32 type, uint32_t eventlog_version) {
 
-    char hexstr[EVENT_BUF_MAX] = { 0, };
-
-    tpm2_tool_output("  EventSize: %" PRIu32 "\n", event->EventSize);
+    tpm2_writer *w = tpm2_writer_stdout();
+    tpm2_writer_uint(w, "EventSize", event->EventSize);
 
     if (event->EventSize == 0) {
         return true;
@@ -1005,17 +785,26 @@ bool yaml_event2data(TCG_EVENT2 const *event, UINT32 type, uint32_t eventlog_ver
     case EV_EFI_HCRTM_EVENT:
         return yaml_uefi_hcrtm(event);
     default:
-        bytes_to_str(event->Event, event->EventSize, hexstr, sizeof(hexstr));
-        tpm2_tool_output("  Event: \"%s\"\n", hexstr);
+        tpm2_writer_bytes(w, "Event", event->Event, event->EventSize,
+                          tpm2_writer_style_double_quoted);
         return true;
     }
 }
+/*
+ * The event data is the last part of an event, it closes the Digests list and
+ * the event opened by the header callbacks.
+ */
 bool yaml_event2data_callback(TCG_EVENT2 const *event, UINT32 type,
                               void *data, uint32_t eventlog_version) {
 
     (void)data;
 
-    return yaml_event2data(event, type, eventlog_version);
+    tpm2_writer *w = tpm2_writer_stdout();
+    tpm2_writer_end(w);
+    bool result = yaml_event2data(event, type, eventlog_version);
+    tpm2_writer_end(w);
+
+    return result;
 }
 bool yaml_digest2_callback(TCG_DIGEST2 const *digest, size_t size,
                             void *data_in) {
@@ -1024,6 +813,31 @@ bool yaml_digest2_callback(TCG_DIGEST2 const *digest, size_t size,
     return yaml_digest2(digest, size);
 }
 
+/* Replaces yaml_digest2_callback() when the digests are looked up */
+bool yaml_refdb_callback(TCG_DIGEST2 const *digest, size_t size,
+                         tpm2_refdb_verdict verdict, const char *label,
+                         void *data_in) {
+
+    (void)data_in;
+
+    tpm2_writer *w = tpm2_writer_stdout();
+    tpm2_writer_map_begin(w, NULL);
+    tpm2_writer_string(w, "AlgorithmId",
+                       tpm2_alg_util_algtostr(digest->AlgorithmId, tpm2_alg_util_flags_hash),
+                       tpm2_writer_style_plain);
+    tpm2_writer_bytes(w, "Digest", digest->Digest, size,
+                      tpm2_writer_style_double_quoted);
+    tpm2_writer_string(w, "Verdict", tpm2_refdb_verdict_to_str(verdict),
+                       tpm2_writer_style_plain);
+    if (verdict != tpm2_refdb_verdict_unknown) {
+        tpm2_writer_string(w, "Label", label,
+                           tpm2_writer_style_double_quoted);
+    }
+    tpm2_writer_end(w);
+
+    return true;
+}
+
 bool yaml_event2hdr_callback(TCG_EVENT_HEADER2 const *eventhdr, size_t size,
                              void *data_in) {
 
@@ -1034,11 +848,13 @@ bool yaml_event2hdr_callback(TCG_EVENT_HEADER2 const *eventhdr, size_t size,
         return false;
     }
 
-    tpm2_tool_output("- EventNum: %zu\n", (*count)++);
+    tpm2_writer *w = tpm2_writer_stdout();
+    tpm2_writer_map_begin(w, NULL);
+    tpm2_writer_uint(w, "EventNum", (*count)++);
 
     yaml_event2hdr(eventhdr, size);
 
-    tpm2_tool_output("  Digests:\n");
+    tpm2_writer_seq_begin(w, "Digests");
 
     return true;
 }
@@ -1047,87 +863,79 @@ bool yaml_sha1_log_eventhdr_callback(TCG_EVENT const *eventhdr, size_t size,
 
     (void)data_in;
 
-    yaml_sha1_log_eventhdr(eventhdr, size);
+    tpm2_writer *w = tpm2_writer_stdout();
+    tpm2_writer_map_begin(w, NULL);
 
-    char hexstr[BYTES_TO_HEX_STRING_SIZE(sizeof(eventhdr->digest))] = { 0, };
-    bytes_to_str(eventhdr->digest, sizeof(eventhdr->digest), hexstr, sizeof(hexstr));
+    yaml_sha1_log_eventhdr(eventhdr, size);
 
-    tpm2_tool_output("  DigestCount: 1\n"
-                     "  Digests:\n"
-                     "  - AlgorithmId: %s\n"
-                     "    Digest: \"%s\"\n",
-                     tpm2_alg_util_algtostr(TPM2_ALG_SHA1, tpm2_alg_util_flags_hash),
-                     hexstr);
+    tpm2_writer_uint(w, "DigestCount", 1);
+    tpm2_writer_seq_begin(w, "Digests");
+    tpm2_writer_map_begin(w, NULL);
+    tpm2_writer_string(w, "AlgorithmId",
+                       tpm2_alg_util_algtostr(TPM2_ALG_SHA1, tpm2_alg_util_flags_hash),
+                       tpm2_writer_style_plain);
+    tpm2_writer_bytes(w, "Digest", eventhdr->digest, sizeof(eventhdr->digest),
+                      tpm2_writer_style_double_quoted);
+    tpm2_writer_end(w);
     return true;
 }
 void yaml_eventhdr(TCG_EVENT const *event, size_t *count) {
 
-    /* digest is 20 bytes, 2 chars / byte and null terminator for string*/
-    char digest_hex[2*sizeof(event->digest) + 1] = {};
-    bytes_to_str(event->digest, sizeof(event->digest), digest_hex, sizeof(digest_hex));
-
-    tpm2_tool_output("- EventNum: %zu\n"
-                     "  PCRIndex: %" PRIu32 "\n"
-                     "  EventType: %s\n"
-                     "  Digest: \"%s\"\n"
-                     "  EventSize: %" PRIu32 "\n",
-                     (*count)++, event->pcrIndex,
-                     eventtype_to_string(event->eventType), digest_hex,
-                     event->eventDataSize);
+    tpm2_writer *w = tpm2_writer_stdout();
+    tpm2_writer_map_begin(w, NULL);
+    tpm2_writer_uint(w, "EventNum", (*count)++);
+    tpm2_writer_uint(w, "PCRIndex", event->pcrIndex);
+    tpm2_writer_string(w, "EventType", eventtype_to_string(event->eventType),
+                       tpm2_writer_style_plain);
+    tpm2_writer_bytes(w, "Digest", event->digest, sizeof(event->digest),
+                      tpm2_writer_style_double_quoted);
+    tpm2_writer_uint(w, "EventSize", event->eventDataSize);
 }
 
 void yaml_specid(TCG_SPECID_EVENT* specid) {
 
     /* 'Signature' defined as byte buf, spec treats it like string w/o null. */
-    char sig_str[sizeof(specid->Signature) + 1] = { '\0', };
-    memcpy(sig_str, specid->Signature, sizeof(specid->Signature));
-
-    tpm2_tool_output("  SpecID:\n"
-                     "  - Signature: %s\n"
-                     "    platformClass: %" PRIu32 "\n"
-                     "    specVersionMinor: %" PRIu8 "\n"
-                     "    specVersionMajor: %" PRIu8 "\n"
-                     "    specErrata: %" PRIu8 "\n"
-                     "    uintnSize: %" PRIu8 "\n"
-                     "    numberOfAlgorithms: %" PRIu32 "\n"
-                     "    Algorithms:\n",
-                     sig_str,
-                     specid->platformClass, specid->specVersionMinor,
-                     specid->specVersionMajor, specid->specErrata,
-                     specid->uintnSize,
-                     specid->numberOfAlgorithms);
-
+    const char *signature = (const char *)specid->Signature;
+
+    tpm2_writer *w = tpm2_writer_stdout();
+    tpm2_writer_seq_begin(w, "SpecID");
+    tpm2_writer_map_begin(w, NULL);
+    tpm2_writer_string_len(w, "Signature", signature,
+                           strnlen(signature, sizeof(specid->Signature)),
+                           tpm2_writer_style_plain);
+    tpm2_writer_uint(w, "platformClass", specid->platformClass);
+    tpm2_writer_uint(w, "specVersionMinor", specid->specVersionMinor);
+    tpm2_writer_uint(w, "specVersionMajor", specid->specVersionMajor);
+    tpm2_writer_uint(w, "specErrata", specid->specErrata);
+    tpm2_writer_uint(w, "uintnSize", specid->uintnSize);
+    tpm2_writer_uint(w, "numberOfAlgorithms", specid->numberOfAlgorithms);
+    tpm2_writer_seq_begin(w, "Algorithms");
 }
 void yaml_specid_algs(TCG_SPECID_ALG const *alg, size_t count) {
 
+    tpm2_writer *w = tpm2_writer_stdout();
     for (size_t i = 0; i < count; ++i, ++alg) {
-        tpm2_tool_output("    - Algorithm[%zu]:\n"
-                         "      algorithmId: %s\n"
-                         "      digestSize: %" PRIu16 "\n",
-                         i,
-                         tpm2_alg_util_algtostr(alg->algorithmId,
-                                                tpm2_alg_util_flags_hash),
-                         alg->digestSize);
+        char key[sizeof("Algorithm[]") + 20];
+        snprintf(key, sizeof(key), "Algorithm[%zu]", i);
+        tpm2_writer_map_begin(w, NULL);
+        tpm2_writer_null(w, key);
+        tpm2_writer_string(w, "algorithmId",
+                           tpm2_alg_util_algtostr(alg->algorithmId,
+                                                  tpm2_alg_util_flags_hash),
+                           tpm2_writer_style_plain);
+        tpm2_writer_uint(w, "digestSize", alg->digestSize);
+        tpm2_writer_end(w);
     }
 }
 bool yaml_specid_vendor(TCG_VENDOR_INFO *vendor) {
 
-    char *vendinfo_str;
-
-    tpm2_tool_output("    vendorInfoSize: %" PRIu8 "\n", vendor->vendorInfoSize);
+    tpm2_writer *w = tpm2_writer_stdout();
+    tpm2_writer_uint(w, "vendorInfoSize", vendor->vendorInfoSize);
     if (vendor->vendorInfoSize == 0) {
         return true;
     }
-    vendinfo_str = calloc(1, vendor->vendorInfoSize * 2 + 1);
-    if (vendinfo_str == NULL) {
-        LOG_ERR("failed to allocate memory for vendorInfo: %s\n",
-                strerror(errno));
-        return false;
-    }
-    bytes_to_str(vendor->vendorInfo, vendor->vendorInfoSize, vendinfo_str,
-                 vendor->vendorInfoSize * 2 + 1);
-    tpm2_tool_output("    vendorInfo: \"%s\"\n", vendinfo_str);
-    free(vendinfo_str);
+    tpm2_writer_bytes(w, "vendorInfo", vendor->vendorInfo,
+                      vendor->vendorInfoSize, tpm2_writer_style_double_quoted);
     return true;
 }
 bool yaml_specid_event(TCG_EVENT const *event, size_t *count) {
@@ -1136,10 +944,17 @@ bool yaml_specid_event(TCG_EVENT const *event, size_t *count) {
     TCG_SPECID_ALG *alg = (TCG_SPECID_ALG*)specid->digestSizes;
     TCG_VENDOR_INFO *vendor = (TCG_VENDOR_INFO*)(alg + specid->numberOfAlgorithms);
 
+    tpm2_writer *w = tpm2_writer_stdout();
     yaml_eventhdr(event, count);
     yaml_specid(specid);
     yaml_specid_algs(alg, specid->numberOfAlgorithms);
-    return yaml_specid_vendor(vendor);
+    /* close the Algorithms list, the SpecID item and list, and the event */
+    tpm2_writer_end(w);
+    bool result = yaml_specid_vendor(vendor);
+    tpm2_writer_end(w);
+    tpm2_writer_end(w);
+    tpm2_writer_end(w);
+    return result;
 }
 bool yaml_specid_callback(TCG_EVENT const *event, void *data) {
 
@@ -1147,69 +962,100 @@ bool yaml_specid_callback(TCG_EVENT const *event, void *data) {
     return yaml_specid_event(event, count);
 }
 
+static void yaml_eventlog_pcr_bank(tpm2_writer *w, const char *bank,
+        uint32_t used, const BYTE *pcrs, size_t pcr_size) {
+
+    if (used == 0) {
+        return;
+    }
+
+    tpm2_writer_map_begin(w, bank);
+    tpm2_writer_align(w, 3, 0);
+    for(unsigned i = 0 ; i < TPM2_MAX_PCRS ; i++) {
+        if ((used & (1u << i)) == 0)
+            continue;
+        char key[sizeof("4294967295")];
+        snprintf(key, sizeof(key), "%u", i);
+        tpm2_writer_bytes(w, key, &pcrs[i * pcr_size], pcr_size,
+                          tpm2_writer_style_prefixed);
+    }
+    tpm2_writer_end(w);
+}
+
 static void yaml_eventlog_pcrs(tpm2_eventlog_context *ctx) {
 
-    char hexstr[DIGEST_HEX_STRING_MAX] = { 0, };
+    tpm2_writer *w = tpm2_writer_stdout();
+    tpm2_writer_map_begin(w, "pcrs");
+    yaml_eventlog_pcr_bank(w, "sha1", ctx->sha1_used, ctx->sha1_pcrs[0],
+            sizeof(ctx->sha1_pcrs[0]));
+    yaml_eventlog_pcr_bank(w, "sha256", ctx->sha256_used, ctx->sha256_pcrs[0],
+            sizeof(ctx->sha256_pcrs[0]));
+    yaml_eventlog_pcr_bank(w, "sha384", ctx->sha384_used, ctx->sha384_pcrs[0],
+            sizeof(ctx->sha384_pcrs[0]));
+    yaml_eventlog_pcr_bank(w, "sha512", ctx->sha512_used, ctx->sha512_pcrs[0],
+            sizeof(ctx->sha512_pcrs[0]));
+    yaml_eventlog_pcr_bank(w, "sm3_256", ctx->sm3_256_used,
+            ctx->sm3_256_pcrs[0], sizeof(ctx->sm3_256_pcrs[0]));
+    tpm2_writer_end(w);
+}
+
+/* The allow/deny summary of the events printed */
+static void yaml_eventlog_references(tpm2_eventlog_context *ctx) {
 
-    tpm2_tool_output("pcrs:\n");
+    tpm2_writer *w = tpm2_writer_stdout();
+    tpm2_writer_map_begin(w, "references");
+    tpm2_writer_uint(w, "allow", ctx->refdb_events[tpm2_refdb_verdict_allow]);
+    tpm2_writer_uint(w, "deny", ctx->refdb_events[tpm2_refdb_verdict_deny]);
+    tpm2_writer_uint(w, "unknown",
+                     ctx->refdb_events[tpm2_refdb_verdict_unknown]);
+    tpm2_writer_end(w);
+}
 
-    if (ctx->sha1_used != 0) {
-        tpm2_tool_output("  sha1:\n");
-        for(unsigned i = 0 ; i < TPM2_MAX_PCRS ; i++) {
-            if ((ctx->sha1_used & (1 << i)) == 0)
-                continue;
-            bytes_to_str(ctx->sha1_pcrs[i], sizeof(ctx->sha1_pcrs[i]),
-                hexstr, sizeof(hexstr));
-            tpm2_tool_output("    %-2d : 0x%s\n", i, hexstr);
-        }
-    }
+/* Annotates the digests with their reference measurements */
+static void yaml_eventlog_refdb(tpm2_eventlog_context *ctx,
+        tpm2_refdb const *refdb) {
 
-    if (ctx->sha256_used != 0) {
-        tpm2_tool_output("  sha256:\n");
-        for(unsigned i = 0 ; i < TPM2_MAX_PCRS ; i++) {
-            if ((ctx->sha256_used & (1 << i)) == 0)
-                continue;
-            bytes_to_str(ctx->sha256_pcrs[i], sizeof(ctx->sha256_pcrs[i]),
-                hexstr, sizeof(hexstr));
-            tpm2_tool_output("    %-2d : 0x%s\n", i, hexstr);
-        }
+    if (!refdb) {
+        return;
     }
 
-    if (ctx->sha384_used != 0) {
-        tpm2_tool_output("  sha384:\n");
-        for(unsigned i = 0 ; i < TPM2_MAX_PCRS ; i++) {
-            if ((ctx->sha384_used & (1 << i)) == 0)
-                continue;
-            bytes_to_str(ctx->sha384_pcrs[i], sizeof(ctx->sha384_pcrs[i]),
-                hexstr, sizeof(hexstr));
-            tpm2_tool_output("    %-2d : 0x%s\n", i, hexstr);
-        }
-    }
+    ctx->refdb = refdb;
+    ctx->refdb_cb = yaml_refdb_callback;
+    ctx->digest2_cb = NULL;
+}
+
+/* Starts the document of a parse, the events are added by the callbacks */
+static void yaml_eventlog_begin(tpm2_writer *w, uint32_t eventlog_version) {
+
+    tpm2_writer_document_begin(w);
+    tpm2_writer_map_begin(w, NULL);
+    tpm2_writer_uint(w, "version", eventlog_version);
+    tpm2_writer_seq_begin(w, "events");
+}
+
+/* Completes the document with the PCRs, or just flushes it on errors */
+static bool yaml_eventlog_end(tpm2_writer *w, tpm2_eventlog_context *ctx,
+        bool rc) {
 
-    if (ctx->sha512_used != 0) {
-        tpm2_tool_output("  sha512:\n");
-        for(unsigned i = 0 ; i < TPM2_MAX_PCRS ; i++) {
-            if ((ctx->sha512_used & (1 << i)) == 0)
-                continue;
-            bytes_to_str(ctx->sha512_pcrs[i], sizeof(ctx->sha512_pcrs[i]),
-                hexstr, sizeof(hexstr));
-            tpm2_tool_output("    %-2d : 0x%s\n", i, hexstr);
+    if (rc) {
+        tpm2_writer_end(w);
+        yaml_eventlog_pcrs(ctx);
+        if (ctx->refdb) {
+            yaml_eventlog_references(ctx);
         }
+        tpm2_writer_end(w);
     }
 
-    if (ctx->sm3_256_used != 0) {
-        tpm2_tool_output("  sm3_256:\n");
-        for(unsigned i = 0 ; i < TPM2_MAX_PCRS ; i++) {
-            if ((ctx->sm3_256_used & (1 << i)) == 0)
-                continue;
-            bytes_to_str(ctx->sm3_256_pcrs[i], sizeof(ctx->sm3_256_pcrs[i]),
-                hexstr, sizeof(hexstr));
-            tpm2_tool_output("    %-2d : 0x%s\n", i, hexstr);
-        }
+    if (!tpm2_writer_flush(w)) {
+        LOG_ERR("Could not write the eventlog output");
+        return false;
     }
+
+    return rc;
 }
 
-bool yaml_eventlog(UINT8 const *eventlog, size_t size, uint32_t eventlog_version) {
+bool yaml_eventlog(UINT8 const *eventlog, size_t size, uint32_t eventlog_version,
+                   tpm2_refdb const *refdb) {
 
     if (eventlog_version < MIN_EVLOG_YAML_VERSION || 
         eventlog_version > MAX_EVLOG_YAML_VERSION) {
@@ -1227,15 +1073,84 @@ bool yaml_eventlog(UINT8 const *eventlog, size_t size, uint32_t eventlog_version
         .event2_cb = yaml_event2data_callback,
         .eventlog_version = eventlog_version,
     };
+    yaml_eventlog_refdb(&ctx, refdb);
 
-    tpm2_tool_output("---\n");
-    tpm2_tool_output("version: %u\n", eventlog_version);
-    tpm2_tool_output("events:\n");
+    tpm2_writer *w = tpm2_writer_stdout();
+    yaml_eventlog_begin(w, eventlog_version);
     bool rc = parse_eventlog(&ctx, eventlog, size);
-    if (!rc) {
-        return rc;
+    return yaml_eventlog_end(w, &ctx, rc);
+}
+
+bool yaml_eventlog_query(UINT8 const *eventlog,
+        tpm2_eventlog_index const *index, size_t first, size_t last,
+        uint32_t pcrs, uint32_t eventlog_version, tpm2_refdb const *refdb) {
+
+    if (eventlog_version < MIN_EVLOG_YAML_VERSION ||
+        eventlog_version > MAX_EVLOG_YAML_VERSION) {
+        LOG_ERR("Unexpected YAML version number: %u\n", eventlog_version);
+        return false;
     }
 
-    yaml_eventlog_pcrs(&ctx);
-    return true;
+    size_t count = 0;
+    tpm2_eventlog_context ctx = {
+        .data = &count,
+        .specid_cb = yaml_specid_callback,
+        .event2hdr_cb = yaml_event2hdr_callback,
+        .log_eventhdr_cb = yaml_sha1_log_eventhdr_callback,
+        .digest2_cb = yaml_digest2_callback,
+        .event2_cb = yaml_event2data_callback,
+        .eventlog_version = eventlog_version,
+    };
+    yaml_eventlog_refdb(&ctx, refdb);
+
+    tpm2_writer *w = tpm2_writer_stdout();
+    yaml_eventlog_begin(w, eventlog_version);
+    bool rc = tpm2_eventlog_index_query(index, &ctx, eventlog, first, last,
+            pcrs, &count);
+    return yaml_eventlog_end(w, &ctx, rc);
+}
+
+void yaml_eventlog_watch_init(tpm2_eventlog_context *ctx, size_t *count,
+        uint32_t eventlog_version, tpm2_refdb const *refdb) {
+
+    *count = 0;
+    *ctx = (tpm2_eventlog_context) {
+        .data = count,
+        .specid_cb = yaml_specid_callback,
+        .event2hdr_cb = yaml_event2hdr_callback,
+        .log_eventhdr_cb = yaml_sha1_log_eventhdr_callback,
+        .digest2_cb = yaml_digest2_callback,
+        .event2_cb = yaml_event2data_callback,
+        .eventlog_version = eventlog_version,
+    };
+    yaml_eventlog_refdb(ctx, refdb);
+}
+
+bool yaml_eventlog_watch(tpm2_eventlog_context *ctx, UINT8 const *eventlog,
+        size_t size, size_t *consumed) {
+
+    /* only print the PCRs extended by the new events */
+    uint32_t sha1_used = ctx->sha1_used;
+    uint32_t sha256_used = ctx->sha256_used;
+    uint32_t sha384_used = ctx->sha384_used;
+    uint32_t sha512_used = ctx->sha512_used;
+    uint32_t sm3_256_used = ctx->sm3_256_used;
+    ctx->sha1_used = ctx->sha256_used = ctx->sha384_used = 0;
+    ctx->sha512_used = ctx->sm3_256_used = 0;
+
+    /* the summary only counts the new events too */
+    memset(ctx->refdb_events, 0, sizeof(ctx->refdb_events));
+
+    tpm2_writer *w = tpm2_writer_stdout();
+    yaml_eventlog_begin(w, ctx->eventlog_version);
+    bool rc = parse_eventlog_incremental(ctx, eventlog, size, consumed);
+    rc = yaml_eventlog_end(w, ctx, rc);
+
+    ctx->sha1_used |= sha1_used;
+    ctx->sha256_used |= sha256_used;
+    ctx->sha384_used |= sha384_used;
+    ctx->sha512_used |= sha512_used;
+    ctx->sm3_256_used |= sm3_256_used;
+
+    return rc;
 }
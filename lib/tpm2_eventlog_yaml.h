@@ -7,6 +7,8 @@
 
 #include "efi_event.h"
 #include "tpm2_eventlog.h"
+#include "tpm2_eventlog_index.h"
+#include "tpm2_refdb.h"
 
 #define MIN_EVLOG_YAML_VERSION 1
 #define MAX_EVLOG_YAML_VERSION 2
@@ -16,11 +18,38 @@ void yaml_event2hdr(TCG_EVENT_HEADER2 const *event_hdr, size_t size);
 bool yaml_digest2(TCG_DIGEST2 const *digest, size_t size);
 bool yaml_event2data(TCG_EVENT2 const *event, UINT32 type, uint32_t eventlog_version);
 bool yaml_digest2_callback(TCG_DIGEST2 const *digest, size_t size, void *data);
+bool yaml_refdb_callback(TCG_DIGEST2 const *digest, size_t size,
+                         tpm2_refdb_verdict verdict, const char *label,
+                         void *data);
 bool yaml_event2hdr_callback(TCG_EVENT_HEADER2 const *event_hdr, size_t size,
                              void *data);
 bool yaml_event2data_callback(TCG_EVENT2 const *event, UINT32 type, void *data,
                               uint32_t eventlog_version);
 
-bool yaml_eventlog(UINT8 const *eventlog, size_t size, uint32_t eventlog_version);
+/*
+ * Prints a log. With a reference database, every digest is annotated with its
+ * verdict and label, followed by the number of events per verdict.
+ */
+bool yaml_eventlog(UINT8 const *eventlog, size_t size, uint32_t eventlog_version,
+                   tpm2_refdb const *refdb);
+
+/*
+ * Prints the events of an indexed log within the range first to last whose
+ * PCR is in the pcrs mask, followed by the values of these PCRs after the
+ * last event of the range. See tpm2_eventlog_index_query().
+ */
+bool yaml_eventlog_query(UINT8 const *eventlog,
+        tpm2_eventlog_index const *index, size_t first, size_t last,
+        uint32_t pcrs, uint32_t eventlog_version, tpm2_refdb const *refdb);
+
+/*
+ * Watch mode: yaml_eventlog_watch_init() sets up a context kept across polls,
+ * each yaml_eventlog_watch() call prints a YAML document with the events
+ * appended since the previous poll and the PCRs they changed.
+ */
+void yaml_eventlog_watch_init(tpm2_eventlog_context *ctx, size_t *count,
+        uint32_t eventlog_version, tpm2_refdb const *refdb);
+bool yaml_eventlog_watch(tpm2_eventlog_context *ctx, UINT8 const *eventlog,
+        size_t size, size_t *consumed);
 
 #endif
@@ -1,21 +1,76 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <errno.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "files.h"
 #include "log.h"
 #include "tpm2.h"
 #include "tpm2_hash.h"
+#include "tpm2_openssl.h"
+#include "tpm2_queue.h"
+
+static tool_rc hash_local(TPMI_ALG_HASH halg, FILE *infilep, BYTE *inbuffer,
+        UINT16 inbuffer_len, TPM2B_DIGEST **result,
+        TPMT_TK_HASHCHECK **validation) {
+
+    TPM2B_DIGEST *digest = calloc(1, sizeof(*digest));
+    if (!digest) {
+        LOG_ERR("oom");
+        return tool_rc_general_error;
+    }
+
+    bool res = infilep ? tpm2_openssl_hash_file(halg, infilep, digest) :
+            tpm2_openssl_hash_compute_data(halg, inbuffer, inbuffer_len, digest);
+    if (!res) {
+        LOG_ERR("Could not hash the input data locally");
+        free(digest);
+        return tool_rc_general_error;
+    }
+
+    /* the same NULL ticket the TPM hands out for TPM2_RH_NULL */
+    if (validation) {
+        *validation = calloc(1, sizeof(**validation));
+        if (!*validation) {
+            LOG_ERR("oom");
+            free(digest);
+            return tool_rc_general_error;
+        }
+
+        (*validation)->tag = TPM2_ST_HASHCHECK;
+        (*validation)->hierarchy = TPM2_RH_NULL;
+    }
+
+    *result = digest;
+
+    return tool_rc_success;
+}
 
 static tool_rc tpm2_hash_common(ESYS_CONTEXT *ectx, TPMI_ALG_HASH halg,
         TPMI_RH_HIERARCHY hierarchy, FILE *infilep, BYTE *inbuffer,
         UINT16 inbuffer_len, TPM2B_DIGEST **result,
         TPMT_TK_HASHCHECK **validation) {
-    bool use_left = true, done;
+    bool use_left = true;
+
+    /*
+     * Without a ticket there is nothing the TPM adds, so avoid the round trip
+     * per TPM2_MAX_DIGEST_BUFFER bytes and hash in-process when OpenSSL knows
+     * the algorithm.
+     */
+    bool is_ticket_needed = validation && hierarchy != TPM2_RH_NULL;
+    if (!is_ticket_needed && tpm2_openssl_md_from_tpmhalg(halg)) {
+        LOG_INFO("No ticket requested, hashing with OpenSSL");
+        return hash_local(halg, infilep, inbuffer, inbuffer_len, result,
+                validation);
+    }
+
     unsigned long left = inbuffer_len;
-    size_t bytes_read;
     TPM2B_AUTH null_auth = TPM2B_EMPTY_INIT;
     TPMI_DH_OBJECT sequence_handle;
     TPM2B_MAX_BUFFER buffer;
@@ -44,71 +99,132 @@ static tool_rc tpm2_hash_common(ESYS_CONTEXT *ectx, TPMI_ALG_HASH halg,
     }
     /*
      * length is either unknown because the FILE * is a fifo, or it's too
-     * big to do in a single hash call. Based on the size figure out the
-     * chunks to loop over, if possible. This way we can call Complete with
-     * data.
+     * big to do in a single hash call. Loop over the chunks and keep the
+     * last one, so we can call Complete with data.
      */
     tool_rc rc = tpm2_hash_sequence_start(ectx, &null_auth, halg, &sequence_handle);
     if (rc != tool_rc_success) {
         return rc;
     }
 
-    /* If we know the file size, we decrement the amount read and terminate
-     * the loop when 1 block is left, else we go till feof.
-     */
-    done = false;
-    while (!done) {
-        /*  if we're using infilep, read the file. Otherwise, directly
-         copy into our local buffer. */
-        buffer.size = BUFFER_SIZE(typeof(buffer), buffer);
-        if (!!infilep) {
-            bytes_read = fread(buffer.buffer, 1, buffer.size, infilep);
-            if (ferror(infilep)) {
-                LOG_ERR("Error reading from input file");
-                return tool_rc_general_error;
-            } else {
-                buffer.size = bytes_read;
-            }
-        } else {
-            memcpy(buffer.buffer, inbuffer, buffer.size);
-            inbuffer = inbuffer + buffer.size;
+    if (!!infilep) {
+        rc = tpm2_hash_sequence_update_file(ectx, sequence_handle, infilep,
+                &buffer);
+        if (rc != tool_rc_success) {
+            return rc;
         }
 
+        return tpm2_sequence_complete(ectx, sequence_handle,
+                &buffer, hierarchy, result, validation);
+    }
+
+    /* update with whole blocks and keep the last one for Complete */
+    while (left > TPM2_MAX_DIGEST_BUFFER) {
+        buffer.size = BUFFER_SIZE(typeof(buffer), buffer);
+        memcpy(buffer.buffer, inbuffer, buffer.size);
+        inbuffer = inbuffer + buffer.size;
+
         rc = tpm2_sequence_update(ectx, sequence_handle, &buffer);
         if (rc != tool_rc_success) {
             return rc;
         }
 
-        if (use_left) {
-            left -= buffer.size;
-            if (left <= TPM2_MAX_DIGEST_BUFFER) {
-                done = true;
-                continue;
-            }
-        } else if (!!infilep && feof(infilep)) {
-            done = true;
+        left -= buffer.size;
+    }
+
+    buffer.size = left;
+    memcpy(buffer.buffer, inbuffer, buffer.size);
+
+    return tpm2_sequence_complete(ectx, sequence_handle,
+            &buffer, hierarchy, result, validation);
+}
+
+static double elapsed_seconds(const struct timespec *start) {
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec - start->tv_sec) +
+            (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static bool read_chunk(FILE *input, TPM2B_MAX_BUFFER *buffer) {
+
+    buffer->size = fread(buffer->buffer, 1,
+            BUFFER_SIZE(typeof(*buffer), buffer), input);
+    if (ferror(input)) {
+        LOG_ERR("Error reading from input file");
+        return false;
+    }
+
+    return true;
+}
+
+tool_rc tpm2_hash_sequence_update_file(ESYS_CONTEXT *ectx,
+        ESYS_TR sequence_handle, FILE *input, TPM2B_MAX_BUFFER *last) {
+
+    /*
+     * While the TPM works on a queued update the next chunk is read. A chunk
+     * is only sent once the following read shows it is not the final one, the
+     * final chunk goes to the Complete call.
+     */
+    unsigned long long total_bytes = 0;
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (!read_chunk(input, last)) {
+        return tool_rc_general_error;
+    }
+
+    tpm2_queue *queue = tpm2_queue_new(ectx);
+    if (!queue) {
+        return tool_rc_general_error;
+    }
+
+    tool_rc rc = tool_rc_success;
+    while (last->size == BUFFER_SIZE(TPM2B_MAX_BUFFER, buffer) &&
+            !feof(input)) {
+
+        rc = tpm2_queue_sequence_update(queue, sequence_handle, last, NULL);
+        if (rc != tool_rc_success) {
+            goto out;
         }
-    } /* end file read/hash update loop */
+        total_bytes += last->size;
 
-    /*  if there is data left, get the last bit of data from the file or
-     buffer or set the size to zero */
-    if (use_left) {
-        buffer.size = left;
-        if (!!infilep) {
-            bool res = files_read_bytes(infilep, buffer.buffer, buffer.size);
-            if (!res) {
-                LOG_ERR("Error reading from input file.");
-                return tool_rc_general_error;
+        /* the previous update completed when this one was sent */
+        if (tpm2_queue_pending(queue) > 1) {
+            rc = tpm2_queue_wait(queue, NULL);
+            if (rc != tool_rc_success) {
+                goto out;
             }
-        } else {
-            memcpy(buffer.buffer, inbuffer, buffer.size);
         }
-    } else {
-        buffer.size = 0;
+
+        /* read ahead while the TPM processes the update */
+        if (!read_chunk(input, last)) {
+            /* the read error wins over the outstanding command */
+            rc = tool_rc_general_error;
+            goto out;
+        }
     }
 
-    return tpm2_sequence_complete(ectx, sequence_handle,
-            &buffer, hierarchy, result, validation);
+    while (tpm2_queue_pending(queue)) {
+        rc = tpm2_queue_wait(queue, NULL);
+        if (rc != tool_rc_success) {
+            goto out;
+        }
+    }
+
+    total_bytes += last->size;
+
+    double seconds = elapsed_seconds(&start);
+    LOG_INFO("Sequence hashed %llu bytes in %.3f s (%.2f MB/s)", total_bytes,
+            seconds, seconds > 0 ? total_bytes / seconds / 1e6 : 0.0);
+
+out:
+    tpm2_queue_free(queue);
+
+    return rc;
 }
 
 tool_rc tpm2_hash_compute_data(ESYS_CONTEXT *ectx, TPMI_ALG_HASH halg,
@@ -134,3 +250,188 @@ tool_rc tpm2_hash_file(ESYS_CONTEXT *ectx, TPMI_ALG_HASH halg,
     return tpm2_hash_common(ectx, halg, hierarchy, input, NULL, 0, result,
         validation);
 }
+
+#define HASH_POOL_MAX_THREADS 64
+
+typedef enum hash_pool_state hash_pool_state;
+enum hash_pool_state {
+    hash_pool_state_pending = 0,
+    hash_pool_state_done,
+    hash_pool_state_failed,
+};
+
+typedef struct hash_pool_item hash_pool_item;
+struct hash_pool_item {
+    hash_pool_state state;
+    TPM2B_DIGEST digest;
+};
+
+struct tpm2_hash_pool {
+    TPMI_ALG_HASH halg;
+    char *const *paths;
+    size_t count;
+    hash_pool_item *items;
+    /* the index of the next file to hash, guarded by lock */
+    size_t next;
+    bool is_stopping;
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    pthread_t workers[HASH_POOL_MAX_THREADS];
+    unsigned worker_count;
+};
+
+static bool hash_pool_file(TPMI_ALG_HASH halg, const char *path,
+        TPM2B_DIGEST *digest) {
+
+    FILE *input = fopen(path, "rb");
+    if (!input) {
+        LOG_ERR("Could not open file \"%s\", error: %s", path,
+                strerror(errno));
+        return false;
+    }
+
+    bool result = tpm2_openssl_hash_file(halg, input, digest);
+    fclose(input);
+    if (!result) {
+        LOG_ERR("Could not hash file \"%s\"", path);
+    }
+
+    return result;
+}
+
+/*
+ * Hashes the next file, called and returning with the pool lock held.
+ */
+static void hash_pool_run_next(tpm2_hash_pool *pool) {
+
+    size_t index = pool->next++;
+    pthread_mutex_unlock(&pool->lock);
+
+    TPM2B_DIGEST digest = { 0 };
+    bool result = hash_pool_file(pool->halg, pool->paths[index], &digest);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->items[index].digest = digest;
+    pool->items[index].state = result ?
+            hash_pool_state_done : hash_pool_state_failed;
+    pthread_cond_broadcast(&pool->done);
+}
+
+static void *hash_pool_worker(void *arg) {
+
+    tpm2_hash_pool *pool = (tpm2_hash_pool *)arg;
+
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->is_stopping && pool->next < pool->count) {
+        hash_pool_run_next(pool);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+tpm2_hash_pool *tpm2_hash_pool_start(TPMI_ALG_HASH halg, char *const *paths,
+        size_t count, unsigned threads) {
+
+    tpm2_hash_pool *pool = calloc(1, sizeof(*pool));
+    hash_pool_item *items = calloc(count ? count : 1, sizeof(*items));
+    if (!pool || !items) {
+        LOG_ERR("oom");
+        free(pool);
+        free(items);
+        return NULL;
+    }
+
+    pool->halg = halg;
+    pool->paths = paths;
+    pool->count = count;
+    pool->items = items;
+
+    int rc = pthread_mutex_init(&pool->lock, NULL);
+    if (rc) {
+        LOG_ERR("Could not initialize lock: %s", strerror(rc));
+        free(items);
+        free(pool);
+        return NULL;
+    }
+
+    rc = pthread_cond_init(&pool->done, NULL);
+    if (rc) {
+        LOG_ERR("Could not initialize condition: %s", strerror(rc));
+        pthread_mutex_destroy(&pool->lock);
+        free(items);
+        free(pool);
+        return NULL;
+    }
+
+    if (!threads) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? cpus : 1;
+    }
+
+    if (threads > HASH_POOL_MAX_THREADS) {
+        threads = HASH_POOL_MAX_THREADS;
+    }
+
+    if (threads > count) {
+        threads = count;
+    }
+
+    /* without workers tpm2_hash_pool_get() hashes every file itself */
+    while (pool->worker_count < threads) {
+        rc = pthread_create(&pool->workers[pool->worker_count], NULL,
+                hash_pool_worker, pool);
+        if (rc) {
+            LOG_WARN("Could not start hash thread: %s", strerror(rc));
+            break;
+        }
+        pool->worker_count++;
+    }
+
+    return pool;
+}
+
+bool tpm2_hash_pool_get(tpm2_hash_pool *pool, size_t index,
+        TPM2B_DIGEST *digest) {
+
+    if (index >= pool->count) {
+        return false;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->items[index].state == hash_pool_state_pending) {
+        if (pool->next <= index) {
+            hash_pool_run_next(pool);
+        } else {
+            pthread_cond_wait(&pool->done, &pool->lock);
+        }
+    }
+
+    bool result = pool->items[index].state == hash_pool_state_done;
+    if (result) {
+        *digest = pool->items[index].digest;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return result;
+}
+
+void tpm2_hash_pool_free(tpm2_hash_pool *pool) {
+
+    if (!pool) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->is_stopping = true;
+    pthread_mutex_unlock(&pool->lock);
+
+    while (pool->worker_count) {
+        pthread_join(pool->workers[--pool->worker_count], NULL);
+    }
+
+    pthread_cond_destroy(&pool->done);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->items);
+    free(pool);
+}
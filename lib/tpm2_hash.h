@@ -23,7 +23,9 @@
  *  The digest result.
  * @param validation
  *  The validation ticket. Note that some hierarchies don't produce a
- *  validation ticket and thus size will be 0.
+ *  validation ticket and thus size will be 0. May be NULL if no ticket is
+ *  needed. Without a ticket, or with the TPM2_RH_NULL hierarchy, the data is
+ *  hashed locally with OpenSSL when it supports the algorithm.
  * @return
  *  A tool_rc indicating status.
  */
@@ -45,7 +47,9 @@ tool_rc tpm2_hash_compute_data(ESYS_CONTEXT *context, TPMI_ALG_HASH halg,
  *  The digest result.
  * @param validation
  *  The validation ticket. Note that some hierarchies don't produce a
- *  validation ticket and thus size will be 0.
+ *  validation ticket and thus size will be 0. May be NULL if no ticket is
+ *  needed. Without a ticket, or with the TPM2_RH_NULL hierarchy, the data is
+ *  hashed locally with OpenSSL when it supports the algorithm.
  * @return
  *  A tool_rc indicating status.
  */
@@ -53,4 +57,69 @@ tool_rc tpm2_hash_file(ESYS_CONTEXT *ectx, TPMI_ALG_HASH halg,
         TPMI_RH_HIERARCHY hierarchy, FILE *input, TPM2B_DIGEST **result,
         TPMT_TK_HASHCHECK **validation);
 
+/**
+ * Feeds a FILE stream into a started hash or event sequence. Reading the next
+ * chunk from the file overlaps with the TPM processing the previous one. The
+ * throughput achieved is reported in verbose mode.
+ * @param ectx
+ *  The esapi context.
+ * @param sequence_handle
+ *  The sequence to update, with an empty auth value.
+ * @param input
+ *  The FILE object to read until EOF.
+ * @param last
+ *  The final chunk of at most TPM2_MAX_DIGEST_BUFFER bytes, which is not sent
+ *  and is meant for the sequence complete call. Its size may be 0.
+ * @return
+ *  A tool_rc indicating status.
+ */
+tool_rc tpm2_hash_sequence_update_file(ESYS_CONTEXT *ectx,
+        ESYS_TR sequence_handle, FILE *input, TPM2B_MAX_BUFFER *last);
+
+/*
+ * Hashes files in-process on a pool of threads, so a tool can feed the TPM
+ * digests while the next files are still being hashed.
+ */
+typedef struct tpm2_hash_pool tpm2_hash_pool;
+
+/**
+ * Starts hashing files locally with OpenSSL on worker threads. The files are
+ * handed out in order, so the first digests are ready first.
+ * @param halg
+ *  The hashing algorithm to use, it must be known to OpenSSL.
+ * @param paths
+ *  The files to hash, the array must outlive the pool.
+ * @param count
+ *  The number of files.
+ * @param threads
+ *  The maximum number of worker threads, 0 for one per online CPU.
+ * @return
+ *  The pool, NULL on error.
+ */
+tpm2_hash_pool *tpm2_hash_pool_start(TPMI_ALG_HASH halg, char *const *paths,
+        size_t count, unsigned threads);
+
+/**
+ * Waits for the digest of a file. If no worker took the file yet, the calling
+ * thread hashes it itself.
+ * @param pool
+ *  The pool started with tpm2_hash_pool_start().
+ * @param index
+ *  The index of the file in the paths given to tpm2_hash_pool_start().
+ * @param digest
+ *  The digest of the file.
+ * @return
+ *  true on success, false if the file could not be hashed.
+ */
+bool tpm2_hash_pool_get(tpm2_hash_pool *pool, size_t index,
+        TPM2B_DIGEST *digest);
+
+/**
+ * Stops the pool. Files not started yet are skipped, the workers finish the
+ * files in progress before this returns.
+ * @param pool
+ *  The pool to free, may be NULL.
+ */
+void tpm2_hash_pool_free(tpm2_hash_pool *pool);
+
 #endif /* SRC_TPM_HASH_H_ */
@@ -0,0 +1,302 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <stdint.h>
+
+#include "tpm2_hex.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define HEX_SIMD 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+static const char hex_digits[] = "0123456789abcdef";
+
+static inline int hex_nibble(unsigned char c) {
+
+    if ((unsigned) (c - '0') < 10) {
+        return c - '0';
+    }
+
+    /* maps 'A' - 'F' to 'a' - 'f', no other character ends up there */
+    c |= 0x20;
+    if ((unsigned) (c - 'a') < 6) {
+        return c - 'a' + 10;
+    }
+
+    return -1;
+}
+
+static void hex_encode_scalar(const BYTE *data, size_t len, char *hex) {
+
+    size_t i;
+    for (i = 0; i < len; i++) {
+        hex[2 * i] = hex_digits[data[i] >> 4];
+        hex[2 * i + 1] = hex_digits[data[i] & 0xf];
+    }
+}
+
+static bool hex_decode_scalar(const char *hex, size_t hex_len, BYTE *data) {
+
+    size_t i;
+    for (i = 0; i < hex_len; i += 2) {
+        int hi = hex_nibble(hex[i]);
+        int lo = hex_nibble(hex[i + 1]);
+        if (hi < 0 || lo < 0) {
+            return false;
+        }
+        data[i / 2] = (BYTE) (hi << 4 | lo);
+    }
+
+    return true;
+}
+
+#ifdef HEX_SIMD
+
+static tpm2_hex_kernel hex_cpu_detect(void) {
+
+    static volatile tpm2_hex_kernel cpu = tpm2_hex_kernel_auto;
+    if (cpu != tpm2_hex_kernel_auto) {
+        return cpu;
+    }
+
+    unsigned eax, ebx, ecx, edx;
+    tpm2_hex_kernel detected = tpm2_hex_kernel_scalar;
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_SSE4_1)
+            && (ecx & bit_SSSE3)) {
+        detected = tpm2_hex_kernel_sse4;
+        /* AVX2 needs the OS to save the YMM registers, see XCR0 */
+        if (ecx & bit_OSXSAVE) {
+            unsigned xcr0_lo, xcr0_hi;
+            __asm__ ("xgetbv" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+            if ((xcr0_lo & 0x6) == 0x6 &&
+                    __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) &&
+                    (ebx & bit_AVX2)) {
+                detected = tpm2_hex_kernel_avx2;
+            }
+        }
+    }
+
+    /* racing threads all store the same value */
+    cpu = detected;
+
+    return detected;
+}
+
+#define SSE4 __attribute__((target("sse4.1")))
+#define AVX2 __attribute__((target("avx2")))
+
+/* encodes 16 bytes to 32 characters */
+static SSE4 void hex_encode_sse4(const BYTE *data, char *hex) {
+
+    const __m128i digits = _mm_loadu_si128((const __m128i *) hex_digits);
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+
+    __m128i in = _mm_loadu_si128((const __m128i *) data);
+    __m128i hi = _mm_shuffle_epi8(digits,
+            _mm_and_si128(_mm_srli_epi16(in, 4), nibble));
+    __m128i lo = _mm_shuffle_epi8(digits, _mm_and_si128(in, nibble));
+
+    _mm_storeu_si128((__m128i *) hex, _mm_unpacklo_epi8(hi, lo));
+    _mm_storeu_si128((__m128i *) (hex + 16), _mm_unpackhi_epi8(hi, lo));
+}
+
+/* encodes 32 bytes to 64 characters */
+static AVX2 void hex_encode_avx2(const BYTE *data, char *hex) {
+
+    const __m256i digits = _mm256_broadcastsi128_si256(
+            _mm_loadu_si128((const __m128i *) hex_digits));
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+
+    __m256i in = _mm256_loadu_si256((const __m256i *) data);
+    __m256i hi = _mm256_shuffle_epi8(digits,
+            _mm256_and_si256(_mm256_srli_epi16(in, 4), nibble));
+    __m256i lo = _mm256_shuffle_epi8(digits, _mm256_and_si256(in, nibble));
+
+    /* the unpacks interleave within the 128 bit lanes, reorder the lanes */
+    __m256i first = _mm256_unpacklo_epi8(hi, lo);
+    __m256i second = _mm256_unpackhi_epi8(hi, lo);
+    _mm256_storeu_si256((__m256i *) hex,
+            _mm256_permute2x128_si256(first, second, 0x20));
+    _mm256_storeu_si256((__m256i *) (hex + 32),
+            _mm256_permute2x128_si256(first, second, 0x31));
+}
+
+/*
+ * Converts 16 characters to their nibble values, valid is set for the
+ * characters that are hex digits.
+ */
+static SSE4 __m128i hex_nibbles_sse4(__m128i in, __m128i *valid) {
+
+    __m128i digit = _mm_sub_epi8(in, _mm_set1_epi8('0'));
+    __m128i is_digit = _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)),
+            digit);
+
+    __m128i alpha = _mm_sub_epi8(_mm_or_si128(in, _mm_set1_epi8(0x20)),
+            _mm_set1_epi8('a'));
+    __m128i is_alpha = _mm_cmpeq_epi8(_mm_min_epu8(alpha, _mm_set1_epi8(5)),
+            alpha);
+
+    *valid = _mm_or_si128(is_digit, is_alpha);
+
+    return _mm_or_si128(_mm_and_si128(is_digit, digit),
+            _mm_and_si128(is_alpha, _mm_add_epi8(alpha, _mm_set1_epi8(10))));
+}
+
+/* decodes 32 characters to 16 bytes */
+static SSE4 bool hex_decode_sse4(const char *hex, BYTE *data) {
+
+    __m128i valid_a, valid_b;
+    __m128i a = hex_nibbles_sse4(_mm_loadu_si128((const __m128i *) hex),
+            &valid_a);
+    __m128i b = hex_nibbles_sse4(_mm_loadu_si128((const __m128i *) (hex + 16)),
+            &valid_b);
+
+    if (_mm_movemask_epi8(_mm_and_si128(valid_a, valid_b)) != 0xffff) {
+        return false;
+    }
+
+    /* high nibble * 16 + low nibble for each pair of characters */
+    const __m128i weights = _mm_set1_epi16(0x0110);
+    __m128i bytes = _mm_packus_epi16(_mm_maddubs_epi16(a, weights),
+            _mm_maddubs_epi16(b, weights));
+    _mm_storeu_si128((__m128i *) data, bytes);
+
+    return true;
+}
+
+static AVX2 __m256i hex_nibbles_avx2(__m256i in, __m256i *valid) {
+
+    __m256i digit = _mm256_sub_epi8(in, _mm256_set1_epi8('0'));
+    __m256i is_digit = _mm256_cmpeq_epi8(
+            _mm256_min_epu8(digit, _mm256_set1_epi8(9)), digit);
+
+    __m256i alpha = _mm256_sub_epi8(
+            _mm256_or_si256(in, _mm256_set1_epi8(0x20)),
+            _mm256_set1_epi8('a'));
+    __m256i is_alpha = _mm256_cmpeq_epi8(
+            _mm256_min_epu8(alpha, _mm256_set1_epi8(5)), alpha);
+
+    *valid = _mm256_or_si256(is_digit, is_alpha);
+
+    return _mm256_or_si256(_mm256_and_si256(is_digit, digit),
+            _mm256_and_si256(is_alpha,
+                    _mm256_add_epi8(alpha, _mm256_set1_epi8(10))));
+}
+
+/* decodes 64 characters to 32 bytes */
+static AVX2 bool hex_decode_avx2(const char *hex, BYTE *data) {
+
+    __m256i valid_a, valid_b;
+    __m256i a = hex_nibbles_avx2(_mm256_loadu_si256((const __m256i *) hex),
+            &valid_a);
+    __m256i b = hex_nibbles_avx2(
+            _mm256_loadu_si256((const __m256i *) (hex + 32)), &valid_b);
+
+    if (_mm256_movemask_epi8(_mm256_and_si256(valid_a, valid_b)) != -1) {
+        return false;
+    }
+
+    const __m256i weights = _mm256_set1_epi16(0x0110);
+    __m256i bytes = _mm256_packus_epi16(_mm256_maddubs_epi16(a, weights),
+            _mm256_maddubs_epi16(b, weights));
+    /* the pack interleaves the 64 bit halves of the lanes of a and b */
+    _mm256_storeu_si256((__m256i *) data,
+            _mm256_permute4x64_epi64(bytes, 0xd8));
+
+    return true;
+}
+
+#endif /* HEX_SIMD */
+
+static volatile tpm2_hex_kernel hex_kernel = tpm2_hex_kernel_auto;
+
+static tpm2_hex_kernel hex_kernel_get(void) {
+
+#ifdef HEX_SIMD
+    tpm2_hex_kernel kernel = hex_kernel;
+    if (kernel == tpm2_hex_kernel_auto) {
+        kernel = hex_cpu_detect();
+        hex_kernel = kernel;
+    }
+    return kernel;
+#else
+    return tpm2_hex_kernel_scalar;
+#endif
+}
+
+bool tpm2_hex_set_kernel(tpm2_hex_kernel kernel) {
+
+#ifdef HEX_SIMD
+    tpm2_hex_kernel cpu = hex_cpu_detect();
+#else
+    tpm2_hex_kernel cpu = tpm2_hex_kernel_scalar;
+#endif
+
+    if (kernel == tpm2_hex_kernel_auto) {
+        kernel = cpu;
+    } else if (kernel > cpu) {
+        return false;
+    }
+
+    hex_kernel = kernel;
+
+    return true;
+}
+
+void tpm2_hex_encode(const BYTE *data, size_t len, char *hex) {
+
+    size_t i = 0;
+
+#ifdef HEX_SIMD
+    /* the wider kernels hand their tail to the narrower ones */
+    switch (hex_kernel_get()) {
+    case tpm2_hex_kernel_avx2:
+        for (; i + 32 <= len; i += 32) {
+            hex_encode_avx2(&data[i], &hex[2 * i]);
+        }
+        /* falls through */
+    case tpm2_hex_kernel_sse4:
+        for (; i + 16 <= len; i += 16) {
+            hex_encode_sse4(&data[i], &hex[2 * i]);
+        }
+        break;
+    default:
+        break;
+    }
+#endif
+
+    hex_encode_scalar(&data[i], len - i, &hex[2 * i]);
+}
+
+bool tpm2_hex_decode(const char *hex, size_t hex_len, BYTE *data) {
+
+    if (hex_len % 2) {
+        return false;
+    }
+
+    size_t i = 0;
+
+#ifdef HEX_SIMD
+    switch (hex_kernel_get()) {
+    case tpm2_hex_kernel_avx2:
+        for (; i + 64 <= hex_len; i += 64) {
+            if (!hex_decode_avx2(&hex[i], &data[i / 2])) {
+                return false;
+            }
+        }
+        /* falls through */
+    case tpm2_hex_kernel_sse4:
+        for (; i + 32 <= hex_len; i += 32) {
+            if (!hex_decode_sse4(&hex[i], &data[i / 2])) {
+                return false;
+            }
+        }
+        break;
+    default:
+        break;
+    }
+#endif
+
+    return hex_decode_scalar(&hex[i], hex_len - i, &data[i / 2]);
+}
@@ -0,0 +1,57 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef LIB_TPM2_HEX_H_
+#define LIB_TPM2_HEX_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <tss2/tss2_tpm2_types.h>
+
+/*
+ * The implementations of the hex conversions. The default picks the widest
+ * one the CPU supports, the others are selected by the tests and benchmarks.
+ */
+typedef enum tpm2_hex_kernel tpm2_hex_kernel;
+enum tpm2_hex_kernel {
+    tpm2_hex_kernel_auto = 0,
+    tpm2_hex_kernel_scalar,
+    tpm2_hex_kernel_sse4,
+    tpm2_hex_kernel_avx2,
+};
+
+/**
+ * Selects the implementation of the hex conversions for the whole process.
+ * @param kernel
+ *  The implementation to use.
+ * @return
+ *  false if the CPU can't run the implementation, the previous one stays
+ *  selected then.
+ */
+bool tpm2_hex_set_kernel(tpm2_hex_kernel kernel);
+
+/**
+ * Encodes binary data as lower case hex characters.
+ * @param data
+ *  The data to encode.
+ * @param len
+ *  The length of the data.
+ * @param hex
+ *  The output, 2 * len characters. It is not NUL terminated.
+ */
+void tpm2_hex_encode(const BYTE *data, size_t len, char *hex);
+
+/**
+ * Decodes hex characters of either case to binary data.
+ * @param hex
+ *  The characters to decode, they need not be NUL terminated.
+ * @param hex_len
+ *  The number of characters, it must be even.
+ * @param data
+ *  The output, hex_len / 2 bytes. It is undefined when the decoding fails.
+ * @return
+ *  false if hex_len is odd or a character is not a hex digit.
+ */
+bool tpm2_hex_decode(const char *hex, size_t hex_len, BYTE *data);
+
+#endif /* LIB_TPM2_HEX_H_ */
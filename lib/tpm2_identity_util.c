@@ -284,17 +284,15 @@ static void hmac_outer_integrity(TPMI_ALG_HASH parent_name_alg,
         uint16_t buffer2_size, uint8_t *hmac_key,
         TPM2B_DIGEST *outer_integrity_hmac) {
 
-    uint8_t to_hmac_buffer[TPM2_MAX_DIGEST_BUFFER];
-    memcpy(to_hmac_buffer, buffer1, buffer1_size);
-    memcpy(to_hmac_buffer + buffer1_size, buffer2, buffer2_size);
-    uint32_t size = 0;
+    size_t size = sizeof(outer_integrity_hmac->buffer);
 
     UINT16 hash_size = tpm2_alg_util_get_hash_size(parent_name_alg);
 
-    HMAC(tpm2_openssl_md_from_tpmhalg(parent_name_alg), hmac_key, hash_size,
-            to_hmac_buffer, buffer1_size + buffer2_size,
-            outer_integrity_hmac->buffer, &size);
-    outer_integrity_hmac->size = size;
+    bool result = tpm2_openssl_hmac_init(parent_name_alg, hmac_key, hash_size)
+            && tpm2_openssl_hmac_update(buffer1, buffer1_size)
+            && tpm2_openssl_hmac_update(buffer2, buffer2_size)
+            && tpm2_openssl_hmac_final(outer_integrity_hmac->buffer, &size);
+    outer_integrity_hmac->size = result ? size : 0;
 }
 
 bool tpm2_identity_util_calculate_inner_integrity(TPMI_ALG_HASH name_alg,
@@ -2,13 +2,6 @@
 
 #include <string.h>
 
-#include <openssl/evp.h>
-#if OPENSSL_VERSION_NUMBER < 0x30000000L
-#include <openssl/hmac.h>
-#else
-#include <openssl/core_names.h>
-#endif
-
 #include "log.h"
 #include "tpm2_kdfa.h"
 #include "tpm2_openssl.h"
@@ -50,41 +43,14 @@ TSS2_RC tpm2_kdfa(TPMI_ALG_HASH hash_alg, TPM2B *key, char *label,
 
     i = 1;
 
-    const EVP_MD *md = tpm2_openssl_md_from_tpmhalg(hash_alg);
-    if (!md) {
-        LOG_ERR("Algorithm not supported for hmac: %x", hash_alg);
-        return TPM2_RC_HASH;
-    }
-
-#if OPENSSL_VERSION_NUMBER < 0x30000000L
-    HMAC_CTX *ctx = HMAC_CTX_new();
-#else
-    EVP_MAC *hmac = EVP_MAC_fetch(NULL, "HMAC", NULL);
-    EVP_MAC_CTX *ctx = EVP_MAC_CTX_new(hmac);
-#endif
-    if (!ctx) {
-        LOG_ERR("HMAC context allocation failed");
-        return TPM2_RC_MEMORY;
-    }
-
-#if OPENSSL_VERSION_NUMBER < 0x30000000L
-    int rc = HMAC_Init_ex(ctx, key->buffer, key->size, md, NULL);
-#else
-    OSSL_PARAM params[2];
-
-    params[0] = OSSL_PARAM_construct_utf8_string(OSSL_ALG_PARAM_DIGEST,
-                                                 (char *)EVP_MD_get0_name(md), 0);
-    params[1] = OSSL_PARAM_construct_end();
-    int rc = EVP_MAC_init(ctx, key->buffer, key->size, params);
-#endif
-    if (!rc) {
-        LOG_ERR("HMAC Init failed: %s", ERR_error_string(rc, NULL));
-        rval = TPM2_RC_MEMORY;
-        goto err;
-    }
-
     // TODO Why is this a loop? It appears to only execute once.
     while (result_key->size < bytes) {
+        /* every round is a new HMAC, the last one dropped the key */
+        bool res = tpm2_openssl_hmac_init(hash_alg, key->buffer, key->size);
+        if (!res) {
+            return TPM2_RC_HASH;
+        }
+
         TPM2B_DIGEST tmpResult;
         // Inner loop
         bits_be = tpm2_util_hton_32(i);
@@ -101,51 +67,29 @@ TSS2_RC tpm2_kdfa(TPMI_ALG_HASH hash_alg, TPM2B *key, char *label,
         int c;
         for (c = 0; c < j; c++) {
             TPM2B_DIGEST *digest = buffer_list[c];
-#if OPENSSL_VERSION_NUMBER < 0x30000000L
-            int rc = HMAC_Update(ctx, digest->buffer, digest->size);
-#else
-            int rc = EVP_MAC_update(ctx, digest->buffer, digest->size);
-#endif
-            if (!rc) {
-                LOG_ERR("HMAC Update failed: %s", ERR_error_string(rc, NULL));
-                rval = TPM2_RC_MEMORY;
-                goto err;
+            res = tpm2_openssl_hmac_update(digest->buffer, digest->size);
+            if (!res) {
+                return TPM2_RC_MEMORY;
             }
         }
 
-#if OPENSSL_VERSION_NUMBER < 0x30000000L
-        unsigned size = sizeof(tmpResult.buffer);
-        int rc = HMAC_Final(ctx, tmpResult.buffer, &size);
-#else
-        size_t size;
-        int rc = EVP_MAC_final(ctx, tmpResult.buffer, &size, sizeof(tmpResult.buffer));
-#endif
-        if (!rc) {
-            LOG_ERR("HMAC Final failed: %s", ERR_error_string(rc, NULL));
-            rval = TPM2_RC_MEMORY;
-            goto err;
+        size_t size = sizeof(tmpResult.buffer);
+        res = tpm2_openssl_hmac_final(tmpResult.buffer, &size);
+        if (!res) {
+            return TPM2_RC_MEMORY;
         }
 
         tmpResult.size = size;
 
-        bool res = tpm2_util_concat_buffer(result_key, (TPM2B *) &tmpResult);
+        res = tpm2_util_concat_buffer(result_key, (TPM2B *) &tmpResult);
         if (!res) {
-            rval = TSS2_SYS_RC_BAD_VALUE;
-            goto err;
+            return TSS2_SYS_RC_BAD_VALUE;
         }
     }
 
     // Truncate the result to the desired size.
     result_key->size = bytes;
 
-err:
-#if OPENSSL_VERSION_NUMBER < 0x30000000L
-    HMAC_CTX_free(ctx);
-#else
-    EVP_MAC_CTX_free(ctx);
-    EVP_MAC_free(hmac);
-#endif
-
     return rval;
 }
 #ifdef _FORTIFY_SOURCE
@@ -0,0 +1,82 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "tpm2.h"
+#include "tpm2_nv_util.h"
+#include "tpm2_queue.h"
+
+tool_rc tpm2_util_nv_read_stream(ESYS_CONTEXT *ectx,
+    TPMI_RH_NV_INDEX nv_index, tpm2_loaded_object *auth_hierarchy_obj,
+    UINT16 size, UINT16 offset, UINT16 max_data_size, UINT8 *data_buffer,
+    UINT16 *bytes_read, ESYS_TR shandle2, ESYS_TR shandle3) {
+
+    ESYS_TR nv_handle = ESYS_TR_NONE;
+    tool_rc rc = tpm2_from_tpm_public(ectx, nv_index, ESYS_TR_NONE,
+        ESYS_TR_NONE, ESYS_TR_NONE, &nv_handle);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    tpm2_queue *queue = tpm2_queue_new(ectx);
+    if (!queue) {
+        tpm2_close(ectx, &nv_handle);
+        return tool_rc_general_error;
+    }
+
+    UINT16 requested = size > max_data_size ? max_data_size : size;
+    /* every read carries its size, the TPM must return all of it */
+    rc = tpm2_queue_nv_read(queue, auth_hierarchy_obj, nv_handle, requested,
+        offset, shandle2, shandle3, (void *)(uintptr_t)requested);
+
+    UINT16 data_buffer_offset = 0;
+    while (rc == tool_rc_success && tpm2_queue_pending(queue)) {
+        /* the read of the next chunk is issued before this one is copied */
+        if (requested < size) {
+            UINT16 left = size - requested;
+            UINT16 chunk = left > max_data_size ? max_data_size : left;
+            rc = tpm2_queue_nv_read(queue, auth_hierarchy_obj, nv_handle,
+                chunk, offset + requested, shandle2, shandle3,
+                (void *)(uintptr_t)chunk);
+            if (rc != tool_rc_success) {
+                break;
+            }
+            requested += chunk;
+        }
+
+        tpm2_queue_result result;
+        rc = tpm2_queue_wait(queue, &result);
+        if (rc != tool_rc_success) {
+            break;
+        }
+
+        UINT16 expected = (uintptr_t)result.userdata;
+        if (result.nv_data->size != expected) {
+            LOG_ERR("Expected %u bytes from NV read, got %u", expected,
+                result.nv_data->size);
+            free(result.nv_data);
+            rc = tool_rc_general_error;
+            break;
+        }
+
+        memcpy(data_buffer + data_buffer_offset, result.nv_data->buffer,
+            result.nv_data->size);
+        data_buffer_offset += result.nv_data->size;
+        free(result.nv_data);
+    }
+
+    tpm2_queue_free(queue);
+
+    if (rc != tool_rc_success) {
+        LOG_ERR("Failed to read NVRAM area at index 0x%X", nv_index);
+    } else if (bytes_read) {
+        *bytes_read = data_buffer_offset;
+    }
+
+    tpm2_close(ectx, &nv_handle);
+
+    return rc;
+}
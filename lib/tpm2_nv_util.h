@@ -58,67 +58,55 @@ static inline uint16_t tpm2_nv_util_max_allowed_nv_size(
      */
     uint16_t max_nv_size = TPM2_MAX_NV_BUFFER_SIZE;
 
-    TPMS_CAPABILITY_DATA *cap_data = 0;
-    UINT32 property = is_nvdefine_op ? TPM2_PT_FIXED : TPM2_PT_NV_BUFFER_MAX;
-    UINT32 property_count = is_nvdefine_op ? TPM2_MAX_TPM_PROPERTIES : 1;
-    tool_rc rc = tpm2_getcap(esys_context, TPM2_CAP_TPM_PROPERTIES, property,
-        property_count, 0, &cap_data);
-    bool is_getcap_op_fail = false;
-    if (rc != tool_rc_success) {
-        is_getcap_op_fail = true;
-        goto out;
-    }
-
-    /*
-     * 2. Non-NVDEFINE ops
-     */
-    if (!is_nvdefine_op) {
-        if(cap_data->data.tpmProperties.tpmProperty[0].property ==
-        TPM2_PT_NV_BUFFER_MAX ) {
-            max_nv_size = cap_data->data.tpmProperties.tpmProperty[0].value;
-        } else {
-            /*
-             * If TPM doesn't report TPM2_PT_NV_BUFFER_MAX in getcap,
-             * set the default sz.
-             */
-            is_getcap_op_fail = true;
-        }
-        goto out;
-    }
-
     /*
-     * 3. NVDEFINE op
+     * 2. Both sizes are fixed properties, served from the capability cache.
+     *    If the TPM doesn't report the property, keep the default size.
      */
-    TPMS_TAGGED_PROPERTY *properties = cap_data->data.tpmProperties.tpmProperty;
-    UINT32 count = cap_data->data.tpmProperties.count;
-    if (!count) {
-        is_getcap_op_fail = true;
-        goto out;
-    }
-
-    /*
-     * If TPM doesn't report TPM2_PT_NV_INDEX_MAX in getcap, set the default sz.
-     */
-    is_getcap_op_fail = true;
-    UINT32 i;
-    for (i = 0; i < count; i++) {
-        if (properties[i].property == TPM2_PT_NV_INDEX_MAX) {
-            max_nv_size = properties[i].value;
-            is_getcap_op_fail = false;
-            break;
-        }
-    }
-
-out:
-    free(cap_data);
-
-    if (is_getcap_op_fail) {
+    UINT32 value = 0;
+    TPM2_PT property = is_nvdefine_op ?
+        TPM2_PT_NV_INDEX_MAX : TPM2_PT_NV_BUFFER_MAX;
+    tool_rc rc = tpm2_capability_get_fixed_property(esys_context, property,
+        &value);
+    if (rc != tool_rc_success) {
         LOG_WARN("Cannot determine size from TPM properties."
                  "Setting max NV index size value to TPM2_MAX_NV_BUFFER_SIZE");
+        return max_nv_size;
     }
+
+    max_nv_size = value;
+
     return max_nv_size;
 }
 
+/**
+ * Reads size bytes at offset of a Non-Volatile (nv) index in chunks of at most
+ * max_data_size bytes. The index is resolved to an ESYS_TR once for all
+ * chunks and the NV_Read commands are issued back to back over it, one in
+ * flight at a time.
+ * @param ectx
+ *  The ESAPI context.
+ * @param nv_index
+ *  The index to read.
+ * @param auth_hierarchy_obj
+ *  The authorization object and session.
+ * @param size
+ *  The number of bytes to read.
+ * @param offset
+ *  Offset (in bytes) from which to start reading.
+ * @param max_data_size
+ *  The maximum number of bytes read per TPM2_NV_Read.
+ * @param data_buffer
+ *  The buffer, of at least size bytes, receiving the data.
+ * @param bytes_read
+ *  The number of bytes written to data_buffer.
+ * @return
+ *  tool_rc indicating status.
+ */
+tool_rc tpm2_util_nv_read_stream(ESYS_CONTEXT *ectx,
+    TPMI_RH_NV_INDEX nv_index, tpm2_loaded_object *auth_hierarchy_obj,
+    UINT16 size, UINT16 offset, UINT16 max_data_size, UINT8 *data_buffer,
+    UINT16 *bytes_read, ESYS_TR shandle2, ESYS_TR shandle3);
+
 /**
  * Reads data at Non-Volatile (nv) index.
  * @param ectx
@@ -240,6 +228,13 @@ static inline tool_rc tpm2_util_nv_read(ESYS_CONTEXT *ectx,
         goto out;
     }
 
+    if (is_nvread_dispatched && !cp_hash->size && !rp_hash->size) {
+        rc = tpm2_util_nv_read_stream(ectx, nv_index, auth_hierarchy_obj, size,
+            offset, max_data_size, *data_buffer, bytes_read, shandle2,
+            shandle3);
+        goto out;
+    }
+
     UINT16 data_buffer_offset = 0;
     while (size > 0) {
         UINT16 bytes_to_read = size > max_data_size ? max_data_size : size;
@@ -1,10 +1,15 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <errno.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 #include <openssl/pem.h>
 #if OPENSSL_VERSION_NUMBER < 0x30000000L
 #include <openssl/rand.h>
@@ -67,6 +72,288 @@ const EVP_MD *tpm2_openssl_md_from_tpmhalg(TPMI_ALG_HASH algorithm) {
     /* no return, not possible */
 }
 
+/*
+ * Every thread keeps a digest context, an HMAC context and, with OpenSSL 3,
+ * explicitly fetched digests. Allocating the contexts and the implicit fetch
+ * done by EVP_DigestInit_ex() for the legacy EVP_sha*() objects otherwise
+ * dominate the short hashes of event log replay and cpHash calculation.
+ */
+#define THREAD_CACHE_MDS 5
+
+typedef struct openssl_thread_cache openssl_thread_cache;
+struct openssl_thread_cache {
+    EVP_MD_CTX *mdctx;
+#if OPENSSL_VERSION_NUMBER < 0x30000000L
+    HMAC_CTX *hmac_ctx;
+#else
+    EVP_MAC *hmac;
+    EVP_MAC_CTX *hmac_ctx;
+    EVP_MD *mds[THREAD_CACHE_MDS];
+#endif
+};
+
+static pthread_key_t thread_cache_key;
+static pthread_once_t thread_cache_once = PTHREAD_ONCE_INIT;
+static bool is_thread_cache_key;
+
+static void thread_cache_free(void *arg) {
+
+    openssl_thread_cache *cache = (openssl_thread_cache *)arg;
+
+    EVP_MD_CTX_free(cache->mdctx);
+#if OPENSSL_VERSION_NUMBER < 0x30000000L
+    HMAC_CTX_free(cache->hmac_ctx);
+#else
+    EVP_MAC_CTX_free(cache->hmac_ctx);
+    EVP_MAC_free(cache->hmac);
+    unsigned i;
+    for (i = 0; i < THREAD_CACHE_MDS; i++) {
+        EVP_MD_free(cache->mds[i]);
+    }
+#endif
+    free(cache);
+}
+
+/*
+ * Thread-specific data destructors do not run for the thread calling exit(),
+ * usually the main thread, so its cache is freed from an exit handler.
+ */
+static void thread_cache_exit(void) {
+
+    openssl_thread_cache *cache = pthread_getspecific(thread_cache_key);
+    if (cache) {
+        pthread_setspecific(thread_cache_key, NULL);
+        thread_cache_free(cache);
+    }
+}
+
+static void thread_cache_key_create(void) {
+
+    is_thread_cache_key =
+            !pthread_key_create(&thread_cache_key, thread_cache_free);
+    if (!is_thread_cache_key) {
+        return;
+    }
+
+    /*
+     * Exit handlers run in reverse order, initializing OpenSSL first
+     * registers its cleanup before ours so the cache is freed while
+     * OpenSSL is still usable.
+     */
+    if (!OPENSSL_init_crypto(0, NULL) || atexit(thread_cache_exit)) {
+        LOG_WARN("The OpenSSL context cache is not freed on exit");
+    }
+}
+
+static openssl_thread_cache *thread_cache_get(void) {
+
+    pthread_once(&thread_cache_once, thread_cache_key_create);
+    if (!is_thread_cache_key) {
+        LOG_ERR("Could not create the OpenSSL context cache");
+        return NULL;
+    }
+
+    openssl_thread_cache *cache = pthread_getspecific(thread_cache_key);
+    if (cache) {
+        return cache;
+    }
+
+    cache = calloc(1, sizeof(*cache));
+    if (!cache) {
+        LOG_ERR("oom");
+        return NULL;
+    }
+
+    if (pthread_setspecific(thread_cache_key, cache)) {
+        LOG_ERR("Could not set up the OpenSSL context cache");
+        free(cache);
+        return NULL;
+    }
+
+    return cache;
+}
+
+static const EVP_MD *thread_cache_md(openssl_thread_cache *cache,
+        TPMI_ALG_HASH halg) {
+
+    const EVP_MD *md = tpm2_openssl_md_from_tpmhalg(halg);
+#if OPENSSL_VERSION_NUMBER < 0x30000000L
+    UNUSED(cache);
+#else
+    int index = -1;
+    switch (halg) {
+    case TPM2_ALG_SHA1:
+        index = 0;
+        break;
+    case TPM2_ALG_SHA256:
+        index = 1;
+        break;
+    case TPM2_ALG_SHA384:
+        index = 2;
+        break;
+    case TPM2_ALG_SHA512:
+        index = 3;
+        break;
+    case TPM2_ALG_SM3_256:
+        index = 4;
+        break;
+    }
+
+    if (md && index >= 0) {
+        if (!cache->mds[index]) {
+            cache->mds[index] = EVP_MD_fetch(NULL, EVP_MD_get0_name(md), NULL);
+        }
+        /* fall back to the implicit fetch if the provider lookup fails */
+        if (cache->mds[index]) {
+            return cache->mds[index];
+        }
+    }
+#endif
+
+    return md;
+}
+
+/*
+ * The HMAC context holds the key until the next HMAC, drop it as soon as an
+ * HMAC is done or has failed.
+ */
+static void thread_cache_hmac_clear(openssl_thread_cache *cache) {
+
+#if OPENSSL_VERSION_NUMBER < 0x30000000L
+    HMAC_CTX_reset(cache->hmac_ctx);
+#else
+    /* EVP_MAC_CTX has no reset, the fetched HMAC is what is worth keeping */
+    EVP_MAC_CTX_free(cache->hmac_ctx);
+    cache->hmac_ctx = NULL;
+#endif
+}
+
+EVP_MD_CTX *tpm2_openssl_digest_init(TPMI_ALG_HASH halg) {
+
+    openssl_thread_cache *cache = thread_cache_get();
+    if (!cache) {
+        return NULL;
+    }
+
+    const EVP_MD *md = thread_cache_md(cache, halg);
+    if (!md) {
+        LOG_ERR("Hash algorithm not supported by OpenSSL: 0x%x", halg);
+        return NULL;
+    }
+
+    if (!cache->mdctx) {
+        cache->mdctx = EVP_MD_CTX_new();
+        if (!cache->mdctx) {
+            LOG_ERR("%s", tpm2_openssl_get_err());
+            return NULL;
+        }
+    }
+
+    int rc = EVP_DigestInit_ex(cache->mdctx, md, NULL);
+    if (!rc) {
+        LOG_ERR("%s", tpm2_openssl_get_err());
+        return NULL;
+    }
+
+    return cache->mdctx;
+}
+
+bool tpm2_openssl_hmac_init(TPMI_ALG_HASH halg, const BYTE *key,
+        size_t key_size) {
+
+    openssl_thread_cache *cache = thread_cache_get();
+    if (!cache) {
+        return false;
+    }
+
+    const EVP_MD *md = thread_cache_md(cache, halg);
+    if (!md) {
+        LOG_ERR("Algorithm not supported for hmac: %x", halg);
+        return false;
+    }
+
+#if OPENSSL_VERSION_NUMBER < 0x30000000L
+    if (!cache->hmac_ctx) {
+        cache->hmac_ctx = HMAC_CTX_new();
+    }
+#else
+    if (!cache->hmac) {
+        cache->hmac = EVP_MAC_fetch(NULL, "HMAC", NULL);
+    }
+    if (cache->hmac && !cache->hmac_ctx) {
+        cache->hmac_ctx = EVP_MAC_CTX_new(cache->hmac);
+    }
+#endif
+    if (!cache->hmac_ctx) {
+        LOG_ERR("HMAC context allocation failed");
+        return false;
+    }
+
+#if OPENSSL_VERSION_NUMBER < 0x30000000L
+    int rc = HMAC_Init_ex(cache->hmac_ctx, key, key_size, md, NULL);
+#else
+    OSSL_PARAM params[2];
+
+    params[0] = OSSL_PARAM_construct_utf8_string(OSSL_ALG_PARAM_DIGEST,
+                                                 (char *)EVP_MD_get0_name(md), 0);
+    params[1] = OSSL_PARAM_construct_end();
+    int rc = EVP_MAC_init(cache->hmac_ctx, key, key_size, params);
+#endif
+    if (!rc) {
+        LOG_ERR("HMAC Init failed: %s", tpm2_openssl_get_err());
+        thread_cache_hmac_clear(cache);
+        return false;
+    }
+
+    return true;
+}
+
+bool tpm2_openssl_hmac_update(const BYTE *data, size_t size) {
+
+    openssl_thread_cache *cache = thread_cache_get();
+    if (!cache || !cache->hmac_ctx) {
+        LOG_ERR("No HMAC started");
+        return false;
+    }
+
+#if OPENSSL_VERSION_NUMBER < 0x30000000L
+    int rc = HMAC_Update(cache->hmac_ctx, data, size);
+#else
+    int rc = EVP_MAC_update(cache->hmac_ctx, data, size);
+#endif
+    if (!rc) {
+        LOG_ERR("HMAC Update failed: %s", tpm2_openssl_get_err());
+        thread_cache_hmac_clear(cache);
+        return false;
+    }
+
+    return true;
+}
+
+bool tpm2_openssl_hmac_final(BYTE *out, size_t *size) {
+
+    openssl_thread_cache *cache = thread_cache_get();
+    if (!cache || !cache->hmac_ctx) {
+        LOG_ERR("No HMAC started");
+        return false;
+    }
+
+#if OPENSSL_VERSION_NUMBER < 0x30000000L
+    unsigned out_size = *size;
+    int rc = HMAC_Final(cache->hmac_ctx, out, &out_size);
+    *size = out_size;
+#else
+    int rc = EVP_MAC_final(cache->hmac_ctx, out, size, *size);
+#endif
+    thread_cache_hmac_clear(cache);
+    if (!rc) {
+        LOG_ERR("HMAC Final failed: %s", tpm2_openssl_get_err());
+        return false;
+    }
+
+    return true;
+}
+
 bool tpm2_openssl_hash_compute_data(TPMI_ALG_HASH halg, BYTE *buffer,
         UINT16 length, TPM2B_DIGEST *digest) {
 
@@ -77,24 +364,141 @@ bool tpm2_openssl_hash_compute_data(TPMI_ALG_HASH halg, BYTE *buffer,
         return false;
     }
 
-    EVP_MD_CTX *mdctx = EVP_MD_CTX_create();
+    EVP_MD_CTX *mdctx = tpm2_openssl_digest_init(halg);
     if (!mdctx) {
-        LOG_ERR("%s", tpm2_openssl_get_err());
         return false;
     }
 
-    int rc = EVP_DigestInit_ex(mdctx, md, NULL);
+    int rc = EVP_DigestUpdate(mdctx, buffer, length);
     if (!rc) {
         LOG_ERR("%s", tpm2_openssl_get_err());
         goto out;
     }
 
-    rc = EVP_DigestUpdate(mdctx, buffer, length);
+    unsigned size = EVP_MD_size(md);
+    rc = EVP_DigestFinal_ex(mdctx, digest->buffer, &size);
     if (!rc) {
         LOG_ERR("%s", tpm2_openssl_get_err());
         goto out;
     }
 
+    digest->size = size;
+
+    result = true;
+
+out:
+    return result;
+}
+
+/*
+ * Regular files are mapped and hashed in one go, everything else, like pipes,
+ * is streamed through a large read buffer.
+ */
+#define HASH_FILE_READ_SIZE (1024 * 1024)
+
+static bool hash_file_mapped(EVP_MD_CTX *mdctx, FILE *input, bool *is_mapped) {
+
+    *is_mapped = false;
+
+    struct stat st;
+    int fd = fileno(input);
+    if (fd < 0 || fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+        return true;
+    }
+
+    off_t offset = ftello(input);
+    if (offset < 0 || offset >= st.st_size) {
+        return true;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        LOG_INFO("Could not map input file, falling back to reads");
+        return true;
+    }
+
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    int rc = EVP_DigestUpdate(mdctx, (BYTE *) map + offset,
+            st.st_size - offset);
+    munmap(map, st.st_size);
+    if (!rc) {
+        LOG_ERR("%s", tpm2_openssl_get_err());
+        return false;
+    }
+
+    /* leave the stream where a full read would have */
+    if (fseeko(input, 0, SEEK_END)) {
+        LOG_ERR("Could not seek input file, error: %s", strerror(errno));
+        return false;
+    }
+
+    *is_mapped = true;
+
+    return true;
+}
+
+static bool hash_file_buffered(EVP_MD_CTX *mdctx, FILE *input) {
+
+    BYTE *buffer = malloc(HASH_FILE_READ_SIZE);
+    if (!buffer) {
+        LOG_ERR("oom");
+        return false;
+    }
+
+    bool result = false;
+    while (!feof(input)) {
+        size_t bytes_read = fread(buffer, 1, HASH_FILE_READ_SIZE, input);
+        if (ferror(input)) {
+            LOG_ERR("Error reading from input file");
+            goto out;
+        }
+
+        int rc = EVP_DigestUpdate(mdctx, buffer, bytes_read);
+        if (!rc) {
+            LOG_ERR("%s", tpm2_openssl_get_err());
+            goto out;
+        }
+    }
+
+    result = true;
+
+out:
+    free(buffer);
+    return result;
+}
+
+bool tpm2_openssl_hash_file(TPMI_ALG_HASH halg, FILE *input,
+        TPM2B_DIGEST *digest) {
+
+    bool result = false;
+
+    const EVP_MD *md = tpm2_openssl_md_from_tpmhalg(halg);
+    if (!md) {
+        return false;
+    }
+
+    EVP_MD_CTX *mdctx = tpm2_openssl_digest_init(halg);
+    if (!mdctx) {
+        return false;
+    }
+
+    int rc;
+
+    bool is_mapped;
+    result = hash_file_mapped(mdctx, input, &is_mapped);
+    if (!result) {
+        goto out;
+    }
+
+    if (!is_mapped) {
+        result = hash_file_buffered(mdctx, input);
+        if (!result) {
+            goto out;
+        }
+    }
+
+    result = false;
     unsigned size = EVP_MD_size(md);
     rc = EVP_DigestFinal_ex(mdctx, digest->buffer, &size);
     if (!rc) {
@@ -107,7 +511,6 @@ bool tpm2_openssl_hash_compute_data(TPMI_ALG_HASH halg, BYTE *buffer,
     result = true;
 
 out:
-    EVP_MD_CTX_destroy(mdctx);
     return result;
 }
 
@@ -121,17 +524,12 @@ bool tpm2_openssl_pcr_extend(TPMI_ALG_HASH halg, BYTE *pcr,
         return false;
     }
 
-    EVP_MD_CTX *mdctx = EVP_MD_CTX_create();
+    EVP_MD_CTX *mdctx = tpm2_openssl_digest_init(halg);
     if (!mdctx) {
-        LOG_ERR("%s", tpm2_openssl_get_err());
         return false;
     }
 
-    int rc = EVP_DigestInit_ex(mdctx, md, NULL);
-    if (!rc) {
-        LOG_ERR("%s", tpm2_openssl_get_err());
-        goto out;
-    }
+    int rc;
 
     // extend operation is pcr = HASH(pcr + data)
     unsigned size = EVP_MD_size(md);
@@ -156,7 +554,6 @@ bool tpm2_openssl_pcr_extend(TPMI_ALG_HASH halg, BYTE *pcr,
     result = true;
 
 out:
-    EVP_MD_CTX_destroy(mdctx);
     return result;
 }
 
@@ -170,17 +567,12 @@ bool tpm2_openssl_hash_pcr_values(TPMI_ALG_HASH halg, TPML_DIGEST *digests,
         return false;
     }
 
-    EVP_MD_CTX *mdctx = EVP_MD_CTX_create();
+    EVP_MD_CTX *mdctx = tpm2_openssl_digest_init(halg);
     if (!mdctx) {
-        LOG_ERR("%s", tpm2_openssl_get_err());
         return false;
     }
 
-    int rc = EVP_DigestInit_ex(mdctx, md, NULL);
-    if (!rc) {
-        LOG_ERR("%s", tpm2_openssl_get_err());
-        goto out;
-    }
+    int rc;
 
     size_t i;
     for (i = 0; i < digests->count; i++) {
@@ -206,7 +598,6 @@ bool tpm2_openssl_hash_pcr_values(TPMI_ALG_HASH halg, TPML_DIGEST *digests,
     result = true;
 
 out:
-    EVP_MD_CTX_destroy(mdctx);
     return result;
 }
 
@@ -222,17 +613,12 @@ bool tpm2_openssl_hash_pcr_banks(TPMI_ALG_HASH hash_alg,
         return false;
     }
 
-    EVP_MD_CTX *mdctx = EVP_MD_CTX_create();
+    EVP_MD_CTX *mdctx = tpm2_openssl_digest_init(hash_alg);
     if (!mdctx) {
-        LOG_ERR("%s", tpm2_openssl_get_err());
         return false;
     }
 
-    int rc = EVP_DigestInit_ex(mdctx, md, NULL);
-    if (!rc) {
-        LOG_ERR("%s", tpm2_openssl_get_err());
-        goto out;
-    }
+    int rc;
 
     // Loop through all PCR/hash banks
     for (i = 0; i < pcr_select->count; i++) {
@@ -283,7 +669,6 @@ bool tpm2_openssl_hash_pcr_banks(TPMI_ALG_HASH hash_alg,
     result = true;
 
 out:
-    EVP_MD_CTX_destroy(mdctx);
     return result;
 }
 
@@ -299,17 +684,12 @@ bool tpm2_openssl_hash_pcr_banks_le(TPMI_ALG_HASH hash_alg,
         return false;
     }
 
-    EVP_MD_CTX *mdctx = EVP_MD_CTX_create();
+    EVP_MD_CTX *mdctx = tpm2_openssl_digest_init(hash_alg);
     if (!mdctx) {
-        LOG_ERR("%s", tpm2_openssl_get_err());
         return false;
     }
 
-    int rc = EVP_DigestInit_ex(mdctx, md, NULL);
-    if (!rc) {
-        LOG_ERR("%s", tpm2_openssl_get_err());
-        goto out;
-    }
+    int rc;
 
     /* Loop through all PCR/hash banks */
     for (i = 0; i < le32toh(pcr_select->count); i++) {
@@ -359,7 +739,6 @@ bool tpm2_openssl_hash_pcr_banks_le(TPMI_ALG_HASH hash_alg,
     result = true;
 
 out:
-    EVP_MD_CTX_destroy(mdctx);
     return result;
 }
 
@@ -51,6 +51,60 @@ int tpm2_openssl_halgid_from_tpmhalg(TPMI_ALG_HASH algorithm);
  */
 const EVP_MD *tpm2_openssl_md_from_tpmhalg(TPMI_ALG_HASH algorithm);
 
+/**
+ * Gets the digest context of the calling thread, initialized for a hash
+ * algorithm. The context and the digest it uses are fetched once per thread
+ * and reused, so it must not be freed and is only valid until the next
+ * tpm2_openssl_* hash routine runs on the thread. Digests must not nest: a
+ * second call before the first digest is finalized restarts the same context
+ * and silently corrupts the first digest.
+ * @param halg
+ *  The hashing algorithm to use.
+ * @return
+ *  The initialized context, NULL on error.
+ */
+EVP_MD_CTX *tpm2_openssl_digest_init(TPMI_ALG_HASH halg);
+
+/**
+ * Starts an HMAC on the HMAC context of the calling thread, which is reused
+ * from one HMAC to the next like the digest context of
+ * tpm2_openssl_digest_init(). HMACs must not nest either, and the key is
+ * dropped from the context by tpm2_openssl_hmac_final() or on any error.
+ * @param halg
+ *  The hashing algorithm to use.
+ * @param key
+ *  The HMAC key.
+ * @param key_size
+ *  The size of the key.
+ * @return
+ *  true on success, false on error.
+ */
+bool tpm2_openssl_hmac_init(TPMI_ALG_HASH halg, const BYTE *key,
+        size_t key_size);
+
+/**
+ * Adds data to the HMAC started with tpm2_openssl_hmac_init().
+ * @param data
+ *  The data.
+ * @param size
+ *  The size of the data.
+ * @return
+ *  true on success, false on error.
+ */
+bool tpm2_openssl_hmac_update(const BYTE *data, size_t size);
+
+/**
+ * Finishes the HMAC started with tpm2_openssl_hmac_init(), a new HMAC has to
+ * be started before the next tpm2_openssl_hmac_update().
+ * @param out
+ *  The HMAC result.
+ * @param size
+ *  On input the size of out, on output the size of the HMAC.
+ * @return
+ *  true on success, false on error.
+ */
+bool tpm2_openssl_hmac_final(BYTE *out, size_t *size);
+
 /**
  * Hash a byte buffer.
  * @param halg
@@ -67,6 +121,21 @@ const EVP_MD *tpm2_openssl_md_from_tpmhalg(TPMI_ALG_HASH algorithm);
 bool tpm2_openssl_hash_compute_data(TPMI_ALG_HASH halg, BYTE *buffer,
         UINT16 length, TPM2B_DIGEST *digest);
 
+/**
+ * Hash everything from the current position to the end of a FILE stream.
+ * Regular files are memory mapped, other streams are read in large chunks.
+ * @param halg
+ *  The hashing algorithm to use.
+ * @param input
+ *  The FILE object to hash.
+ * @param digest
+ *  The result of hashing the stream with halg.
+ * @return
+ *  true on success, false on error.
+ */
+bool tpm2_openssl_hash_file(TPMI_ALG_HASH halg, FILE *input,
+        TPM2B_DIGEST *digest);
+
 /**
  * Hash a list of PCR digests.
  * @param halg
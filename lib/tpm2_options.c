@@ -19,6 +19,7 @@
 
 #include "config.h"
 #include "log.h"
+#include "tpm2_capability.h"
 #include "tpm2_options.h"
 
 #ifndef VERSION
@@ -311,6 +312,17 @@ tpm2_option_code tpm2_handle_options(int argc, char **argv,
         }
     }
 
+    /*
+     * A caller may hand in an already initialized TCTI, like the tpm2 shell
+     * does for the commands it dispatches. Only give it back to tools that
+     * would have loaded one.
+     */
+    TSS2_TCTI_CONTEXT *preloaded_tcti = NULL;
+    if (tcti) {
+        preloaded_tcti = *tcti;
+        *tcti = NULL;
+    }
+
     /* Parse the options, calling the tool callback if unknown */
     const char *tcti_conf_option = NULL;
     optind = 1;
@@ -326,6 +338,13 @@ tpm2_option_code tpm2_handle_options(int argc, char **argv,
                 rc = tpm2_option_code_err;
                 goto out;
             }
+            /* the commands of the tpm2 shell share its connection */
+            if (preloaded_tcti) {
+                LOG_ERR("%s: the TCTI option is not supported by the commands "
+                        "of the tpm2 shell, set it on the shell", argv[0]);
+                rc = tpm2_option_code_err;
+                goto out;
+            }
             /* only attempt to get options from tcti option string */
             tcti_conf_option = optarg;
             flags->tcti_none = !strcmp(tcti_conf_option, "none");
@@ -501,11 +520,17 @@ tpm2_option_code tpm2_handle_options(int argc, char **argv,
             goto none;
         }
 
-        rc_tcti = Tss2_TctiLdr_Initialize(tcti_conf_option, tcti);
-        if (rc_tcti != TSS2_RC_SUCCESS || !*tcti) {
-            LOG_ERR("Could not load tcti, got: \"%s\"", tcti_conf_option);
-            rc = tpm2_option_code_err;
-            goto out;
+        if (preloaded_tcti) {
+            *tcti = preloaded_tcti;
+        } else {
+            rc_tcti = Tss2_TctiLdr_Initialize(tcti_conf_option, tcti);
+            if (rc_tcti != TSS2_RC_SUCCESS || !*tcti) {
+                LOG_ERR("Could not load tcti, got: \"%s\"", tcti_conf_option);
+                rc = tpm2_option_code_err;
+                goto out;
+            }
+
+            tpm2_capability_cache_init(tcti_conf_option);
         }
         /*
          * no loader requested ie --tcti=none is an error if tool
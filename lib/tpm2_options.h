@@ -146,7 +146,9 @@ enum tpm2_option_code {
  * @param flags
  *  The tpm2_option_flags to set during parsing.
  * @param tcti
- *  The tcti initialized from the tcti options.
+ *  The tcti initialized from the tcti options. If *tcti is not NULL on
+ *  entry, it is treated as an already initialized TCTI and handed back
+ *  instead of loading a new one, when the tool requires a TCTI.
  * @return
  *  A tpm option code indicating if an error, further processing
  *  or an immediate exit is desired.
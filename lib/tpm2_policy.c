@@ -4,6 +4,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <tss2/tss2_mu.h>
+
 #include "files.h"
 #include "log.h"
 #include "tool_rc.h"
@@ -14,6 +16,124 @@
 #include "tpm2_tool.h"
 #include "tpm2_util.h"
 
+/*
+ * Offline sessions compute the policyDigest updates of the TPM2 Part 3 policy
+ * commands in software, with the behavior of a trial session on the TPM.
+ */
+static tool_rc policy_offline_hash(tpm2_session *session, const BYTE *data,
+        size_t size) {
+
+    TPM2B_DIGEST *digest = tpm2_session_get_offline_digest(session);
+
+    /* policyDigest_new := H(policyDigest_old || data) */
+    BYTE buffer[sizeof(TPMU_HA) + sizeof(TPM2_CC) + sizeof(TPML_DIGEST)];
+    if (size > sizeof(buffer) - digest->size) {
+        LOG_ERR("Policy command parameters too large");
+        return tool_rc_general_error;
+    }
+
+    memcpy(buffer, digest->buffer, digest->size);
+    memcpy(&buffer[digest->size], data, size);
+
+    bool result = tpm2_openssl_hash_compute_data(
+            tpm2_session_get_authhash(session), buffer, digest->size + size,
+            digest);
+    if (!result) {
+        LOG_ERR("Could not update the offline policy digest");
+        return tool_rc_general_error;
+    }
+
+    return tool_rc_success;
+}
+
+static tool_rc policy_offline_command(tpm2_session *session, TPM2_CC cc,
+        const BYTE *parameters, size_t size) {
+
+    BYTE buffer[sizeof(TPM2_CC) + sizeof(TPML_DIGEST)];
+    size_t offset = 0;
+    TSS2_RC rval = Tss2_MU_TPM2_CC_Marshal(cc, buffer, sizeof(buffer),
+            &offset);
+    if (rval != TSS2_RC_SUCCESS || size > sizeof(buffer) - offset) {
+        LOG_ERR("Policy command parameters too large");
+        return tool_rc_general_error;
+    }
+
+    if (size) {
+        memcpy(&buffer[offset], parameters, size);
+    }
+
+    return policy_offline_hash(session, buffer, offset + size);
+}
+
+/*
+ * PolicyUpdate() of TPM2 Part 3, used by the commands that bind an entity and
+ * a policyRef.
+ */
+static tool_rc policy_offline_update(tpm2_session *session, TPM2_CC cc,
+        const TPM2B_NAME *name, const TPM2B_NONCE *policy_ref) {
+
+    tool_rc rc = policy_offline_command(session, cc, name->name, name->size);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    return policy_offline_hash(session, policy_ref->buffer, policy_ref->size);
+}
+
+static void policy_offline_clear(tpm2_session *session) {
+
+    TPM2B_DIGEST *digest = tpm2_session_get_offline_digest(session);
+    memset(digest->buffer, 0, digest->size);
+}
+
+/* like a trial session on the TPM, no timeout and no ticket are produced */
+static tool_rc policy_offline_no_ticket(TPM2B_TIMEOUT **timeout,
+        TPMT_TK_AUTH **policy_ticket) {
+
+    *timeout = calloc(1, sizeof(**timeout));
+    *policy_ticket = calloc(1, sizeof(**policy_ticket));
+    if (!*timeout || !*policy_ticket) {
+        LOG_ERR("oom");
+        return tool_rc_general_error;
+    }
+
+    return tool_rc_success;
+}
+
+static tool_rc policy_offline_check_cphash(const TPM2B_DIGEST *cp_hash) {
+
+    if (cp_hash && cp_hash->size) {
+        LOG_ERR("Cannot calculate cpHash for an offline session");
+        return tool_rc_option_error;
+    }
+
+    return tool_rc_success;
+}
+
+static tool_rc policy_pcr(ESYS_CONTEXT *ectx, tpm2_session *session,
+        const TPM2B_DIGEST *pcr_digest, const TPML_PCR_SELECTION *pcrs) {
+
+    if (!tpm2_session_is_offline(session)) {
+        ESYS_TR handle = tpm2_session_get_handle(session);
+        return tpm2_policy_pcr(ectx, handle, ESYS_TR_NONE, ESYS_TR_NONE,
+                ESYS_TR_NONE, pcr_digest, pcrs);
+    }
+
+    BYTE buffer[sizeof(TPML_PCR_SELECTION) + sizeof(TPMU_HA)];
+    size_t offset = 0;
+    TSS2_RC rval = Tss2_MU_TPML_PCR_SELECTION_Marshal(pcrs, buffer,
+            sizeof(buffer), &offset);
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Tss2_MU_TPML_PCR_SELECTION_Marshal, rval);
+        return tool_rc_general_error;
+    }
+
+    memcpy(&buffer[offset], pcr_digest->buffer, pcr_digest->size);
+    offset += pcr_digest->size;
+
+    return policy_offline_command(session, TPM2_CC_PolicyPCR, buffer, offset);
+}
+
 static bool evaluate_populate_pcr_digests(TPML_PCR_SELECTION *pcr_selections,
         const char *raw_pcrs_file, tpm2_pcrs *pcrs) {
 
@@ -148,7 +268,6 @@ tool_rc tpm2_policy_build_pcr(ESYS_CONTEXT *ectx, tpm2_session *policy_session,
 
     TPM2B_DIGEST pcr_digest = TPM2B_TYPE_INIT(TPM2B_DIGEST, buffer);
     TPMI_ALG_HASH auth_hash = tpm2_session_get_authhash(policy_session);
-    ESYS_TR handle = tpm2_session_get_handle(policy_session);
 
     /*
      * If digest of all PCRs is directly given, handle it here.
@@ -160,8 +279,14 @@ tool_rc tpm2_policy_build_pcr(ESYS_CONTEXT *ectx, tpm2_session *policy_session,
     }
     // Call the PolicyPCR command
     if (raw_pcr_digest) {
-        return tpm2_policy_pcr(ectx, handle, ESYS_TR_NONE, ESYS_TR_NONE,
-            ESYS_TR_NONE, raw_pcr_digest, pcr_selections);
+        return policy_pcr(ectx, policy_session, raw_pcr_digest,
+            pcr_selections);
+    }
+
+    if (!raw_pcrs_file && tpm2_session_is_offline(policy_session)) {
+        LOG_ERR("Offline sessions cannot read the PCRs, specify the PCR "
+                "values or their digest");
+        return tool_rc_option_error;
     }
 
 
@@ -223,8 +348,25 @@ tool_rc tpm2_policy_build_pcr(ESYS_CONTEXT *ectx, tpm2_session *policy_session,
     }
 
     // Call the PolicyPCR command
-    return tpm2_policy_pcr(ectx, handle, ESYS_TR_NONE, ESYS_TR_NONE,
-            ESYS_TR_NONE, &pcr_digest, pcr_selections);
+    return policy_pcr(ectx, policy_session, &pcr_digest, pcr_selections);
+}
+
+static bool policy_load_name(const char *path, TPM2B_NAME *name) {
+
+    unsigned long file_size = 0;
+    bool result = files_get_file_size_path(path, &file_size);
+    if (!result) {
+        return false;
+    }
+
+    if (!file_size || file_size > sizeof(name->name)) {
+        LOG_ERR("Verifying public key name file \"%s\", cannot be empty or "
+                "larger than a name", path);
+        return false;
+    }
+
+    name->size = (uint16_t) file_size;
+    return files_load_bytes_from_path(path, name->name, &name->size);
 }
 
 tool_rc tpm2_policy_build_policyauthorize(ESYS_CONTEXT *ectx,
@@ -259,22 +401,8 @@ tool_rc tpm2_policy_build_policyauthorize(ESYS_CONTEXT *ectx,
         }
     }
 
-    unsigned long file_size = 0;
-    result = files_get_file_size_path(verifying_pubkey_name_path, &file_size);
-    if (!result) {
-        return tool_rc_general_error;
-    }
-
-    if (!file_size) {
-        LOG_ERR("Verifying public key name file \"%s\", cannot be empty",
-                verifying_pubkey_name_path);
-        return tool_rc_general_error;
-    }
-
-    TPM2B_NAME key_sign = { .size = (uint16_t) file_size };
-
-    result = files_load_bytes_from_path(verifying_pubkey_name_path,
-            key_sign.name, &key_sign.size);
+    TPM2B_NAME key_sign = { .size = 0 };
+    result = policy_load_name(verifying_pubkey_name_path, &key_sign);
     if (!result) {
         return tool_rc_general_error;
     }
@@ -290,6 +418,17 @@ tool_rc tpm2_policy_build_policyauthorize(ESYS_CONTEXT *ectx,
         }
     }
 
+    if (tpm2_session_is_offline(policy_session)) {
+        tool_rc rc = policy_offline_check_cphash(cp_hash);
+        if (rc != tool_rc_success) {
+            return rc;
+        }
+
+        policy_offline_clear(policy_session);
+        return policy_offline_update(policy_session, TPM2_CC_PolicyAuthorize,
+                &key_sign, &policy_qualifier);
+    }
+
     ESYS_TR sess_handle = tpm2_session_get_handle(policy_session);
     return tpm2_policy_authorize(ectx, sess_handle, ESYS_TR_NONE, ESYS_TR_NONE,
             ESYS_TR_NONE, &approved_policy, &policy_qualifier, &key_sign,
@@ -299,6 +438,21 @@ tool_rc tpm2_policy_build_policyauthorize(ESYS_CONTEXT *ectx,
 tool_rc tpm2_policy_build_policyor(ESYS_CONTEXT *ectx,
         tpm2_session *policy_session, TPML_DIGEST *policy_list) {
 
+    if (tpm2_session_is_offline(policy_session)) {
+        BYTE buffer[sizeof(TPML_DIGEST)];
+        size_t offset = 0;
+        UINT32 i;
+        for (i = 0; i < policy_list->count; i++) {
+            memcpy(&buffer[offset], policy_list->digests[i].buffer,
+                    policy_list->digests[i].size);
+            offset += policy_list->digests[i].size;
+        }
+
+        policy_offline_clear(policy_session);
+        return policy_offline_command(policy_session, TPM2_CC_PolicyOR, buffer,
+                offset);
+    }
+
     ESYS_TR sess_handle = tpm2_session_get_handle(policy_session);
     return tpm2_policy_or(ectx, sess_handle, ESYS_TR_NONE, ESYS_TR_NONE,
             ESYS_TR_NONE, policy_list);
@@ -308,6 +462,13 @@ tool_rc tpm2_policy_build_policypassword(ESYS_CONTEXT *ectx,
         tpm2_session *session, TPM2B_DIGEST *cp_hash,
         TPMI_ALG_HASH parameter_hash_algorithm) {
 
+    if (tpm2_session_is_offline(session)) {
+        /* PolicyPassword extends the same value as PolicyAuthValue */
+        tool_rc rc = policy_offline_check_cphash(cp_hash);
+        return rc != tool_rc_success ? rc :
+            policy_offline_command(session, TPM2_CC_PolicyAuthValue, NULL, 0);
+    }
+
     ESYS_TR policy_session_handle = tpm2_session_get_handle(session);
 
     return tpm2_policy_password(ectx, policy_session_handle, ESYS_TR_NONE,
@@ -317,6 +478,11 @@ tool_rc tpm2_policy_build_policypassword(ESYS_CONTEXT *ectx,
 tool_rc tpm2_policy_build_policynamehash(ESYS_CONTEXT *ectx,
     tpm2_session *session, const TPM2B_DIGEST *name_hash) {
 
+    if (tpm2_session_is_offline(session)) {
+        return policy_offline_command(session, TPM2_CC_PolicyNameHash,
+                name_hash->buffer, name_hash->size);
+    }
+
     ESYS_TR policy_session_handle = tpm2_session_get_handle(session);
 
     return tpm2_policy_namehash(ectx, policy_session_handle, name_hash);
@@ -325,6 +491,11 @@ tool_rc tpm2_policy_build_policynamehash(ESYS_CONTEXT *ectx,
 tool_rc tpm2_policy_build_policytemplate(ESYS_CONTEXT *ectx,
     tpm2_session *session, const TPM2B_DIGEST *template_hash) {
 
+    if (tpm2_session_is_offline(session)) {
+        return policy_offline_command(session, TPM2_CC_PolicyTemplate,
+                template_hash->buffer, template_hash->size);
+    }
+
     ESYS_TR policy_session_handle = tpm2_session_get_handle(session);
 
     return tpm2_policy_template(ectx, policy_session_handle, template_hash);
@@ -333,6 +504,11 @@ tool_rc tpm2_policy_build_policytemplate(ESYS_CONTEXT *ectx,
 tool_rc tpm2_policy_build_policycphash(ESYS_CONTEXT *ectx,
     tpm2_session *session, const TPM2B_DIGEST *cphash) {
 
+    if (tpm2_session_is_offline(session)) {
+        return policy_offline_command(session, TPM2_CC_PolicyCpHash,
+                cphash->buffer, cphash->size);
+    }
+
     ESYS_TR policy_session_handle = tpm2_session_get_handle(session);
 
     return tpm2_policy_cphash(ectx, policy_session_handle, cphash);
@@ -342,12 +518,54 @@ tool_rc tpm2_policy_build_policyauthvalue(ESYS_CONTEXT *ectx,
         tpm2_session *session, TPM2B_DIGEST *cp_hash,
         TPMI_ALG_HASH parameter_hash_algorithm) {
 
+    if (tpm2_session_is_offline(session)) {
+        tool_rc rc = policy_offline_check_cphash(cp_hash);
+        return rc != tool_rc_success ? rc :
+            policy_offline_command(session, TPM2_CC_PolicyAuthValue, NULL, 0);
+    }
+
     ESYS_TR policy_session_handle = tpm2_session_get_handle(session);
 
     return tpm2_policy_authvalue(ectx, policy_session_handle, ESYS_TR_NONE,
             ESYS_TR_NONE, ESYS_TR_NONE, cp_hash, parameter_hash_algorithm);
 }
 
+static tool_rc policy_offline_secret(tpm2_session *session,
+        tpm2_loaded_object *auth_entity_obj, TPMT_TK_AUTH **policy_ticket,
+        TPM2B_TIMEOUT **timeout, bool is_nonce_tpm,
+        const TPM2B_NONCE *policy_qualifier, TPM2B_DIGEST *cp_hash) {
+
+    tool_rc rc = policy_offline_check_cphash(cp_hash);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    /* only the name of a permanent entity is known without a TPM */
+    if (is_nonce_tpm ||
+        (auth_entity_obj->handle >> TPM2_HR_SHIFT) != TPM2_HT_PERMANENT) {
+        LOG_ERR("Offline sessions support permanent auth entities without "
+                "nonceTPM only");
+        return tool_rc_option_error;
+    }
+
+    TPM2B_NAME name = { .size = 0 };
+    TSS2_RC rval = Tss2_MU_TPM2_HANDLE_Marshal(auth_entity_obj->handle,
+            name.name, sizeof(name.name), NULL);
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Tss2_MU_TPM2_HANDLE_Marshal, rval);
+        return tool_rc_general_error;
+    }
+    name.size = sizeof(TPM2_HANDLE);
+
+    rc = policy_offline_no_ticket(timeout, policy_ticket);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    return policy_offline_update(session, TPM2_CC_PolicySecret, &name,
+            policy_qualifier);
+}
+
 tool_rc tpm2_policy_build_policysecret(ESYS_CONTEXT *ectx,
         tpm2_session *policy_session, tpm2_loaded_object *auth_entity_obj,
         INT32 expiration, TPMT_TK_AUTH **policy_ticket,
@@ -369,6 +587,12 @@ tool_rc tpm2_policy_build_policysecret(ESYS_CONTEXT *ectx,
         }
     }
 
+    if (tpm2_session_is_offline(policy_session)) {
+        return policy_offline_secret(policy_session, auth_entity_obj,
+                policy_ticket, timeout, is_nonce_tpm, &policy_qualifier,
+                cp_hash);
+    }
+
     ESYS_TR policy_session_handle = tpm2_session_get_handle(policy_session);
 
     TPM2B_NONCE *nonce_tpm = NULL;
@@ -452,7 +676,7 @@ tool_rc tpm2_policy_build_policysigned(ESYS_CONTEXT *ectx,
         TPMT_SIGNATURE *signature, INT32 expiration, TPM2B_TIMEOUT **timeout,
         TPMT_TK_AUTH **policy_ticket, const char *policy_qualifier_data,
         bool is_nonce_tpm, const char *raw_data_path,
-        const char *cphash_path) {
+        const char *cphash_path, const char *key_name_path) {
 
     bool result = true;
 
@@ -484,6 +708,39 @@ tool_rc tpm2_policy_build_policysigned(ESYS_CONTEXT *ectx,
         }
     }
 
+    if (tpm2_session_is_offline(policy_session) && !raw_data_path) {
+        if (is_nonce_tpm) {
+            LOG_ERR("Offline sessions have no nonceTPM");
+            return tool_rc_option_error;
+        }
+
+        /* the name of the signing key, from a file or from its ESYS_TR */
+        TPM2B_NAME name = { .size = 0 };
+        if (key_name_path) {
+            result = policy_load_name(key_name_path, &name);
+            if (!result) {
+                return tool_rc_general_error;
+            }
+        } else if (ectx && auth_entity_obj) {
+            TPM2B_NAME *key_name = NULL;
+            tool_rc rc = tpm2_tr_get_name(ectx, auth_entity_obj->tr_handle,
+                &key_name);
+            if (rc != tool_rc_success) {
+                return rc;
+            }
+            name = *key_name;
+            Esys_Free(key_name);
+        } else {
+            LOG_ERR("Offline sessions need the name of the signing key");
+            return tool_rc_option_error;
+        }
+
+        tool_rc rc = policy_offline_update(policy_session,
+                TPM2_CC_PolicySigned, &name, &policy_qualifier);
+        return rc != tool_rc_success ? rc :
+            policy_offline_no_ticket(timeout, policy_ticket);
+    }
+
     ESYS_TR policy_session_handle = tpm2_session_get_handle(policy_session);
 
     TPM2B_NONCE *nonce_tpm = NULL;
@@ -553,6 +810,22 @@ tool_rc tpm2_policy_get_digest(ESYS_CONTEXT *ectx, tpm2_session *session,
     TPM2B_DIGEST **policy_digest, TPM2B_DIGEST *cphash,
     TPMI_ALG_HASH parameter_hash_algorithm) {
 
+    if (tpm2_session_is_offline(session)) {
+        tool_rc rc = policy_offline_check_cphash(cphash);
+        if (rc != tool_rc_success) {
+            return rc;
+        }
+
+        *policy_digest = malloc(sizeof(**policy_digest));
+        if (!*policy_digest) {
+            LOG_ERR("oom");
+            return tool_rc_general_error;
+        }
+
+        **policy_digest = *tpm2_session_get_offline_digest(session);
+        return tool_rc_success;
+    }
+
     ESYS_TR handle = tpm2_session_get_handle(session);
 
     return tpm2_policy_getdigest(ectx, handle, ESYS_TR_NONE, ESYS_TR_NONE,
@@ -563,6 +836,20 @@ tool_rc tpm2_policy_build_policycommandcode(ESYS_CONTEXT *ectx,
         tpm2_session *session, uint32_t command_code, TPM2B_DIGEST *cp_hash,
         TPMI_ALG_HASH parameter_hash_algorithm) {
 
+    if (tpm2_session_is_offline(session)) {
+        BYTE buffer[sizeof(TPM2_CC)];
+        size_t offset = 0;
+        tool_rc rc = policy_offline_check_cphash(cp_hash);
+        if (rc != tool_rc_success ||
+            Tss2_MU_TPM2_CC_Marshal(command_code, buffer, sizeof(buffer),
+                &offset) != TSS2_RC_SUCCESS) {
+            return rc != tool_rc_success ? rc : tool_rc_general_error;
+        }
+
+        return policy_offline_command(session, TPM2_CC_PolicyCommandCode,
+                buffer, offset);
+    }
+
     ESYS_TR handle = tpm2_session_get_handle(session);
 
     return tpm2_policy_command_code(ectx, handle, ESYS_TR_NONE, ESYS_TR_NONE,
@@ -573,6 +860,13 @@ tool_rc  tpm2_policy_build_policynvwritten(ESYS_CONTEXT *ectx,
         tpm2_session *session, TPMI_YES_NO written_set, TPM2B_DIGEST *cp_hash,
         TPMI_ALG_HASH parameter_hash_algorithm) {
 
+    if (tpm2_session_is_offline(session)) {
+        tool_rc rc = policy_offline_check_cphash(cp_hash);
+        return rc != tool_rc_success ? rc :
+            policy_offline_command(session, TPM2_CC_PolicyNvWritten,
+                &written_set, sizeof(written_set));
+    }
+
     ESYS_TR handle = tpm2_session_get_handle(session);
 
     return tpm2_policy_nv_written(ectx, handle, ESYS_TR_NONE, ESYS_TR_NONE,
@@ -583,6 +877,13 @@ tool_rc tpm2_policy_build_policylocality(ESYS_CONTEXT *ectx,
         tpm2_session *session, TPMA_LOCALITY locality, TPM2B_DIGEST *cp_hash,
         TPMI_ALG_HASH parameter_hash_algorithm) {
 
+    if (tpm2_session_is_offline(session)) {
+        tool_rc rc = policy_offline_check_cphash(cp_hash);
+        return rc != tool_rc_success ? rc :
+            policy_offline_command(session, TPM2_CC_PolicyLocality, &locality,
+                sizeof(locality));
+    }
+
     ESYS_TR handle = tpm2_session_get_handle(session);
 
     return tpm2_policy_locality(ectx, handle, ESYS_TR_NONE, ESYS_TR_NONE,
@@ -617,6 +918,22 @@ tool_rc tpm2_policy_build_policyduplicationselect(ESYS_CONTEXT *ectx,
         return tool_rc_general_error;
     }
 
+    if (tpm2_session_is_offline(session)) {
+        /* the object name is only included when asked to */
+        BYTE buffer[2 * sizeof(TPMU_NAME) + sizeof(TPMI_YES_NO)];
+        size_t offset = 0;
+        if (is_include_obj) {
+            memcpy(buffer, obj_name.name, obj_name.size);
+            offset += obj_name.size;
+        }
+        memcpy(&buffer[offset], new_parent_name.name, new_parent_name.size);
+        offset += new_parent_name.size;
+        buffer[offset++] = is_include_obj;
+
+        return policy_offline_command(session, TPM2_CC_PolicyDuplicationSelect,
+                buffer, offset);
+    }
+
     ESYS_TR handle = tpm2_session_get_handle(session);
 
     return tpm2_policy_duplication_select(ectx, handle, ESYS_TR_NONE,
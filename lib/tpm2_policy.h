@@ -197,13 +197,16 @@ tool_rc tpm2_policy_build_policyauthvalue(ESYS_CONTEXT *ectx,
  *  The loaded TPM2 key object public portion used for signature verification
  * @param signature
  *  The signature of the optional TPM2 parameters
+ * @param key_name_path
+ *  For offline trial sessions, the file holding the name of the verification
+ *  key, used instead of auth_entity_obj. NULL otherwise.
  */
 tool_rc tpm2_policy_build_policysigned(ESYS_CONTEXT *ectx,
         tpm2_session *policy_session, tpm2_loaded_object *auth_entity_obj,
         TPMT_SIGNATURE *signature, INT32 expiration, TPM2B_TIMEOUT **timeout,
         TPMT_TK_AUTH **policy_ticket, const char *policy_qualifier_path,
         bool is_nonce_tpm, const char *raw_data_path,
-        const char *cphash_path);
+        const char *cphash_path, const char *key_name_path);
 
 /**
  * PolicyTicket assertion enables proxy authentication for either PolicySecret
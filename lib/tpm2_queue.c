@@ -0,0 +1,239 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "tpm2.h"
+#include "tpm2_queue.h"
+
+typedef enum queue_cmd queue_cmd;
+enum queue_cmd {
+    queue_cmd_nv_read,
+    queue_cmd_pcr_read,
+    queue_cmd_sequence_update,
+    queue_cmd_getrandom,
+};
+
+typedef struct queue_slot queue_slot;
+struct queue_slot {
+    queue_cmd cmd;
+    tool_rc rc;
+    tpm2_queue_result result;
+};
+
+struct tpm2_queue {
+    ESYS_CONTEXT *ectx;
+    queue_slot slots[TPM2_QUEUE_DEPTH];
+    size_t first;
+    size_t count;
+    /* the newest slot is sent but not finished */
+    bool is_in_flight;
+};
+
+static queue_slot *queue_slot_at(tpm2_queue *queue, size_t i) {
+
+    return &queue->slots[(queue->first + i) % TPM2_QUEUE_DEPTH];
+}
+
+static void queue_result_free(tpm2_queue_result *result) {
+
+    free(result->nv_data);
+    free(result->pcr_selection);
+    free(result->pcr_values);
+    free(result->random);
+}
+
+static tool_rc queue_finish_in_flight(tpm2_queue *queue) {
+
+    queue_slot *slot = queue_slot_at(queue, queue->count - 1);
+    tpm2_queue_result *result = &slot->result;
+
+    queue->is_in_flight = false;
+
+    switch (slot->cmd) {
+    case queue_cmd_nv_read:
+        slot->rc = tpm2_nv_read_finish(queue->ectx, &result->nv_data);
+        break;
+    case queue_cmd_pcr_read:
+        slot->rc = tpm2_pcr_read_finish(queue->ectx,
+                &result->pcr_update_counter, &result->pcr_selection,
+                &result->pcr_values);
+        break;
+    case queue_cmd_sequence_update:
+        slot->rc = tpm2_sequence_update_finish(queue->ectx);
+        break;
+    case queue_cmd_getrandom:
+        slot->rc = tpm2_getrandom_finish(queue->ectx, &result->random);
+        break;
+    default:
+        LOG_ERR("Unknown queued command: %d", slot->cmd);
+        slot->rc = tool_rc_general_error;
+    }
+
+    return slot->rc;
+}
+
+/*
+ * Makes room for the next command, the command in flight has to complete
+ * before ESYS accepts another one.
+ */
+static tool_rc queue_reserve(tpm2_queue *queue) {
+
+    if (queue->count == TPM2_QUEUE_DEPTH) {
+        LOG_ERR("TPM command queue is full, wait for a response first");
+        return tool_rc_general_error;
+    }
+
+    if (!queue->is_in_flight) {
+        return tool_rc_success;
+    }
+
+    return queue_finish_in_flight(queue);
+}
+
+static void queue_push(tpm2_queue *queue, queue_cmd cmd, void *userdata) {
+
+    queue_slot *slot = queue_slot_at(queue, queue->count++);
+    memset(slot, 0, sizeof(*slot));
+    slot->cmd = cmd;
+    slot->result.userdata = userdata;
+    queue->is_in_flight = true;
+}
+
+tpm2_queue *tpm2_queue_new(ESYS_CONTEXT *ectx) {
+
+    tpm2_queue *queue = calloc(1, sizeof(*queue));
+    if (!queue) {
+        LOG_ERR("oom");
+        return NULL;
+    }
+
+    queue->ectx = ectx;
+
+    return queue;
+}
+
+void tpm2_queue_free(tpm2_queue *queue) {
+
+    if (!queue) {
+        return;
+    }
+
+    /* drain the outstanding command, the caller already has an error */
+    if (queue->is_in_flight) {
+        queue_finish_in_flight(queue);
+    }
+
+    while (queue->count) {
+        queue_result_free(&queue_slot_at(queue, 0)->result);
+        queue->first = (queue->first + 1) % TPM2_QUEUE_DEPTH;
+        queue->count--;
+    }
+
+    free(queue);
+}
+
+size_t tpm2_queue_pending(const tpm2_queue *queue) {
+
+    return queue->count;
+}
+
+tool_rc tpm2_queue_nv_read(tpm2_queue *queue,
+        tpm2_loaded_object *auth_hierarchy_obj, ESYS_TR nv_handle, UINT16 size,
+        UINT16 offset, ESYS_TR shandle2, ESYS_TR shandle3, void *userdata) {
+
+    tool_rc rc = queue_reserve(queue);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    rc = tpm2_nv_read_async(queue->ectx, auth_hierarchy_obj, nv_handle, size,
+            offset, shandle2, shandle3);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    queue_push(queue, queue_cmd_nv_read, userdata);
+
+    return tool_rc_success;
+}
+
+tool_rc tpm2_queue_pcr_read(tpm2_queue *queue,
+        const TPML_PCR_SELECTION *pcr_selection, void *userdata) {
+
+    tool_rc rc = queue_reserve(queue);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    rc = tpm2_pcr_read_async(queue->ectx, pcr_selection);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    queue_push(queue, queue_cmd_pcr_read, userdata);
+
+    return tool_rc_success;
+}
+
+tool_rc tpm2_queue_sequence_update(tpm2_queue *queue, ESYS_TR sequence_handle,
+        const TPM2B_MAX_BUFFER *buffer, void *userdata) {
+
+    tool_rc rc = queue_reserve(queue);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    rc = tpm2_sequence_update_async(queue->ectx, sequence_handle, buffer);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    queue_push(queue, queue_cmd_sequence_update, userdata);
+
+    return tool_rc_success;
+}
+
+tool_rc tpm2_queue_getrandom(tpm2_queue *queue, UINT16 count,
+        ESYS_TR shandle1, ESYS_TR shandle2, ESYS_TR shandle3, void *userdata) {
+
+    tool_rc rc = queue_reserve(queue);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    rc = tpm2_getrandom_async(queue->ectx, count, shandle1, shandle2,
+            shandle3);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    queue_push(queue, queue_cmd_getrandom, userdata);
+
+    return tool_rc_success;
+}
+
+tool_rc tpm2_queue_wait(tpm2_queue *queue, tpm2_queue_result *result) {
+
+    if (!queue->count) {
+        LOG_ERR("No TPM command queued");
+        return tool_rc_general_error;
+    }
+
+    if (queue->count == 1 && queue->is_in_flight) {
+        queue_finish_in_flight(queue);
+    }
+
+    queue_slot *slot = queue_slot_at(queue, 0);
+    if (result) {
+        *result = slot->result;
+    } else {
+        queue_result_free(&slot->result);
+    }
+
+    queue->first = (queue->first + 1) % TPM2_QUEUE_DEPTH;
+    queue->count--;
+
+    return slot->rc;
+}
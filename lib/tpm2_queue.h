@@ -0,0 +1,127 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef LIB_TPM2_QUEUE_H_
+#define LIB_TPM2_QUEUE_H_
+
+#include <stdbool.h>
+
+#include <tss2/tss2_esys.h>
+
+#include "object.h"
+#include "tool_rc.h"
+
+/*
+ * A queue of TPM commands built on the tpm2_*_async() and tpm2_*_finish()
+ * wrappers of tpm2.c. ESYS runs one command at a time, so submitting a command
+ * first completes the one in flight and keeps its response, then sends the
+ * new one. The TPM executes the newest command while the tool does host work
+ * such as file I/O, and the responses are collected in submission order.
+ */
+#define TPM2_QUEUE_DEPTH 4
+
+typedef struct tpm2_queue tpm2_queue;
+
+/*
+ * The response of a queued command. Only the fields of the command type are
+ * set, the buffers are owned by the caller and must be freed with free().
+ */
+typedef struct tpm2_queue_result tpm2_queue_result;
+struct tpm2_queue_result {
+    void *userdata;
+    TPM2B_MAX_NV_BUFFER *nv_data;
+    UINT32 pcr_update_counter;
+    TPML_PCR_SELECTION *pcr_selection;
+    TPML_DIGEST *pcr_values;
+    TPM2B_DIGEST *random;
+};
+
+/**
+ * Creates an empty command queue.
+ * @param ectx
+ *  The ESAPI context the commands are sent on. No other command may be sent
+ *  on it while the queue has one in flight.
+ * @return
+ *  The queue, NULL on error.
+ */
+tpm2_queue *tpm2_queue_new(ESYS_CONTEXT *ectx);
+
+/**
+ * Completes the command in flight, if any, and frees the queue and the
+ * responses nobody waited for.
+ * @param queue
+ *  The queue to free, may be NULL.
+ */
+void tpm2_queue_free(tpm2_queue *queue);
+
+/**
+ * Gets the number of submitted commands whose response was not yet collected
+ * with tpm2_queue_wait().
+ * @param queue
+ *  The command queue.
+ * @return
+ *  The number of pending commands, at most TPM2_QUEUE_DEPTH.
+ */
+size_t tpm2_queue_pending(const tpm2_queue *queue);
+
+/**
+ * Queues a TPM2_NV_Read, see tpm2_nv_read_async(). The response carries
+ * nv_data.
+ * @param userdata
+ *  Returned with the response.
+ * @return
+ *  tool_rc indicating status, including the status of the command that was
+ *  in flight.
+ */
+tool_rc tpm2_queue_nv_read(tpm2_queue *queue,
+        tpm2_loaded_object *auth_hierarchy_obj, ESYS_TR nv_handle, UINT16 size,
+        UINT16 offset, ESYS_TR shandle2, ESYS_TR shandle3, void *userdata);
+
+/**
+ * Queues a TPM2_PCR_Read, see tpm2_pcr_read_async(). The response carries
+ * pcr_update_counter, pcr_selection and pcr_values.
+ * @param userdata
+ *  Returned with the response.
+ * @return
+ *  tool_rc indicating status, including the status of the command that was
+ *  in flight.
+ */
+tool_rc tpm2_queue_pcr_read(tpm2_queue *queue,
+        const TPML_PCR_SELECTION *pcr_selection, void *userdata);
+
+/**
+ * Queues a TPM2_SequenceUpdate, see tpm2_sequence_update_async(). The buffer
+ * is marshaled right away and can be reused when the call returns.
+ * @param userdata
+ *  Returned with the response.
+ * @return
+ *  tool_rc indicating status, including the status of the command that was
+ *  in flight.
+ */
+tool_rc tpm2_queue_sequence_update(tpm2_queue *queue, ESYS_TR sequence_handle,
+        const TPM2B_MAX_BUFFER *buffer, void *userdata);
+
+/**
+ * Queues a TPM2_GetRandom, see tpm2_getrandom_async(). The response carries
+ * random.
+ * @param userdata
+ *  Returned with the response.
+ * @return
+ *  tool_rc indicating status, including the status of the command that was
+ *  in flight.
+ */
+tool_rc tpm2_queue_getrandom(tpm2_queue *queue, UINT16 count,
+        ESYS_TR shandle1, ESYS_TR shandle2, ESYS_TR shandle3, void *userdata);
+
+/**
+ * Collects the response of the oldest pending command, waiting for the TPM
+ * if it is the one in flight.
+ * @param queue
+ *  The command queue.
+ * @param result
+ *  The response, NULL to discard it.
+ * @return
+ *  The status of the command, an error if nothing is pending.
+ */
+tool_rc tpm2_queue_wait(tpm2_queue *queue, tpm2_queue_result *result);
+
+#endif /* LIB_TPM2_QUEUE_H_ */
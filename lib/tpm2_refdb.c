@@ -0,0 +1,456 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <tss2/tss2_tpm2_types.h>
+
+#include "files.h"
+#include "log.h"
+#include "tpm2_alg_util.h"
+#include "tpm2_refdb.h"
+#include "tpm2_util.h"
+
+/* the header of files_write_header() */
+#define REFDB_MAGIC 0xBADCC0DE
+#define REFDB_VERSION 1
+
+/* magic and version, capacity, count and the size of the labels */
+#define REFDB_HEADER_SIZE (2 * sizeof(UINT32) + 3 * sizeof(UINT32))
+
+/*
+ * The table is an open addressing hash table with linear probing, of a power
+ * of two slots and at most half full, so probes end at an empty slot soon.
+ * All fields are big endian:
+ *   UINT16 alg, 0 for an empty slot
+ *   UINT8 verdict
+ *   UINT8 reserved
+ *   UINT32 label, the offset of its NUL terminated label in the labels
+ *   BYTE digest[TPM2_SHA512_DIGEST_SIZE], zero padded
+ */
+#define REFDB_SLOT_ALG 0
+#define REFDB_SLOT_VERDICT 2
+#define REFDB_SLOT_LABEL 4
+#define REFDB_SLOT_DIGEST 8
+#define REFDB_SLOT_SIZE (REFDB_SLOT_DIGEST + TPM2_SHA512_DIGEST_SIZE)
+
+#define REFDB_SLOT_EMPTY 0
+
+#define REFDB_MIN_CAPACITY 16
+
+struct tpm2_refdb {
+    files_mapping mapping;
+    const BYTE *slots;
+    size_t capacity;
+    size_t count;
+    const char *labels;
+    size_t labels_size;
+};
+
+static UINT16 refdb_get_16(const BYTE *p) {
+
+    return (UINT16)(p[0] << 8 | p[1]);
+}
+
+static UINT32 refdb_get_32(const BYTE *p) {
+
+    return (UINT32)p[0] << 24 | (UINT32)p[1] << 16 | (UINT32)p[2] << 8 | p[3];
+}
+
+static void refdb_put_16(BYTE *p, UINT16 v) {
+
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+static void refdb_put_32(BYTE *p, UINT32 v) {
+
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+/* the digests are uniformly distributed already, their start is the hash */
+static size_t refdb_slot_first(TPMI_ALG_HASH alg, const BYTE *digest,
+        size_t capacity) {
+
+    uint64_t h = 0;
+    unsigned i;
+    for (i = 0; i < sizeof(h); i++) {
+        h = h << 8 | digest[i];
+    }
+    h ^= alg * UINT64_C(0x9e3779b97f4a7c15);
+
+    return h & (capacity - 1);
+}
+
+/*
+ * Finds the slot of a digest, or the empty slot ending its probe sequence.
+ * Only a malformed database has no empty slot, NULL is returned then.
+ */
+static const BYTE *refdb_slot_find(const BYTE *slots, size_t capacity,
+        TPMI_ALG_HASH alg, const BYTE *digest, size_t digest_size) {
+
+    size_t i = refdb_slot_first(alg, digest, capacity);
+    size_t probes;
+    for (probes = 0; probes < capacity; probes++) {
+        const BYTE *slot = slots + i * REFDB_SLOT_SIZE;
+        UINT16 slot_alg = refdb_get_16(slot + REFDB_SLOT_ALG);
+        if (slot_alg == REFDB_SLOT_EMPTY || (slot_alg == alg &&
+                !memcmp(slot + REFDB_SLOT_DIGEST, digest, digest_size))) {
+            return slot;
+        }
+        i = (i + 1) & (capacity - 1);
+    }
+
+    return NULL;
+}
+
+const char *tpm2_refdb_verdict_to_str(tpm2_refdb_verdict verdict) {
+
+    switch (verdict) {
+    case tpm2_refdb_verdict_allow:
+        return "allow";
+    case tpm2_refdb_verdict_deny:
+        return "deny";
+    default:
+        return "unknown";
+    }
+}
+
+typedef struct refdb_source refdb_source;
+struct refdb_source {
+    BYTE *slots;
+    size_t capacity;
+    size_t count;
+    char *labels;
+    size_t labels_size;
+    size_t labels_capacity;
+};
+
+static bool refdb_source_grow(refdb_source *src) {
+
+    size_t capacity = src->capacity ? src->capacity * 2 : REFDB_MIN_CAPACITY;
+    BYTE *slots = calloc(capacity, REFDB_SLOT_SIZE);
+    if (!slots) {
+        LOG_ERR("oom");
+        return false;
+    }
+
+    size_t i;
+    for (i = 0; i < src->capacity; i++) {
+        const BYTE *slot = src->slots + i * REFDB_SLOT_SIZE;
+        TPMI_ALG_HASH alg = refdb_get_16(slot + REFDB_SLOT_ALG);
+        if (alg == REFDB_SLOT_EMPTY) {
+            continue;
+        }
+        BYTE *to = (BYTE *)refdb_slot_find(slots, capacity, alg,
+                slot + REFDB_SLOT_DIGEST, tpm2_alg_util_get_hash_size(alg));
+        memcpy(to, slot, REFDB_SLOT_SIZE);
+    }
+
+    free(src->slots);
+    src->slots = slots;
+    src->capacity = capacity;
+
+    return true;
+}
+
+static bool refdb_source_label_add(refdb_source *src, const char *label,
+        UINT32 *offset) {
+
+    size_t len = strlen(label) + 1;
+    if (src->labels_size + len > UINT32_MAX) {
+        LOG_ERR("Too many reference measurement labels");
+        return false;
+    }
+
+    if (src->labels_size + len > src->labels_capacity) {
+        size_t capacity = src->labels_capacity ? src->labels_capacity : 4096;
+        while (capacity < src->labels_size + len) {
+            capacity *= 2;
+        }
+        char *labels = realloc(src->labels, capacity);
+        if (!labels) {
+            LOG_ERR("oom");
+            return false;
+        }
+        src->labels = labels;
+        src->labels_capacity = capacity;
+    }
+
+    *offset = src->labels_size;
+    memcpy(src->labels + src->labels_size, label, len);
+    src->labels_size += len;
+
+    return true;
+}
+
+/* <alg>:<hex digest> <allow|deny> <label> */
+static bool refdb_source_line(refdb_source *src, char *line,
+        unsigned long line_number) {
+
+    char *saveptr = NULL;
+    char *digest_str = strtok_r(line, " \t\r\n", &saveptr);
+    if (!digest_str) {
+        return true;
+    }
+
+    char *verdict_str = strtok_r(NULL, " \t\r\n", &saveptr);
+    char *label = strtok_r(NULL, "\r\n", &saveptr);
+    if (label) {
+        label += strspn(label, " \t");
+        size_t len = strlen(label);
+        while (len && (label[len - 1] == ' ' || label[len - 1] == '\t')) {
+            label[--len] = '\0';
+        }
+    }
+    if (!verdict_str || !label || !*label) {
+        LOG_ERR("Reference line %lu: a digest, verdict and label are required",
+                line_number);
+        return false;
+    }
+
+    char *hex = strchr(digest_str, ':');
+    if (!hex) {
+        LOG_ERR("Reference line %lu: expected <alg>:<digest>, got \"%s\"",
+                line_number, digest_str);
+        return false;
+    }
+    *hex++ = '\0';
+
+    TPMI_ALG_HASH alg = tpm2_alg_util_strtoalg(digest_str,
+            tpm2_alg_util_flags_hash);
+    if (alg == TPM2_ALG_ERROR) {
+        LOG_ERR("Reference line %lu: unknown hash algorithm \"%s\"",
+                line_number, digest_str);
+        return false;
+    }
+
+    BYTE digest[TPM2_SHA512_DIGEST_SIZE] = { 0 };
+    size_t digest_size = sizeof(digest);
+    if (tpm2_util_hex_to_bytes(hex, &digest_size, digest) ||
+            digest_size != tpm2_alg_util_get_hash_size(alg)) {
+        LOG_ERR("Reference line %lu: invalid %s digest \"%s\"", line_number,
+                digest_str, hex);
+        return false;
+    }
+
+    tpm2_refdb_verdict verdict;
+    if (!strcmp(verdict_str, "allow")) {
+        verdict = tpm2_refdb_verdict_allow;
+    } else if (!strcmp(verdict_str, "deny")) {
+        verdict = tpm2_refdb_verdict_deny;
+    } else {
+        LOG_ERR("Reference line %lu: expected allow or deny, got \"%s\"",
+                line_number, verdict_str);
+        return false;
+    }
+
+    /* keep the table at most half full */
+    if (2 * (src->count + 1) > src->capacity && !refdb_source_grow(src)) {
+        return false;
+    }
+
+    BYTE *slot = (BYTE *)refdb_slot_find(src->slots, src->capacity, alg,
+            digest, digest_size);
+    if (refdb_get_16(slot + REFDB_SLOT_ALG) != REFDB_SLOT_EMPTY) {
+        LOG_ERR("Reference line %lu: duplicate digest %s:%s", line_number,
+                digest_str, hex);
+        return false;
+    }
+
+    UINT32 label_offset;
+    if (!refdb_source_label_add(src, label, &label_offset)) {
+        return false;
+    }
+
+    refdb_put_16(slot + REFDB_SLOT_ALG, alg);
+    slot[REFDB_SLOT_VERDICT] = verdict;
+    refdb_put_32(slot + REFDB_SLOT_LABEL, label_offset);
+    memcpy(slot + REFDB_SLOT_DIGEST, digest, digest_size);
+    src->count++;
+
+    return true;
+}
+
+static bool refdb_source_write(refdb_source const *src, const char *path) {
+
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        LOG_ERR("Could not open reference database \"%s\" error: \"%s\"",
+                path, strerror(errno));
+        return false;
+    }
+
+    bool result = files_write_header(f, REFDB_VERSION)
+            && files_write_32(f, src->capacity)
+            && files_write_32(f, src->count)
+            && files_write_32(f, src->labels_size)
+            && files_write_bytes(f, src->slots,
+                    src->capacity * REFDB_SLOT_SIZE)
+            && files_write_bytes(f, (UINT8 *)src->labels, src->labels_size);
+
+    if (fclose(f)) {
+        result = false;
+    }
+
+    if (!result) {
+        LOG_ERR("Could not write reference database \"%s\"", path);
+    }
+
+    return result;
+}
+
+bool tpm2_refdb_compile(const char *source, const char *path) {
+
+    FILE *f = fopen(source, "r");
+    if (!f) {
+        LOG_ERR("Could not open reference file \"%s\" error: \"%s\"", source,
+                strerror(errno));
+        return false;
+    }
+
+    bool result = false;
+    refdb_source src = { 0 };
+    /* an empty database still has a table and a label */
+    UINT32 empty_label;
+    if (!refdb_source_grow(&src)
+            || !refdb_source_label_add(&src, "", &empty_label)) {
+        goto out;
+    }
+
+    char *line = NULL;
+    size_t len = 0;
+    unsigned long line_number = 0;
+    while (getline(&line, &len, f) != -1) {
+        line_number++;
+
+        char *comment = strchr(line, '#');
+        if (comment) {
+            *comment = '\0';
+        }
+
+        if (!refdb_source_line(&src, line, line_number)) {
+            free(line);
+            goto out;
+        }
+    }
+    free(line);
+
+    if (ferror(f)) {
+        LOG_ERR("Error reading reference file \"%s\"", source);
+        goto out;
+    }
+
+    result = refdb_source_write(&src, path);
+
+out:
+    free(src.slots);
+    free(src.labels);
+    fclose(f);
+
+    return result;
+}
+
+tpm2_refdb *tpm2_refdb_load(const char *path) {
+
+    tpm2_refdb *refdb = calloc(1, sizeof(*refdb));
+    if (!refdb) {
+        LOG_ERR("oom");
+        return NULL;
+    }
+
+    if (!files_map_path(path, &refdb->mapping)) {
+        free(refdb);
+        return NULL;
+    }
+
+    const BYTE *data = refdb->mapping.data;
+    size_t size = refdb->mapping.size;
+    if (size < REFDB_HEADER_SIZE
+            || refdb_get_32(data) != REFDB_MAGIC
+            || refdb_get_32(data + 4) != REFDB_VERSION) {
+        goto malformed;
+    }
+
+    refdb->capacity = refdb_get_32(data + 8);
+    refdb->count = refdb_get_32(data + 12);
+    refdb->labels_size = refdb_get_32(data + 16);
+
+    /* the table must be a power of two slots with empty ones left */
+    size_t capacity = refdb->capacity;
+    if (!capacity || (capacity & (capacity - 1)) ||
+            refdb->count >= capacity ||
+            capacity > (size - REFDB_HEADER_SIZE) / REFDB_SLOT_SIZE) {
+        goto malformed;
+    }
+
+    size_t slots_size = capacity * REFDB_SLOT_SIZE;
+    if (size - REFDB_HEADER_SIZE - slots_size != refdb->labels_size ||
+            !refdb->labels_size) {
+        goto malformed;
+    }
+
+    refdb->slots = data + REFDB_HEADER_SIZE;
+    refdb->labels = (const char *)refdb->slots + slots_size;
+    /* every label ends within the file */
+    if (refdb->labels[refdb->labels_size - 1] != '\0') {
+        goto malformed;
+    }
+
+    return refdb;
+
+malformed:
+    LOG_ERR("Malformed reference database \"%s\"", path);
+    tpm2_refdb_free(refdb);
+    return NULL;
+}
+
+size_t tpm2_refdb_count(tpm2_refdb const *refdb) {
+
+    return refdb->count;
+}
+
+tpm2_refdb_verdict tpm2_refdb_lookup(tpm2_refdb const *refdb,
+        TPMI_ALG_HASH alg, const BYTE *digest, const char **label) {
+
+    size_t digest_size = tpm2_alg_util_get_hash_size(alg);
+    if (!digest_size) {
+        return tpm2_refdb_verdict_unknown;
+    }
+
+    const BYTE *slot = refdb_slot_find(refdb->slots, refdb->capacity, alg,
+            digest, digest_size);
+    if (!slot) {
+        return tpm2_refdb_verdict_unknown;
+    }
+
+    tpm2_refdb_verdict verdict = slot[REFDB_SLOT_VERDICT];
+    if (refdb_get_16(slot + REFDB_SLOT_ALG) == REFDB_SLOT_EMPTY ||
+            (verdict != tpm2_refdb_verdict_allow &&
+             verdict != tpm2_refdb_verdict_deny)) {
+        return tpm2_refdb_verdict_unknown;
+    }
+
+    if (label) {
+        /* the labels are only checked when used, loading stays cheap */
+        UINT32 offset = refdb_get_32(slot + REFDB_SLOT_LABEL);
+        *label = offset < refdb->labels_size ? refdb->labels + offset : "";
+    }
+
+    return verdict;
+}
+
+void tpm2_refdb_free(tpm2_refdb *refdb) {
+
+    if (!refdb) {
+        return;
+    }
+
+    files_unmap_path(&refdb->mapping);
+    free(refdb);
+}
@@ -0,0 +1,93 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+#ifndef TPM2_REFDB_H
+#define TPM2_REFDB_H
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include <tss2/tss2_tpm2_types.h>
+
+/*
+ * A database of reference measurements: the known-good (allow) and known-bad
+ * (deny) digests of firmware, boot loaders, kernels and the like, each with a
+ * label. It is compiled from a text file into a hash table that is mapped at
+ * load, a lookup probes a few slots of the table whatever its size.
+ */
+typedef struct tpm2_refdb tpm2_refdb;
+
+typedef enum tpm2_refdb_verdict tpm2_refdb_verdict;
+enum tpm2_refdb_verdict {
+    /* do not reorder or change, part of the database file */
+    tpm2_refdb_verdict_unknown = 0,
+    tpm2_refdb_verdict_allow,
+    tpm2_refdb_verdict_deny,
+};
+
+/**
+ * Compiles the text form of a database. Every line holds a digest, a verdict
+ * and a label, separated by white space, like:
+ *   sha256:<hex digest> allow shim 15.7
+ * Empty lines and everything following a '#' are ignored.
+ * @param source
+ *  The path of the text file.
+ * @param path
+ *  The path of the database file to write.
+ * @return
+ *  true on success, false if the text is malformed, holds a digest twice or on
+ *  I/O errors.
+ */
+bool tpm2_refdb_compile(const char *source, const char *path);
+
+/**
+ * Maps a database written by tpm2_refdb_compile(). Only the header is checked,
+ * loading does not depend on the number of digests either.
+ * @param path
+ *  The path of the database file.
+ * @return
+ *  The database or NULL if the file cannot be read or is malformed.
+ */
+tpm2_refdb *tpm2_refdb_load(const char *path);
+
+/**
+ * Gets the number of digests in a database.
+ * @param refdb
+ *  The database.
+ * @return
+ *  The number of digests.
+ */
+size_t tpm2_refdb_count(tpm2_refdb const *refdb);
+
+/**
+ * Looks up a digest.
+ * @param refdb
+ *  The database.
+ * @param alg
+ *  The hash algorithm of the digest.
+ * @param digest
+ *  The digest, of the size of alg.
+ * @param label
+ *  Set to the label of the digest when found, may be NULL. The label stays
+ *  valid until the database is freed.
+ * @return
+ *  The verdict of the digest, tpm2_refdb_verdict_unknown when not found.
+ */
+tpm2_refdb_verdict tpm2_refdb_lookup(tpm2_refdb const *refdb,
+        TPMI_ALG_HASH alg, const BYTE *digest, const char **label);
+
+/**
+ * Gets the name of a verdict, like "allow".
+ * @param verdict
+ *  The verdict.
+ * @return
+ *  The name of the verdict.
+ */
+const char *tpm2_refdb_verdict_to_str(tpm2_refdb_verdict verdict);
+
+/**
+ * Unmaps a database.
+ * @param refdb
+ *  The database, may be NULL.
+ */
+void tpm2_refdb_free(tpm2_refdb *refdb);
+
+#endif
@@ -9,6 +9,7 @@
 #include "files.h"
 #include "log.h"
 #include "tpm2.h"
+#include "tpm2_alg_util.h"
 #include "tpm2_session.h"
 
 struct tpm2_session_data {
@@ -35,6 +36,8 @@ struct tpm2_session {
         char *path;
         ESYS_CONTEXT *ectx;
         bool is_final;
+        bool is_offline;
+        TPM2B_DIGEST policy_digest;
     } internal;
 };
 
@@ -201,12 +204,154 @@ tool_rc tpm2_session_open(ESYS_CONTEXT *context, tpm2_session_data *data,
     return tool_rc_success;
 }
 
+tool_rc tpm2_session_open_offline(tpm2_session_data *data,
+        tpm2_session **session) {
+
+    UINT16 size = tpm2_alg_util_get_hash_size(data->auth_hash);
+    if (data->session_type != TPM2_SE_TRIAL || !size) {
+        LOG_ERR("Offline sessions must be trial sessions with a known hash "
+                "algorithm");
+        free(data);
+        return tool_rc_option_error;
+    }
+
+    tool_rc rc = tpm2_session_open(NULL, data, session);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    (*session)->output.session_handle = ESYS_TR_NONE;
+    (*session)->internal.is_offline = true;
+    (*session)->internal.policy_digest.size = size;
+
+    return tool_rc_success;
+}
+
+bool tpm2_session_is_offline(tpm2_session *session) {
+    return session->internal.is_offline;
+}
+
+TPM2B_DIGEST *tpm2_session_get_offline_digest(tpm2_session *session) {
+    return session->internal.is_offline ?
+            &session->internal.policy_digest : NULL;
+}
+
 /* SESSION_VERSION 1 was used prior to the switch to ESAPI. As the types of
  * several of the tpm2_session_data object members have changed the version is
  * bumped.
  */
 #define SESSION_VERSION 2
 
+/*
+ * Offline sessions store the policy digest in place of the session context.
+ */
+#define SESSION_VERSION_OFFLINE 3
+
+/*
+ * Sessions held by the broker store the serialized ESAPI session object in
+ * place of the session context, the session itself stays loaded in the TPM.
+ */
+#define SESSION_VERSION_BROKER 4
+
+static const tpm2_session_broker *session_broker;
+
+void tpm2_session_set_broker(const tpm2_session_broker *broker) {
+    session_broker = broker;
+}
+
+bool tpm2_session_is_brokered(const char *path) {
+    return path && !strncmp(path, TPM2_SESSION_BROKER_PREFIX,
+            sizeof(TPM2_SESSION_BROKER_PREFIX) - 1);
+}
+
+static FILE *session_broker_open(const char *path) {
+
+    if (!session_broker) {
+        LOG_ERR("Session \"%s\" is only available in the shell mode of tpm2",
+                path);
+        return NULL;
+    }
+
+    const UINT8 *data = NULL;
+    size_t size = 0;
+    if (!session_broker->load(path, &data, &size)) {
+        LOG_ERR("Unknown session \"%s\"", path);
+        return NULL;
+    }
+
+    /* read only, the broker keeps the data */
+    FILE *f = fmemopen((void *) data, size, "rb");
+    if (!f) {
+        LOG_ERR("Could not read session \"%s\", due to error: \"%s\"", path,
+                strerror(errno));
+    }
+
+    return f;
+}
+
+static bool session_broker_remove(const char *path) {
+
+    bool result = session_broker && session_broker->store(path, NULL, 0);
+    if (!result) {
+        LOG_ERR("Could not remove session \"%s\"", path);
+    }
+
+    return result;
+}
+
+static tool_rc session_broker_load_handle(ESYS_CONTEXT *ctx, FILE *f,
+        ESYS_TR *handle) {
+
+    UINT32 size;
+    bool result = files_read_32(f, &size);
+    if (!result) {
+        LOG_ERR("Could not read session state size");
+        return tool_rc_general_error;
+    }
+
+    UINT8 *buffer = malloc(size);
+    if (!buffer) {
+        LOG_ERR("oom");
+        return tool_rc_general_error;
+    }
+
+    tool_rc rc = tool_rc_general_error;
+    result = files_read_bytes(f, buffer, size);
+    if (!result) {
+        LOG_ERR("Could not read session state");
+        goto out;
+    }
+
+    rc = tpm2_tr_deserialize(ctx, buffer, size, handle);
+
+out:
+    free(buffer);
+
+    return rc;
+}
+
+static tool_rc session_broker_save_handle(ESYS_CONTEXT *ctx, ESYS_TR handle,
+        FILE *f) {
+
+    UINT8 *buffer = NULL;
+    size_t size = 0;
+    tool_rc rc = tpm2_tr_serialize(ctx, handle, &buffer, &size);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    bool result = files_write_32(f, size) &&
+            files_write_bytes(f, buffer, size);
+    if (!result) {
+        LOG_ERR("Could not write session state");
+        rc = tool_rc_general_error;
+    }
+
+    Esys_Free(buffer);
+
+    return rc;
+}
+
 /*
  * Checks that two types are equal in size.
  *
@@ -240,10 +385,14 @@ tool_rc tpm2_session_restore(ESYS_CONTEXT *ctx, const char *path, bool is_final,
         return tool_rc_general_error;
     }
 
-    FILE *f = fopen(dup_path, "rb");
+    bool is_brokered = tpm2_session_is_brokered(dup_path);
+    FILE *f = is_brokered ? session_broker_open(dup_path) :
+            fopen(dup_path, "rb");
     if (!f) {
-        LOG_ERR("Could not open path \"%s\", due to error: \"%s\"", dup_path,
-                strerror(errno));
+        if (!is_brokered) {
+            LOG_ERR("Could not open path \"%s\", due to error: \"%s\"",
+                    dup_path, strerror(errno));
+        }
         free(dup_path);
         return tool_rc_general_error;
     }
@@ -252,7 +401,7 @@ tool_rc tpm2_session_restore(ESYS_CONTEXT *ctx, const char *path, bool is_final,
     bool result = files_read_header(f, &version);
 
     TPM2_SE type;
-    result = files_read_bytes(f, &type, sizeof(type));
+    result = result && files_read_bytes(f, &type, sizeof(type));
     if (!result) {
         LOG_ERR("Could not read session type");
         goto out;
@@ -265,8 +414,29 @@ tool_rc tpm2_session_restore(ESYS_CONTEXT *ctx, const char *path, bool is_final,
         goto out;
     }
 
-    ESYS_TR handle;
-    tool_rc tmp_rc = files_load_tpm_context_from_file(ctx, &handle, f);
+    TPM2B_DIGEST policy_digest = { 0 };
+    bool is_offline = version == SESSION_VERSION_OFFLINE;
+    if (is_offline) {
+        result = files_read_16(f, &policy_digest.size) &&
+            policy_digest.size <= sizeof(policy_digest.buffer) &&
+            files_read_bytes(f, policy_digest.buffer, policy_digest.size);
+        if (!result) {
+            LOG_ERR("Could not read offline policy digest");
+            goto out;
+        }
+    } else if (!ctx) {
+        LOG_ERR("Session \"%s\" is held by a TPM, only offline trial sessions "
+                "can be used without one", path);
+        goto out;
+    }
+
+    ESYS_TR handle = ESYS_TR_NONE;
+    tool_rc tmp_rc = tool_rc_success;
+    if (version == SESSION_VERSION_BROKER) {
+        tmp_rc = session_broker_load_handle(ctx, f, &handle);
+    } else if (!is_offline) {
+        tmp_rc = files_load_tpm_context_from_file(ctx, &handle, f);
+    }
     if (tmp_rc != tool_rc_success) {
         rc = tmp_rc;
         LOG_ERR("Could not load session context");
@@ -291,11 +461,13 @@ tool_rc tpm2_session_restore(ESYS_CONTEXT *ctx, const char *path, bool is_final,
     s->output.session_handle = handle;
     s->internal.path = dup_path;
     s->internal.ectx = ctx;
+    s->internal.is_offline = is_offline;
+    s->internal.policy_digest = policy_digest;
     dup_path = NULL;
 
     TPMA_SESSION attrs = 0;
 
-    if (ctx) {
+    if (ctx && !is_offline && !is_brokered) {
 
         /* hack this in here, should be done when starting the session */
         tmp_rc = tpm2_sess_get_attributes(ctx, handle, &attrs);
@@ -345,18 +517,46 @@ tool_rc tpm2_session_close(tpm2_session **s) {
     }
 
     const char *path = session->internal.path;
-    FILE *session_file = path ? fopen(path, "w+b") : NULL;
-    if (path && !session_file) {
+    bool is_brokered = tpm2_session_is_brokered(path);
+    if (session->internal.is_offline && (!path || session->internal.is_final)) {
+        /* nothing is held by a TPM */
+        if (is_brokered && !session_broker_remove(path)) {
+            rc = tool_rc_general_error;
+        }
+        goto out2;
+    }
+
+    if (is_brokered && !session_broker) {
+        LOG_ERR("Session \"%s\" is only available in the shell mode of tpm2",
+                path);
+        rc = tool_rc_general_error;
+        goto out2;
+    }
+
+    /* the broker gets the state once it is complete */
+    char *broker_data = NULL;
+    size_t broker_size = 0;
+    FILE *session_file = NULL;
+    bool flush = path ? session->internal.is_final : true;
+    if (is_brokered) {
+        session_file = flush ? NULL :
+                open_memstream(&broker_data, &broker_size);
+    } else if (path) {
+        session_file = fopen(path, "w+b");
+    }
+    if (!session_file && (is_brokered ? !flush : path != NULL)) {
         LOG_ERR("Could not open path \"%s\", due to error: \"%s\"", path,
                 strerror(errno));
         rc = tool_rc_general_error;
         goto out;
     }
 
-    bool flush = path ? session->internal.is_final : true;
     if (flush) {
         rc = tpm2_flush_context(session->internal.ectx,
                 session->output.session_handle, NULL, TPM2_ALG_NULL);
+        if (is_brokered && !session_broker_remove(path)) {
+            rc = tool_rc_general_error;
+        }
         /* done, use rc to indicate status */
         goto out;
     }
@@ -364,7 +564,14 @@ tool_rc tpm2_session_close(tpm2_session **s) {
     /*
      * Now write the session_type, handle and auth hash data to disk
      */
-    bool result = files_write_header(session_file, SESSION_VERSION);
+    UINT32 version = SESSION_VERSION;
+    if (session->internal.is_offline) {
+        version = SESSION_VERSION_OFFLINE;
+    } else if (is_brokered) {
+        version = SESSION_VERSION_BROKER;
+    }
+
+    bool result = files_write_header(session_file, version);
     if (!result) {
         LOG_ERR("Could not write context file header");
         rc = tool_rc_general_error;
@@ -390,12 +597,30 @@ tool_rc tpm2_session_close(tpm2_session **s) {
         goto out;
     }
 
+    if (session->internal.is_offline) {
+        TPM2B_DIGEST *digest = &session->internal.policy_digest;
+        result = files_write_16(session_file, digest->size) &&
+            files_write_bytes(session_file, digest->buffer, digest->size);
+        if (!result) {
+            LOG_ERR("Could not write offline policy digest");
+            rc = tool_rc_general_error;
+        }
+        goto out;
+    }
+
+    ESYS_TR handle = tpm2_session_get_handle(session);
+    if (is_brokered) {
+        /* the session stays loaded, only its ESAPI state is kept */
+        rc = session_broker_save_handle(session->internal.ectx, handle,
+                session_file);
+        goto out;
+    }
+
     /*
      * Save session context at end of tpm2_session. With tabrmd support it
      * can be reloaded under certain circumstances.
      */
 
-    ESYS_TR handle = tpm2_session_get_handle(session);
     LOG_INFO("Saved session: ESYS_TR(0x%x)", handle);
     rc = files_save_tpm_context_to_file(session->internal.ectx, handle,
     session_file);
@@ -408,15 +633,44 @@ out:
     if (session_file) {
         fclose(session_file);
     }
+    if (broker_data) {
+        if (rc == tool_rc_success && !session_broker->store(path,
+                (UINT8 *) broker_data, broker_size)) {
+            LOG_ERR("Could not store session \"%s\"", path);
+            rc = tool_rc_general_error;
+        }
+        free(broker_data);
+    }
 out2:
     tpm2_session_free(s);
 
     return rc;
 }
 
+void tpm2_session_forget(tpm2_session **session) {
+
+    tpm2_session *s = *session;
+    if (s && tpm2_session_is_brokered(s->internal.path)) {
+        session_broker_remove(s->internal.path);
+    }
+
+    tpm2_session_free(session);
+}
+
 tool_rc tpm2_session_restart(ESYS_CONTEXT *context, tpm2_session *s,
     TPM2B_DIGEST *cp_hash, TPMI_ALG_HASH parameter_hash_algorithm) {
 
+    if (s->internal.is_offline) {
+        if (cp_hash && cp_hash->size) {
+            LOG_ERR("Cannot calculate cpHash for an offline session");
+            return tool_rc_option_error;
+        }
+
+        memset(s->internal.policy_digest.buffer, 0,
+                s->internal.policy_digest.size);
+        return tool_rc_success;
+    }
+
     ESYS_TR handle = tpm2_session_get_handle(s);
 
     return tpm2_policy_restart(context, handle, ESYS_TR_NONE, ESYS_TR_NONE,
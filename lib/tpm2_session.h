@@ -170,6 +170,88 @@ static inline bool tpm2_session_is_trial(tpm2_session *session) {
 tool_rc tpm2_session_open(ESYS_CONTEXT *context, tpm2_session_data *data,
         tpm2_session **session);
 
+/**
+ * Starts a trial session that lives entirely in software. No TPM is involved,
+ * the policy commands of tpm2_policy.h update its digest with OpenSSL and
+ * tpm2_session_close() saves it to the session path.
+ * @param data
+ *  Session data of type TPM2_SE_TRIAL, owned by the session afterwards.
+ * @param session
+ *  The output session on success.
+ * @return
+ *  A tool_rc indicating status.
+ */
+tool_rc tpm2_session_open_offline(tpm2_session_data *data,
+        tpm2_session **session);
+
+/**
+ * True if a session was started with tpm2_session_open_offline().
+ * @param session
+ *  The session to check.
+ * @return
+ *  True for offline sessions, false for sessions held by a TPM.
+ */
+bool tpm2_session_is_offline(tpm2_session *session);
+
+/**
+ * Gets the policy digest of an offline session, to be updated in place.
+ * @param session
+ *  The session.
+ * @return
+ *  The policy digest, NULL if the session is not an offline session.
+ */
+TPM2B_DIGEST *tpm2_session_get_offline_digest(tpm2_session *session);
+
+/*
+ * Session paths starting with this prefix name sessions held by the shell mode
+ * of tpm2(1) rather than files. The sessions stay loaded in the TPM between
+ * commands, so no ContextSave/ContextLoad or file rewrite takes place.
+ */
+#define TPM2_SESSION_BROKER_PREFIX "shell:"
+
+/*
+ * Keeps the serialized state of sessions by name, see
+ * tpm2_session_set_broker().
+ */
+typedef struct tpm2_session_broker tpm2_session_broker;
+struct tpm2_session_broker {
+    /*
+     * Looks up the state stored under name, the data stays owned by the
+     * broker. Returns false for unknown names.
+     */
+    bool (*load)(const char *name, const UINT8 **data, size_t *size);
+    /*
+     * Stores the state under name, replacing any previous state. A NULL data
+     * removes the name. Returns false on error.
+     */
+    bool (*store)(const char *name, const UINT8 *data, size_t size);
+};
+
+/**
+ * Registers the broker that backs the session paths starting with
+ * TPM2_SESSION_BROKER_PREFIX. Without a broker such paths are an error.
+ * @param broker
+ *  The broker, NULL to unregister.
+ */
+void tpm2_session_set_broker(const tpm2_session_broker *broker);
+
+/**
+ * True if a session path names a session held by the broker.
+ * @param path
+ *  The session path.
+ * @return
+ *  True if path starts with TPM2_SESSION_BROKER_PREFIX.
+ */
+bool tpm2_session_is_brokered(const char *path);
+
+/**
+ * Frees a restored session that the caller flushed itself, dropping it from
+ * the broker if it is held there.
+ * @param session
+ *  The session to forget.
+ */
+void tpm2_session_forget(tpm2_session **session);
+
 /**
  * Saves session data to disk allowing tpm2_session_from_file() to
  * restore the session if applicable and frees resources.
@@ -180,6 +262,8 @@ tool_rc tpm2_session_open(ESYS_CONTEXT *context, tpm2_session_data *data,
  *                            handle on client disconnection.
  *   - Esys_ContextLoad - restores the session so it can be used.
  *   - Saving a custom file format at path - records the handle and algorithm.
+ * Sessions held by the broker skip the context save, their ESAPI state is
+ * serialized to the broker instead.
  * @param session
  *  The session context to save
  * @return
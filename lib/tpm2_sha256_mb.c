@@ -0,0 +1,242 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "log.h"
+#include "tpm2_openssl.h"
+#include "tpm2_sha256_mb.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define SHA256_MB_AVX2 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#ifdef SHA256_MB_AVX2
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static const uint32_t sha256_h0[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c,
+    0x1f83d9ab, 0x5be0cd19,
+};
+
+typedef enum sha256_mb_cpu sha256_mb_cpu;
+enum sha256_mb_cpu {
+    sha256_mb_cpu_unknown = 0,
+    sha256_mb_cpu_none,
+    sha256_mb_cpu_avx2,
+    sha256_mb_cpu_avx2_sha,
+};
+
+static sha256_mb_cpu sha256_mb_cpu_detect(void) {
+
+    static volatile sha256_mb_cpu cpu = sha256_mb_cpu_unknown;
+    if (cpu != sha256_mb_cpu_unknown) {
+        return cpu;
+    }
+
+    unsigned eax, ebx, ecx, edx;
+    sha256_mb_cpu detected = sha256_mb_cpu_none;
+    /* AVX2 needs the OS to save the YMM registers, see XCR0 */
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_OSXSAVE)) {
+        unsigned xcr0_lo, xcr0_hi;
+        __asm__ ("xgetbv" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+        if ((xcr0_lo & 0x6) == 0x6 &&
+                __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) &&
+                (ebx & bit_AVX2)) {
+            detected = (ebx & bit_SHA) ?
+                    sha256_mb_cpu_avx2_sha : sha256_mb_cpu_avx2;
+        }
+    }
+
+    /* racing threads all store the same value */
+    cpu = detected;
+
+    return detected;
+}
+
+#define AVX2 __attribute__((target("avx2")))
+
+#define ROTR(x, n) \
+    _mm256_or_si256(_mm256_srli_epi32((x), (n)), _mm256_slli_epi32((x), 32 - (n)))
+
+#define SIGMA0(x) _mm256_xor_si256(_mm256_xor_si256(ROTR(x, 2), ROTR(x, 13)), \
+        ROTR(x, 22))
+#define SIGMA1(x) _mm256_xor_si256(_mm256_xor_si256(ROTR(x, 6), ROTR(x, 11)), \
+        ROTR(x, 25))
+#define SMALL_SIGMA0(x) _mm256_xor_si256(_mm256_xor_si256(ROTR(x, 7), \
+        ROTR(x, 18)), _mm256_srli_epi32((x), 3))
+#define SMALL_SIGMA1(x) _mm256_xor_si256(_mm256_xor_si256(ROTR(x, 17), \
+        ROTR(x, 19)), _mm256_srli_epi32((x), 10))
+
+/*
+ * Runs the SHA-256 compression function over one message block in each of the
+ * 8 lanes of state, block holds the 16 message words of each lane.
+ */
+static AVX2 void sha256_mb_compress(__m256i state[8], const __m256i block[16]) {
+
+    __m256i w[64];
+    unsigned t;
+    for (t = 0; t < 16; t++) {
+        w[t] = block[t];
+    }
+    for (t = 16; t < 64; t++) {
+        w[t] = _mm256_add_epi32(_mm256_add_epi32(SMALL_SIGMA1(w[t - 2]),
+                w[t - 7]), _mm256_add_epi32(SMALL_SIGMA0(w[t - 15]),
+                w[t - 16]));
+    }
+
+    __m256i a = state[0], b = state[1], c = state[2], d = state[3];
+    __m256i e = state[4], f = state[5], g = state[6], h = state[7];
+    for (t = 0; t < 64; t++) {
+        /* ch = (e & f) ^ (~e & g), maj = (a & b) ^ (a & c) ^ (b & c) */
+        __m256i ch = _mm256_xor_si256(_mm256_and_si256(e, f),
+                _mm256_andnot_si256(e, g));
+        __m256i maj = _mm256_xor_si256(_mm256_and_si256(a, b),
+                _mm256_and_si256(c, _mm256_xor_si256(a, b)));
+        __m256i t1 = _mm256_add_epi32(_mm256_add_epi32(h, SIGMA1(e)),
+                _mm256_add_epi32(_mm256_add_epi32(ch,
+                _mm256_set1_epi32(sha256_k[t])), w[t]));
+        __m256i t2 = _mm256_add_epi32(SIGMA0(a), maj);
+        h = g;
+        g = f;
+        f = e;
+        e = _mm256_add_epi32(d, t1);
+        d = c;
+        c = b;
+        b = a;
+        a = _mm256_add_epi32(t1, t2);
+    }
+
+    state[0] = _mm256_add_epi32(state[0], a);
+    state[1] = _mm256_add_epi32(state[1], b);
+    state[2] = _mm256_add_epi32(state[2], c);
+    state[3] = _mm256_add_epi32(state[3], d);
+    state[4] = _mm256_add_epi32(state[4], e);
+    state[5] = _mm256_add_epi32(state[5], f);
+    state[6] = _mm256_add_epi32(state[6], g);
+    state[7] = _mm256_add_epi32(state[7], h);
+}
+
+static inline uint32_t load_be32(const BYTE *p) {
+
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+            ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline void store_be32(BYTE *p, uint32_t v) {
+
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+/*
+ * An extend hashes exactly one block of data, the old PCR value and the
+ * digest, followed by a padding block that is the same for every lane.
+ */
+static AVX2 void sha256_mb_extend_avx2(BYTE *const pcrs[],
+        const BYTE *const digests[], unsigned count) {
+
+    uint32_t words[16][TPM2_SHA256_MB_LANES] = { { 0 } };
+    unsigned lane, t;
+    for (lane = 0; lane < count; lane++) {
+        for (t = 0; t < 8; t++) {
+            words[t][lane] = load_be32(pcrs[lane] + 4 * t);
+            words[t + 8][lane] = load_be32(digests[lane] + 4 * t);
+        }
+    }
+
+    __m256i block[16];
+    for (t = 0; t < 16; t++) {
+        block[t] = _mm256_loadu_si256((const __m256i *)words[t]);
+    }
+
+    __m256i state[8];
+    for (t = 0; t < 8; t++) {
+        state[t] = _mm256_set1_epi32(sha256_h0[t]);
+    }
+
+    sha256_mb_compress(state, block);
+
+    /* 0x80 terminator and the message length of 512 bits */
+    for (t = 0; t < 16; t++) {
+        block[t] = _mm256_setzero_si256();
+    }
+    block[0] = _mm256_set1_epi32(0x80000000);
+    block[15] = _mm256_set1_epi32(512);
+
+    sha256_mb_compress(state, block);
+
+    for (t = 0; t < 8; t++) {
+        _mm256_storeu_si256((__m256i *)words[t], state[t]);
+    }
+    for (lane = 0; lane < count; lane++) {
+        for (t = 0; t < 8; t++) {
+            store_be32(pcrs[lane] + 4 * t, words[t][lane]);
+        }
+    }
+}
+
+#endif /* SHA256_MB_AVX2 */
+
+unsigned tpm2_sha256_mb_min_lanes(void) {
+
+#ifdef SHA256_MB_AVX2
+    /*
+     * A kernel call costs about as much as 2 OpenSSL extends, or 5 when
+     * OpenSSL uses the SHA extensions.
+     */
+    switch (sha256_mb_cpu_detect()) {
+    case sha256_mb_cpu_avx2:
+        return 2;
+    case sha256_mb_cpu_avx2_sha:
+        return 5;
+    default:
+        return 0;
+    }
+#else
+    return 0;
+#endif
+}
+
+bool tpm2_sha256_mb_pcr_extend(BYTE *const pcrs[], const BYTE *const digests[],
+        unsigned count) {
+
+    if (!count || count > TPM2_SHA256_MB_LANES) {
+        LOG_ERR("Invalid number of SHA-256 lanes: %u", count);
+        return false;
+    }
+
+#ifdef SHA256_MB_AVX2
+    if (sha256_mb_cpu_detect() != sha256_mb_cpu_none) {
+        sha256_mb_extend_avx2(pcrs, digests, count);
+        return true;
+    }
+#endif
+
+    unsigned lane;
+    for (lane = 0; lane < count; lane++) {
+        if (!tpm2_openssl_pcr_extend(TPM2_ALG_SHA256, pcrs[lane],
+                digests[lane], TPM2_SHA256_DIGEST_SIZE)) {
+            return false;
+        }
+    }
+
+    return true;
+}
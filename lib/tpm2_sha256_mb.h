@@ -0,0 +1,40 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef LIB_TPM2_SHA256_MB_H_
+#define LIB_TPM2_SHA256_MB_H_
+
+#include <stdbool.h>
+
+#include <tss2/tss2_tpm2_types.h>
+
+/* the number of independent extends done by one kernel call */
+#define TPM2_SHA256_MB_LANES 8
+
+/**
+ * Gets the number of lanes from which one tpm2_sha256_mb_pcr_extend() call is
+ * faster than extending the lanes one by one with tpm2_openssl_pcr_extend().
+ * With the SHA extensions, OpenSSL is faster for a few lanes, so more lanes
+ * are needed than on CPUs with AVX2 only.
+ * @return
+ *  The lane count, 0 if the CPU can't run the multi-buffer kernel.
+ */
+unsigned tpm2_sha256_mb_min_lanes(void);
+
+/**
+ * Extends up to TPM2_SHA256_MB_LANES independent SHA-256 PCR values at once,
+ * pcrs[i] = SHA256(pcrs[i] || digests[i]). The lanes are hashed with AVX2
+ * when the CPU supports it and one by one with OpenSSL otherwise, so the
+ * result is always the one of tpm2_openssl_pcr_extend().
+ * @param pcrs
+ *  The PCR values, TPM2_SHA256_DIGEST_SIZE bytes each, updated in place.
+ * @param digests
+ *  The digests to extend, TPM2_SHA256_DIGEST_SIZE bytes each.
+ * @param count
+ *  The number of lanes, from 1 to TPM2_SHA256_MB_LANES.
+ * @return
+ *  true on success, false on error.
+ */
+bool tpm2_sha256_mb_pcr_extend(BYTE *const pcrs[], const BYTE *const digests[],
+        unsigned count);
+
+#endif /* LIB_TPM2_SHA256_MB_H_ */
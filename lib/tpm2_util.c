@@ -15,6 +15,7 @@
 #include "tpm2_alg_util.h"
 #include "tpm2_attr_util.h"
 #include "tpm2_convert.h"
+#include "tpm2_hex.h"
 #include "tpm2_openssl.h"
 #include "tpm2_session.h"
 #include "tpm2_tool.h"
@@ -182,34 +183,45 @@ bool tpm2_util_string_to_int32(const char *str, int32_t *value) {
     return true;
 }
 
-int tpm2_util_hex_to_byte_structure(const char *input_string, UINT16 *byte_length,
+int tpm2_util_hex_to_bytes(const char *input_string, size_t *byte_length,
         BYTE *byte_buffer) {
-    int str_length; //if the input_string likes "1a2b...", no prefix "0x"
-    int i = 0;
+    size_t str_length; //if the input_string likes "1a2b...", no prefix "0x"
     if (input_string == NULL || byte_length == NULL || byte_buffer == NULL)
         return -1;
     str_length = strlen(input_string);
     if (str_length % 2)
         return -2;
-    for (i = 0; i < str_length; i++) {
-        if (!isxdigit(input_string[i]))
-            return -3;
+    if (*byte_length < str_length / 2) {
+        /* report invalid characters before a too small buffer */
+        size_t i;
+        for (i = 0; i < str_length; i++) {
+            if (!isxdigit(input_string[i]))
+                return -3;
+        }
+        return -4;
     }
 
-    if (*byte_length < str_length / 2)
-        return -4;
+    if (!tpm2_hex_decode(input_string, str_length, byte_buffer))
+        return -3;
 
     *byte_length = str_length / 2;
 
-    for (i = 0; i < *byte_length; i++) {
-        char tmp_str[4] = { 0 };
-        tmp_str[0] = input_string[i * 2];
-        tmp_str[1] = input_string[i * 2 + 1];
-        byte_buffer[i] = strtol(tmp_str, NULL, 16);
-    }
     return 0;
 }
 
+int tpm2_util_hex_to_byte_structure(const char *input_string, UINT16 *byte_length,
+        BYTE *byte_buffer) {
+    if (byte_length == NULL)
+        return -1;
+
+    size_t length = *byte_length;
+    int rc = tpm2_util_hex_to_bytes(input_string, &length, byte_buffer);
+    if (rc == 0)
+        *byte_length = length;
+
+    return rc;
+}
+
 bool tpm2_util_bin_from_hex_or_file(const char *input, UINT16 *len, BYTE *buffer) {
 
     bool result = false;
@@ -231,11 +243,21 @@ out:
     return result;
 }
 
+void tpm2_util_hex_encode(const BYTE *data, size_t len, char *hex) {
+
+    tpm2_hex_encode(data, len, hex);
+}
+
 void tpm2_util_hexdump2(FILE *f, const BYTE *data, size_t len) {
 
-    size_t i;
-    for (i = 0; i < len; i++) {
-        fprintf(f, "%02x", data[i]);
+    char hex[512];
+
+    while (len) {
+        size_t chunk = len < sizeof(hex) / 2 ? len : sizeof(hex) / 2;
+        tpm2_util_hex_encode(data, chunk, hex);
+        fwrite(hex, 1, 2 * chunk, f);
+        data += chunk;
+        len -= chunk;
     }
 }
 
@@ -953,20 +975,13 @@ bool tpm2_calq_qname(TPM2B_NAME *pqname,
 
     const EVP_MD *md = tpm2_openssl_md_from_tpmhalg(halg);
 
-    EVP_MD_CTX *mdctx = EVP_MD_CTX_create();
+    EVP_MD_CTX *mdctx = tpm2_openssl_digest_init(halg);
     if (!mdctx) {
-        LOG_ERR("%s", tpm2_openssl_get_err());
         return false;
     }
 
-    int rc = EVP_DigestInit_ex(mdctx, md, NULL);
-    if (!rc) {
-        LOG_ERR("%s", tpm2_openssl_get_err());
-        goto out;
-    }
-
     size_t offset = sizeof(halg);
-    rc = EVP_DigestUpdate(mdctx, pqname->name, pqname->size);
+    int rc = EVP_DigestUpdate(mdctx, pqname->name, pqname->size);
     if (!rc) {
         LOG_ERR("%s", tpm2_openssl_get_err());
         goto out;
@@ -997,7 +1012,6 @@ bool tpm2_calq_qname(TPM2B_NAME *pqname,
     result = true;
 
 out:
-    EVP_MD_CTX_destroy(mdctx);
     return result;
 }
 
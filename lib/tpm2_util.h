@@ -103,6 +103,22 @@ typedef struct {
 int tpm2_util_hex_to_byte_structure(const char *in_str, UINT16 *byte_length,
         BYTE *byte_buffer);
 
+/**
+ * Same as tpm2_util_hex_to_byte_structure(), for bulk data that does not fit
+ * a TPM2B.
+ * @param in_str
+ *  The NUL terminated hex string, without a "0x" prefix.
+ * @param byte_length
+ *  On input the size of byte_buffer, on output the number of bytes decoded.
+ * @param byte_buffer
+ *  The buffer to decode into.
+ * @return
+ *  0 on success, -1 for NULL arguments, -2 for an odd string length, -3 for
+ *  characters that are not hex digits and -4 if byte_buffer is too small.
+ */
+int tpm2_util_hex_to_bytes(const char *in_str, size_t *byte_length,
+        BYTE *byte_buffer);
+
 /**
  * Compares two digests to ensure they are equal (for validation).
  * @param quote_digest
@@ -205,6 +221,17 @@ void tpm2_util_hexdump(const BYTE *data, size_t len);
  */
 void tpm2_util_hexdump2(FILE *f, const BYTE *data, size_t len);
 
+/**
+ * Encodes binary data as lower case hex characters.
+ * @param data
+ *  The data to encode.
+ * @param len
+ *  The length of the data.
+ * @param hex
+ *  The output, 2 * len characters. It is not NUL terminated.
+ */
+void tpm2_util_hex_encode(const BYTE *data, size_t len, char *hex);
+
 /**
  * Read a hex string converting it to binary or a binary file and
  * store into a binary buffer.
@@ -0,0 +1,746 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "tpm2_tool_output.h"
+#include "tpm2_util.h"
+#include "tpm2_writer.h"
+
+#define WRITER_BUFFER_SIZE (64 * 1024)
+#define WRITER_MAX_DEPTH 16
+
+typedef enum writer_scope_type writer_scope_type;
+enum writer_scope_type {
+    writer_scope_root,
+    writer_scope_map,
+    writer_scope_seq,
+    writer_scope_flow_seq,
+};
+
+typedef struct writer_scope writer_scope;
+struct writer_scope {
+    writer_scope_type type;
+    /* YAML column of the entries */
+    unsigned indent;
+    /* the first entry follows the "- " of the enclosing sequence item */
+    bool is_inline;
+    size_t count;
+    unsigned key_width;
+    unsigned value_column;
+};
+
+struct tpm2_writer {
+    FILE *out;
+    tpm2_writer_format format;
+    bool error;
+    unsigned depth;
+    /* scopes opened beyond WRITER_MAX_DEPTH, their entries are flattened */
+    unsigned overflow;
+    writer_scope scopes[WRITER_MAX_DEPTH];
+    char *scratch;
+    size_t scratch_size;
+    size_t len;
+    char buf[WRITER_BUFFER_SIZE];
+};
+
+static const char hex_digits[] = "0123456789abcdef";
+static const char hex_digits_upper[] = "0123456789ABCDEF";
+
+static void writer_init(tpm2_writer *w, FILE *out, tpm2_writer_format format) {
+
+    w->out = out;
+    w->format = format;
+    w->error = false;
+    w->depth = 0;
+    w->overflow = 0;
+    w->scopes[0] = (writer_scope) { .type = writer_scope_root };
+    w->scratch = NULL;
+    w->scratch_size = 0;
+    w->len = 0;
+}
+
+static void writer_drain(tpm2_writer *w) {
+
+    if (w->out && w->len && fwrite(w->buf, 1, w->len, w->out) != w->len) {
+        w->error = true;
+    }
+    w->len = 0;
+}
+
+/* size must not exceed the buffer size */
+static char *writer_reserve(tpm2_writer *w, size_t size) {
+
+    if (sizeof(w->buf) - w->len < size) {
+        writer_drain(w);
+    }
+
+    char *p = &w->buf[w->len];
+    w->len += size;
+    return p;
+}
+
+static void writer_put(tpm2_writer *w, const char *data, size_t size) {
+
+    if (size > sizeof(w->buf)) {
+        writer_drain(w);
+        if (w->out && fwrite(data, 1, size, w->out) != size) {
+            w->error = true;
+        }
+        return;
+    }
+
+    memcpy(writer_reserve(w, size), data, size);
+}
+
+static void writer_putc(tpm2_writer *w, char c) {
+
+    *writer_reserve(w, 1) = c;
+}
+
+static void writer_puts(tpm2_writer *w, const char *s) {
+
+    writer_put(w, s, strlen(s));
+}
+
+static void writer_spaces(tpm2_writer *w, unsigned count) {
+
+    memset(writer_reserve(w, count), ' ', count);
+}
+
+static void writer_put_number(tpm2_writer *w, uint64_t value, unsigned base,
+        const char *digits) {
+
+    char tmp[20];
+    size_t i = sizeof(tmp);
+    do {
+        tmp[--i] = digits[value % base];
+        value /= base;
+    } while (value);
+
+    writer_put(w, &tmp[i], sizeof(tmp) - i);
+}
+
+static void writer_put_hex_data(tpm2_writer *w, const uint8_t *data,
+        size_t len) {
+
+    while (len) {
+        size_t chunk = len < sizeof(w->buf) / 2 ? len : sizeof(w->buf) / 2;
+        tpm2_util_hex_encode(data, chunk, writer_reserve(w, 2 * chunk));
+        data += chunk;
+        len -= chunk;
+    }
+}
+
+/*
+ * Gets the length of the well-formed UTF-8 sequence (RFC 3629) starting with
+ * a byte >= 0x80, 0 if the bytes are not one: overlong encodings, surrogates
+ * and code points above U+10FFFF are rejected.
+ */
+static size_t utf8_sequence_len(const unsigned char *s, size_t len) {
+
+    size_t size;
+    unsigned char min = 0x80;
+    unsigned char max = 0xbf;
+    if (s[0] >= 0xc2 && s[0] <= 0xdf) {
+        size = 2;
+    } else if (s[0] >= 0xe0 && s[0] <= 0xef) {
+        size = 3;
+        if (s[0] == 0xe0) {
+            min = 0xa0;
+        } else if (s[0] == 0xed) {
+            max = 0x9f;
+        }
+    } else if (s[0] >= 0xf0 && s[0] <= 0xf4) {
+        size = 4;
+        if (s[0] == 0xf0) {
+            min = 0x90;
+        } else if (s[0] == 0xf4) {
+            max = 0x8f;
+        }
+    } else {
+        return 0;
+    }
+
+    if (len < size || s[1] < min || s[1] > max) {
+        return 0;
+    }
+
+    size_t i;
+    for (i = 2; i < size; i++) {
+        if (s[i] < 0x80 || s[i] > 0xbf) {
+            return 0;
+        }
+    }
+
+    return size;
+}
+
+/*
+ * JSON text must be UTF-8, the bytes of the string that are not well-formed
+ * UTF-8 are escaped as the code point of the same value, as if the string
+ * was Latin-1.
+ */
+static void writer_put_json_string(tpm2_writer *w, const char *s, size_t len) {
+
+    writer_putc(w, '"');
+
+    size_t start = 0;
+    size_t i;
+    for (i = 0; i < len; i++) {
+        unsigned char c = s[i];
+        if (c >= 0x80) {
+            size_t size = utf8_sequence_len((const unsigned char *)&s[i],
+                    len - i);
+            if (size) {
+                i += size - 1;
+                continue;
+            }
+        } else if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+
+        writer_put(w, &s[start], i - start);
+        start = i + 1;
+
+        switch (c) {
+        case '"':
+            writer_put(w, "\\\"", 2);
+            break;
+        case '\\':
+            writer_put(w, "\\\\", 2);
+            break;
+        case '\b':
+            writer_put(w, "\\b", 2);
+            break;
+        case '\f':
+            writer_put(w, "\\f", 2);
+            break;
+        case '\n':
+            writer_put(w, "\\n", 2);
+            break;
+        case '\r':
+            writer_put(w, "\\r", 2);
+            break;
+        case '\t':
+            writer_put(w, "\\t", 2);
+            break;
+        default: {
+            char escape[6] = { '\\', 'u', '0', '0', hex_digits[c >> 4],
+                    hex_digits[c & 0xf] };
+            writer_put(w, escape, sizeof(escape));
+        }
+        }
+    }
+    writer_put(w, &s[start], len - start);
+
+    writer_putc(w, '"');
+}
+
+/*
+ * The strings written double-quoted are usually text of an unknown encoding,
+ * for example grub uses UTF-8 and sd-boot UTF-16LE. The escaping ignores the
+ * encoding and applies a few simple rules that keep the YAML valid in
+ * practice:
+ *
+ *  - non-printable ASCII characters are escaped
+ *  - leading spaces and tabs of a line are escaped
+ *  - the string is split into continuation lines after each newline, for
+ *    ease of reading
+ *
+ * It does not guarantee valid UTF-8 if the input was not. Most UTF-16LE data
+ * is rendered with lots of escaped \0 bytes.
+ */
+static void writer_put_yaml_double_quoted(tpm2_writer *w, const char *s,
+        size_t len, unsigned indent) {
+
+    writer_putc(w, '"');
+
+    bool is_leading = true;
+    size_t start = 0;
+    size_t i;
+    for (i = 0; i < len; i++) {
+        unsigned char c = s[i];
+        char hex[5] = { '\\', 'x', hex_digits[c >> 4], hex_digits[c & 0xf] };
+        const char *escape = NULL;
+
+        switch (c) {
+        case '\0':
+            escape = "\\0";
+            break;
+        case '\a':
+            escape = "\\a";
+            break;
+        case '\b':
+            escape = "\\b";
+            break;
+        case '\t':
+            if (is_leading) {
+                escape = "\\t";
+            }
+            break;
+        case '\v':
+            escape = "\\v";
+            break;
+        case '\f':
+            escape = "\\f";
+            break;
+        case '\n':
+            escape = "\\n";
+            break;
+        case '\r':
+            escape = "\\r";
+            break;
+        case '\e':
+            escape = "\\e";
+            break;
+        case '\\':
+            escape = "\\\\";
+            break;
+        case '"':
+            escape = "\\\"";
+            break;
+        case ' ':
+            if (is_leading) {
+                escape = "\\x20";
+            }
+            break;
+        default:
+            if (c < 0x20 || c == 0x7f) {
+                escape = hex;
+            }
+        }
+
+        if (c != ' ' && c != '\t') {
+            is_leading = false;
+        }
+
+        if (escape) {
+            writer_put(w, &s[start], i - start);
+            writer_puts(w, escape);
+            start = i + 1;
+        }
+
+        if (c == '\n' && i + 1 < len) {
+            writer_put(w, "\\\n", 2);
+            writer_spaces(w, indent);
+            is_leading = true;
+        }
+    }
+    writer_put(w, &s[start], len - start);
+
+    writer_putc(w, '"');
+}
+
+static void writer_put_yaml_single_quoted(tpm2_writer *w, const char *s,
+        size_t len) {
+
+    writer_putc(w, '\'');
+
+    size_t start = 0;
+    size_t i;
+    for (i = 0; i < len; i++) {
+        if (s[i] == '\'') {
+            writer_put(w, &s[start], i + 1 - start);
+            start = i;
+        }
+    }
+    writer_put(w, &s[start], len - start);
+
+    writer_putc(w, '\'');
+}
+
+static void writer_put_yaml_literal(tpm2_writer *w, const char *s, size_t len,
+        unsigned indent) {
+
+    writer_put(w, "|-", 2);
+
+    size_t start = 0;
+    do {
+        const char *nl = memchr(&s[start], '\n', len - start);
+        size_t end = nl ? (size_t) (nl - s) : len;
+        writer_putc(w, '\n');
+        writer_spaces(w, indent);
+        writer_put(w, &s[start], end - start);
+        start = end + 1;
+    } while (start < len);
+}
+
+/*
+ * Writes what precedes a value in the current scope: the separating comma
+ * and the key in JSON, the indentation and the key or the "- " of a sequence
+ * item in YAML. Scalars are separated from their YAML key by a space or the
+ * alignment of the map.
+ */
+static writer_scope *writer_entry(tpm2_writer *w, const char *key,
+        bool is_scalar) {
+
+    writer_scope *scope = &w->scopes[w->depth];
+    bool is_first = scope->count++ == 0;
+    bool has_key = key && scope->type != writer_scope_seq
+            && scope->type != writer_scope_flow_seq;
+
+    if (w->format == tpm2_writer_format_json) {
+        if (!is_first && scope->type != writer_scope_root) {
+            writer_putc(w, ',');
+        }
+        if (has_key && scope->type != writer_scope_root) {
+            writer_put_json_string(w, key, strlen(key));
+            writer_putc(w, ':');
+        }
+        return scope;
+    }
+
+    switch (scope->type) {
+    case writer_scope_flow_seq:
+        writer_puts(w, is_first ? " " : ", ");
+        return scope;
+    case writer_scope_seq:
+        if (!is_first || !scope->is_inline) {
+            writer_spaces(w, scope->indent);
+        }
+        writer_put(w, "- ", 2);
+        return scope;
+    case writer_scope_root:
+    case writer_scope_map:
+        if (!has_key) {
+            return scope;
+        }
+        if (!is_first || !scope->is_inline) {
+            writer_spaces(w, scope->indent);
+        }
+        break;
+    }
+
+    size_t key_len = strlen(key);
+    writer_put(w, key, key_len);
+    if (key_len < scope->key_width) {
+        writer_spaces(w, scope->key_width - key_len);
+        key_len = scope->key_width;
+    }
+    writer_putc(w, ':');
+
+    if (is_scalar) {
+        size_t written = key_len + 1;
+        writer_spaces(w, scope->value_column > written ?
+                scope->value_column - written : 1);
+    }
+
+    return scope;
+}
+
+static void writer_scalar_end(tpm2_writer *w) {
+
+    if (w->format == tpm2_writer_format_json) {
+        if (!w->depth) {
+            writer_putc(w, '\n');
+        }
+        return;
+    }
+
+    if (w->scopes[w->depth].type != writer_scope_flow_seq) {
+        writer_putc(w, '\n');
+    }
+}
+
+static void writer_scope_begin(tpm2_writer *w, const char *key,
+        writer_scope_type type, bool is_indented) {
+
+    if (w->overflow || w->depth + 1 == WRITER_MAX_DEPTH) {
+        LOG_ERR("Output nested deeper than %u levels", WRITER_MAX_DEPTH);
+        w->error = true;
+        w->overflow++;
+        return;
+    }
+
+    writer_scope *parent = writer_entry(w, key, false);
+    writer_scope scope = { .type = type };
+
+    if (w->format == tpm2_writer_format_json) {
+        writer_putc(w, type == writer_scope_map ? '{' : '[');
+    } else if (parent->type == writer_scope_seq) {
+        if (type == writer_scope_flow_seq) {
+            writer_putc(w, '[');
+        } else {
+            scope.indent = parent->indent + 2;
+            scope.is_inline = true;
+        }
+    } else if (key) {
+        if (type == writer_scope_flow_seq) {
+            writer_put(w, " [", 2);
+        } else {
+            writer_putc(w, '\n');
+            /* sequences are not indented below their key by default */
+            scope.indent = parent->indent
+                    + (type == writer_scope_map || is_indented ? 2 : 0);
+        }
+    } else if (type == writer_scope_flow_seq) {
+        writer_putc(w, '[');
+    }
+
+    w->scopes[++w->depth] = scope;
+}
+
+tpm2_writer *tpm2_writer_new(FILE *out, tpm2_writer_format format) {
+
+    tpm2_writer *w = malloc(sizeof(*w));
+    if (!w) {
+        LOG_ERR("oom");
+        return NULL;
+    }
+
+    writer_init(w, out, format);
+
+    return w;
+}
+
+void tpm2_writer_free(tpm2_writer *w) {
+
+    if (!w) {
+        return;
+    }
+
+    tpm2_writer_flush(w);
+    free(w->scratch);
+    free(w);
+}
+
+tpm2_writer *tpm2_writer_stdout(void) {
+
+    static tpm2_writer stdout_writer;
+    static bool is_initialized;
+
+    if (!is_initialized) {
+        writer_init(&stdout_writer, output_enabled ? stdout : NULL,
+                tpm2_writer_format_yaml);
+        is_initialized = true;
+    }
+
+    return &stdout_writer;
+}
+
+void tpm2_writer_set_format(tpm2_writer *w, tpm2_writer_format format) {
+
+    w->format = format;
+}
+
+bool tpm2_writer_format_from_str(const char *str, tpm2_writer_format *format) {
+
+    if (!strcmp(str, "yaml")) {
+        *format = tpm2_writer_format_yaml;
+    } else if (!strcmp(str, "json")) {
+        *format = tpm2_writer_format_json;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+bool tpm2_writer_flush(tpm2_writer *w) {
+
+    writer_drain(w);
+    if (w->out && fflush(w->out)) {
+        w->error = true;
+    }
+
+    return !w->error;
+}
+
+void tpm2_writer_document_begin(tpm2_writer *w) {
+
+    w->depth = 0;
+    w->overflow = 0;
+    w->scopes[0] = (writer_scope) { .type = writer_scope_root };
+
+    if (w->format == tpm2_writer_format_yaml) {
+        writer_put(w, "---\n", 4);
+    }
+}
+
+void tpm2_writer_map_begin(tpm2_writer *w, const char *key) {
+
+    writer_scope_begin(w, key, writer_scope_map, false);
+}
+
+void tpm2_writer_seq_begin(tpm2_writer *w, const char *key) {
+
+    writer_scope_begin(w, key, writer_scope_seq, false);
+}
+
+void tpm2_writer_seq_begin_indented(tpm2_writer *w, const char *key) {
+
+    writer_scope_begin(w, key, writer_scope_seq, true);
+}
+
+void tpm2_writer_flow_seq_begin(tpm2_writer *w, const char *key) {
+
+    writer_scope_begin(w, key, writer_scope_flow_seq, false);
+}
+
+void tpm2_writer_end(tpm2_writer *w) {
+
+    if (w->overflow) {
+        w->overflow--;
+        return;
+    }
+
+    if (!w->depth) {
+        return;
+    }
+
+    writer_scope *scope = &w->scopes[w->depth--];
+
+    if (w->format == tpm2_writer_format_json) {
+        writer_putc(w, scope->type == writer_scope_map ? '}' : ']');
+        if (!w->depth) {
+            writer_putc(w, '\n');
+        }
+        return;
+    }
+
+    if (scope->type == writer_scope_flow_seq) {
+        writer_put(w, " ]\n", 3);
+    } else if (!scope->count && scope->is_inline) {
+        /* an empty sequence item */
+        writer_puts(w, scope->type == writer_scope_map ? "{}\n" : "[]\n");
+    }
+}
+
+void tpm2_writer_align(tpm2_writer *w, unsigned key_width,
+        unsigned value_column) {
+
+    writer_scope *scope = &w->scopes[w->depth];
+    scope->key_width = key_width;
+    scope->value_column = value_column;
+}
+
+void tpm2_writer_null(tpm2_writer *w, const char *key) {
+
+    writer_entry(w, key, false);
+    if (w->format == tpm2_writer_format_json) {
+        writer_put(w, "null", 4);
+    }
+    writer_scalar_end(w);
+}
+
+void tpm2_writer_uint(tpm2_writer *w, const char *key, uint64_t value) {
+
+    writer_entry(w, key, true);
+    writer_put_number(w, value, 10, hex_digits);
+    writer_scalar_end(w);
+}
+
+static void writer_hex_number(tpm2_writer *w, const char *key, uint64_t value,
+        const char *digits) {
+
+    writer_entry(w, key, true);
+    if (w->format == tpm2_writer_format_json) {
+        writer_put_number(w, value, 10, digits);
+    } else {
+        writer_put(w, "0x", 2);
+        writer_put_number(w, value, 16, digits);
+    }
+    writer_scalar_end(w);
+}
+
+void tpm2_writer_hex(tpm2_writer *w, const char *key, uint64_t value) {
+
+    writer_hex_number(w, key, value, hex_digits);
+}
+
+void tpm2_writer_hex_upper(tpm2_writer *w, const char *key, uint64_t value) {
+
+    writer_hex_number(w, key, value, hex_digits_upper);
+}
+
+void tpm2_writer_number(tpm2_writer *w, const char *key, const char *number) {
+
+    writer_entry(w, key, true);
+    writer_puts(w, number);
+    writer_scalar_end(w);
+}
+
+void tpm2_writer_string(tpm2_writer *w, const char *key, const char *value,
+        tpm2_writer_style style) {
+
+    if (!value) {
+        tpm2_writer_null(w, key);
+        return;
+    }
+
+    tpm2_writer_string_len(w, key, value, strlen(value), style);
+}
+
+void tpm2_writer_string_len(tpm2_writer *w, const char *key,
+        const char *value, size_t len, tpm2_writer_style style) {
+
+    writer_scope *scope = writer_entry(w, key, true);
+
+    if (w->format == tpm2_writer_format_json) {
+        writer_put_json_string(w, value, len);
+        writer_scalar_end(w);
+        return;
+    }
+
+    switch (style) {
+    case tpm2_writer_style_double_quoted:
+        writer_put_yaml_double_quoted(w, value, len, scope->indent + 2);
+        break;
+    case tpm2_writer_style_single_quoted:
+        writer_put_yaml_single_quoted(w, value, len);
+        break;
+    case tpm2_writer_style_literal:
+        writer_put_yaml_literal(w, value, len, scope->indent + 2);
+        break;
+    case tpm2_writer_style_plain:
+    case tpm2_writer_style_prefixed:
+        writer_put(w, value, len);
+        break;
+    }
+
+    writer_scalar_end(w);
+}
+
+void tpm2_writer_bytes(tpm2_writer *w, const char *key, const uint8_t *data,
+        size_t len, tpm2_writer_style style) {
+
+    writer_entry(w, key, true);
+
+    char quote = '\0';
+    if (w->format == tpm2_writer_format_json
+            || style == tpm2_writer_style_double_quoted) {
+        quote = '"';
+    } else if (style == tpm2_writer_style_single_quoted) {
+        quote = '\'';
+    }
+
+    if (quote) {
+        writer_putc(w, quote);
+    }
+    if (style == tpm2_writer_style_prefixed) {
+        writer_put(w, "0x", 2);
+    }
+    writer_put_hex_data(w, data, len);
+    if (quote) {
+        writer_putc(w, quote);
+    }
+
+    writer_scalar_end(w);
+}
+
+char *tpm2_writer_scratch(tpm2_writer *w, size_t size) {
+
+    if (size > w->scratch_size) {
+        char *tmp = realloc(w->scratch, size);
+        if (!tmp) {
+            LOG_ERR("oom");
+            return NULL;
+        }
+        w->scratch = tmp;
+        w->scratch_size = size;
+    }
+
+    return w->scratch;
+}
@@ -0,0 +1,197 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef LIB_TPM2_WRITER_H_
+#define LIB_TPM2_WRITER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * A structured output writer for tool output. The tools describe their output
+ * as nested maps, sequences and scalars, the writer renders them as YAML in
+ * the layout the tools always printed, or as JSON with one document per line.
+ * Output is collected in a large buffer that is reused for the whole run and
+ * written out when it fills up or on tpm2_writer_flush(), hex data is encoded
+ * straight into that buffer.
+ *
+ * A key of NULL adds an item to the current sequence, any other key an entry
+ * to the current map.
+ */
+typedef struct tpm2_writer tpm2_writer;
+
+typedef enum tpm2_writer_format tpm2_writer_format;
+enum tpm2_writer_format {
+    tpm2_writer_format_yaml,
+    tpm2_writer_format_json,
+};
+
+/*
+ * How a string scalar is rendered in YAML, JSON output always uses escaped
+ * double-quoted strings.
+ */
+typedef enum tpm2_writer_style tpm2_writer_style;
+enum tpm2_writer_style {
+    /* written as is */
+    tpm2_writer_style_plain,
+    /* escaped, split into continuation lines after each newline */
+    tpm2_writer_style_double_quoted,
+    tpm2_writer_style_single_quoted,
+    /* a "|-" block, indented below the key */
+    tpm2_writer_style_literal,
+    /* hex data only: plain with a 0x prefix, also in JSON */
+    tpm2_writer_style_prefixed,
+};
+
+/**
+ * Creates a writer.
+ * @param out
+ *  The stream the output is written to, NULL discards the output.
+ * @param format
+ *  The output format.
+ * @return
+ *  The writer, NULL on error.
+ */
+tpm2_writer *tpm2_writer_new(FILE *out, tpm2_writer_format format);
+
+/**
+ * Flushes and frees a writer.
+ * @param w
+ *  The writer to free, may be NULL.
+ */
+void tpm2_writer_free(tpm2_writer *w);
+
+/**
+ * Gets the writer of the tool output on stdout. Like tpm2_tool_output(), it
+ * discards the output when the -Q option is set. It must not be used before
+ * the options were parsed.
+ * @return
+ *  The stdout writer, YAML unless set otherwise.
+ */
+tpm2_writer *tpm2_writer_stdout(void);
+
+/**
+ * Selects the output format, must be called between documents.
+ */
+void tpm2_writer_set_format(tpm2_writer *w, tpm2_writer_format format);
+
+/**
+ * Converts an option value of "yaml" or "json" to an output format.
+ * @param str
+ *  The string to convert.
+ * @param format
+ *  The output format.
+ * @return
+ *  true on success, false if the format is unknown.
+ */
+bool tpm2_writer_format_from_str(const char *str, tpm2_writer_format *format);
+
+/**
+ * Writes the buffered output to the stream and flushes it.
+ * @return
+ *  false if any output of the writer could not be written.
+ */
+bool tpm2_writer_flush(tpm2_writer *w);
+
+/**
+ * Starts a new document, it discards the scopes left open by the previous
+ * one. YAML documents start with "---".
+ */
+void tpm2_writer_document_begin(tpm2_writer *w);
+
+/**
+ * Opens a map as the value of key, or as a sequence item for a NULL key.
+ */
+void tpm2_writer_map_begin(tpm2_writer *w, const char *key);
+
+/**
+ * Opens a sequence as the value of key, or as a sequence item for a NULL
+ * key. In YAML the items of a map value are not indented below the key.
+ */
+void tpm2_writer_seq_begin(tpm2_writer *w, const char *key);
+
+/**
+ * Like tpm2_writer_seq_begin(), but the YAML items of a map value are
+ * indented by two spaces below the key.
+ */
+void tpm2_writer_seq_begin_indented(tpm2_writer *w, const char *key);
+
+/**
+ * Like tpm2_writer_seq_begin(), but the YAML items are written on one line
+ * as "key: [ item, item ]". The items must be scalars.
+ */
+void tpm2_writer_flow_seq_begin(tpm2_writer *w, const char *key);
+
+/**
+ * Closes the innermost map or sequence. A JSON document ends with its
+ * outermost scope.
+ */
+void tpm2_writer_end(tpm2_writer *w);
+
+/**
+ * Aligns the following YAML entries of the current map, JSON is not aligned.
+ * @param key_width
+ *  The keys are padded with spaces to key_width before the colon.
+ * @param value_column
+ *  The values start value_column characters after the start of the key, or
+ *  one space after the colon if the key is longer.
+ */
+void tpm2_writer_align(tpm2_writer *w, unsigned key_width,
+        unsigned value_column);
+
+/**
+ * Writes an entry without a value, "key:" in YAML and null in JSON.
+ */
+void tpm2_writer_null(tpm2_writer *w, const char *key);
+
+/**
+ * Writes an unsigned decimal number.
+ */
+void tpm2_writer_uint(tpm2_writer *w, const char *key, uint64_t value);
+
+/**
+ * Writes a number as 0x followed by lower case hex digits in YAML, JSON
+ * numbers are decimal.
+ */
+void tpm2_writer_hex(tpm2_writer *w, const char *key, uint64_t value);
+
+/**
+ * Same as tpm2_writer_hex(), with upper case hex digits.
+ */
+void tpm2_writer_hex_upper(tpm2_writer *w, const char *key, uint64_t value);
+
+/**
+ * Writes a number that the caller formatted, like "1.38".
+ */
+void tpm2_writer_number(tpm2_writer *w, const char *key, const char *number);
+
+/**
+ * Writes a NUL terminated string, a NULL value is written as null, which is
+ * an empty value in YAML.
+ */
+void tpm2_writer_string(tpm2_writer *w, const char *key, const char *value,
+        tpm2_writer_style style);
+
+/**
+ * Writes a string of len bytes, it may contain NUL bytes.
+ */
+void tpm2_writer_string_len(tpm2_writer *w, const char *key,
+        const char *value, size_t len, tpm2_writer_style style);
+
+/**
+ * Writes binary data as a string of lower case hex digits.
+ */
+void tpm2_writer_bytes(tpm2_writer *w, const char *key, const uint8_t *data,
+        size_t len, tpm2_writer_style style);
+
+/**
+ * Gets a scratch buffer for formatting values, it is kept by the writer and
+ * reused by the next call.
+ * @param size
+ *  The minimal size of the buffer.
+ * @return
+ *  The scratch buffer, NULL on error.
+ */
+char *tpm2_writer_scratch(tpm2_writer *w, size_t size);
+
+#endif /* LIB_TPM2_WRITER_H_ */
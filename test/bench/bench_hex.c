@@ -0,0 +1,153 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Micro-benchmark of the hex conversions of lib/tpm2_hex.c. Every kernel the
+ * CPU supports is timed against the per byte printf and strtol pattern the
+ * conversions replaced, the rates are printed in MiB of binary data per
+ * second.
+ *
+ * Build and run with: make bench && test/bench/bench_hex [SECONDS]
+ */
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tpm2_hex.h"
+
+#define BENCH_MAX_SIZE 65536
+
+typedef bool (*bench_fn)(size_t size);
+
+static BYTE data[BENCH_MAX_SIZE];
+static char hex[2 * BENCH_MAX_SIZE + 1];
+
+static double now_seconds(void) {
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static double bench_run(bench_fn fn, size_t size, double seconds) {
+
+    unsigned long calls = 0;
+    double start = now_seconds();
+    double elapsed;
+    do {
+        unsigned i;
+        for (i = 0; i < 100; i++) {
+            if (!fn(size)) {
+                fprintf(stderr, "benchmark call failed\n");
+                exit(1);
+            }
+        }
+        calls += i;
+        elapsed = now_seconds() - start;
+    } while (elapsed < seconds);
+
+    return calls * (double) size / elapsed / (1024 * 1024);
+}
+
+/* the pattern tpm2_util_hexdump2() used before the hex kernels */
+static bool encode_printf(size_t size) {
+
+    size_t i;
+    for (i = 0; i < size; i++) {
+        snprintf(&hex[2 * i], 3, "%02x", data[i]);
+    }
+
+    return true;
+}
+
+/* the pattern tpm2_util_hex_to_byte_structure() used before the kernels */
+static bool decode_strtol(size_t size) {
+
+    size_t i;
+    for (i = 0; i < 2 * size; i++) {
+        if (!isxdigit(hex[i])) {
+            return false;
+        }
+    }
+
+    for (i = 0; i < size; i++) {
+        char tmp_str[4] = { 0 };
+        tmp_str[0] = hex[i * 2];
+        tmp_str[1] = hex[i * 2 + 1];
+        data[i] = strtol(tmp_str, NULL, 16);
+    }
+
+    return true;
+}
+
+static bool encode_kernel(size_t size) {
+
+    tpm2_hex_encode(data, size, hex);
+
+    return true;
+}
+
+static bool decode_kernel(size_t size) {
+
+    return tpm2_hex_decode(hex, 2 * size, data);
+}
+
+static void bench_kernels(const char *name, bench_fn before, bench_fn after,
+        size_t size, double seconds) {
+
+    static const struct {
+        tpm2_hex_kernel kernel;
+        const char *name;
+    } kernels[] = {
+        { tpm2_hex_kernel_scalar, "scalar" },
+        { tpm2_hex_kernel_sse4,   "sse4"   },
+        { tpm2_hex_kernel_avx2,   "avx2"   },
+    };
+
+    printf("%-6s %6zu bytes  before: %9.1f MiB/s", name, size,
+            bench_run(before, size, seconds));
+
+    size_t i;
+    for (i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+        if (tpm2_hex_set_kernel(kernels[i].kernel)) {
+            printf("  %s: %9.1f MiB/s", kernels[i].name,
+                    bench_run(after, size, seconds));
+        }
+    }
+    printf("\n");
+
+    tpm2_hex_set_kernel(tpm2_hex_kernel_auto);
+}
+
+/* link required symbol, but tpm2_tool.c declares it AND main */
+bool output_enabled = true;
+
+int main(int argc, char *argv[]) {
+
+    double seconds = argc > 1 ? atof(argv[1]) : 1.0;
+    if (seconds <= 0) {
+        fprintf(stderr, "Usage: %s [SECONDS]\n", argv[0]);
+        return 1;
+    }
+
+    size_t i;
+    for (i = 0; i < sizeof(data); i++) {
+        data[i] = i * 7;
+    }
+    tpm2_hex_encode(data, sizeof(data), hex);
+
+    /* a SHA-256 digest, a large NV index and an eventlog sized buffer */
+    static const size_t sizes[] = { 32, 2048, BENCH_MAX_SIZE };
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        bench_kernels("encode", encode_printf, encode_kernel, sizes[i],
+                seconds);
+        bench_kernels("decode", decode_strtol, decode_kernel, sizes[i],
+                seconds);
+    }
+
+    return 0;
+}
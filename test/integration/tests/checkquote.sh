@@ -21,7 +21,7 @@ output_quotepcr=quotepcr.out
 cleanup() {
   rm -f $output_ek_pub_pem $output_ak_pub_pem $output_ak_pub_name \
   $output_quote $output_quotesig $output_quotepcr rand.out $ak_ctx \
-  pcr.bin
+  pcr.bin manifest.txt batch.yaml
 
   tpm2 pcrreset 16
   tpm2 evictcontrol -C o -c $handle_ek 2>/dev/null || true
@@ -90,4 +90,26 @@ tpm2 pcrread sha256:15,16,22 -o pcr.bin
 tpm2 checkquote -u ecc.ak.tpmt -m quote.bin -s quote.sig -g sha256 -q nonce.bin \
 -f pcr.bin -l sha256:15,16,22
 
+# Verify many quotes in one process, the RSA quote uses the default key and
+# the ECC ones carry their own key.
+cat > manifest.txt <<EOF
+# message signature pcr eventlog nonce public
+$output_quote $output_quotesig $output_quotepcr - $loaded_randomness
+quote.bin quote.sig quote.pcr - nonce.bin ecc.ak.pem
+quote.bin quote.sig quote.pcr - nonce.bin ecc.ak.tss
+quote.bin quote.sig - - nonce.bin ecc.ak.tpmt
+EOF
+
+tpm2 checkquote -u $output_ak_pub_pem --batch manifest.txt --jobs 2 > batch.yaml
+test $(grep -c "verified: true" batch.yaml) = 4
+
+# A wrong nonce fails only its own record
+echo "quote.bin quote.sig quote.pcr - 00 ecc.ak.pem" >> manifest.txt
+if tpm2 checkquote -u $output_ak_pub_pem --batch manifest.txt > batch.yaml; then
+  echo "Expected batch verification to fail on a bad nonce"
+  exit 1
+fi
+test $(grep -c "verified: true" batch.yaml) = 4
+test $(grep -c "verified: false" batch.yaml) = 1
+
 exit 0
@@ -7,7 +7,8 @@ cleanup() {
   decrypt2.out encrypt.out encrypt2.out secret.dat secret2.dat \
   iv.dat iv2.dat key128.ctx plain.dec128.tpm plain.dec256.tpm plain.enc128.tpm \
   plain.enc256.tpm sym128.key key256.ctx plain.dec128.ssl plain.dec256.ssl \
-  plain.enc128.ssl plain.enc256.ssl plain.txt sym256.key
+  plain.enc128.ssl plain.enc256.ssl plain.txt sym256.key plain.large \
+  plain.large.ssl plain.large.tpm plain.large.dec
 
   if [ "$1" != "no-shut-down" ]; then
       shut_down
@@ -195,6 +196,22 @@ openssl enc -d -in plain.enc256.tpm -out plain.dec256.ssl -aes-256-cbc -iv 0 \
 
 diff plain.dec256.ssl plain.txt
 
+## Inputs larger than 64KiB are streamed through the TPM block by block
+dd if=/dev/urandom of=plain.large bs=1024 count=100 status=none
+
+openssl enc -in plain.large -out plain.large.ssl \
+-K `xxd -c 128 -p sym128.key` -aes-128-cbc -iv 0
+
+cat plain.large | tpm2 encryptdecrypt -c key128.ctx -o plain.large.tpm -e \
+-G cbc
+
+cmp plain.large.ssl plain.large.tpm
+
+tpm2 encryptdecrypt -c key128.ctx -o plain.large.dec -e -G cbc -d \
+plain.large.tpm
+
+cmp plain.large plain.large.dec
+
 ## Encrypt with ossl and tpm for cfb mode that does not apply padding
 
 ### Key size = 128
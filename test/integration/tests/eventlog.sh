@@ -116,6 +116,244 @@ then
     exit 1
 fi
 
+# The JSON output is one document per line and holds the same data as the YAML
+# output, the PCR values are "0x" prefixed strings instead of YAML integers.
+evlog=${srcdir}/test/integration/fixtures/event-arch-linux.bin
+tpm2 eventlog --eventlog-version=2 --format=json $evlog > json.out
+
+python << pyscript
+import json
+import sys
+import yaml
+
+with open("$evlog.yaml", 'r') as file:
+    whole = yaml.safe_load(file)
+
+with open("json.out", 'r') as file:
+    lines = file.readlines()
+
+if len(lines) != 1:
+    print("Expected a single JSON document, got %d lines" % len(lines))
+    sys.exit(1)
+
+doc = json.loads(lines[0])
+pcrs = {bank: {int(pcr): int(value, 16) for pcr, value in values.items()}
+        for bank, values in doc['pcrs'].items()}
+
+if doc['events'] != whole['events'] or pcrs != whole['pcrs']:
+    print("JSON eventlog does not match the YAML eventlog")
+    sys.exit(1)
+pyscript
+if [ $? -ne 0 ]; then
+    exit 1
+fi
+rm json.out
+
+expect_fail --format=xml ${srcdir}/test/integration/fixtures/event.bin
+
+# Queries select events and PCRs of the complete log. The first query builds
+# the sidecar index, the second one reuses it.
+evlog=${srcdir}/test/integration/fixtures/event-gce-ubuntu-2104-log.bin
+tpm2 eventlog --eventlog-version=2 --index=eventlog.idx --pcr=4,7 $evlog \
+    > pcr.out
+tpm2 eventlog --eventlog-version=2 --index=eventlog.idx --event-range=10:30 \
+    $evlog > range.out
+
+python << pyscript
+import sys
+import yaml
+
+with open("$evlog.yaml", 'r') as file:
+    whole = yaml.safe_load(file)
+
+with open("pcr.out", 'r') as file:
+    pcr = yaml.safe_load(file)
+
+with open("range.out", 'r') as file:
+    ranged = yaml.safe_load(file)
+
+events = [e for e in whole['events'] if e['PCRIndex'] in (4, 7)]
+pcrs = {bank: {i: v for i, v in values.items() if i in (4, 7)}
+        for bank, values in whole['pcrs'].items()}
+if pcr['events'] != events or pcr['pcrs'] != pcrs:
+    print("PCR query does not match the complete eventlog")
+    sys.exit(1)
+
+if ranged['events'] != whole['events'][10:31]:
+    print("Event range query does not match the complete eventlog")
+    sys.exit(1)
+pyscript
+if [ $? -ne 0 ]; then
+    exit 1
+fi
+rm eventlog.idx pcr.out range.out
+
+expect_fail --event-range=30:10 $evlog
+expect_fail --event-range=10:100000 $evlog
+expect_fail --pcr=24 $evlog
+expect_fail --index=eventlog.idx --watch=1 $evlog
+
+# Prints how many times the events of the complete log $evlog were printed by
+# the polls so far, as a decimal when a poll printed only part of them, or -1
+# while the output does not match the complete log.
+watch_progress() {
+    python << pyscript
+import yaml
+
+with open("$evlog.yaml", 'r') as file:
+    whole = yaml.safe_load(file)
+
+events = []
+pcrs = {}
+try:
+    with open("watch.out", 'r') as file:
+        for doc in yaml.safe_load_all(file):
+            events += doc['events'] or []
+            for bank, values in (doc['pcrs'] or {}).items():
+                pcrs.setdefault(bank, {}).update(values)
+except yaml.YAMLError:
+    # a poll is still printing its document
+    events = []
+
+n = len(whole['events'])
+full = len(events) // n
+if events[:full * n] != whole['events'] * full or \
+        events[full * n:] != whole['events'][:len(events) - full * n] or \
+        (full and not len(events) % n and pcrs != whole['pcrs']):
+    print(-1)
+else:
+    print(len(events) / n)
+pyscript
+}
+
+# Waits for the polls to print the events of the complete log the given number
+# of times, or more than that when the second argument is "more".
+watch_wait() {
+    local times=$1
+    local cmp=${2-equal}
+    local i progress
+    for i in $(seq 300); do
+        progress=$(watch_progress)
+        if [ "$progress" == "-1" ]; then
+            echo "Watched eventlog does not match the complete eventlog"
+            return 1
+        fi
+        if python -c "import sys; p = $progress; sys.exit(not (p > $times \
+                if '$cmp' == 'more' else p == $times))"; then
+            return 0
+        fi
+        sleep 0.1
+    done
+    echo "Timed out watching the eventlog, got $progress times the events"
+    return 1
+}
+
+# Follow a log that grows while it is watched, the YAML documents printed by
+# the polls must add up to the events and PCRs of the complete log. A log that
+# is replaced or truncated is followed again from its start.
+evlog=${srcdir}/test/integration/fixtures/event-arch-linux.bin
+head -c 10000 $evlog > growing.bin
+tpm2 eventlog --eventlog-version=2 --watch=1 growing.bin > watch.out &
+watch_pid=$!
+ret=0
+{
+    watch_wait 0 more &&
+    tail -c +10001 $evlog >> growing.bin &&
+    watch_wait 1 &&
+    cp $evlog rotated.bin && mv rotated.bin growing.bin &&
+    watch_wait 2 &&
+    head -c 10000 $evlog > growing.bin &&
+    watch_wait 2 more &&
+    tail -c +10001 $evlog >> growing.bin &&
+    watch_wait 3
+} || ret=1
+kill $watch_pid
+wait $watch_pid || true
+if [ $ret -ne 0 ]; then
+    exit 1
+fi
+rm growing.bin watch.out
+
+# Look up the digests in reference measurements, the first event is allowed,
+# the second one is denied and all others are unknown.
+evlog=${srcdir}/test/integration/fixtures/event-gce-ubuntu-2104-log.bin
+python << pyscript > refs.txt
+import yaml
+
+with open("$evlog.yaml", 'r') as file:
+    whole = yaml.safe_load(file)
+
+print("# reference measurements")
+for event, verdict in zip(whole['events'][1:3], ('allow', 'deny')):
+    for digest in event['Digests']:
+        print("%s:%s %s event %d" % (digest['AlgorithmId'], digest['Digest'],
+                                     verdict, event['EventNum']))
+pyscript
+tpm2 eventlog --eventlog-version=2 --refdb=refs.db --refdb-source=refs.txt \
+    $evlog > refdb.out
+
+python << pyscript
+import sys
+import yaml
+
+with open("$evlog.yaml", 'r') as file:
+    whole = yaml.safe_load(file)
+
+with open("refdb.out", 'r') as file:
+    refdb = yaml.safe_load(file)
+
+expected = {1: ('allow', 'event 1'), 2: ('deny', 'event 2')}
+for event in refdb['events']:
+    for digest in event.get('Digests', []):
+        verdict, label = expected.get(event['EventNum'], ('unknown', None))
+        if digest['Verdict'] != verdict or digest.get('Label') != label:
+            print("Unexpected verdict of event %d" % event['EventNum'])
+            sys.exit(1)
+        del digest['Verdict']
+        digest.pop('Label', None)
+
+events = len([e for e in whole['events'] if e['EventType'] != 'EV_NO_ACTION'])
+references = {'allow': 1, 'deny': 1, 'unknown': events - 2}
+if refdb['events'] != whole['events'] or refdb['references'] != references:
+    print("Reference measurements do not match the complete eventlog")
+    sys.exit(1)
+pyscript
+if [ $? -ne 0 ]; then
+    exit 1
+fi
+
+# the compiled database is reused, a query only looks up the events it prints
+tpm2 eventlog --eventlog-version=2 --refdb=refs.db --index=eventlog.idx \
+    --event-range=2:3 $evlog > refdb.out
+yaml_validate "assert y['references'] == {'allow': 0, 'deny': 1, 'unknown': 1}" \
+    < refdb.out
+if [ $? -ne 0 ]; then
+    echo "Reference measurements of the query do not match"
+    exit 1
+fi
+
+# an event is only allowed when all its digests are, only the SHA1 digest of
+# event 1 is known
+head -n 2 refs.txt > refs1.txt
+tpm2 eventlog --eventlog-version=2 --refdb=refs1.db --refdb-source=refs1.txt \
+    $evlog > refdb.out
+yaml_validate "
+e = [e for e in y['events'] if e['EventNum'] == 1][0]
+assert [d['Verdict'] for d in e['Digests']] == ['allow', 'unknown', 'unknown']
+assert y['references']['allow'] == 0 and y['references']['deny'] == 0" \
+    < refdb.out
+if [ $? -ne 0 ]; then
+    echo "An event with unknown digests was allowed"
+    exit 1
+fi
+rm refs1.txt refs1.db
+
+head -n 2 refs.txt | tail -n 1 >> refs.txt
+expect_fail --refdb=dup.db --refdb-source=refs.txt $evlog
+expect_fail --refdb-source=refs.txt $evlog
+expect_fail --refdb=refs.txt $evlog
+rm refs.txt refs.db refdb.out eventlog.idx
+
 # Compare strings generated by tpm2_eventlog with binary data of the corresponding
 # events.
 
@@ -7,7 +7,7 @@ start_up
 out=out.yaml
 
 cleanup() {
-    rm -f $out
+    rm -f $out out.json
 
     shut_down
 }
@@ -37,6 +37,23 @@ caplist=$(yaml_to_list $out)
 for c in $caplist; do
     tpm2 getcap "$c" > $out
     yaml_verify $out
+
+    # the JSON output holds the same keys and numbers as the YAML output
+    tpm2 getcap --format=json "$c" > out.json
+    python << pyscript
+import json
+import yaml
+
+with open("$out") as f:
+    y = yaml.safe_load(f)
+with open("out.json") as f:
+    j = json.load(f)
+
+if isinstance(y, dict):
+    assert sorted(y.keys()) == sorted(j.keys()), "keys of $c differ"
+else:
+    assert (y or []) == j, "items of $c differ"
+pyscript
 done;
 
 # negative tests
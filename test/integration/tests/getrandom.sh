@@ -39,6 +39,19 @@ tpm2 startauthsession -S enc_session.ctx --hmac-session --tpmkey-context prim.ct
 tpm2 sessionconfig enc_session.ctx --enable-encrypt
 tpm2 getrandom 8 -S enc_session.ctx -S audit_session.ctx
 
+# bulk mode is not bounded by the max digest size
+tpm2 getrandom --bulk -o random.out 100000
+s=`ls -l random.out | awk {'print $5'}`
+test $s -eq 100000
+
+tpm2 getrandom --bulk --hex 1000 > random.out
+s=`ls -l random.out | awk {'print $5'}`
+test $s -eq 2000
+
+tpm2 getrandom --bulk -S enc_session.ctx -o random.out 4096
+s=`ls -l random.out | awk {'print $5'}`
+test $s -eq 4096
+
 # negative tests
 trap - ERR
 
@@ -49,6 +62,13 @@ if [ $? -eq 0 ]; then
     exit 1
 fi
 
+# bulk mode cannot calculate parameter hashes
+tpm2 getrandom --bulk --cphash cp.hash 64 &> /dev/null
+if [ $? -eq 0 ]; then
+    echo "tpm2 getrandom --bulk should fail with --cphash"
+    exit 1
+fi
+
 # verify that tpm2 getrandom requires a TCTI
 ./tools/tpm2 getrandom -T none &> /dev/null
 if [ $? -eq 0 ]; then
@@ -72,4 +72,20 @@ if [ "$tpm_hash_val" != "$sha1sum_val" ]; then
   exit 1
 fi
 
+# Test a large file hashed locally and by the TPM to get a ticket, both
+# digests must match.
+dd if=/dev/urandom of=$hash_in_file bs=1024 count=300 2>/dev/null
+local_hash_val=`tpm2 hash -g sha256 --hex $hash_in_file`
+tpm_hash_val=`tpm2 hash -g sha256 -t $ticket_file --hex $hash_in_file`
+sha256sum_val=`shasum -a 256 $hash_in_file | cut -d\  -f 1-2 | tr -d '[:space:]'`
+if [ "$local_hash_val" != "$sha256sum_val" ] || \
+   [ "$tpm_hash_val" != "$sha256sum_val" ]; then
+  echo "Expected local, tpm and sha256sum to produce same hashes"
+  echo "Got:"
+  echo "  tpm2 hash (local): $local_hash_val"
+  echo "  tpm2 hash (tpm):   $tpm_hash_val"
+  echo "  sha256sum:         $sha256sum_val"
+  exit 1
+fi
+
 exit 0
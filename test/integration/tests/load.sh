@@ -31,9 +31,10 @@ Pem_persistent_parent=0x81100000
 cleanup() {
 
   rm -f $file_load_key_pub $file_load_key_priv $file_load_key_name \
-  $file_load_key_ctx
+  $file_load_key_ctx srk_auth.ctx
 
   tpm2 evictcontrol -Q -Co -c $Handle_parent 2>/dev/null || true
+  tpm2 evictcontrol -Q -Co -c 0x81000001 2>/dev/null || true
 
   if [ $(ina "$@" "keep_ctx") -ne 0 ]; then
     rm -f $file_primary_key_ctx
@@ -104,4 +105,33 @@ tpm2 encodeobject -C $pem_parent.ctx -u $pem_file.pub -r $pem_file.priv \
 
 tpm2 load -r $pem_file.pem -c $pem_file.ctx
 
+#####pem test - cached SRK
+
+export XDG_CACHE_HOME=$PWD/srk_cache
+rm -rf $XDG_CACHE_HOME
+
+TPM2TOOLS_CAPABILITY_CACHE=1 tpm2 load -r $pem_file.pem -c $pem_file.ctx
+test -n "$(ls $XDG_CACHE_HOME/tpm2-tools/*-srk)"
+TPM2TOOLS_CAPABILITY_CACHE=1 tpm2 load -r $pem_file.pem -c $pem_file.ctx
+
+rm -rf $XDG_CACHE_HOME
+unset XDG_CACHE_HOME
+
+#####pem test - persistent SRK
+
+TPM2TOOLS_PERSIST_SRK=1 tpm2 load -r $pem_file.pem -c $pem_file.ctx
+tpm2 getcap handles-persistent | grep -q 0x81000001
+TPM2TOOLS_PERSIST_SRK=1 tpm2 load -r $pem_file.pem -c $pem_file.ctx
+tpm2 evictcontrol -C o -c 0x81000001
+
+#####pem test - a key with an authValue at the SRK handle is not reused
+
+tpm2 createprimary -C o -G ecc256:aes128cfb -p srkauth \
+-a "fixedtpm|fixedparent|sensitivedataorigin|userwithauth|noda|restricted|decrypt" \
+-c srk_auth.ctx
+tpm2 evictcontrol -C o -c srk_auth.ctx 0x81000001
+tpm2 flushcontext -t
+tpm2 load -r $pem_file.pem -c $pem_file.ctx
+tpm2 evictcontrol -C o -c 0x81000001
+
 exit 0
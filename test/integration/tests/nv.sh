@@ -139,6 +139,12 @@ tpm2 nvread   $nv_test_index -C o > $large_file_read_name
 
 cmp -s $large_file_read_name $large_file_name
 
+# Test a read at an offset that spans more than one NV read chunk
+tpm2 nvread $nv_test_index -C o -s $(($large_file_size - 3)) --offset 3 \
+    > $large_file_read_name
+
+tail -c +4 $large_file_name | cmp -s $large_file_read_name -
+
 # test per-index readpublic
 tpm2 nvreadpublic "$nv_test_index" > nv.out
 yaml_get_kv nv.out "$nv_test_index" > /dev/null
@@ -73,6 +73,21 @@ if [ "$new_pcr_value" == "$old_pcr_value" ]; then
   exit 1;
 fi
 
+# Test a multi-chunk input from a file and from a pipe, both must produce the
+# expected digest, and verbose mode reports the sequence throughput
+dd if=/dev/urandom of=$hash_in_file count=1 bs=10000 2> /dev/null
+tpm2 pcrevent -V $hash_in_file > $hash_out_file 2> verbose.log
+grep -q "MB/s" verbose.log
+rm -f verbose.log
+
+check=`shasum -a 256 $hash_in_file | cut -d' ' -f1-1`
+hash=`yaml_get_kv $hash_out_file "sha256"`
+test "$hash" == "$check"
+
+cat $hash_in_file | tpm2 pcrevent > $hash_out_file
+hash=`yaml_get_kv $hash_out_file "sha256"`
+test "$hash" == "$check"
+
 # verify that specifying -P without -i fails
 trap - ERR
 
@@ -0,0 +1,101 @@
+# SPDX-License-Identifier: BSD-3-Clause
+
+source helpers.sh
+
+session_ctx=session.ctx
+
+cleanup() {
+    rm -f $session_ctx pcr.bin other.dat key.pem key.pub.pem key.ctx key.name \
+    branch.tpm branch.none or.tpm or.none policy.tpm policy.none \
+    signed.tpm signed.none
+
+    tpm2 flushcontext $session_ctx 2>/dev/null || true
+
+    if [ "${1}" != "no-shutdown" ]; then
+        shut_down
+    fi
+}
+trap cleanup EXIT
+
+start_up
+
+cleanup "no-shutdown"
+
+tpm2 clear
+
+tpm2 pcrread -o pcr.bin sha256:0,1,2
+dd if=/dev/urandom of=other.dat bs=1 count=32
+
+openssl genrsa -out key.pem 2048
+openssl rsa -in key.pem -out key.pub.pem -pubout
+tpm2 loadexternal -C o -G rsa -u key.pub.pem -c key.ctx -n key.name
+
+#
+# Builds the same policy with a trial session of the TPM and with a trial
+# session computed in software, the digests must match.
+#
+build_policy() {
+    local tcti=$1
+    local suffix=$2
+
+    tpm2 startauthsession $tcti -S $session_ctx
+    tpm2 policypcr $tcti -S $session_ctx -l sha256:0,1,2 -f pcr.bin
+    tpm2 policycommandcode $tcti -S $session_ctx TPM2_CC_Unseal
+    tpm2 policyauthvalue $tcti -S $session_ctx
+    tpm2 policylocality $tcti -S $session_ctx three
+    tpm2 policysecret $tcti -S $session_ctx -c o -L branch.$suffix
+    tpm2 policyrestart $tcti -S $session_ctx
+    tpm2 policyor $tcti -S $session_ctx -L or.$suffix \
+        sha256:branch.$suffix,other.dat
+    tpm2 policyauthorize $tcti -S $session_ctx -i or.$suffix -n key.name \
+        -L policy.$suffix
+    if [ "$tcti" == "" ]; then
+        tpm2 flushcontext $session_ctx
+    fi
+    rm $session_ctx
+}
+
+build_policy "" tpm
+build_policy "-T none" none
+
+cmp branch.tpm branch.none
+cmp or.tpm or.none
+cmp policy.tpm policy.none
+
+# PolicySigned only needs the name of the verifying key offline, trial
+# sessions on the TPM do not check the signature either
+tpm2 startauthsession -S $session_ctx
+tpm2 policysigned -S $session_ctx -c key.ctx -q 0102 -L signed.tpm
+tpm2 flushcontext $session_ctx
+rm $session_ctx
+
+tpm2 startauthsession -T none -S $session_ctx
+tpm2 policysigned -T none -S $session_ctx -n key.name -q 0102 -L signed.none
+rm $session_ctx
+
+cmp signed.tpm signed.none
+
+# Known answer of PolicyCommandCode(TPM2_CC_Unseal) over sha256
+tpm2 startauthsession -T none -S $session_ctx
+tpm2 policycommandcode -T none -S $session_ctx -L policy.none TPM2_CC_Unseal
+rm $session_ctx
+test "$(xxd -p -c 32 policy.none)" == \
+    "e613137076524bde487533865884e9732ebee3aacb095d94a6de492ec06c46fa"
+
+# Only trial sessions can be started without a TPM
+trap - ERR
+tpm2 startauthsession -T none --policy-session -S $session_ctx
+if [ $? -eq 0 ]; then
+    echo "A policy session must not start without a TPM"
+    exit 1
+fi
+
+# PCR values can't be read without a TPM
+tpm2 startauthsession -T none -S $session_ctx
+tpm2 policypcr -T none -S $session_ctx -l sha256:0
+if [ $? -eq 0 ]; then
+    echo "policypcr must not read PCRs without a TPM"
+    exit 1
+fi
+
+exit 0
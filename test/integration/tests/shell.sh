@@ -0,0 +1,128 @@
+# SPDX-License-Identifier: BSD-3-Clause
+
+source helpers.sh
+
+cleanup() {
+    rm -f script.txt random.out primary.ctx key.pub key.priv key.ctx \
+    session.ctx policy.file policy.shell secret.dat seal.pub seal.priv \
+    seal.ctx unsealed.dat
+
+    if [ "$1" != "no-shut-down" ]; then
+        shut_down
+    fi
+}
+trap cleanup EXIT
+
+start_up
+
+cleanup "no-shut-down"
+
+# run a script file over a single TPM connection
+cat > script.txt <<EOF
+# comments and blank lines are skipped
+
+getrandom -o random.out 16
+tpm2_createprimary -C o -c primary.ctx -Q
+create -C primary.ctx -u key.pub -r key.priv -Q
+load -C primary.ctx -u key.pub -r key.priv -c key.ctx -Q
+flushcontext -t
+EOF
+
+tpm2 shell script.txt
+
+test "$(stat -c %s random.out)" -eq 16
+test -f key.ctx
+
+# every command exits cleanly, not only the first one of the script
+rm -f random.out
+cat > script.txt <<EOF
+getrandom -o random.out 4
+getrandom -o random.out 8
+createprimary -C o -c primary.ctx -Q
+getrandom -o random.out 12
+EOF
+tpm2 shell script.txt
+test "$(stat -c %s random.out)" -eq 12
+
+# objects the commands leave loaded are flushed after each one
+echo 'createprimary -C o -c primary.ctx -Q' | tpm2 shell
+test -z "$(tpm2 getcap handles-transient)"
+
+# commands can also come from stdin, quoted words stay together
+rm -f random.out
+echo 'getrandom -o "random.out" 8' | tpm2 shell
+test "$(stat -c %s random.out)" -eq 8
+
+# sessions held by the shell build the same policy as session files
+cat > script.txt <<EOF
+startauthsession -S session.ctx
+policypcr -S session.ctx -l sha256:0,1,2
+policycommandcode -S session.ctx TPM2_CC_Unseal
+policyauthvalue -S session.ctx -L policy.file
+flushcontext session.ctx
+startauthsession -S shell:trial
+policypcr -S shell:trial -l sha256:0,1,2
+policycommandcode -S shell:trial TPM2_CC_Unseal
+policyauthvalue -S shell:trial -L policy.shell
+flushcontext shell:trial
+EOF
+
+tpm2 shell script.txt
+cmp policy.file policy.shell
+
+# and satisfy it, the session state carries over from command to command
+echo "sealed secret" > secret.dat
+cat > script.txt <<EOF
+createprimary -C o -c primary.ctx -Q
+create -C primary.ctx -u seal.pub -r seal.priv -L policy.shell -p secret -i secret.dat -Q
+load -C primary.ctx -u seal.pub -r seal.priv -c seal.ctx -Q
+startauthsession --policy-session -S shell:policy
+policypcr -S shell:policy -l sha256:0,1,2
+policycommandcode -S shell:policy TPM2_CC_Unseal
+policyauthvalue -S shell:policy
+unseal -c seal.ctx -p session:shell:policy+secret -o unsealed.dat
+EOF
+
+tpm2 shell script.txt
+cmp secret.dat unsealed.dat
+
+# the shell flushed the session it still held on exit
+test -z "$(tpm2 getcap handles-loaded-session)"
+
+# negative tests
+trap - ERR
+
+tpm2 startauthsession -S shell:trial &> /dev/null
+if [ $? -eq 0 ]; then
+    echo "shell: sessions must fail outside of the shell"
+    exit 1
+fi
+
+echo 'policyrestart -S shell:unknown' | tpm2 shell &> /dev/null
+if [ $? -eq 0 ]; then
+    echo "tpm2 shell should fail on unknown sessions"
+    exit 1
+fi
+
+# a failing command stops the script and its status is returned
+rm -f random.out
+printf 'getrandom 2000\ngetrandom -o random.out 8\n' > script.txt
+tpm2 shell script.txt &> /dev/null
+if [ $? -eq 0 ] || [ -f random.out ]; then
+    echo "tpm2 shell should stop on the first failing command"
+    exit 1
+fi
+
+echo 'getrandom -T none 8' | tpm2 shell &> /dev/null
+if [ $? -eq 0 ]; then
+    echo "tpm2 shell should reject a TCTI per command"
+    exit 1
+fi
+
+echo 'notatool' | tpm2 shell &> /dev/null
+if [ $? -eq 0 ]; then
+    echo "tpm2 shell should fail on unknown tools"
+    exit 1
+fi
+
+exit 0
@@ -282,6 +282,46 @@ tpm2 commit -c key.ctx -t commit.ctr --eccpoint-K K.bin --eccpoint-L L.bin -u E.
 tpm2 sign -c key.ctx -g sha256 -o test.sig test.rnd -s ecdaa --commit-index 1
 tpm2 sign -c key.ctx -g sha256 -o test.sig test.rnd -s ecdaa
 
+# Test batch signing of digests and messages with one key load
+cleanup "no-shut-down"
+
+tpm2 createprimary -Q -C o -c $file_primary_key_ctx
+tpm2 create -Q -G rsa2048:rsassa -u $file_signing_key_pub \
+-r $file_signing_key_priv -C $file_primary_key_ctx
+tpm2 load -Q -C $file_primary_key_ctx -u $file_signing_key_pub \
+-r $file_signing_key_priv -c $file_signing_key_ctx
+
+rm -rf batch.out
+mkdir -p batch.in batch.out
+for i in 1 2 3; do
+    head -c 1000 /dev/urandom > batch.in/msg$i
+    openssl dgst -sha256 -binary batch.in/msg$i > batch.in/msg$i.digest
+done
+
+tpm2 sign -c $file_signing_key_ctx -g sha256 -d -f plain --batch=batch.out \
+batch.in/msg1.digest batch.in/msg2.digest batch.in/msg3.digest
+tpm2 sign -c $file_signing_key_ctx -g sha256 -f plain --batch=batch.out \
+batch.in/msg1 batch.in/msg2 batch.in/msg3
+
+mkdir -p batch.local
+tpm2 sign -c $file_signing_key_ctx -g sha256 -f plain --local-hash \
+--batch=batch.local batch.in/msg1 batch.in/msg2 batch.in/msg3
+
+# RSASSA is deterministic, batch and single signatures must match
+for i in 1 2 3; do
+    tpm2 sign -c $file_signing_key_ctx -g sha256 -d -f plain \
+    -o $file_output_data batch.in/msg$i.digest
+    cmp $file_output_data batch.out/msg$i.digest.sig
+    cmp $file_output_data batch.out/msg$i.sig
+    cmp $file_output_data batch.local/msg$i.sig
+
+    tpm2 sign -c $file_signing_key_ctx -g sha256 -f plain --local-hash \
+    -o $file_output_data batch.in/msg$i
+    cmp $file_output_data batch.out/msg$i.sig
+done
+
+rm -rf batch.in batch.out batch.local $file_output_data
+
 # Test that invalid password returns the proper code
 cleanup "no-shut-down"
 
@@ -301,6 +341,39 @@ tpm2 sign -Q -p "badpassword" -c $file_signing_key_ctx -g $alg_hash \
 if [ $? != 3 ]; then
     echo "Expected RC 3, got: $?" 1>&2
 fi
+
+# Batch mode signs with a fresh ticket per input
+tpm2 hash -Q -C o -g $alg_hash -t $file_output_ticket $file_input_data
+tpm2 sign -Q -c $file_signing_key_ctx -p "mypassword" -g $alg_hash \
+-t $file_output_ticket --batch=. $file_input_data
+if [ $? -eq 0 ]; then
+    echo "Batch mode must reject a validation ticket" 1>&2
+    exit 1
+fi
+
+# Inputs with the same file name would overwrite each other's signature
+mkdir -p batch.a batch.b
+cp $file_input_data batch.a/in
+cp $file_input_data batch.b/in
+tpm2 sign -Q -c $file_signing_key_ctx -p "mypassword" -g $alg_hash \
+--batch=. batch.a/in batch.b/in
+if [ $? -eq 0 ] || [ -e in.sig ]; then
+    echo "Batch mode must reject inputs with the same file name" 1>&2
+    exit 1
+fi
+rm -rf batch.a batch.b
+
+# A policy session only authorizes a single signature
+tpm2 startauthsession -S session.ctx --policy-session
+tpm2 policypassword -S session.ctx
+tpm2 sign -Q -c $file_signing_key_ctx -p "session:session.ctx+mypassword" \
+-g $alg_hash --batch=. $file_input_data
+if [ $? -eq 0 ]; then
+    echo "Batch mode must reject a policy session" 1>&2
+    exit 1
+fi
+tpm2 flushcontext session.ctx
+rm -f session.ctx
 trap onerror ERR
 
 exit 0
@@ -238,6 +238,61 @@ static void test_file_exists_bad_args(void **state) {
     assert_false(res);
 }
 
+static void test_file_map(void **state) {
+
+    test_file *tf = test_file_from_state(state);
+
+    UINT8 data[40000];
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = i & 0xFF;
+    }
+
+    bool res = files_write_bytes(tf->file, data, sizeof(data));
+    assert_true(res);
+
+    int rc = fflush(tf->file);
+    assert_return_code(rc, errno);
+
+    files_mapping mapping;
+    res = files_map_path(tf->path, &mapping);
+    assert_true(res);
+
+    assert_true(mapping.is_mapped);
+    assert_int_equal(mapping.size, sizeof(data));
+    assert_memory_equal(mapping.data, data, sizeof(data));
+
+    files_unmap_path(&mapping);
+    assert_null(mapping.data);
+}
+
+static void test_file_map_unmappable(void **state) {
+
+    (void) state;
+
+    /* character devices can't be mapped and are read instead */
+    files_mapping mapping;
+    bool res = files_map_path("/dev/null", &mapping);
+    assert_true(res);
+
+    assert_false(mapping.is_mapped);
+    assert_int_equal(mapping.size, 0);
+
+    files_unmap_path(&mapping);
+    assert_null(mapping.data);
+}
+
+static void test_file_map_bad_args(void **state) {
+
+    (void) state;
+
+    files_mapping mapping;
+    bool res = files_map_path("this_should_be_a_bad_path", &mapping);
+    assert_false(res);
+
+    res = files_map_path(NULL, &mapping);
+    assert_false(res);
+}
+
 /* link required symbol, but tpm2_tool.c declares it AND main, which
  * we have a main below for cmocka tests.
  */
@@ -279,6 +334,11 @@ int main(int argc, char* argv[]) {
                 test_setup, test_teardown),
         cmocka_unit_test_setup_teardown(test_file_exists_bad_args,
                 test_setup, test_teardown),
+
+        cmocka_unit_test_setup_teardown(test_file_map,
+                test_setup, test_teardown),
+        cmocka_unit_test(test_file_map_unmappable),
+        cmocka_unit_test(test_file_map_bad_args),
     };
 
     return cmocka_run_group_tests(tests, NULL, NULL);
@@ -3,6 +3,8 @@
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include <setjmp.h>
 #include <cmocka.h>
@@ -149,6 +151,183 @@ static void test_pcr_forward_seal(void **state) {
             sizeof(pcr_selections_sha256));
 }
 
+/*
+ * A fake TPM answering PCR_Read with a digest holding the bank and the PCR
+ * index. Commands are queued by the _Async call and answered in order.
+ */
+#define FAKE_MAX_QUEUED 4
+
+static TPML_PCR_SELECTION fake_queue[FAKE_MAX_QUEUED];
+static unsigned fake_queued;
+static unsigned fake_reads;
+static unsigned fake_bump_counter_at;
+static bool fake_is_extending;
+static UINT32 fake_update_counter;
+
+TSS2_RC __wrap_Esys_PCR_Read_Async(ESYS_CONTEXT *esysContext,
+        ESYS_TR shandle1, ESYS_TR shandle2, ESYS_TR shandle3,
+        const TPML_PCR_SELECTION *pcrSelectionIn) {
+
+    (void) esysContext;
+    (void) shandle1;
+    (void) shandle2;
+    (void) shandle3;
+
+    assert_true(fake_queued < FAKE_MAX_QUEUED);
+    fake_queue[fake_queued++] = *pcrSelectionIn;
+
+    return TSS2_RC_SUCCESS;
+}
+
+TSS2_RC __wrap_Esys_PCR_Read_Finish(ESYS_CONTEXT *esysContext,
+        UINT32 *pcrUpdateCounter, TPML_PCR_SELECTION **pcrSelectionOut,
+        TPML_DIGEST **pcrValues) {
+
+    (void) esysContext;
+
+    assert_true(fake_queued > 0);
+    TPML_PCR_SELECTION in = fake_queue[0];
+    memmove(fake_queue, fake_queue + 1, --fake_queued * sizeof(fake_queue[0]));
+
+    if (++fake_reads == fake_bump_counter_at || fake_is_extending) {
+        fake_update_counter++;
+    }
+    *pcrUpdateCounter = fake_update_counter;
+
+    *pcrSelectionOut = calloc(1, sizeof(**pcrSelectionOut));
+    *pcrValues = calloc(1, sizeof(**pcrValues));
+
+    /* like the TPM, answer as many PCRs as fit and report which */
+    TPML_PCR_SELECTION *out = *pcrSelectionOut;
+    UINT32 i, pcr;
+    for (i = 0; i < in.count; i++) {
+        out->pcrSelections[i].hash = in.pcrSelections[i].hash;
+        out->pcrSelections[i].sizeofSelect = in.pcrSelections[i].sizeofSelect;
+        out->count++;
+        for (pcr = 0; pcr < in.pcrSelections[i].sizeofSelect * 8u; pcr++) {
+            if (!(in.pcrSelections[i].pcrSelect[pcr / 8] & (1 << (pcr % 8))) ||
+                    (*pcrValues)->count == ARRAY_LEN((*pcrValues)->digests)) {
+                continue;
+            }
+            out->pcrSelections[i].pcrSelect[pcr / 8] |= 1 << (pcr % 8);
+            TPM2B_DIGEST *d = &(*pcrValues)->digests[(*pcrValues)->count++];
+            d->size = 2;
+            d->buffer[0] = in.pcrSelections[i].hash;
+            d->buffer[1] = pcr;
+        }
+    }
+
+    return TSS2_RC_SUCCESS;
+}
+
+TSS2_RC __wrap_Esys_PCR_Read(ESYS_CONTEXT *esysContext,
+        ESYS_TR shandle1, ESYS_TR shandle2, ESYS_TR shandle3,
+        const TPML_PCR_SELECTION *pcrSelectionIn, UINT32 *pcrUpdateCounter,
+        TPML_PCR_SELECTION **pcrSelectionOut, TPML_DIGEST **pcrValues) {
+
+    TSS2_RC rc = __wrap_Esys_PCR_Read_Async(esysContext, shandle1, shandle2,
+            shandle3, pcrSelectionIn);
+    if (rc != TSS2_RC_SUCCESS) {
+        return rc;
+    }
+
+    return __wrap_Esys_PCR_Read_Finish(esysContext, pcrUpdateCounter,
+            pcrSelectionOut, pcrValues);
+}
+
+static int fake_tpm_reset(void **state) {
+    (void) state;
+
+    fake_queued = 0;
+    fake_reads = 0;
+    fake_bump_counter_at = 0;
+    fake_is_extending = false;
+    fake_update_counter = 42;
+
+    return 0;
+}
+
+static void test_pcr_read_pipelined(void **state) {
+
+    (void) state;
+
+    TPML_PCR_SELECTION pcr_selections = TPML_PCR_SELECTION_EMPTY_INIT;
+    bool result = pcr_parse_selections(
+            "sha1:0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20,21,22,23"
+            "+sha256:0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20,21,"
+            "22,23", &pcr_selections, NULL);
+    assert_true(result);
+
+    tpm2_pcrs pcrs;
+    tool_rc rc = pcr_read_pcr_values((ESYS_CONTEXT *) 0xDEADBEEF,
+            &pcr_selections, &pcrs, NULL, TPM2_ALG_SHA256);
+    assert_int_equal(rc, tool_rc_success);
+
+    /* 48 PCRs at 8 digests per response */
+    assert_int_equal(fake_reads, 6);
+    assert_int_equal(pcrs.count, 6);
+    assert_int_equal(fake_queued, 0);
+
+    /* the digests line up with the selection */
+    unsigned n = 0;
+    size_t vi, di;
+    for (vi = 0; vi < pcrs.count; vi++) {
+        for (di = 0; di < pcrs.pcr_values[vi].count; di++, n++) {
+            TPM2B_DIGEST *d = &pcrs.pcr_values[vi].digests[di];
+            assert_int_equal(d->buffer[0],
+                    n < 24 ? TPM2_ALG_SHA1 : TPM2_ALG_SHA256);
+            assert_int_equal(d->buffer[1], n % 24);
+        }
+    }
+    assert_int_equal(n, 48);
+}
+
+static void test_pcr_read_update_counter(void **state) {
+
+    (void) state;
+
+    TPML_PCR_SELECTION pcr_selections = TPML_PCR_SELECTION_EMPTY_INIT;
+    bool result = pcr_parse_selections("sha256:0,1,2,3,4,5,6,7,8,9,10,11",
+            &pcr_selections, NULL);
+    assert_true(result);
+
+    /* an extend between the two chunks restarts the read */
+    fake_bump_counter_at = 2;
+
+    tpm2_pcrs pcrs;
+    tool_rc rc = pcr_read_pcr_values((ESYS_CONTEXT *) 0xDEADBEEF,
+            &pcr_selections, &pcrs, NULL, TPM2_ALG_SHA256);
+    assert_int_equal(rc, tool_rc_success);
+    assert_int_equal(fake_reads, 4);
+    assert_int_equal(pcrs.count, 2);
+    assert_int_equal(pcrs.pcr_values[0].count, 8);
+    assert_int_equal(pcrs.pcr_values[1].count, 4);
+}
+
+static void test_pcr_read_update_counter_racing(void **state) {
+
+    (void) state;
+
+    TPML_PCR_SELECTION pcr_selections = TPML_PCR_SELECTION_EMPTY_INIT;
+    bool result = pcr_parse_selections("sha256:0,1,2,3,4,5,6,7,8,9,10,11",
+            &pcr_selections, NULL);
+    assert_true(result);
+
+    /* PCRs extended all the time fall back to reading them in turns */
+    fake_is_extending = true;
+
+    tpm2_pcrs pcrs;
+    tool_rc rc = pcr_read_pcr_values((ESYS_CONTEXT *) 0xDEADBEEF,
+            &pcr_selections, &pcrs, NULL, TPM2_ALG_SHA256);
+    assert_int_equal(rc, tool_rc_success);
+    assert_int_equal(fake_reads, 3 * 2 + 2);
+    assert_int_equal(fake_queued, 0);
+    assert_int_equal(pcrs.count, 2);
+    assert_int_equal(pcrs.pcr_values[0].count, 8);
+    assert_int_equal(pcrs.pcr_values[1].count, 4);
+    assert_int_equal(pcrs.pcr_values[1].digests[3].buffer[1], 11);
+}
+
 /* link required symbol, but tpm2_tool.c declares it AND main, which
  * we have a main below for cmocka tests.
  */
@@ -160,7 +339,11 @@ int main(int argc, char* argv[]) {
 
     const struct CMUnitTest tests[] = {
         cmocka_unit_test(test_pcr_alg_nice_names),
-        cmocka_unit_test(test_pcr_forward_seal)
+        cmocka_unit_test(test_pcr_forward_seal),
+        cmocka_unit_test_setup(test_pcr_read_pipelined, fake_tpm_reset),
+        cmocka_unit_test_setup(test_pcr_read_update_counter, fake_tpm_reset),
+        cmocka_unit_test_setup(test_pcr_read_update_counter_racing,
+                fake_tpm_reset),
     };
 
     return cmocka_run_group_tests(tests, NULL, NULL);
@@ -0,0 +1,234 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "tpm2_capability.h"
+#include "tpm2_util.h"
+
+#define TEST_MANUFACTURER 0x49424d00
+#define TEST_MAX_DIGEST   64
+
+static unsigned getcap_calls;
+
+TSS2_RC __wrap_Esys_GetCapability(ESYS_CONTEXT *context, ESYS_TR session1,
+        ESYS_TR session2, ESYS_TR session3, TPM2_CAP capability,
+        UINT32 property, UINT32 propertyCount, TPMI_YES_NO *moreData,
+        TPMS_CAPABILITY_DATA **capabilityData) {
+
+    UNUSED(context);
+    UNUSED(session1);
+    UNUSED(session2);
+    UNUSED(session3);
+    UNUSED(property);
+    UNUSED(propertyCount);
+
+    getcap_calls++;
+
+    *moreData = TPM2_NO;
+    *capabilityData = calloc(1, sizeof(**capabilityData));
+    (*capabilityData)->capability = capability;
+
+    if (capability == TPM2_CAP_PCRS) {
+        TPML_PCR_SELECTION *pcrs = &(*capabilityData)->data.assignedPCR;
+        pcrs->count = 2;
+        pcrs->pcrSelections[0].hash = TPM2_ALG_SHA1;
+        pcrs->pcrSelections[0].sizeofSelect = 3;
+        pcrs->pcrSelections[1].hash = TPM2_ALG_SHA256;
+        pcrs->pcrSelections[1].sizeofSelect = 3;
+        memset(pcrs->pcrSelections[1].pcrSelect, 0xff, 3);
+        return TSS2_RC_SUCCESS;
+    }
+
+    /* the TPM continues into the variable group */
+    TPML_TAGGED_TPM_PROPERTY *properties =
+            &(*capabilityData)->data.tpmProperties;
+    properties->count = 5;
+    properties->tpmProperty[0].property = TPM2_PT_MANUFACTURER;
+    properties->tpmProperty[0].value = TEST_MANUFACTURER;
+    properties->tpmProperty[1].property = TPM2_PT_FIRMWARE_VERSION_1;
+    properties->tpmProperty[1].value = 0x20191023;
+    properties->tpmProperty[2].property = TPM2_PT_FIRMWARE_VERSION_2;
+    properties->tpmProperty[2].value = 0x00163636;
+    properties->tpmProperty[3].property = TPM2_PT_MAX_DIGEST;
+    properties->tpmProperty[3].value = TEST_MAX_DIGEST;
+    properties->tpmProperty[4].property = TPM2_PT_STARTUP_CLEAR;
+    properties->tpmProperty[4].value = 0x8000000f;
+
+    return TSS2_RC_SUCCESS;
+}
+
+static char cache_dir[] = "/tmp/tpm2_capability_XXXXXX";
+
+static int setup(void **state) {
+    UNUSED(state);
+
+    if (!mkdtemp(cache_dir)) {
+        return -1;
+    }
+
+    setenv("XDG_CACHE_HOME", cache_dir, 1);
+    unsetenv(TPM2TOOLS_ENV_CAPABILITY_CACHE);
+
+    return 0;
+}
+
+static int teardown(void **state) {
+    UNUSED(state);
+
+    char cmd[256];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", cache_dir);
+
+    return system(cmd) ? -1 : 0;
+}
+
+static int reset(void **state) {
+    UNUSED(state);
+
+    tpm2_capability_cache_flush();
+    unsetenv(TPM2TOOLS_ENV_CAPABILITY_CACHE);
+    tpm2_capability_cache_init("mssim:port=2321");
+    getcap_calls = 0;
+
+    return 0;
+}
+
+static void test_fixed_property_in_process(void **state) {
+    UNUSED(state);
+
+    ESYS_CONTEXT *ectx = (ESYS_CONTEXT *) 0xDEADBEEF;
+
+    UINT32 value = 0;
+    tool_rc rc = tpm2_capability_get_fixed_property(ectx, TPM2_PT_MAX_DIGEST,
+            &value);
+    assert_int_equal(rc, tool_rc_success);
+    assert_int_equal(value, TEST_MAX_DIGEST);
+
+    rc = tpm2_capability_get_fixed_property(ectx, TPM2_PT_MANUFACTURER,
+            &value);
+    assert_int_equal(rc, tool_rc_success);
+    assert_int_equal(value, TEST_MANUFACTURER);
+    assert_int_equal(getcap_calls, 1);
+
+    /* variable properties are never served from the cache */
+    rc = tpm2_capability_get_fixed_property(ectx, TPM2_PT_STARTUP_CLEAR,
+            &value);
+    assert_int_equal(rc, tool_rc_general_error);
+
+    /* nothing is kept on disk unless enabled */
+    rc = tpm2_capability_get_fixed_property((ESYS_CONTEXT *) 0xCAFEF00D,
+            TPM2_PT_MAX_DIGEST, &value);
+    assert_int_equal(rc, tool_rc_success);
+    assert_int_equal(getcap_calls, 2);
+}
+
+static void test_disk_cache(void **state) {
+    UNUSED(state);
+
+    setenv(TPM2TOOLS_ENV_CAPABILITY_CACHE, "1", 1);
+    tpm2_capability_cache_init("mssim:port=2321");
+
+    UINT32 value = 0;
+    tool_rc rc = tpm2_capability_get_fixed_property((ESYS_CONTEXT *) 0xDEADBEEF,
+            TPM2_PT_MAX_DIGEST, &value);
+    assert_int_equal(rc, tool_rc_success);
+    assert_int_equal(value, TEST_MAX_DIGEST);
+    assert_int_equal(getcap_calls, 1);
+
+    /* a new context, like the next tool run, sends no command */
+    rc = tpm2_capability_get_fixed_property((ESYS_CONTEXT *) 0xCAFEF00D,
+            TPM2_PT_MAX_DIGEST, &value);
+    assert_int_equal(rc, tool_rc_success);
+    assert_int_equal(value, TEST_MAX_DIGEST);
+    assert_int_equal(getcap_calls, 1);
+
+    /* the PCR allocation is never served from disk */
+    TPMS_CAPABILITY_DATA *pcrs = NULL;
+    rc = tpm2_capability_get_pcrs((ESYS_CONTEXT *) 0xCAFEF00D, &pcrs);
+    assert_int_equal(rc, tool_rc_success);
+    assert_int_equal(getcap_calls, 2);
+    assert_int_equal(pcrs->data.assignedPCR.count, 2);
+    assert_int_equal(pcrs->data.assignedPCR.pcrSelections[1].hash,
+            TPM2_ALG_SHA256);
+    assert_int_equal(pcrs->data.assignedPCR.pcrSelections[1].pcrSelect[2],
+            0xff);
+    free(pcrs);
+
+    rc = tpm2_capability_get_pcrs((ESYS_CONTEXT *) 0xCAFEF00D, &pcrs);
+    assert_int_equal(rc, tool_rc_success);
+    assert_int_equal(getcap_calls, 2);
+    free(pcrs);
+
+    /* another TCTI is another TPM */
+    tpm2_capability_cache_init("mssim:port=2331");
+    rc = tpm2_capability_get_fixed_property((ESYS_CONTEXT *) 0xDEADBEEF,
+            TPM2_PT_MAX_DIGEST, &value);
+    assert_int_equal(rc, tool_rc_success);
+    assert_int_equal(getcap_calls, 3);
+
+    /* a flush invalidates the entry on disk */
+    tpm2_capability_cache_init("mssim:port=2321");
+    rc = tpm2_capability_get_fixed_property((ESYS_CONTEXT *) 0xCAFEF00D,
+            TPM2_PT_MAX_DIGEST, &value);
+    assert_int_equal(rc, tool_rc_success);
+    assert_int_equal(getcap_calls, 3);
+    tpm2_capability_cache_flush();
+    rc = tpm2_capability_get_fixed_property((ESYS_CONTEXT *) 0xCAFEF00D,
+            TPM2_PT_MAX_DIGEST, &value);
+    assert_int_equal(rc, tool_rc_success);
+    assert_int_equal(getcap_calls, 4);
+}
+
+static void test_disk_cache_refresh(void **state) {
+    UNUSED(state);
+
+    setenv(TPM2TOOLS_ENV_CAPABILITY_CACHE, "1", 1);
+    tpm2_capability_cache_init("mssim:port=2321");
+
+    UINT32 value = 0;
+    tool_rc rc = tpm2_capability_get_fixed_property((ESYS_CONTEXT *) 0xDEADBEEF,
+            TPM2_PT_MAX_DIGEST, &value);
+    assert_int_equal(rc, tool_rc_success);
+    getcap_calls = 0;
+
+    /* a firmware update needs a refresh, which ignores and replaces the entry */
+    setenv(TPM2TOOLS_ENV_CAPABILITY_CACHE, "refresh", 1);
+    tpm2_capability_cache_init("mssim:port=2321");
+
+    rc = tpm2_capability_get_fixed_property((ESYS_CONTEXT *) 0xCAFEF00D,
+            TPM2_PT_MAX_DIGEST, &value);
+    assert_int_equal(rc, tool_rc_success);
+    assert_int_equal(getcap_calls, 1);
+
+    setenv(TPM2TOOLS_ENV_CAPABILITY_CACHE, "1", 1);
+    tpm2_capability_cache_init("mssim:port=2321");
+
+    rc = tpm2_capability_get_fixed_property((ESYS_CONTEXT *) 0xDEADBEEF,
+            TPM2_PT_MAX_DIGEST, &value);
+    assert_int_equal(rc, tool_rc_success);
+    assert_int_equal(getcap_calls, 1);
+}
+
+/* link required symbol, but tpm2_tool.c declares it AND main, which
+ * we have a main below for cmocka tests.
+ */
+bool output_enabled = true;
+
+int main(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup(test_fixed_property_in_process, reset),
+        cmocka_unit_test_setup(test_disk_cache, reset),
+        cmocka_unit_test_setup(test_disk_cache_refresh, reset),
+    };
+
+    return cmocka_run_group_tests(tests, setup, teardown);
+}
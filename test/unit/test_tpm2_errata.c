@@ -7,12 +7,16 @@
 #include <setjmp.h>
 #include <cmocka.h>
 
+#include "tpm2_capability.h"
 #include "tpm2_errata.h"
 #include "tpm2_util.h"
 
 static inline void setcaps(UINT32 level, UINT32 rev, UINT32 day, UINT32 year,
         TSS2_RC rc) {
 
+    /* the properties are cached, make the next init query them again */
+    tpm2_capability_cache_flush();
+
     will_return(__wrap_Esys_GetCapability, level);
     will_return(__wrap_Esys_GetCapability, rev);
     will_return(__wrap_Esys_GetCapability, day);
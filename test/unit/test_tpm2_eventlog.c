@@ -3,6 +3,7 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <setjmp.h>
 #include <cmocka.h>
@@ -10,6 +11,7 @@
 #include <tss2/tss2_tpm2_types.h>
 
 #include "tpm2_eventlog.h"
+#include "tpm2_openssl.h"
 
 #define TCG_DIGEST2_SHA1_SIZE (sizeof(TCG_DIGEST2) + TPM2_SHA_DIGEST_SIZE)
 #define TCG_DIGEST2_SHA256_SIZE (sizeof(TCG_DIGEST2) + TPM2_SHA256_DIGEST_SIZE)
@@ -96,6 +98,89 @@ static void test_sha256(void **state){
     assert_true(foreach_digest2(&ctx, 0, pcr_index, digest, 1, TCG_DIGEST2_SHA256_SIZE, 0));
     assert_memory_equal(ctx.sha256_pcrs[pcr_index], sha256sum, sizeof(sha256sum));
 }
+/* a SHA1 and a SHA256 digest, filled with the given bytes */
+static void refdb_test_digests(uint8_t *buf, uint8_t sha1, uint8_t sha256) {
+
+    TCG_DIGEST2 *digest = (TCG_DIGEST2*)buf;
+    digest->AlgorithmId = TPM2_ALG_SHA1;
+    memset(digest->Digest, sha1, TPM2_SHA1_DIGEST_SIZE);
+
+    digest = (TCG_DIGEST2*)(buf + TCG_DIGEST2_SHA1_SIZE);
+    digest->AlgorithmId = TPM2_ALG_SHA256;
+    memset(digest->Digest, sha256, TPM2_SHA256_DIGEST_SIZE);
+}
+static tpm2_refdb_verdict refdb_test_verdict(tpm2_refdb const *refdb,
+        uint32_t banks, uint8_t sha1, uint8_t sha256) {
+
+    uint8_t buf[TCG_DIGEST2_SHA1_SIZE + TCG_DIGEST2_SHA256_SIZE] = { 0 };
+    refdb_test_digests(buf, sha1, sha256);
+
+    tpm2_eventlog_context ctx = { .refdb = refdb, .refdb_banks = banks };
+    assert_true(foreach_digest2(&ctx, 0, 0, (TCG_DIGEST2*)buf, 2,
+            sizeof(buf), 0));
+
+    return ctx.refdb_verdict;
+}
+static void test_refdb_verdict_banks(void **state){
+
+    (void)state;
+    char source[] = "/tmp/test_tpm2_eventlog_src_XXXXXX";
+    char db[] = "/tmp/test_tpm2_eventlog_db_XXXXXX";
+    int fd = mkstemp(source);
+    assert_true(fd >= 0);
+    close(fd);
+    fd = mkstemp(db);
+    assert_true(fd >= 0);
+    close(fd);
+
+    /* the SHA1 digest of 0x11 is allowed, the SHA256 digest of 0x33 denied */
+    FILE *f = fopen(source, "w");
+    assert_non_null(f);
+    fprintf(f, "sha1:");
+    size_t i;
+    for (i = 0; i < TPM2_SHA1_DIGEST_SIZE; i++) {
+        fprintf(f, "11");
+    }
+    fprintf(f, " allow good\nsha256:");
+    for (i = 0; i < TPM2_SHA256_DIGEST_SIZE; i++) {
+        fprintf(f, "33");
+    }
+    fprintf(f, " deny bad\n");
+    assert_int_equal(fclose(f), 0);
+
+    assert_true(tpm2_refdb_compile(source, db));
+    tpm2_refdb *refdb = tpm2_refdb_load(db);
+    assert_non_null(refdb);
+
+    const uint32_t sha1 = 1u << TPM2_ALG_SHA1;
+    const uint32_t sha256 = 1u << TPM2_ALG_SHA256;
+    const uint32_t sha384 = 1u << TPM2_ALG_SHA384;
+
+    /* an unknown digest of a checked bank is not outweighed by an allowed one */
+    assert_int_equal(refdb_test_verdict(refdb, 0, 0x11, 0x22),
+            tpm2_refdb_verdict_unknown);
+    assert_int_equal(refdb_test_verdict(refdb, sha1 | sha256, 0x11, 0x22),
+            tpm2_refdb_verdict_unknown);
+    assert_int_equal(refdb_test_verdict(refdb, sha256, 0x11, 0x22),
+            tpm2_refdb_verdict_unknown);
+    assert_int_equal(refdb_test_verdict(refdb, sha1, 0x11, 0x22),
+            tpm2_refdb_verdict_allow);
+    /* no digest of a checked bank */
+    assert_int_equal(refdb_test_verdict(refdb, sha384, 0x11, 0x22),
+            tpm2_refdb_verdict_unknown);
+
+    /* a denied digest wins, unless its bank is not checked */
+    assert_int_equal(refdb_test_verdict(refdb, 0, 0x11, 0x33),
+            tpm2_refdb_verdict_deny);
+    assert_int_equal(refdb_test_verdict(refdb, 0, 0x22, 0x33),
+            tpm2_refdb_verdict_deny);
+    assert_int_equal(refdb_test_verdict(refdb, sha1, 0x11, 0x33),
+            tpm2_refdb_verdict_allow);
+
+    tpm2_refdb_free(refdb);
+    unlink(source);
+    unlink(db);
+}
 static void test_foreach_digest2_cbfail(void **state){
 
     (void)state;
@@ -551,6 +636,196 @@ static void test_specid_event(void **state) {
 
     assert_true(specid_event(event, sizeof(buf), &next));
 }
+static size_t replay_test_log(uint8_t *buf, size_t events) {
+
+    size_t offset = 0, i;
+    for (i = 0; i < events; i++) {
+        TCG_EVENT_HEADER2 *eventhdr = (TCG_EVENT_HEADER2*)(buf + offset);
+        /* start with an H-CRTM event, so the locality handling is replayed */
+        bool is_hcrtm = (i == 0);
+        const char *data = is_hcrtm ? "HCRTM" : "";
+
+        eventhdr->PCRIndex = i % 8;
+        eventhdr->EventType = is_hcrtm ? EV_EFI_HCRTM_EVENT : EV_POST_CODE;
+        eventhdr->DigestCount = 2;
+        offset += sizeof(*eventhdr);
+
+        TCG_DIGEST2 *digest = (TCG_DIGEST2*)(buf + offset);
+        digest->AlgorithmId = TPM2_ALG_SHA1;
+        memset(digest->Digest, i, TPM2_SHA1_DIGEST_SIZE);
+        offset += TCG_DIGEST2_SHA1_SIZE;
+
+        digest = (TCG_DIGEST2*)(buf + offset);
+        digest->AlgorithmId = TPM2_ALG_SHA256;
+        memset(digest->Digest, ~i, TPM2_SHA256_DIGEST_SIZE);
+        offset += TCG_DIGEST2_SHA256_SIZE;
+
+        TCG_EVENT2 *event = (TCG_EVENT2*)(buf + offset);
+        event->EventSize = strlen(data);
+        memcpy(event->Event, data, event->EventSize);
+        offset += sizeof(*event) + event->EventSize;
+    }
+
+    return offset;
+}
+static void test_replay_matches_sequential(void **state){
+
+    (void)state;
+    uint8_t buf[8192] = { 0, };
+    size_t size = replay_test_log(buf, 64);
+
+    tpm2_eventlog_context sequential = { 0 };
+    assert_true(foreach_event2(&sequential, (TCG_EVENT_HEADER2*)buf, size));
+
+    tpm2_eventlog_context parallel = { 0 };
+    parallel.replay = eventlog_replay_new();
+    assert_non_null(parallel.replay);
+    assert_true(foreach_event2(&parallel, (TCG_EVENT_HEADER2*)buf, size));
+    assert_true(eventlog_replay_run(parallel.replay, 4));
+    eventlog_replay_free(parallel.replay);
+
+    assert_int_equal(parallel.sha1_used, sequential.sha1_used);
+    assert_int_equal(parallel.sha256_used, sequential.sha256_used);
+    assert_memory_equal(parallel.sha1_pcrs, sequential.sha1_pcrs,
+            sizeof(sequential.sha1_pcrs));
+    assert_memory_equal(parallel.sha256_pcrs, sequential.sha256_pcrs,
+            sizeof(sequential.sha256_pcrs));
+}
+static void test_replay_deferred(void **state){
+
+    (void)state;
+    uint8_t buf[TCG_DIGEST2_SHA1_SIZE] = { 0, };
+    TCG_DIGEST2 *digest = (TCG_DIGEST2*)buf;
+    digest->AlgorithmId = TPM2_ALG_SHA1;
+
+    tpm2_eventlog_context ctx = { 0 };
+    ctx.replay = eventlog_replay_new();
+    assert_non_null(ctx.replay);
+
+    /* nothing is extended until the replay runs */
+    assert_true(foreach_digest2(&ctx, EV_POST_CODE, 3, digest, 1,
+            sizeof(buf), 0));
+    uint8_t zero[TPM2_SHA1_DIGEST_SIZE] = { 0, };
+    assert_memory_equal(ctx.sha1_pcrs[3], zero, sizeof(zero));
+
+    assert_true(eventlog_replay_run(ctx.replay, 0));
+    assert_memory_not_equal(ctx.sha1_pcrs[3], zero, sizeof(zero));
+
+    eventlog_replay_free(ctx.replay);
+}
+static size_t verify_test_log(uint8_t *buf, size_t events) {
+
+    size_t offset = 0, i;
+    for (i = 0; i < events; i++) {
+        TCG_EVENT_HEADER2 *eventhdr = (TCG_EVENT_HEADER2*)(buf + offset);
+        /* alternate separators and grub command lines, hashed with the NUL */
+        bool is_ipl = i % 2;
+        const char *data = is_ipl ? "grub_cmd: linux /vmlinuz" : "\0\0\0";
+        size_t data_size = is_ipl ? strlen(data) + 1 : 4;
+        size_t hashed = is_ipl ? sizeof("linux /vmlinuz") : data_size;
+
+        eventhdr->PCRIndex = is_ipl ? 8 : i % 8;
+        eventhdr->EventType = is_ipl ? EV_IPL : EV_SEPARATOR;
+        eventhdr->DigestCount = 2;
+        offset += sizeof(*eventhdr);
+
+        TCG_DIGEST2 *sha1 = (TCG_DIGEST2*)(buf + offset);
+        offset += TCG_DIGEST2_SHA1_SIZE;
+        TCG_DIGEST2 *sha256 = (TCG_DIGEST2*)(buf + offset);
+        offset += TCG_DIGEST2_SHA256_SIZE;
+
+        TCG_EVENT2 *event = (TCG_EVENT2*)(buf + offset);
+        event->EventSize = data_size;
+        memcpy(event->Event, data, data_size);
+        offset += sizeof(*event) + event->EventSize;
+
+        BYTE *payload = event->Event + data_size - hashed;
+        TPM2B_DIGEST digest;
+        sha1->AlgorithmId = TPM2_ALG_SHA1;
+        assert_true(tpm2_openssl_hash_compute_data(TPM2_ALG_SHA1, payload,
+                hashed, &digest));
+        memcpy(sha1->Digest, digest.buffer, TPM2_SHA1_DIGEST_SIZE);
+        sha256->AlgorithmId = TPM2_ALG_SHA256;
+        assert_true(tpm2_openssl_hash_compute_data(TPM2_ALG_SHA256, payload,
+                hashed, &digest));
+        memcpy(sha256->Digest, digest.buffer, TPM2_SHA256_DIGEST_SIZE);
+    }
+
+    return offset;
+}
+static void test_verify_deferred(void **state){
+
+    (void)state;
+    uint8_t buf[16384] = { 0, };
+    size_t size = verify_test_log(buf, 99);
+
+    size_t count = 0;
+    tpm2_eventlog_context ctx = { .data = &count };
+    ctx.verify = eventlog_verify_new();
+    assert_non_null(ctx.verify);
+
+    assert_true(foreach_event2(&ctx, (TCG_EVENT_HEADER2*)buf, size));
+    assert_true(eventlog_verify_run(ctx.verify, 4));
+
+    /* the payload of the last separator no longer matches its digests */
+    buf[size - 1] = 0xff;
+    assert_true(foreach_event2(&ctx, (TCG_EVENT_HEADER2*)buf, size));
+    assert_false(eventlog_verify_run(ctx.verify, 4));
+
+    /* the jobs of a run are dropped, nothing is left to verify */
+    assert_true(eventlog_verify_run(ctx.verify, 0));
+
+    eventlog_verify_free(ctx.verify);
+}
+static void test_parse_eventlog_incremental(void **state){
+
+    (void)state;
+    uint8_t buf[8192] = { 0, };
+    size_t size = replay_test_log(buf, 64);
+
+    tpm2_eventlog_context whole = { 0 };
+    assert_true(foreach_event2(&whole, (TCG_EVENT_HEADER2*)buf, size));
+
+    /* the log grows by odd amounts, events are cut in the middle */
+    tpm2_eventlog_context ctx = {
+        .is_header_parsed = true,
+    };
+    size_t parsed = 0;
+    size_t written;
+    for (written = 0; written < size; ) {
+        written += 77;
+        if (written > size) {
+            written = size;
+        }
+
+        size_t consumed;
+        assert_true(parse_eventlog_incremental(&ctx, buf + parsed,
+                written - parsed, &consumed));
+        parsed += consumed;
+        assert_true(parsed <= written);
+    }
+    assert_int_equal(parsed, size);
+
+    assert_int_equal(ctx.sha1_used, whole.sha1_used);
+    assert_int_equal(ctx.sha256_used, whole.sha256_used);
+    assert_memory_equal(ctx.sha1_pcrs, whole.sha1_pcrs,
+            sizeof(whole.sha1_pcrs));
+    assert_memory_equal(ctx.sha256_pcrs, whole.sha256_pcrs,
+            sizeof(whole.sha256_pcrs));
+}
+static void test_parse_eventlog_incremental_nohdr(void **state){
+
+    (void)state;
+    uint8_t buf[sizeof(TCG_EVENT) - 1] = { 0, };
+
+    /* nothing is parsed until the first event is complete */
+    tpm2_eventlog_context ctx = { 0 };
+    size_t consumed = 1;
+    assert_true(parse_eventlog_incremental(&ctx, buf, sizeof(buf),
+            &consumed));
+    assert_int_equal(consumed, 0);
+    assert_false(ctx.is_header_parsed);
+}
 int main(void) {
 
     const struct CMUnitTest tests[] = {
@@ -561,6 +836,7 @@ int main(void) {
         cmocka_unit_test(test_foreach_digest2_cbnull),
         cmocka_unit_test(test_sha1),
         cmocka_unit_test(test_sha256),
+        cmocka_unit_test(test_refdb_verdict_banks),
         cmocka_unit_test(test_digest2_accumulator_callback),
         cmocka_unit_test(test_digest2_accumulator_callback_null),
         cmocka_unit_test(test_parse_event2_badhdr),
@@ -588,6 +864,11 @@ int main(void) {
         cmocka_unit_test(test_specid_event_nosizeforvendorstruct),
         cmocka_unit_test(test_specid_event_nosizeforvendordata),
         cmocka_unit_test(test_specid_event),
+        cmocka_unit_test(test_replay_matches_sequential),
+        cmocka_unit_test(test_replay_deferred),
+        cmocka_unit_test(test_verify_deferred),
+        cmocka_unit_test(test_parse_eventlog_incremental),
+        cmocka_unit_test(test_parse_eventlog_incremental_nohdr),
     };
 
     return cmocka_run_group_tests(tests, NULL, NULL);
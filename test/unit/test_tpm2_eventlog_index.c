@@ -0,0 +1,251 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <tss2/tss2_tpm2_types.h>
+
+#include "tpm2_eventlog.h"
+#include "tpm2_eventlog_index.h"
+
+#define TCG_DIGEST2_SHA1_SIZE (sizeof(TCG_DIGEST2) + TPM2_SHA1_DIGEST_SIZE)
+#define TCG_DIGEST2_SHA256_SIZE (sizeof(TCG_DIGEST2) + TPM2_SHA256_DIGEST_SIZE)
+
+/* enough events for a few snapshots */
+#define TEST_EVENTS (3 * EVENTLOG_INDEX_SNAPSHOT_INTERVAL + 17)
+
+typedef struct test_log test_log;
+struct test_log {
+    uint8_t buf[TEST_EVENTS * 96];
+    size_t size;
+    /* the offset of every event, the SpecID event is event 0 */
+    size_t offsets[TEST_EVENTS + 2];
+};
+
+static void test_log_build(test_log *log) {
+
+    memset(log, 0, sizeof(*log));
+
+    TCG_EVENT *specid = (TCG_EVENT*)log->buf;
+    specid->eventType = EV_NO_ACTION;
+    specid->eventDataSize = sizeof(TCG_SPECID_EVENT) +
+        2 * sizeof(TCG_SPECID_ALG) + sizeof(TCG_VENDOR_INFO);
+    TCG_SPECID_EVENT *event_specid = (TCG_SPECID_EVENT*)specid->event;
+    event_specid->numberOfAlgorithms = 2;
+    event_specid->digestSizes[0].algorithmId = TPM2_ALG_SHA1;
+    event_specid->digestSizes[0].digestSize = TPM2_SHA1_DIGEST_SIZE;
+    event_specid->digestSizes[1].algorithmId = TPM2_ALG_SHA256;
+    event_specid->digestSizes[1].digestSize = TPM2_SHA256_DIGEST_SIZE;
+    size_t offset = sizeof(*specid) + specid->eventDataSize;
+
+    size_t i;
+    for (i = 0; i < TEST_EVENTS; i++) {
+        log->offsets[i + 1] = offset;
+
+        TCG_EVENT_HEADER2 *eventhdr = (TCG_EVENT_HEADER2*)(log->buf + offset);
+        /* start with an H-CRTM event, so the locality handling is replayed */
+        bool is_hcrtm = (i == 0);
+        const char *data = is_hcrtm ? "HCRTM" : "";
+
+        eventhdr->PCRIndex = i % 8;
+        eventhdr->EventType = is_hcrtm ? EV_EFI_HCRTM_EVENT : EV_POST_CODE;
+        eventhdr->DigestCount = 2;
+        offset += sizeof(*eventhdr);
+
+        TCG_DIGEST2 *digest = (TCG_DIGEST2*)(log->buf + offset);
+        digest->AlgorithmId = TPM2_ALG_SHA1;
+        memset(digest->Digest, i, TPM2_SHA1_DIGEST_SIZE);
+        offset += TCG_DIGEST2_SHA1_SIZE;
+
+        digest = (TCG_DIGEST2*)(log->buf + offset);
+        digest->AlgorithmId = TPM2_ALG_SHA256;
+        memset(digest->Digest, ~i, TPM2_SHA256_DIGEST_SIZE);
+        offset += TCG_DIGEST2_SHA256_SIZE;
+
+        TCG_EVENT2 *event = (TCG_EVENT2*)(log->buf + offset);
+        event->EventSize = strlen(data);
+        memcpy(event->Event, data, event->EventSize);
+        offset += sizeof(*event) + event->EventSize;
+    }
+
+    log->offsets[TEST_EVENTS + 1] = offset;
+    log->size = offset;
+}
+
+/* the PCRs after event last, replayed by parsing all events up to it */
+static void test_log_replay(test_log *log, size_t last,
+        tpm2_eventlog_context *ctx) {
+
+    memset(ctx, 0, sizeof(*ctx));
+    assert_true(foreach_event2(ctx,
+            (TCG_EVENT_HEADER2*)(log->buf + log->offsets[1]),
+            log->offsets[last + 1] - log->offsets[1]));
+}
+
+static bool test_event2hdr_callback(TCG_EVENT_HEADER2 const *eventhdr,
+        size_t size, void *data) {
+
+    (void)size;
+    size_t *count = (size_t*)data;
+
+    /* the query numbers the events like the whole log does */
+    assert_int_equal(eventhdr->PCRIndex, (*count - 1) % 8);
+    (*count)++;
+
+    return true;
+}
+
+static void test_eventlog_index_query_all(void **state) {
+
+    (void)state;
+    static test_log log;
+    test_log_build(&log);
+
+    tpm2_eventlog_index *index = tpm2_eventlog_index_build(log.buf, log.size);
+    assert_non_null(index);
+    assert_int_equal(tpm2_eventlog_index_count(index), TEST_EVENTS + 1);
+
+    tpm2_eventlog_context whole = { 0 };
+    assert_true(parse_eventlog(&whole, log.buf, log.size));
+
+    tpm2_eventlog_context ctx = { 0 };
+    assert_true(tpm2_eventlog_index_query(index, &ctx, log.buf, 0,
+            TEST_EVENTS, UINT32_MAX, NULL));
+
+    assert_int_equal(ctx.sha1_used, whole.sha1_used);
+    assert_int_equal(ctx.sha256_used, whole.sha256_used);
+    assert_memory_equal(ctx.sha1_pcrs, whole.sha1_pcrs,
+            sizeof(whole.sha1_pcrs));
+    assert_memory_equal(ctx.sha256_pcrs, whole.sha256_pcrs,
+            sizeof(whole.sha256_pcrs));
+
+    tpm2_eventlog_index_free(index);
+}
+
+static void test_eventlog_index_query_range(void **state) {
+
+    (void)state;
+    static test_log log;
+    test_log_build(&log);
+
+    tpm2_eventlog_index *index = tpm2_eventlog_index_build(log.buf, log.size);
+    assert_non_null(index);
+
+    /* ranges starting before, at and after a snapshot */
+    static const size_t ranges[][2] = {
+        { 1, 1 },
+        { 5, EVENTLOG_INDEX_SNAPSHOT_INTERVAL + 9 },
+        { EVENTLOG_INDEX_SNAPSHOT_INTERVAL, EVENTLOG_INDEX_SNAPSHOT_INTERVAL },
+        { 2 * EVENTLOG_INDEX_SNAPSHOT_INTERVAL + 3, TEST_EVENTS },
+    };
+
+    size_t i;
+    for (i = 0; i < sizeof(ranges) / sizeof(ranges[0]); i++) {
+        size_t first = ranges[i][0];
+        size_t last = ranges[i][1];
+
+        tpm2_eventlog_context expected;
+        test_log_replay(&log, last, &expected);
+
+        size_t count = 0;
+        tpm2_eventlog_context ctx = {
+            .data = &count,
+            .event2hdr_cb = test_event2hdr_callback,
+        };
+        uint32_t pcrs = (1 << 3) | (1 << 0);
+        assert_true(tpm2_eventlog_index_query(index, &ctx, log.buf, first,
+                last, pcrs, &count));
+
+        assert_int_equal(ctx.sha1_used, expected.sha1_used & pcrs);
+        assert_int_equal(ctx.sha256_used, expected.sha256_used & pcrs);
+        if (ctx.sha1_used & (1 << 3)) {
+            assert_memory_equal(ctx.sha1_pcrs[3], expected.sha1_pcrs[3],
+                    sizeof(expected.sha1_pcrs[3]));
+            assert_memory_equal(ctx.sha256_pcrs[3], expected.sha256_pcrs[3],
+                    sizeof(expected.sha256_pcrs[3]));
+        }
+        assert_memory_equal(ctx.sha1_pcrs[0], expected.sha1_pcrs[0],
+                sizeof(expected.sha1_pcrs[0]));
+        assert_memory_equal(ctx.sha256_pcrs[0], expected.sha256_pcrs[0],
+                sizeof(expected.sha256_pcrs[0]));
+    }
+
+    tpm2_eventlog_context ctx = { 0 };
+    assert_false(tpm2_eventlog_index_query(index, &ctx, log.buf, 3, 2,
+            UINT32_MAX, NULL));
+    assert_false(tpm2_eventlog_index_query(index, &ctx, log.buf, 0,
+            TEST_EVENTS + 1, UINT32_MAX, NULL));
+
+    tpm2_eventlog_index_free(index);
+}
+
+static void test_eventlog_index_save_load(void **state) {
+
+    (void)state;
+    static test_log log;
+    test_log_build(&log);
+
+    char path[] = "/tmp/test_tpm2_eventlog_index_XXXXXX";
+    int fd = mkstemp(path);
+    assert_true(fd >= 0);
+    close(fd);
+
+    tpm2_eventlog_index *index = tpm2_eventlog_index_build(log.buf, log.size);
+    assert_non_null(index);
+    assert_true(tpm2_eventlog_index_save(index, path));
+    tpm2_eventlog_index_free(index);
+
+    index = tpm2_eventlog_index_load(path, log.buf, log.size);
+    assert_non_null(index);
+    assert_int_equal(tpm2_eventlog_index_count(index), TEST_EVENTS + 1);
+
+    tpm2_eventlog_context expected;
+    test_log_replay(&log, TEST_EVENTS - 1, &expected);
+    tpm2_eventlog_context ctx = { 0 };
+    assert_true(tpm2_eventlog_index_query(index, &ctx, log.buf,
+            TEST_EVENTS - 1, TEST_EVENTS - 1, UINT32_MAX, NULL));
+    assert_memory_equal(ctx.sha256_pcrs, expected.sha256_pcrs,
+            sizeof(expected.sha256_pcrs));
+    tpm2_eventlog_index_free(index);
+
+    /* the index of an earlier state of the log is not used */
+    assert_null(tpm2_eventlog_index_load(path, log.buf,
+            log.offsets[TEST_EVENTS]));
+    log.buf[log.size - 1] ^= 1;
+    assert_null(tpm2_eventlog_index_load(path, log.buf, log.size));
+
+    unlink(path);
+    assert_null(tpm2_eventlog_index_load(path, log.buf, log.size));
+}
+
+static void test_eventlog_index_malformed(void **state) {
+
+    (void)state;
+    uint8_t buf[sizeof(TCG_EVENT) - 1] = { 0, };
+
+    assert_null(tpm2_eventlog_index_build(NULL, 0));
+    assert_null(tpm2_eventlog_index_build(buf, sizeof(buf)));
+}
+
+/* link required symbol, but tpm2_tool.c declares it AND main, which
+ * we have a main below for cmocka tests.
+ */
+bool output_enabled = true;
+
+int main(void) {
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_eventlog_index_query_all),
+        cmocka_unit_test(test_eventlog_index_query_range),
+        cmocka_unit_test(test_eventlog_index_save_load),
+        cmocka_unit_test(test_eventlog_index_malformed),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
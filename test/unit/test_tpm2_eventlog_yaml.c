@@ -111,7 +111,7 @@ static void test_yaml_eventlog(void **state){
 
     (void)state;
 
-    assert_false(yaml_eventlog(NULL, 0, 1));
+    assert_false(yaml_eventlog(NULL, 0, 1, NULL));
 }
 int main(void) {
 
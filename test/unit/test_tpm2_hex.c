@@ -0,0 +1,174 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "tpm2_hex.h"
+#include "tpm2_util.h"
+
+#define TEST_MAX_LEN 200
+
+static const tpm2_hex_kernel kernels[] = {
+    tpm2_hex_kernel_scalar,
+    tpm2_hex_kernel_sse4,
+    tpm2_hex_kernel_avx2,
+};
+
+/* the lengths cover every mix of AVX2, SSE4 and scalar blocks */
+static void test_tpm2_hex_encode(void **state) {
+    (void) state;
+
+    BYTE data[TEST_MAX_LEN];
+    size_t i;
+    for (i = 0; i < sizeof(data); i++) {
+        data[i] = (BYTE) (i * 37 + 11);
+    }
+
+    size_t k;
+    for (k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+        if (!tpm2_hex_set_kernel(kernels[k])) {
+            continue;
+        }
+
+        size_t len;
+        for (len = 0; len <= sizeof(data); len++) {
+            char expected[2 * TEST_MAX_LEN + 1];
+            for (i = 0; i < len; i++) {
+                sprintf(&expected[2 * i], "%02x", data[i]);
+            }
+
+            /* the guard byte must survive, the output is not NUL terminated */
+            char hex[2 * TEST_MAX_LEN + 1];
+            memset(hex, '#', sizeof(hex));
+            tpm2_hex_encode(data, len, hex);
+            assert_memory_equal(hex, expected, 2 * len);
+            assert_int_equal(hex[2 * len], '#');
+        }
+    }
+
+    tpm2_hex_set_kernel(tpm2_hex_kernel_auto);
+}
+
+static void test_tpm2_hex_decode(void **state) {
+    (void) state;
+
+    BYTE data[TEST_MAX_LEN];
+    char hex[2 * TEST_MAX_LEN + 1];
+    size_t i;
+    for (i = 0; i < sizeof(data); i++) {
+        data[i] = (BYTE) (i * 37 + 11);
+        /* mix the cases, both decode to the same byte */
+        sprintf(&hex[2 * i], i % 3 ? "%02x" : "%02X", data[i]);
+    }
+
+    size_t k;
+    for (k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+        if (!tpm2_hex_set_kernel(kernels[k])) {
+            continue;
+        }
+
+        size_t len;
+        for (len = 0; len <= sizeof(data); len++) {
+            BYTE out[TEST_MAX_LEN + 1];
+            memset(out, 0xa5, sizeof(out));
+            assert_true(tpm2_hex_decode(hex, 2 * len, out));
+            assert_memory_equal(out, data, len);
+            assert_int_equal(out[len], 0xa5);
+        }
+    }
+
+    tpm2_hex_set_kernel(tpm2_hex_kernel_auto);
+}
+
+/* every position lands in an AVX2, SSE4 or scalar block for some kernel */
+static void test_tpm2_hex_decode_invalid(void **state) {
+    (void) state;
+
+    static const char bad[] = { 'g', 'G', '/', ':', '@', '`', ' ', '\0',
+            '\x80', '\xff', 'x' };
+
+    char hex[2 * TEST_MAX_LEN];
+    memset(hex, 'a', sizeof(hex));
+
+    size_t k;
+    for (k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+        if (!tpm2_hex_set_kernel(kernels[k])) {
+            continue;
+        }
+
+        size_t pos;
+        for (pos = 0; pos < sizeof(hex); pos++) {
+            size_t b;
+            for (b = 0; b < sizeof(bad); b++) {
+                BYTE out[TEST_MAX_LEN];
+                hex[pos] = bad[b];
+                assert_false(tpm2_hex_decode(hex, sizeof(hex), out));
+            }
+            hex[pos] = 'a';
+        }
+    }
+
+    tpm2_hex_set_kernel(tpm2_hex_kernel_auto);
+}
+
+static void test_tpm2_hex_decode_odd_length(void **state) {
+    (void) state;
+
+    BYTE out[4];
+    assert_false(tpm2_hex_decode("abc", 3, out));
+    assert_false(tpm2_hex_decode("a", 1, out));
+}
+
+static void test_tpm2_hex_set_kernel(void **state) {
+    (void) state;
+
+    /* every CPU runs the scalar implementation and the default */
+    assert_true(tpm2_hex_set_kernel(tpm2_hex_kernel_scalar));
+    assert_true(tpm2_hex_set_kernel(tpm2_hex_kernel_auto));
+}
+
+static void test_tpm2_util_hex_to_bytes(void **state) {
+    (void) state;
+
+    BYTE out[4];
+    size_t len = sizeof(out);
+    assert_int_equal(tpm2_util_hex_to_bytes("01aBfF", &len, out), 0);
+    assert_int_equal(len, 3);
+    assert_int_equal(out[0], 0x01);
+    assert_int_equal(out[1], 0xab);
+    assert_int_equal(out[2], 0xff);
+
+    len = sizeof(out);
+    assert_int_equal(tpm2_util_hex_to_bytes(NULL, &len, out), -1);
+    assert_int_equal(tpm2_util_hex_to_bytes("01a", &len, out), -2);
+    assert_int_equal(tpm2_util_hex_to_bytes("01ag", &len, out), -3);
+    assert_int_equal(tpm2_util_hex_to_bytes("0102030405", &len, out), -4);
+    /* invalid characters are reported before the size */
+    assert_int_equal(tpm2_util_hex_to_bytes("01020304zz", &len, out), -3);
+}
+
+/* link required symbol, but tpm2_tool.c declares it AND main, which
+ * we have a main below for cmocka tests.
+ */
+bool output_enabled = true;
+
+int main(int argc, char *argv[]) {
+    (void) argc;
+    (void) argv;
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_tpm2_hex_encode),
+        cmocka_unit_test(test_tpm2_hex_decode),
+        cmocka_unit_test(test_tpm2_hex_decode_invalid),
+        cmocka_unit_test(test_tpm2_hex_decode_odd_length),
+        cmocka_unit_test(test_tpm2_hex_set_kernel),
+        cmocka_unit_test(test_tpm2_util_hex_to_bytes),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,176 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "tpm2_queue.h"
+#include "tpm2_util.h"
+
+#define ESYS_CTX ((ESYS_CONTEXT *) 0xDEADBEEF)
+
+static unsigned sent;
+static unsigned finished;
+static bool is_in_flight;
+static UINT16 requested;
+/* the number of the command to fail in Finish, 0 for none */
+static unsigned fail_at;
+
+TSS2_RC __wrap_Esys_GetRandom_Async(ESYS_CONTEXT *esysContext,
+        ESYS_TR shandle1, ESYS_TR shandle2, ESYS_TR shandle3,
+        UINT16 bytesRequested) {
+
+    UNUSED(esysContext);
+    UNUSED(shandle1);
+    UNUSED(shandle2);
+    UNUSED(shandle3);
+
+    /* ESYS rejects a command while another one is in flight */
+    assert_false(is_in_flight);
+    is_in_flight = true;
+    requested = bytesRequested;
+    sent++;
+
+    return TSS2_RC_SUCCESS;
+}
+
+TSS2_RC __wrap_Esys_GetRandom_Finish(ESYS_CONTEXT *esysContext,
+        TPM2B_DIGEST **randomBytes) {
+
+    UNUSED(esysContext);
+
+    assert_true(is_in_flight);
+    is_in_flight = false;
+    finished++;
+
+    if (finished == fail_at) {
+        return TPM2_RC_FAILURE;
+    }
+
+    /* the size tells the commands apart */
+    *randomBytes = calloc(1, sizeof(**randomBytes));
+    (*randomBytes)->size = requested;
+
+    return TSS2_RC_SUCCESS;
+}
+
+static int reset(void **state) {
+    UNUSED(state);
+
+    sent = 0;
+    finished = 0;
+    is_in_flight = false;
+    fail_at = 0;
+
+    return 0;
+}
+
+static tool_rc queue_getrandom(tpm2_queue *queue, UINT16 count) {
+
+    return tpm2_queue_getrandom(queue, count, ESYS_TR_NONE, ESYS_TR_NONE,
+            ESYS_TR_NONE, (void *)(uintptr_t)count);
+}
+
+static void test_queue_order(void **state) {
+    UNUSED(state);
+
+    tpm2_queue *queue = tpm2_queue_new(ESYS_CTX);
+    assert_non_null(queue);
+
+    assert_int_equal(queue_getrandom(queue, 1), tool_rc_success);
+    assert_int_equal(queue_getrandom(queue, 2), tool_rc_success);
+    assert_int_equal(queue_getrandom(queue, 3), tool_rc_success);
+
+    /* the TPM works on the newest command, the older ones are done */
+    assert_int_equal(sent, 3);
+    assert_int_equal(finished, 2);
+    assert_int_equal(tpm2_queue_pending(queue), 3);
+
+    UINT16 i;
+    for (i = 1; i <= 3; i++) {
+        tpm2_queue_result result;
+        assert_int_equal(tpm2_queue_wait(queue, &result), tool_rc_success);
+        assert_ptr_equal(result.userdata, (void *)(uintptr_t)i);
+        assert_int_equal(result.random->size, i);
+        free(result.random);
+    }
+
+    assert_int_equal(finished, 3);
+    assert_int_equal(tpm2_queue_pending(queue), 0);
+
+    /* nothing left to wait for */
+    assert_int_equal(tpm2_queue_wait(queue, NULL), tool_rc_general_error);
+
+    tpm2_queue_free(queue);
+}
+
+static void test_queue_full(void **state) {
+    UNUSED(state);
+
+    tpm2_queue *queue = tpm2_queue_new(ESYS_CTX);
+    assert_non_null(queue);
+
+    unsigned i;
+    for (i = 0; i < TPM2_QUEUE_DEPTH; i++) {
+        assert_int_equal(queue_getrandom(queue, i + 1), tool_rc_success);
+    }
+
+    assert_int_equal(queue_getrandom(queue, 42), tool_rc_general_error);
+    assert_int_equal(sent, TPM2_QUEUE_DEPTH);
+
+    /* a collected response makes room again */
+    assert_int_equal(tpm2_queue_wait(queue, NULL), tool_rc_success);
+    assert_int_equal(queue_getrandom(queue, 42), tool_rc_success);
+
+    /* the command in flight is drained */
+    tpm2_queue_free(queue);
+    assert_false(is_in_flight);
+    assert_int_equal(finished, sent);
+}
+
+static void test_queue_error(void **state) {
+    UNUSED(state);
+
+    fail_at = 2;
+
+    tpm2_queue *queue = tpm2_queue_new(ESYS_CTX);
+    assert_non_null(queue);
+
+    assert_int_equal(queue_getrandom(queue, 1), tool_rc_success);
+    assert_int_equal(queue_getrandom(queue, 2), tool_rc_success);
+
+    /* the failure of the command in flight stops the next one */
+    assert_int_not_equal(queue_getrandom(queue, 3), tool_rc_success);
+    assert_int_equal(sent, 2);
+
+    tpm2_queue_result result;
+    assert_int_equal(tpm2_queue_wait(queue, &result), tool_rc_success);
+    assert_int_equal(result.random->size, 1);
+    free(result.random);
+
+    assert_int_not_equal(tpm2_queue_wait(queue, &result), tool_rc_success);
+    assert_null(result.random);
+
+    tpm2_queue_free(queue);
+}
+
+/* link required symbol, but tpm2_tool.c declares it AND main, which
+ * we have a main below for cmocka tests.
+ */
+bool output_enabled = true;
+
+int main(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup(test_queue_order, reset),
+        cmocka_unit_test_setup(test_queue_full, reset),
+        cmocka_unit_test_setup(test_queue_error, reset),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
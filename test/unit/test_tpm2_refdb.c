@@ -0,0 +1,296 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <tss2/tss2_tpm2_types.h>
+
+#include "tpm2_refdb.h"
+
+/* more digests than the first few sizes of the table */
+#define TEST_DIGESTS 5000
+
+#define SHA1_HEX "3f708bdbaff2006655b540360e16474c100c1310"
+#define SHA256_HEX \
+    "d0fcf11a32a8fbf5a4e1a58cd74dd2357d07e7503b5b6afd5a7989a98e17be7f"
+
+typedef struct test_paths test_paths;
+struct test_paths {
+    char source[sizeof("/tmp/test_tpm2_refdb_src_XXXXXX")];
+    char db[sizeof("/tmp/test_tpm2_refdb_db_XXXXXX")];
+};
+
+static void test_paths_init(test_paths *paths) {
+
+    strcpy(paths->source, "/tmp/test_tpm2_refdb_src_XXXXXX");
+    strcpy(paths->db, "/tmp/test_tpm2_refdb_db_XXXXXX");
+
+    int fd = mkstemp(paths->source);
+    assert_true(fd >= 0);
+    close(fd);
+    fd = mkstemp(paths->db);
+    assert_true(fd >= 0);
+    close(fd);
+}
+
+static void test_paths_remove(test_paths *paths) {
+
+    unlink(paths->source);
+    unlink(paths->db);
+}
+
+static void test_source_write(test_paths *paths, const char *text) {
+
+    FILE *f = fopen(paths->source, "w");
+    assert_non_null(f);
+    assert_true(fputs(text, f) >= 0);
+    assert_int_equal(fclose(f), 0);
+}
+
+static void test_digest_fill(BYTE *digest, size_t size, unsigned n) {
+
+    size_t i;
+    for (i = 0; i < size; i++) {
+        digest[i] = (BYTE)((n >> (8 * (i % 4))) ^ (i * 31));
+    }
+}
+
+static void hex_to_digest(const char *hex, BYTE *digest) {
+
+    size_t i;
+    for (i = 0; hex[2 * i]; i++) {
+        unsigned v;
+        assert_int_equal(sscanf(hex + 2 * i, "%2x", &v), 1);
+        digest[i] = v;
+    }
+}
+
+static void test_refdb_lookup(void **state) {
+
+    (void)state;
+    test_paths paths;
+    test_paths_init(&paths);
+
+    test_source_write(&paths,
+        "# reference measurements\n"
+        "sha1:" SHA1_HEX " allow  crtm version \n"
+        "\n"
+        "sha256:" SHA256_HEX "\tdeny\tbad \"firmware\"   # revoked\n");
+    assert_true(tpm2_refdb_compile(paths.source, paths.db));
+
+    tpm2_refdb *refdb = tpm2_refdb_load(paths.db);
+    assert_non_null(refdb);
+    assert_int_equal(tpm2_refdb_count(refdb), 2);
+
+    BYTE sha1[TPM2_SHA1_DIGEST_SIZE];
+    hex_to_digest(SHA1_HEX, sha1);
+    BYTE sha256[TPM2_SHA256_DIGEST_SIZE];
+    hex_to_digest(SHA256_HEX, sha256);
+
+    const char *label = NULL;
+    assert_int_equal(tpm2_refdb_lookup(refdb, TPM2_ALG_SHA1, sha1, &label),
+            tpm2_refdb_verdict_allow);
+    assert_string_equal(label, "crtm version");
+    assert_int_equal(tpm2_refdb_lookup(refdb, TPM2_ALG_SHA256, sha256,
+            &label), tpm2_refdb_verdict_deny);
+    assert_string_equal(label, "bad \"firmware\"");
+    assert_int_equal(tpm2_refdb_lookup(refdb, TPM2_ALG_SHA256, sha256, NULL),
+            tpm2_refdb_verdict_deny);
+
+    /* the same bytes under another algorithm are another digest */
+    BYTE sha256_of_sha1[TPM2_SHA256_DIGEST_SIZE] = { 0 };
+    memcpy(sha256_of_sha1, sha1, sizeof(sha1));
+    assert_int_equal(tpm2_refdb_lookup(refdb, TPM2_ALG_SHA256,
+            sha256_of_sha1, NULL), tpm2_refdb_verdict_unknown);
+    sha256[0] ^= 1;
+    assert_int_equal(tpm2_refdb_lookup(refdb, TPM2_ALG_SHA256, sha256, NULL),
+            tpm2_refdb_verdict_unknown);
+
+    assert_string_equal(tpm2_refdb_verdict_to_str(tpm2_refdb_verdict_allow),
+            "allow");
+    assert_string_equal(tpm2_refdb_verdict_to_str(tpm2_refdb_verdict_deny),
+            "deny");
+    assert_string_equal(tpm2_refdb_verdict_to_str(tpm2_refdb_verdict_unknown),
+            "unknown");
+
+    tpm2_refdb_free(refdb);
+    test_paths_remove(&paths);
+}
+
+static void test_refdb_large(void **state) {
+
+    (void)state;
+    test_paths paths;
+    test_paths_init(&paths);
+
+    FILE *f = fopen(paths.source, "w");
+    assert_non_null(f);
+    unsigned i;
+    for (i = 0; i < TEST_DIGESTS; i++) {
+        BYTE digest[TPM2_SHA256_DIGEST_SIZE];
+        test_digest_fill(digest, sizeof(digest), i);
+        fputs("sha256:", f);
+        size_t j;
+        for (j = 0; j < sizeof(digest); j++) {
+            fprintf(f, "%02x", digest[j]);
+        }
+        fprintf(f, " %s digest %u\n", i % 3 ? "allow" : "deny", i);
+    }
+    assert_int_equal(fclose(f), 0);
+
+    assert_true(tpm2_refdb_compile(paths.source, paths.db));
+    tpm2_refdb *refdb = tpm2_refdb_load(paths.db);
+    assert_non_null(refdb);
+    assert_int_equal(tpm2_refdb_count(refdb), TEST_DIGESTS);
+
+    for (i = 0; i < TEST_DIGESTS; i++) {
+        BYTE digest[TPM2_SHA256_DIGEST_SIZE];
+        test_digest_fill(digest, sizeof(digest), i);
+        const char *label = NULL;
+        assert_int_equal(tpm2_refdb_lookup(refdb, TPM2_ALG_SHA256, digest,
+                &label), i % 3 ? tpm2_refdb_verdict_allow :
+                        tpm2_refdb_verdict_deny);
+        char expected[32];
+        snprintf(expected, sizeof(expected), "digest %u", i);
+        assert_string_equal(label, expected);
+    }
+
+    BYTE digest[TPM2_SHA256_DIGEST_SIZE];
+    test_digest_fill(digest, sizeof(digest), TEST_DIGESTS);
+    assert_int_equal(tpm2_refdb_lookup(refdb, TPM2_ALG_SHA256, digest, NULL),
+            tpm2_refdb_verdict_unknown);
+
+    tpm2_refdb_free(refdb);
+    test_paths_remove(&paths);
+}
+
+static void test_refdb_empty(void **state) {
+
+    (void)state;
+    test_paths paths;
+    test_paths_init(&paths);
+
+    test_source_write(&paths, "# nothing yet\n");
+    assert_true(tpm2_refdb_compile(paths.source, paths.db));
+
+    tpm2_refdb *refdb = tpm2_refdb_load(paths.db);
+    assert_non_null(refdb);
+    assert_int_equal(tpm2_refdb_count(refdb), 0);
+
+    BYTE sha256[TPM2_SHA256_DIGEST_SIZE];
+    hex_to_digest(SHA256_HEX, sha256);
+    assert_int_equal(tpm2_refdb_lookup(refdb, TPM2_ALG_SHA256, sha256, NULL),
+            tpm2_refdb_verdict_unknown);
+
+    tpm2_refdb_free(refdb);
+    test_paths_remove(&paths);
+}
+
+static void test_refdb_source_malformed(void **state) {
+
+    (void)state;
+    test_paths paths;
+    test_paths_init(&paths);
+
+    static const char *sources[] = {
+        /* duplicate digest */
+        "sha256:" SHA256_HEX " allow a\n"
+        "sha256:" SHA256_HEX " deny b\n",
+        /* no label */
+        "sha1:" SHA1_HEX " allow\n",
+        /* digest of the wrong size */
+        "sha256:" SHA1_HEX " allow a\n",
+        "sha1:" SHA1_HEX "0 allow a\n",
+        /* no or an unknown algorithm */
+        SHA1_HEX " allow a\n",
+        "foo:" SHA1_HEX " allow a\n",
+        /* unknown verdict */
+        "sha1:" SHA1_HEX " trust a\n",
+    };
+
+    size_t i;
+    for (i = 0; i < sizeof(sources) / sizeof(sources[0]); i++) {
+        test_source_write(&paths, sources[i]);
+        assert_false(tpm2_refdb_compile(paths.source, paths.db));
+    }
+
+    unlink(paths.source);
+    assert_false(tpm2_refdb_compile(paths.source, paths.db));
+
+    test_paths_remove(&paths);
+}
+
+static void test_refdb_load_malformed(void **state) {
+
+    (void)state;
+    test_paths paths;
+    test_paths_init(&paths);
+
+    test_source_write(&paths, "sha1:" SHA1_HEX " allow a\n");
+    assert_true(tpm2_refdb_compile(paths.source, paths.db));
+
+    FILE *f = fopen(paths.db, "rb");
+    assert_non_null(f);
+    BYTE buf[4096];
+    size_t size = fread(buf, 1, sizeof(buf), f);
+    fclose(f);
+    assert_true(size > 20 && size < sizeof(buf));
+
+    /* a truncated file, a bad magic, a capacity and the labels */
+    struct {
+        size_t offset;
+        BYTE value;
+        size_t size;
+    } corruptions[] = {
+        { 0, buf[0], size - 1 },
+        { 0, buf[0], 19 },
+        { 0, buf[0] ^ 1, size },
+        { 11, buf[11] ^ 3, size },
+        { 15, buf[11], size },
+        { size - 1, 'a', size },
+    };
+
+    size_t i;
+    for (i = 0; i < sizeof(corruptions) / sizeof(corruptions[0]); i++) {
+        BYTE corrupt[sizeof(buf)];
+        memcpy(corrupt, buf, size);
+        corrupt[corruptions[i].offset] = corruptions[i].value;
+
+        f = fopen(paths.db, "wb");
+        assert_non_null(f);
+        assert_int_equal(fwrite(corrupt, 1, corruptions[i].size, f),
+                corruptions[i].size);
+        assert_int_equal(fclose(f), 0);
+
+        assert_null(tpm2_refdb_load(paths.db));
+    }
+
+    unlink(paths.db);
+    assert_null(tpm2_refdb_load(paths.db));
+
+    test_paths_remove(&paths);
+}
+
+/* link required symbol, but tpm2_tool.c declares it AND main, which
+ * we have a main below for cmocka tests.
+ */
+bool output_enabled = true;
+
+int main(void) {
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_refdb_lookup),
+        cmocka_unit_test(test_refdb_large),
+        cmocka_unit_test(test_refdb_empty),
+        cmocka_unit_test(test_refdb_source_malformed),
+        cmocka_unit_test(test_refdb_load_malformed),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
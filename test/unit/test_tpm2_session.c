@@ -92,6 +92,71 @@ TSS2_RC __wrap_tpm2_flush_context(ESYS_CONTEXT *esysContext,
     return TSS2_RC_SUCCESS;
 }
 
+static unsigned tr_serialize_calls;
+
+TSS2_RC __wrap_Esys_TR_Serialize(ESYS_CONTEXT *esysContext, ESYS_TR object,
+        uint8_t **buffer, size_t *buffer_size) {
+
+    UNUSED(esysContext);
+
+    tr_serialize_calls++;
+
+    *buffer = malloc(sizeof(object));
+    memcpy(*buffer, &object, sizeof(object));
+    *buffer_size = sizeof(object);
+
+    return TSS2_RC_SUCCESS;
+}
+
+TSS2_RC __wrap_Esys_TR_Deserialize(ESYS_CONTEXT *esysContext,
+        uint8_t const *buffer, size_t buffer_size, ESYS_TR *esys_handle) {
+
+    UNUSED(esysContext);
+
+    assert_int_equal(buffer_size, sizeof(*esys_handle));
+    memcpy(esys_handle, buffer, sizeof(*esys_handle));
+
+    return TSS2_RC_SUCCESS;
+}
+
+static struct {
+    char name[64];
+    UINT8 data[256];
+    size_t size;
+} broker_entry;
+
+static bool test_broker_load(const char *name, const UINT8 **data,
+        size_t *size) {
+
+    if (!broker_entry.size || strcmp(name, broker_entry.name)) {
+        return false;
+    }
+
+    *data = broker_entry.data;
+    *size = broker_entry.size;
+
+    return true;
+}
+
+static bool test_broker_store(const char *name, const UINT8 *data,
+        size_t size) {
+
+    assert_true(size <= sizeof(broker_entry.data));
+
+    snprintf(broker_entry.name, sizeof(broker_entry.name), "%s", name);
+    broker_entry.size = data ? size : 0;
+    if (data) {
+        memcpy(broker_entry.data, data, size);
+    }
+
+    return true;
+}
+
+static const tpm2_session_broker test_broker = {
+    .load = test_broker_load,
+    .store = test_broker_store,
+};
+
 static void test_tpm2_session_defaults_good(void **state) {
     UNUSED(state);
 
@@ -218,6 +283,68 @@ static void test_tpm2_session_save(void **state) {
     assert_null(s);
 }
 
+static void test_tpm2_session_broker(void **state) {
+    UNUSED(state);
+
+    set_expected_defaults(TPM2_SE_POLICY, SESSION_HANDLE, TPM2_RC_SUCCESS);
+
+    tpm2_session_data *d = tpm2_session_data_new(TPM2_SE_POLICY);
+    assert_non_null(d);
+
+    tpm2_session_set_path(d, TPM2_SESSION_BROKER_PREFIX "policy");
+
+    tpm2_session *s = NULL;
+    tool_rc rc = tpm2_session_open(CONTEXT, d, &s);
+    assert_int_equal(rc, tool_rc_success);
+
+    /* without a broker the name is unknown */
+    rc = tpm2_session_close(&s);
+    assert_int_not_equal(rc, tool_rc_success);
+    assert_null(s);
+
+    tpm2_session_set_broker(&test_broker);
+
+    set_expected_defaults(TPM2_SE_POLICY, SESSION_HANDLE, TPM2_RC_SUCCESS);
+    d = tpm2_session_data_new(TPM2_SE_POLICY);
+    tpm2_session_set_path(d, TPM2_SESSION_BROKER_PREFIX "policy");
+    rc = tpm2_session_open(CONTEXT, d, &s);
+    assert_int_equal(rc, tool_rc_success);
+
+    /* the session state goes to the broker, no context is saved */
+    _save_handle = ESYS_TR_NONE;
+    rc = tpm2_session_close(&s);
+    assert_int_equal(rc, tool_rc_success);
+    assert_int_equal(tr_serialize_calls, 1);
+    assert_int_equal(_save_handle, ESYS_TR_NONE);
+    assert_string_equal(broker_entry.name, TPM2_SESSION_BROKER_PREFIX "policy");
+    assert_int_not_equal(broker_entry.size, 0);
+
+    rc = tpm2_session_restore(CONTEXT, TPM2_SESSION_BROKER_PREFIX "other",
+            false, &s);
+    assert_int_not_equal(rc, tool_rc_success);
+
+    rc = tpm2_session_restore(CONTEXT, TPM2_SESSION_BROKER_PREFIX "policy",
+            false, &s);
+    assert_int_equal(rc, tool_rc_success);
+    assert_int_equal(tpm2_session_get_handle(s), SESSION_HANDLE);
+    assert_int_equal(tpm2_session_get_type(s), TPM2_SE_POLICY);
+
+    rc = tpm2_session_close(&s);
+    assert_int_equal(rc, tool_rc_success);
+    assert_int_equal(tr_serialize_calls, 2);
+
+    /* the last use flushes the session and removes it from the broker */
+    rc = tpm2_session_restore(CONTEXT, TPM2_SESSION_BROKER_PREFIX "policy",
+            true, &s);
+    assert_int_equal(rc, tool_rc_success);
+
+    rc = tpm2_session_close(&s);
+    assert_int_equal(rc, tool_rc_success);
+    assert_int_equal(broker_entry.size, 0);
+
+    tpm2_session_set_broker(NULL);
+}
+
 static void test_tpm2_session_restart(void **state) {
     UNUSED(state);
 
@@ -286,6 +413,7 @@ int main(int argc, char *argv[]) {
     cmocka_unit_test(test_tpm2_session_defaults_bad),
     cmocka_unit_test_setup_teardown(test_tpm2_session_save,
             test_session_setup, test_session_teardown),
+    cmocka_unit_test(test_tpm2_session_broker),
     cmocka_unit_test(test_tpm2_session_restart),
     cmocka_unit_test(test_tpm2_session_is_trial_test)
     };
@@ -0,0 +1,108 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "tpm2_openssl.h"
+#include "tpm2_sha256_mb.h"
+#include "tpm2_util.h"
+
+#define TEST_ROUNDS 100
+
+static void fill_random(BYTE *buf, size_t size) {
+
+    size_t i;
+    for (i = 0; i < size; i++) {
+        buf[i] = rand();
+    }
+}
+
+static void test_extend_matches_openssl(void **state) {
+    UNUSED(state);
+
+    srand(0x7e57);
+
+    unsigned count;
+    for (count = 1; count <= TPM2_SHA256_MB_LANES; count++) {
+        BYTE pcrs[TPM2_SHA256_MB_LANES][TPM2_SHA256_DIGEST_SIZE];
+        BYTE expected[TPM2_SHA256_MB_LANES][TPM2_SHA256_DIGEST_SIZE];
+        BYTE digests[TPM2_SHA256_MB_LANES][TPM2_SHA256_DIGEST_SIZE];
+        fill_random(&pcrs[0][0], sizeof(pcrs));
+        fill_random(&digests[0][0], sizeof(digests));
+        memcpy(expected, pcrs, sizeof(expected));
+
+        BYTE *lanes[TPM2_SHA256_MB_LANES];
+        const BYTE *lane_digests[TPM2_SHA256_MB_LANES];
+        unsigned i;
+        for (i = 0; i < count; i++) {
+            lanes[i] = pcrs[i];
+            lane_digests[i] = digests[i];
+        }
+
+        /* chained extends, each round starts from the previous result */
+        unsigned round;
+        for (round = 0; round < TEST_ROUNDS; round++) {
+            assert_true(tpm2_sha256_mb_pcr_extend(lanes, lane_digests, count));
+            for (i = 0; i < count; i++) {
+                assert_true(tpm2_openssl_pcr_extend(TPM2_ALG_SHA256,
+                        expected[i], digests[i], TPM2_SHA256_DIGEST_SIZE));
+            }
+        }
+
+        /* the unused lanes are left alone */
+        assert_memory_equal(pcrs, expected, sizeof(pcrs));
+    }
+}
+
+static void test_extend_known_answer(void **state) {
+    UNUSED(state);
+
+    /* SHA256(32 zero bytes || 32 zero bytes) */
+    static const BYTE expected[TPM2_SHA256_DIGEST_SIZE] = {
+        0xf5, 0xa5, 0xfd, 0x42, 0xd1, 0x6a, 0x20, 0x30,
+        0x27, 0x98, 0xef, 0x6e, 0xd3, 0x09, 0x97, 0x9b,
+        0x43, 0x00, 0x3d, 0x23, 0x20, 0xd9, 0xf0, 0xe8,
+        0xea, 0x98, 0x31, 0xa9, 0x27, 0x59, 0xfb, 0x4b,
+    };
+
+    BYTE pcr[TPM2_SHA256_DIGEST_SIZE] = { 0 };
+    BYTE digest[TPM2_SHA256_DIGEST_SIZE] = { 0 };
+    BYTE *pcrs[] = { pcr };
+    const BYTE *digests[] = { digest };
+
+    assert_true(tpm2_sha256_mb_pcr_extend(pcrs, digests, 1));
+    assert_memory_equal(pcr, expected, sizeof(expected));
+}
+
+static void test_extend_bad_lanes(void **state) {
+    UNUSED(state);
+
+    BYTE *pcrs[TPM2_SHA256_MB_LANES + 1] = { 0 };
+    const BYTE *digests[TPM2_SHA256_MB_LANES + 1] = { 0 };
+
+    assert_false(tpm2_sha256_mb_pcr_extend(pcrs, digests, 0));
+    assert_false(tpm2_sha256_mb_pcr_extend(pcrs, digests,
+            TPM2_SHA256_MB_LANES + 1));
+}
+
+/* link required symbol, but tpm2_tool.c declares it AND main, which
+ * we have a main below for cmocka tests.
+ */
+bool output_enabled = true;
+
+int main(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_extend_matches_openssl),
+        cmocka_unit_test(test_extend_known_answer),
+        cmocka_unit_test(test_extend_bad_lanes),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
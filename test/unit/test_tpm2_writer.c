@@ -0,0 +1,332 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "tpm2_writer.h"
+
+typedef struct test_output test_output;
+struct test_output {
+    FILE *stream;
+    char *data;
+    size_t size;
+};
+
+static tpm2_writer *writer_new(test_output *out, tpm2_writer_format format) {
+
+    out->stream = open_memstream(&out->data, &out->size);
+    assert_non_null(out->stream);
+
+    tpm2_writer *w = tpm2_writer_new(out->stream, format);
+    assert_non_null(w);
+
+    return w;
+}
+
+static void writer_check(tpm2_writer *w, test_output *out,
+        const char *expected) {
+
+    assert_true(tpm2_writer_flush(w));
+    tpm2_writer_free(w);
+    fclose(out->stream);
+
+    assert_string_equal(out->data, expected);
+    free(out->data);
+}
+
+/* the layout of the eventlog output */
+static void write_events(tpm2_writer *w) {
+
+    static const uint8_t digest[] = { 0x01, 0xab, 0xff };
+
+    tpm2_writer_document_begin(w);
+    tpm2_writer_map_begin(w, NULL);
+    tpm2_writer_uint(w, "version", 2);
+    tpm2_writer_seq_begin(w, "events");
+    tpm2_writer_map_begin(w, NULL);
+    tpm2_writer_uint(w, "EventNum", 0);
+    tpm2_writer_seq_begin(w, "Digests");
+    tpm2_writer_map_begin(w, NULL);
+    tpm2_writer_string(w, "AlgorithmId", "sha1", tpm2_writer_style_plain);
+    tpm2_writer_bytes(w, "Digest", digest, sizeof(digest),
+            tpm2_writer_style_double_quoted);
+    tpm2_writer_end(w);
+    tpm2_writer_end(w);
+    tpm2_writer_map_begin(w, "Event");
+    tpm2_writer_hex(w, "BlobBase", 0xabc);
+    tpm2_writer_end(w);
+    tpm2_writer_end(w);
+    tpm2_writer_end(w);
+    tpm2_writer_map_begin(w, "pcrs");
+    tpm2_writer_map_begin(w, "sha1");
+    tpm2_writer_align(w, 3, 0);
+    tpm2_writer_bytes(w, "7", digest, sizeof(digest),
+            tpm2_writer_style_prefixed);
+    tpm2_writer_end(w);
+    tpm2_writer_end(w);
+    tpm2_writer_end(w);
+}
+
+static void test_tpm2_writer_yaml(void **state) {
+    (void) state;
+
+    test_output out;
+    tpm2_writer *w = writer_new(&out, tpm2_writer_format_yaml);
+
+    write_events(w);
+
+    writer_check(w, &out,
+            "---\n"
+            "version: 2\n"
+            "events:\n"
+            "- EventNum: 0\n"
+            "  Digests:\n"
+            "  - AlgorithmId: sha1\n"
+            "    Digest: \"01abff\"\n"
+            "  Event:\n"
+            "    BlobBase: 0xabc\n"
+            "pcrs:\n"
+            "  sha1:\n"
+            "    7  : 0x01abff\n");
+}
+
+static void test_tpm2_writer_json(void **state) {
+    (void) state;
+
+    test_output out;
+    tpm2_writer *w = writer_new(&out, tpm2_writer_format_json);
+
+    write_events(w);
+    write_events(w);
+
+    const char *doc = "{\"version\":2,\"events\":[{\"EventNum\":0,"
+            "\"Digests\":[{\"AlgorithmId\":\"sha1\",\"Digest\":\"01abff\"}],"
+            "\"Event\":{\"BlobBase\":2748}}],"
+            "\"pcrs\":{\"sha1\":{\"7\":\"0x01abff\"}}}\n";
+    char expected[512];
+    snprintf(expected, sizeof(expected), "%s%s", doc, doc);
+
+    writer_check(w, &out, expected);
+}
+
+static void test_tpm2_writer_align(void **state) {
+    (void) state;
+
+    test_output out;
+    tpm2_writer *w = writer_new(&out, tpm2_writer_format_yaml);
+
+    tpm2_writer_map_begin(w, NULL);
+    tpm2_writer_map_begin(w, "rsa");
+    tpm2_writer_hex_upper(w, "value", 0x1a);
+    tpm2_writer_align(w, 0, 12);
+    tpm2_writer_uint(w, "hash", 0);
+    tpm2_writer_uint(w, "encrypting", 1);
+    tpm2_writer_uint(w, "a_very_long_key", 1);
+    tpm2_writer_end(w);
+    tpm2_writer_null(w, "Algorithm[0]");
+    tpm2_writer_number(w, "revision", "1.38");
+    tpm2_writer_end(w);
+
+    writer_check(w, &out,
+            "rsa:\n"
+            "  value: 0x1A\n"
+            "  hash:       0\n"
+            "  encrypting: 1\n"
+            "  a_very_long_key: 1\n"
+            "Algorithm[0]:\n"
+            "revision: 1.38\n");
+}
+
+static void test_tpm2_writer_sequences(void **state) {
+    (void) state;
+
+    test_output out;
+    tpm2_writer *w = writer_new(&out, tpm2_writer_format_yaml);
+
+    tpm2_writer_map_begin(w, NULL);
+    tpm2_writer_seq_begin_indented(w, "selected-pcrs");
+    tpm2_writer_map_begin(w, NULL);
+    tpm2_writer_flow_seq_begin(w, "sha1");
+    tpm2_writer_uint(w, NULL, 0);
+    tpm2_writer_uint(w, NULL, 7);
+    tpm2_writer_end(w);
+    tpm2_writer_end(w);
+    tpm2_writer_map_begin(w, NULL);
+    tpm2_writer_flow_seq_begin(w, "sha256");
+    tpm2_writer_end(w);
+    tpm2_writer_end(w);
+    tpm2_writer_map_begin(w, NULL);
+    tpm2_writer_end(w);
+    tpm2_writer_end(w);
+    tpm2_writer_seq_begin(w, "keys");
+    tpm2_writer_seq_begin(w, NULL);
+    tpm2_writer_string(w, NULL, "a", tpm2_writer_style_plain);
+    tpm2_writer_string(w, NULL, "b", tpm2_writer_style_plain);
+    tpm2_writer_end(w);
+    tpm2_writer_end(w);
+    tpm2_writer_end(w);
+
+    writer_check(w, &out,
+            "selected-pcrs:\n"
+            "  - sha1: [ 0, 7 ]\n"
+            "  - sha256: [ ]\n"
+            "  - {}\n"
+            "keys:\n"
+            "- - a\n"
+            "  - b\n");
+}
+
+static void test_tpm2_writer_strings(void **state) {
+    (void) state;
+
+    static const char text[] = "a\tb\"\\\x01\ncontinued";
+    static const char lines[] = "first\nsecond";
+
+    test_output out;
+    tpm2_writer *w = writer_new(&out, tpm2_writer_format_yaml);
+
+    tpm2_writer_map_begin(w, NULL);
+    tpm2_writer_map_begin(w, "Event");
+    tpm2_writer_string_len(w, "String", text, sizeof(text) - 1,
+            tpm2_writer_style_double_quoted);
+    tpm2_writer_string(w, "Quoted", "it's", tpm2_writer_style_single_quoted);
+    tpm2_writer_string_len(w, "Lines", lines, sizeof(lines) - 1,
+            tpm2_writer_style_literal);
+    tpm2_writer_string(w, "Missing", NULL, tpm2_writer_style_double_quoted);
+    tpm2_writer_end(w);
+    tpm2_writer_end(w);
+
+    writer_check(w, &out,
+            "Event:\n"
+            "  String: \"a\tb\\\"\\\\\\x01\\n\\\n"
+            "    continued\"\n"
+            "  Quoted: 'it''s'\n"
+            "  Lines: |-\n"
+            "    first\n"
+            "    second\n"
+            "  Missing:\n");
+}
+
+static void test_tpm2_writer_json_strings(void **state) {
+    (void) state;
+
+    static const char text[] = "a\tb\"\\\x01\n\0z";
+
+    test_output out;
+    tpm2_writer *w = writer_new(&out, tpm2_writer_format_json);
+
+    tpm2_writer_map_begin(w, NULL);
+    tpm2_writer_string_len(w, "String", text, sizeof(text) - 1,
+            tpm2_writer_style_literal);
+    tpm2_writer_string(w, "Missing", NULL, tpm2_writer_style_plain);
+    tpm2_writer_null(w, "Empty");
+    tpm2_writer_seq_begin(w, "None");
+    tpm2_writer_end(w);
+    tpm2_writer_end(w);
+
+    writer_check(w, &out,
+            "{\"String\":\"a\\tb\\\"\\\\\\u0001\\n\\u0000z\","
+            "\"Missing\":null,\"Empty\":null,\"None\":[]}\n");
+}
+
+/* well-formed UTF-8 is kept, any other byte is escaped */
+static void test_tpm2_writer_json_utf8(void **state) {
+    (void) state;
+
+    static const char text[] =
+            /* U+00E9, U+20AC, U+1F600 */
+            "\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80"
+            /* a lone continuation byte and an invalid lead byte */
+            "\x80\xff"
+            /* overlong "/", a surrogate, above U+10FFFF */
+            "\xc0\xaf\xed\xa0\x80\xf4\x90\x80\x80"
+            /* truncated at the end */
+            "\xe2\x82";
+
+    test_output out;
+    tpm2_writer *w = writer_new(&out, tpm2_writer_format_json);
+
+    tpm2_writer_map_begin(w, NULL);
+    tpm2_writer_string_len(w, "String", text, sizeof(text) - 1,
+            tpm2_writer_style_double_quoted);
+    tpm2_writer_end(w);
+
+    writer_check(w, &out,
+            "{\"String\":\"\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80"
+            "\\u0080\\u00ff"
+            "\\u00c0\\u00af\\u00ed\\u00a0\\u0080"
+            "\\u00f4\\u0090\\u0080\\u0080"
+            "\\u00e2\\u0082\"}\n");
+}
+
+/* hex data larger than the output buffer is written out in chunks */
+static void test_tpm2_writer_large_bytes(void **state) {
+    (void) state;
+
+    size_t len = 3 * 65536 + 5;
+    uint8_t *data = malloc(len);
+    char *expected = malloc(2 * len + sizeof("Event: \"\"\n"));
+    assert_non_null(data);
+    assert_non_null(expected);
+
+    char *p = expected + sprintf(expected, "Event: \"");
+    size_t i;
+    for (i = 0; i < len; i++) {
+        data[i] = (uint8_t) (i * 7);
+        p += sprintf(p, "%02x", data[i]);
+    }
+    strcpy(p, "\"\n");
+
+    test_output out;
+    tpm2_writer *w = writer_new(&out, tpm2_writer_format_yaml);
+
+    tpm2_writer_map_begin(w, NULL);
+    tpm2_writer_bytes(w, "Event", data, len, tpm2_writer_style_double_quoted);
+    tpm2_writer_end(w);
+
+    writer_check(w, &out, expected);
+
+    free(expected);
+    free(data);
+}
+
+static void test_tpm2_writer_format_from_str(void **state) {
+    (void) state;
+
+    tpm2_writer_format format;
+
+    assert_true(tpm2_writer_format_from_str("yaml", &format));
+    assert_int_equal(format, tpm2_writer_format_yaml);
+    assert_true(tpm2_writer_format_from_str("json", &format));
+    assert_int_equal(format, tpm2_writer_format_json);
+    assert_false(tpm2_writer_format_from_str("xml", &format));
+}
+
+/* link required symbol, but tpm2_tool.c declares it AND main, which
+ * we have a main below for cmocka tests.
+ */
+bool output_enabled = true;
+
+int main(int argc, char *argv[]) {
+    (void) argc;
+    (void) argv;
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_tpm2_writer_yaml),
+        cmocka_unit_test(test_tpm2_writer_json),
+        cmocka_unit_test(test_tpm2_writer_align),
+        cmocka_unit_test(test_tpm2_writer_sequences),
+        cmocka_unit_test(test_tpm2_writer_strings),
+        cmocka_unit_test(test_tpm2_writer_json_strings),
+        cmocka_unit_test(test_tpm2_writer_json_utf8),
+        cmocka_unit_test(test_tpm2_writer_large_bytes),
+        cmocka_unit_test(test_tpm2_writer_format_from_str),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -1,10 +1,12 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
 #include <inttypes.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <openssl/pem.h>
 #include <openssl/err.h>
@@ -19,6 +21,59 @@
 #include "tpm2_systemdeps.h"
 #include "tpm2_tool.h"
 #include "tpm2_eventlog.h"
+#include "tpm2_refdb.h"
+
+/* the state of verifying a single quote */
+typedef struct quote_ctx quote_ctx;
+struct quote_ctx {
+    TPMI_ALG_HASH halg;
+    bool is_halg_set;
+    TPM2B_DIGEST msg_hash;
+    TPM2B_DIGEST pcr_hash;
+    TPMS_ATTEST attest;
+    TPM2B_DATA extra_data;
+    TPM2B_MAX_BUFFER signature;
+    const char *msg_file_path;
+    const char *sig_file_path;
+    const char *pcr_file_path;
+    const char *eventlog_path;
+    const char *pubkey_file_path;
+    tpm2_refdb const *refdb;
+    bool is_output_enabled;
+};
+
+#define BATCH_MAX_JOBS 64
+
+/* one manifest line, the fields point into line */
+typedef struct batch_job batch_job;
+struct batch_job {
+    char *line;
+    unsigned long line_number;
+    const char *msg_file_path;
+    const char *sig_file_path;
+    const char *pcr_file_path;
+    const char *eventlog_path;
+    const char *nonce;
+    const char *pubkey_file_path;
+    bool is_verified;
+};
+
+typedef struct pkey_cache_entry pkey_cache_entry;
+struct pkey_cache_entry {
+    char *path;
+    bool is_sm2;
+    EVP_PKEY *pkey;
+    pkey_cache_entry *next;
+};
+
+typedef struct batch_ctx batch_ctx;
+struct batch_ctx {
+    batch_job *jobs;
+    size_t count;
+    size_t next;
+    pkey_cache_entry *pkeys;
+    pthread_mutex_t lock;
+};
 
 typedef struct tpm2_verifysig_ctx tpm2_verifysig_ctx;
 struct tpm2_verifysig_ctx {
@@ -29,56 +84,58 @@ struct tpm2_verifysig_ctx {
             UINT8 pcr :1;
             UINT8 hlg :1;
             UINT8 eventlog :1;
+            UINT8 qualification :1;
         };
         UINT8 all;
     } flags;
     TPMI_ALG_HASH halg;
-    TPM2B_DIGEST msg_hash;
-    TPM2B_DIGEST pcr_hash;
-    TPMS_ATTEST attest;
     TPM2B_DATA extra_data;
-    TPM2B_MAX_BUFFER signature;
     char *msg_file_path;
     char *sig_file_path;
-    char *out_file_path;
     char *pcr_file_path;
     const char *pubkey_file_path;
     char *eventlog_path;
-    tpm2_loaded_object key_context_object;
     const char *pcr_selection_string;
+    const char *batch_path;
+    unsigned batch_jobs;
+    const char *refdb_path;
+    tpm2_refdb *refdb;
 };
 
 static tpm2_verifysig_ctx ctx = {
         .halg = TPM2_ALG_SHA256,
-        .msg_hash = TPM2B_TYPE_INIT(TPM2B_DIGEST, buffer),
-        .pcr_hash = TPM2B_TYPE_INIT(TPM2B_DIGEST, buffer),
 };
 
-static bool verify(void) {
+static bool load_pkey(const char *path, TPMI_ALG_HASH halg, EVP_PKEY **pkey) {
 
-    bool result = false;
-    EVP_PKEY_CTX *pkey_ctx = NULL;
-
-    /* read the public key */
-    EVP_PKEY *pkey = NULL;
-    bool ret = tpm2_public_load_pkey(ctx.pubkey_file_path, &pkey);
+    bool ret = tpm2_public_load_pkey(path, pkey);
     if (!ret) {
         return false;
     }
 
 #if OPENSSL_VERSION_NUMBER >= 0x10101003L
 #if OPENSSL_VERSION_MAJOR < 3
-    if (ctx.halg == TPM2_ALG_SM3_256) {
-        ret = EVP_PKEY_set_alias_type(pkey, EVP_PKEY_SM2);
+    if (halg == TPM2_ALG_SM3_256) {
+        ret = EVP_PKEY_set_alias_type(*pkey, EVP_PKEY_SM2);
         if (!ret) {
             LOG_ERR("EVP_PKEY_set_alias_type failed: %s", ERR_error_string(ERR_get_error(), NULL));
-            goto err;
+            EVP_PKEY_free(*pkey);
+            *pkey = NULL;
+            return false;
         }
     }
 #endif
 #endif
+    UNUSED(halg);
+
+    return true;
+}
 
-    pkey_ctx = EVP_PKEY_CTX_new(pkey, NULL);
+static bool verify(quote_ctx *q, EVP_PKEY *pkey) {
+
+    bool result = false;
+
+    EVP_PKEY_CTX *pkey_ctx = EVP_PKEY_CTX_new(pkey, NULL);
     if (!pkey_ctx) {
         LOG_ERR("EVP_PKEY_CTX_new failed: %s", ERR_error_string(ERR_get_error(), NULL));
         goto err;
@@ -87,7 +144,7 @@ static bool verify(void) {
     /* get the digest alg */
     /* TODO SPlit loading on plain vs tss format to detect the hash alg */
     /* If its a plain sig we need -g */
-    const EVP_MD *md = tpm2_openssl_md_from_tpmhalg(ctx.halg);
+    const EVP_MD *md = tpm2_openssl_md_from_tpmhalg(q->halg);
     // TODO error handling
 
     int rc = EVP_PKEY_verify_init(pkey_ctx);
@@ -103,14 +160,16 @@ static bool verify(void) {
     }
 
     /* TODO dump actual signature */
-    tpm2_tool_output("sig: ");
-    tpm2_util_hexdump(ctx.signature.buffer, ctx.signature.size);
-    tpm2_tool_output("\n");
+    if (q->is_output_enabled) {
+        tpm2_tool_output("sig: ");
+        tpm2_util_hexdump(q->signature.buffer, q->signature.size);
+        tpm2_tool_output("\n");
+    }
 
     // Verify the signature matches message digest
 
-    rc = EVP_PKEY_verify(pkey_ctx, ctx.signature.buffer, ctx.signature.size,
-            ctx.msg_hash.buffer, ctx.msg_hash.size);
+    rc = EVP_PKEY_verify(pkey_ctx, q->signature.buffer, q->signature.size,
+            q->msg_hash.buffer, q->msg_hash.size);
     if (rc != 1) {
         if (rc == 0) {
             LOG_ERR("Error validating signed message with public key provided");
@@ -121,17 +180,17 @@ static bool verify(void) {
     }
 
     // Ensure nonce is the same as given
-    if (ctx.attest.extraData.size != ctx.extra_data.size ||
-        memcmp(ctx.attest.extraData.buffer, ctx.extra_data.buffer,
-        ctx.extra_data.size) != 0) {
+    if (q->attest.extraData.size != q->extra_data.size ||
+        memcmp(q->attest.extraData.buffer, q->extra_data.buffer,
+        q->extra_data.size) != 0) {
         LOG_ERR("Error validating nonce from quote");
         goto err;
     }
 
     // Also ensure digest from quote matches PCR digest
-    if (ctx.flags.pcr) {
-        if (!tpm2_util_verify_digests(&ctx.attest.attested.quote.pcrDigest,
-                &ctx.pcr_hash)) {
+    if (q->pcr_file_path) {
+        if (!tpm2_util_verify_digests(&q->attest.attested.quote.pcrDigest,
+                &q->pcr_hash)) {
             LOG_ERR("Error validating PCR composite against signed message");
             goto err;
         }
@@ -141,7 +200,6 @@ static bool verify(void) {
 
 err:
 
-    EVP_PKEY_free(pkey);
     EVP_PKEY_CTX_free(pkey_ctx);
 
     return result;
@@ -345,55 +403,67 @@ out:
 
 static bool eventlog_from_file(tpm2_eventlog_context *evctx, const char *file_path) {
 
-    unsigned long size;
-
-    if (!files_get_file_size_path(file_path, &size)) {
+    files_mapping eventlog;
+    if (!files_map_path(file_path, &eventlog)) {
         return false;
     }
 
-    if (!size) {
+    bool rc = false;
+    if (!eventlog.size) {
         LOG_ERR("The eventlog file \"%s\" is empty", file_path);
-        return false;
-    }
-
-    uint8_t *eventlog = calloc(1, size);
-    if (!eventlog) {
-        LOG_ERR("OOM");
-        return false;
+        goto out;
     }
 
-    uint16_t size_tmp = size;
-    if (!files_load_bytes_from_path(file_path, eventlog, &size_tmp)) {
-        free(eventlog);
-        return false;
-    }
+    rc = parse_eventlog(evctx, eventlog.data, eventlog.size);
 
-    bool rc = parse_eventlog(evctx, eventlog, size);
-    free(eventlog);
+out:
+    files_unmap_path(&eventlog);
 
     return rc;
 }
 
-static tool_rc init(void) {
+/*
+ * The PCRs matching the eventlog only proves the events were measured, the
+ * reference measurements tell whether they are acceptable. Unknown events are
+ * reported, denied ones fail the verification.
+ */
+static bool eventlog_references_check(quote_ctx *q,
+        tpm2_eventlog_context const *eventlog_ctx) {
+
+    size_t allowed = eventlog_ctx->refdb_events[tpm2_refdb_verdict_allow];
+    size_t denied = eventlog_ctx->refdb_events[tpm2_refdb_verdict_deny];
+    size_t unknown = eventlog_ctx->refdb_events[tpm2_refdb_verdict_unknown];
+
+    if (q->is_output_enabled) {
+        tpm2_tool_output("references:\n");
+        tpm2_tool_output("  allow: %zu\n", allowed);
+        tpm2_tool_output("  deny: %zu\n", denied);
+        tpm2_tool_output("  unknown: %zu\n", unknown);
+    }
 
-    /* check flags for mismatches */
-    if (!(ctx.pubkey_file_path && ctx.flags.sig && ctx.flags.msg)) {
-        LOG_ERR(
-                "--pubkey (-u), --msg (-m) and --sig (-s) are required");
-        return tool_rc_option_error;
+    if (unknown) {
+        LOG_WARN("Eventlog \"%s\" has %zu events without a reference "
+                "measurement", q->eventlog_path, unknown);
     }
-    if (ctx.flags.eventlog && !ctx.flags.pcr) {
-        LOG_ERR("PCR file is required to validate eventlog");
-        return tool_rc_option_error;
+
+    if (denied) {
+        LOG_ERR("Eventlog \"%s\" has %zu events denied by the reference "
+                "measurements", q->eventlog_path, denied);
+        return false;
     }
 
+    return true;
+}
+
+static tool_rc init(quote_ctx *q) {
+
     TPM2B_ATTEST *msg = NULL;
     TPML_PCR_SELECTION pcr_select;
     tpm2_pcrs *pcrs;
     tpm2_pcrs temp_pcrs = {};
     tool_rc return_value = tool_rc_general_error;
 
-    msg = message_from_file(ctx.msg_file_path);
+    msg = message_from_file(q->msg_file_path);
     if (!msg) {
         /* message_from_file() logs specific error no need to here */
         return tool_rc_general_error;
@@ -409,27 +479,27 @@ static tool_rc init(void) {
      * specifies the hash alg, or we're guessing, we should use the right one.
      */
     TPMI_ALG_HASH expected_halg = TPM2_ALG_ERROR;
-    bool res = tpm2_convert_sig_load_plain(ctx.sig_file_path,
-            &ctx.signature, &expected_halg);
+    bool res = tpm2_convert_sig_load_plain(q->sig_file_path,
+            &q->signature, &expected_halg);
     if (!res) {
         goto err;
     }
 
     if (expected_halg != TPM2_ALG_NULL) {
-        if (ctx.halg != expected_halg) {
-            if (ctx.flags.hlg) {
-                const char *got_str = tpm2_alg_util_algtostr(ctx.halg, tpm2_alg_util_flags_any);
+        if (q->halg != expected_halg) {
+            if (q->is_halg_set) {
+                const char *got_str = tpm2_alg_util_algtostr(q->halg, tpm2_alg_util_flags_any);
                 const char *expected_str = tpm2_alg_util_algtostr(expected_halg, tpm2_alg_util_flags_any);
                 LOG_WARN("User specified hash algorithm of \"%s\", does not match"
                         "expected hash algorithm of \"%s\", using: \"%s\"",
                         got_str, expected_str, expected_str);
             }
-            ctx.halg = expected_halg;
+            q->halg = expected_halg;
         }
     }
 
     /* If no digest is specified, compute it */
-    if (!ctx.flags.msg) {
+    if (!q->msg_file_path) {
         /*
          * This is a redundant check since main() checks this case, but we'll add it here to silence any
          * complainers.
@@ -439,8 +509,8 @@ static tool_rc init(void) {
         goto err;
     }
 
-    if (ctx.flags.pcr) {
-        if (pcrs_from_file(ctx.pcr_file_path, &pcr_select, &temp_pcrs)) {
+    if (q->pcr_file_path) {
+        if (pcrs_from_file(q->pcr_file_path, &pcr_select, &temp_pcrs)) {
             /* pcrs_from_file() logs specific error no need to here */
             pcrs = &temp_pcrs;
         } else {
@@ -455,19 +525,19 @@ static tool_rc init(void) {
             if (le16toh(pcr_select.pcrSelections[i].hash) == TPM2_ALG_ERROR)
             goto err;
 
-        if (!tpm2_openssl_hash_pcr_banks_le(ctx.halg, &pcr_select, pcrs,
-                &ctx.pcr_hash)) {
+        if (!tpm2_openssl_hash_pcr_banks_le(q->halg, &pcr_select, pcrs,
+                &q->pcr_hash)) {
             LOG_ERR("Failed to hash PCR values related to quote!");
             goto err;
         }
-        if (!pcr_print_pcr_struct_le(&pcr_select, pcrs)) {
+        if (q->is_output_enabled && !pcr_print_pcr_struct_le(&pcr_select, pcrs)) {
             LOG_ERR("Failed to print PCR values related to quote!");
             goto err;
         }
     }
 
-    if (ctx.flags.eventlog && ctx.flags.pcr) {
-        if (pcrs_from_file(ctx.pcr_file_path, &pcr_select, &temp_pcrs)) {
+    if (q->eventlog_path && q->pcr_file_path) {
+        if (pcrs_from_file(q->pcr_file_path, &pcr_select, &temp_pcrs)) {
             /* pcrs_from_file() logs specific error no need to here */
             pcrs = &temp_pcrs;
         } else {
@@ -477,8 +547,19 @@ static tool_rc init(void) {
         if (pcr_select.count > TPM2_NUM_PCR_BANKS)
             goto err;
 
-        tpm2_eventlog_context eventlog_ctx = { 0 };
-        bool rc = eventlog_from_file(&eventlog_ctx, ctx.eventlog_path);
+        /*
+         * Only the banks of the quote are verified, the digests of the other
+         * banks must not allow an event.
+         */
+        tpm2_eventlog_context eventlog_ctx = { .refdb = q->refdb };
+        for (unsigned i = 0; i < pcr_select.count; i++) {
+            TPMI_ALG_HASH alg = pcr_select.pcrSelections[i].hash;
+            if (alg < 32) {
+                eventlog_ctx.refdb_banks |= 1u << alg;
+            }
+        }
+
+        bool rc = eventlog_from_file(&eventlog_ctx, q->eventlog_path);
         if (!rc) {
             LOG_ERR("Failed to process eventlog");
             goto err;
@@ -543,17 +624,21 @@ static tool_rc init(void) {
             LOG_ERR("Eventlog and quote PCR mismatch");
             goto err;
         }
+
+        if (q->refdb && !eventlog_references_check(q, &eventlog_ctx)) {
+            goto err;
+        }
     }
 
-    tool_rc tmp_rc = files_tpm2b_attest_to_tpms_attest(msg, &ctx.attest);
+    tool_rc tmp_rc = files_tpm2b_attest_to_tpms_attest(msg, &q->attest);
     if (tmp_rc != tool_rc_success) {
         return_value = tmp_rc;
         goto err;
     }
 
     // Figure out the digest for this message
-    res = tpm2_openssl_hash_compute_data(ctx.halg, msg->attestationData,
-            msg->size, &ctx.msg_hash);
+    res = tpm2_openssl_hash_compute_data(q->halg, msg->attestationData,
+            msg->size, &q->msg_hash);
     if (!res) {
         LOG_ERR("Compute message hash failed!");
         goto err;
@@ -567,6 +652,316 @@ err:
     return return_value;
 }
 
+static const char *manifest_field(const char *field) {
+
+    /* a dash marks an unused optional column */
+    return (field && strcmp(field, "-")) ? field : NULL;
+}
+
+static bool batch_load(batch_ctx *b, const char *path) {
+
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        LOG_ERR("Could not open manifest file \"%s\" error: \"%s\"", path,
+                strerror(errno));
+        return false;
+    }
+
+    bool result = false;
+    char *line = NULL;
+    size_t len = 0;
+    size_t capacity = 0;
+    unsigned long line_number = 0;
+    while (getline(&line, &len, f) != -1) {
+        line_number++;
+
+        char *comment = strchr(line, '#');
+        if (comment) {
+            *comment = '\0';
+        }
+
+        /* message signature [pcr [eventlog [nonce [public]]]] */
+        char *fields[6] = { 0 };
+        size_t count = 0;
+        char *saveptr = NULL;
+        char *tok;
+        while ((tok = strtok_r(count ? NULL : line, " \t\r\n", &saveptr))) {
+            if (count == ARRAY_LEN(fields)) {
+                LOG_ERR("Manifest line %lu: too many fields", line_number);
+                goto out;
+            }
+            fields[count++] = tok;
+        }
+
+        if (!count) {
+            continue;
+        }
+
+        if (count < 2) {
+            LOG_ERR("Manifest line %lu: a message and signature are required",
+                    line_number);
+            goto out;
+        }
+
+        if (b->count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            batch_job *jobs = realloc(b->jobs, capacity * sizeof(*jobs));
+            if (!jobs) {
+                LOG_ERR("oom");
+                goto out;
+            }
+            b->jobs = jobs;
+        }
+
+        batch_job *job = &b->jobs[b->count];
+        *job = (batch_job) {
+            .line = line,
+            .line_number = line_number,
+            .msg_file_path = fields[0],
+            .sig_file_path = fields[1],
+            .pcr_file_path = manifest_field(fields[2]),
+            .eventlog_path = manifest_field(fields[3]),
+            .nonce = manifest_field(fields[4]),
+            .pubkey_file_path = manifest_field(fields[5]),
+        };
+        b->count++;
+
+        /* the job owns the line now */
+        line = NULL;
+        len = 0;
+
+        if (job->eventlog_path && !job->pcr_file_path) {
+            LOG_ERR("Manifest line %lu: PCR file is required to validate "
+                    "eventlog", line_number);
+            goto out;
+        }
+
+        if (!job->pubkey_file_path) {
+            job->pubkey_file_path = ctx.pubkey_file_path;
+        }
+
+        if (!job->pubkey_file_path) {
+            LOG_ERR("Manifest line %lu: no public key and --public (-u) not "
+                    "specified", line_number);
+            goto out;
+        }
+    }
+
+    if (ferror(f)) {
+        LOG_ERR("Error reading manifest file \"%s\"", path);
+        goto out;
+    }
+
+    result = true;
+
+out:
+    free(line);
+    fclose(f);
+
+    return result;
+}
+
+static bool batch_pkey_get(batch_ctx *b, const char *path, TPMI_ALG_HASH halg,
+        EVP_PKEY **pkey) {
+
+    bool is_sm2 = (halg == TPM2_ALG_SM3_256);
+    bool result = false;
+
+    pthread_mutex_lock(&b->lock);
+
+    pkey_cache_entry *entry;
+    for (entry = b->pkeys; entry; entry = entry->next) {
+        if (entry->is_sm2 == is_sm2 && !strcmp(entry->path, path)) {
+            break;
+        }
+    }
+
+    if (!entry) {
+        entry = calloc(1, sizeof(*entry));
+        if (!entry) {
+            LOG_ERR("oom");
+            goto out;
+        }
+
+        entry->path = strdup(path);
+        if (!entry->path) {
+            LOG_ERR("oom");
+            free(entry);
+            goto out;
+        }
+
+        if (!load_pkey(path, halg, &entry->pkey)) {
+            free(entry->path);
+            free(entry);
+            goto out;
+        }
+
+        entry->is_sm2 = is_sm2;
+        entry->next = b->pkeys;
+        b->pkeys = entry;
+    }
+
+    *pkey = entry->pkey;
+    result = true;
+
+out:
+    pthread_mutex_unlock(&b->lock);
+
+    return result;
+}
+
+static bool batch_verify(batch_ctx *b, batch_job *job) {
+
+    quote_ctx q = {
+        .halg = ctx.halg,
+        .is_halg_set = ctx.flags.hlg,
+        .msg_hash = TPM2B_TYPE_INIT(TPM2B_DIGEST, buffer),
+        .pcr_hash = TPM2B_TYPE_INIT(TPM2B_DIGEST, buffer),
+        .msg_file_path = job->msg_file_path,
+        .sig_file_path = job->sig_file_path,
+        .pcr_file_path = job->pcr_file_path,
+        .eventlog_path = job->eventlog_path,
+        .pubkey_file_path = job->pubkey_file_path,
+        .refdb = ctx.refdb,
+    };
+
+    if (job->nonce) {
+        q.extra_data.size = sizeof(q.extra_data.buffer);
+        bool res = tpm2_util_bin_from_hex_or_file(job->nonce,
+                &q.extra_data.size, q.extra_data.buffer);
+        if (!res) {
+            return false;
+        }
+    }
+
+    tool_rc rc = init(&q);
+    if (rc != tool_rc_success) {
+        return false;
+    }
+
+    /* the cache owns the key */
+    EVP_PKEY *pkey = NULL;
+    bool res = batch_pkey_get(b, q.pubkey_file_path, q.halg, &pkey);
+    if (!res) {
+        return false;
+    }
+
+    return verify(&q, pkey);
+}
+
+static void *batch_worker(void *arg) {
+
+    batch_ctx *b = (batch_ctx *)arg;
+
+    while (true) {
+        batch_job *job = NULL;
+
+        pthread_mutex_lock(&b->lock);
+        if (b->next < b->count) {
+            job = &b->jobs[b->next++];
+        }
+        pthread_mutex_unlock(&b->lock);
+
+        if (!job) {
+            break;
+        }
+
+        job->is_verified = batch_verify(b, job);
+        if (!job->is_verified) {
+            LOG_ERR("Manifest line %lu: verify signature failed!",
+                    job->line_number);
+        }
+    }
+
+    return NULL;
+}
+
+static tool_rc batch_run(void) {
+
+    if (ctx.flags.msg || ctx.flags.sig || ctx.flags.pcr ||
+            ctx.flags.eventlog || ctx.flags.qualification) {
+        LOG_ERR("--batch cannot be combined with -m, -s, -f, -e or -q");
+        return tool_rc_option_error;
+    }
+
+    batch_ctx b = { 0 };
+    int err = pthread_mutex_init(&b.lock, NULL);
+    if (err) {
+        LOG_ERR("Could not initialize batch lock: %s", strerror(err));
+        return tool_rc_general_error;
+    }
+
+    size_t i;
+    tool_rc rc = tool_rc_general_error;
+    bool res = batch_load(&b, ctx.batch_path);
+    if (!res) {
+        goto out;
+    }
+
+    unsigned threads = ctx.batch_jobs;
+    if (!threads) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? cpus : 1;
+    }
+
+    if (threads > BATCH_MAX_JOBS) {
+        threads = BATCH_MAX_JOBS;
+    }
+
+    if (threads > b.count) {
+        threads = b.count;
+    }
+
+    /* the calling thread is a worker as well */
+    pthread_t workers[BATCH_MAX_JOBS];
+    unsigned started = 0;
+    while (started + 1 < threads) {
+        err = pthread_create(&workers[started], NULL, batch_worker, &b);
+        if (err) {
+            LOG_WARN("Could not start batch worker: %s", strerror(err));
+            break;
+        }
+        started++;
+    }
+
+    batch_worker(&b);
+
+    while (started) {
+        pthread_join(workers[--started], NULL);
+    }
+
+    /* results are reported in manifest order, once all are known */
+    rc = tool_rc_success;
+    for (i = 0; i < b.count; i++) {
+        batch_job *job = &b.jobs[i];
+        tpm2_tool_output("- line: %lu\n", job->line_number);
+        tpm2_tool_output("  message: %s\n", job->msg_file_path);
+        tpm2_tool_output("  verified: %s\n",
+                job->is_verified ? "true" : "false");
+        if (!job->is_verified) {
+            rc = tool_rc_general_error;
+        }
+    }
+
+out:
+    for (i = 0; i < b.count; i++) {
+        free(b.jobs[i].line);
+    }
+    free(b.jobs);
+
+    while (b.pkeys) {
+        pkey_cache_entry *next = b.pkeys->next;
+        EVP_PKEY_free(b.pkeys->pkey);
+        free(b.pkeys->path);
+        free(b.pkeys);
+        b.pkeys = next;
+    }
+
+    pthread_mutex_destroy(&b.lock);
+
+    return rc;
+}
+
 static bool on_option(char key, char *value) {
 
     switch (key) {
@@ -591,6 +986,7 @@ static bool on_option(char key, char *value) {
         LOG_WARN("DEPRECATED: Format ignored");
         break;
     case 'q':
+        ctx.flags.qualification = 1;
         ctx.extra_data.size = sizeof(ctx.extra_data.buffer);
         return tpm2_util_bin_from_hex_or_file(value, &ctx.extra_data.size,
                 ctx.extra_data.buffer);
@@ -610,6 +1006,19 @@ static bool on_option(char key, char *value) {
     case 'l':
         ctx.pcr_selection_string = value;
         break;
+    case 0:
+        ctx.batch_path = value;
+        break;
+    case 1:
+        if (!tpm2_util_string_to_uint32(value, &ctx.batch_jobs) ||
+                !ctx.batch_jobs) {
+            LOG_ERR("Invalid number of jobs, got: \"%s\"", value);
+            return false;
+        }
+        break;
+    case 2:
+        ctx.refdb_path = value;
+        break;
         /* no default */
     }
 
@@ -628,6 +1037,9 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
             { "pcr-list",           required_argument, NULL, 'l' },
             { "public",             required_argument, NULL, 'u' },
             { "qualification",      required_argument, NULL, 'q' },
+            { "batch",              required_argument, NULL,  0  },
+            { "jobs",               required_argument, NULL,  1  },
+            { "refdb",              required_argument, NULL,  2  },
     };
 
 
@@ -642,13 +1054,58 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
     UNUSED(ectx);
     UNUSED(flags);
 
+    /* shared by the batch jobs, lookups only read the mapped database */
+    if (ctx.refdb_path) {
+        ctx.refdb = tpm2_refdb_load(ctx.refdb_path);
+        if (!ctx.refdb) {
+            return tool_rc_general_error;
+        }
+    }
+
+    if (ctx.batch_path) {
+        return batch_run();
+    }
+
+    /* check flags for mismatches */
+    if (!(ctx.pubkey_file_path && ctx.flags.sig && ctx.flags.msg)) {
+        LOG_ERR(
+                "--pubkey (-u), --msg (-m) and --sig (-s) are required");
+        return tool_rc_option_error;
+    }
+    if (ctx.flags.eventlog && !ctx.flags.pcr) {
+        LOG_ERR("PCR file is required to validate eventlog");
+        return tool_rc_option_error;
+    }
+    if (ctx.refdb && !ctx.flags.eventlog) {
+        LOG_ERR("Eventlog is required to check reference measurements");
+        return tool_rc_option_error;
+    }
+
+    quote_ctx q = {
+        .halg = ctx.halg,
+        .is_halg_set = ctx.flags.hlg,
+        .msg_hash = TPM2B_TYPE_INIT(TPM2B_DIGEST, buffer),
+        .pcr_hash = TPM2B_TYPE_INIT(TPM2B_DIGEST, buffer),
+        .extra_data = ctx.extra_data,
+        .msg_file_path = ctx.msg_file_path,
+        .sig_file_path = ctx.sig_file_path,
+        .pcr_file_path = ctx.pcr_file_path,
+        .eventlog_path = ctx.eventlog_path,
+        .pubkey_file_path = ctx.pubkey_file_path,
+        .refdb = ctx.refdb,
+        .is_output_enabled = true,
+    };
+
     /* initialize and process */
-    tool_rc rc = init();
+    tool_rc rc = init(&q);
     if (rc != tool_rc_success) {
         return rc;
     }
 
-    bool res = verify();
+    EVP_PKEY *pkey = NULL;
+    bool res = load_pkey(q.pubkey_file_path, q.halg, &pkey) &&
+            verify(&q, pkey);
+    EVP_PKEY_free(pkey);
     if (!res) {
         LOG_ERR("Verify signature failed!");
         return tool_rc_general_error;
@@ -657,5 +1114,11 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
     return tool_rc_success;
 }
 
+static void tpm2_tool_onexit(void) {
+
+    tpm2_refdb_free(ctx.refdb);
+}
+
 // Register this tool with tpm2_tool.c
-TPM2_TOOL_REGISTER("checkquote", tpm2_tool_onstart, tpm2_tool_onrun, NULL, NULL)
+TPM2_TOOL_REGISTER("checkquote", tpm2_tool_onstart, tpm2_tool_onrun, NULL,
+        tpm2_tool_onexit)
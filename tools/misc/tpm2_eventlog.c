@@ -2,23 +2,45 @@
 #include <errno.h>
 #include <inttypes.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "files.h"
 #include "log.h"
 #include "efi_event.h"
 #include "tpm2_eventlog.h"
+#include "tpm2_eventlog_index.h"
 #include "tpm2_eventlog_yaml.h"
+#include "tpm2_refdb.h"
 #include "tpm2_tool.h"
-
-#define CHUNK_SIZE 16384
+#include "tpm2_writer.h"
 
 static char *filename = NULL;
 
 /* Set the default YAML version */
 static uint32_t eventlog_version = 1;
 
+/* Seconds between two polls of the log in watch mode, 0 parses it once */
+static uint32_t watch_interval;
+
+static tpm2_writer_format output_format = tpm2_writer_format_yaml;
+
+/* The sidecar index of the log, rebuilt when it does not match the log */
+static char *index_path;
+
+/* The query answered from the index, all events of all PCRs by default */
+static uint32_t query_pcrs;
+static bool has_event_range;
+static size_t query_first;
+static size_t query_last = SIZE_MAX;
+
+/* The reference measurements, compiled from refdb_source first when set */
+static char *refdb_path;
+static char *refdb_source;
+
 static bool on_positional(int argc, char **argv) {
 
     if (argc != 1) {
@@ -32,6 +54,60 @@ static bool on_positional(int argc, char **argv) {
     return true;
 }
 
+static bool on_pcr_list(char *value) {
+
+    char *saveptr;
+    char *token = strtok_r(value, ",", &saveptr);
+    if (!token) {
+        LOG_ERR("Expected a list of PCR indices, got: \"%s\"", value);
+        return false;
+    }
+
+    for (; token; token = strtok_r(NULL, ",", &saveptr)) {
+        uint32_t pcr;
+        if (!tpm2_util_string_to_uint32(token, &pcr) || pcr >= TPM2_MAX_PCRS) {
+            LOG_ERR("Invalid PCR index: %s", token);
+            return false;
+        }
+        query_pcrs |= 1u << pcr;
+    }
+
+    return true;
+}
+
+/* Parses "FIRST:LAST", "FIRST:" up to the end of the log or a single "N" */
+static bool on_event_range(char *value) {
+
+    char *last = strchr(value, ':');
+    if (last) {
+        *last++ = '\0';
+    }
+
+    uint32_t first_num;
+    uint32_t last_num;
+    if (!tpm2_util_string_to_uint32(value, &first_num)) {
+        LOG_ERR("Cannot parse the first event of the range: %s", value);
+        return false;
+    }
+
+    query_first = first_num;
+    query_last = first_num;
+    if (last && *last == '\0') {
+        query_last = SIZE_MAX;
+    } else if (last) {
+        if (!tpm2_util_string_to_uint32(last, &last_num)
+                || last_num < first_num) {
+            LOG_ERR("Cannot parse the last event of the range: %s", last);
+            return false;
+        }
+        query_last = last_num;
+    }
+
+    has_event_range = true;
+
+    return true;
+}
+
 static bool on_option(char key, char *value) {
 
     uint32_t version;
@@ -48,6 +124,32 @@ static bool on_option(char key, char *value) {
         }
         eventlog_version = version;
         break;
+    case 1:
+        if (!tpm2_util_string_to_uint32(value, &watch_interval)
+                || !watch_interval) {
+            LOG_ERR("Cannot parse watch interval: %s", value);
+            return false;
+        }
+        break;
+    case 2:
+        if (!tpm2_writer_format_from_str(value, &output_format)) {
+            LOG_ERR("Unknown output format: %s", value);
+            return false;
+        }
+        break;
+    case 3:
+        index_path = value;
+        break;
+    case 4:
+        return on_pcr_list(value);
+    case 5:
+        return on_event_range(value);
+    case 6:
+        refdb_path = value;
+        break;
+    case 7:
+        refdb_source = value;
+        break;
     }
     return true;
 }
@@ -56,6 +158,13 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
 
     static struct option topts[] = {
          { "eventlog-version",         required_argument, NULL, 0 },
+         { "watch",                    required_argument, NULL, 1 },
+         { "format",                   required_argument, NULL, 2 },
+         { "index",                    required_argument, NULL, 3 },
+         { "pcr",                      required_argument, NULL, 4 },
+         { "event-range",              required_argument, NULL, 5 },
+         { "refdb",                    required_argument, NULL, 6 },
+         { "refdb-source",             required_argument, NULL, 7 },
     };
 
     *opts = tpm2_options_new("y:", ARRAY_LEN(topts), topts, on_option,
@@ -64,6 +173,174 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
     return *opts != NULL;
 }
 
+#define WATCH_READ_CHUNK_SIZE 16384
+
+/* How far watch mode read the log and which file it was */
+typedef struct watch_position watch_position;
+struct watch_position {
+    long offset;
+    dev_t dev;
+    ino_t ino;
+};
+
+/*
+ * Reads the bytes appended to the log after the position into the unparsed
+ * tail of the previous polls. The log is reopened on every poll, pseudo files
+ * like the ones in securityfs may not report new data to a reader that already
+ * reached their end. A log that was replaced, or truncated below the position,
+ * is read again from its start and is_reset is set.
+ */
+static bool watch_read(watch_position *position, UINT8 **data, size_t *size,
+        size_t *capacity, size_t *read_size, bool *is_reset) {
+
+    *read_size = 0;
+    *is_reset = false;
+
+    FILE *f = fopen(filename, "rb");
+    if (!f) {
+        LOG_ERR("Could not open file \"%s\" error: %s", filename,
+                strerror(errno));
+        return false;
+    }
+
+    struct stat st;
+    bool result = !fstat(fileno(f), &st);
+    if (!result) {
+        LOG_ERR("Could not stat \"%s\" error: %s", filename, strerror(errno));
+        goto out;
+    }
+
+    /* pseudo files report a size of 0, only regular files can be truncated */
+    bool is_replaced = st.st_dev != position->dev || st.st_ino != position->ino;
+    bool is_truncated = S_ISREG(st.st_mode) && st.st_size < position->offset;
+    if (position->offset && (is_replaced || is_truncated)) {
+        LOG_WARN("\"%s\" was %s, reading it from the start", filename,
+                is_replaced ? "replaced" : "truncated");
+        position->offset = 0;
+        *size = 0;
+        *is_reset = true;
+    }
+    position->dev = st.st_dev;
+    position->ino = st.st_ino;
+
+    result = !fseek(f, position->offset, SEEK_SET);
+    if (!result) {
+        LOG_ERR("Could not seek to offset %ld in \"%s\"", position->offset,
+                filename);
+        goto out;
+    }
+
+    bool is_chunk_full;
+    do {
+        if (*capacity - *size < WATCH_READ_CHUNK_SIZE) {
+            size_t new_capacity = *capacity ?
+                    *capacity * 2 : WATCH_READ_CHUNK_SIZE;
+            UINT8 *tmp = realloc(*data, new_capacity);
+            if (!tmp) {
+                LOG_ERR("oom");
+                result = false;
+                goto out;
+            }
+            *data = tmp;
+            *capacity = new_capacity;
+        }
+
+        size_t chunk_size = 0;
+        is_chunk_full = files_read_bytes_chunk(f, *data + *size,
+                WATCH_READ_CHUNK_SIZE, &chunk_size);
+        *size += chunk_size;
+        *read_size += chunk_size;
+    } while (is_chunk_full);
+
+    if (ferror(f)) {
+        LOG_ERR("Could not read \"%s\"", filename);
+        result = false;
+        goto out;
+    }
+
+    position->offset += *read_size;
+
+out:
+    fclose(f);
+    return result;
+}
+
+static tool_rc eventlog_watch(tpm2_refdb const *refdb) {
+
+    tpm2_eventlog_context ctx;
+    size_t count;
+    yaml_eventlog_watch_init(&ctx, &count, eventlog_version, refdb);
+
+    UINT8 *data = NULL;
+    size_t size = 0;
+    size_t capacity = 0;
+    watch_position position = { 0 };
+
+    tool_rc rc = tool_rc_general_error;
+    for (;;) {
+        size_t read_size;
+        bool is_reset;
+        bool ret = watch_read(&position, &data, &size, &capacity, &read_size,
+                &is_reset);
+        if (!ret) {
+            goto out;
+        }
+
+        /* a new log starts over with its specid event and zeroed PCRs */
+        if (is_reset) {
+            yaml_eventlog_watch_init(&ctx, &count, eventlog_version, refdb);
+        }
+
+        if (read_size) {
+            size_t consumed;
+            ret = yaml_eventlog_watch(&ctx, data, size, &consumed);
+            if (!ret) {
+                LOG_ERR("failed to parse tpm2 eventlog");
+                goto out;
+            }
+
+            /* keep the incomplete tail for the next poll */
+            size -= consumed;
+            memmove(data, data + consumed, size);
+        }
+
+        sleep(watch_interval);
+    }
+
+out:
+    free(data);
+    return rc;
+}
+
+/*
+ * Loads the index of the log, or builds it when the index file is missing or
+ * out of date and saves it for the next queries.
+ */
+static tpm2_eventlog_index *eventlog_index_get(files_mapping *eventlog) {
+
+    tpm2_eventlog_index *index = NULL;
+    if (index_path) {
+        index = tpm2_eventlog_index_load(index_path, eventlog->data,
+                eventlog->size);
+        if (index) {
+            return index;
+        }
+    }
+
+    index = tpm2_eventlog_index_build(eventlog->data, eventlog->size);
+    if (!index) {
+        LOG_ERR("failed to index tpm2 eventlog");
+        return NULL;
+    }
+
+    if (index_path && !tpm2_eventlog_index_save(index, index_path)) {
+        tpm2_eventlog_index_free(index);
+        return NULL;
+    }
+
+    return index;
+}
+
 static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
 
     UNUSED(flags);
@@ -74,44 +351,81 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
         return tool_rc_option_error;
     }
 
-    /* Read the file in chunks.  Usually the file will reside in
-       securityfs, and those files do not have a public file size */
-    FILE *fileptr = fopen(filename, "rb");
-    if (!fileptr) {
+    tpm2_writer_set_format(tpm2_writer_stdout(), output_format);
+
+    bool is_query = query_pcrs || has_event_range;
+    if (watch_interval && (index_path || is_query)) {
+        LOG_ERR("--watch cannot be combined with --index, --pcr or "
+                "--event-range");
+        return tool_rc_option_error;
+    }
+
+    if (refdb_source && !refdb_path) {
+        LOG_ERR("--refdb-source requires --refdb for the compiled database");
+        return tool_rc_option_error;
+    }
+
+    if (refdb_source && !tpm2_refdb_compile(refdb_source, refdb_path)) {
         return tool_rc_general_error;
     }
 
-    /* Reserve the buffer for the first chunk */
+    tpm2_refdb *refdb = NULL;
+    if (refdb_path) {
+        refdb = tpm2_refdb_load(refdb_path);
+        if (!refdb) {
+            return tool_rc_general_error;
+        }
+    }
+
     tool_rc rc = tool_rc_success;
-    UINT8 *eventlog = NULL;
-    size_t size = 0;
-    bool is_file_read = false;
-    do {
-        UINT8 *eventlog_tmp = realloc(eventlog, size + CHUNK_SIZE);
-        if (!eventlog_tmp){
-            LOG_ERR("failed to allocate %zu bytes: %s", size + CHUNK_SIZE, strerror(errno));
+    tpm2_eventlog_index *index = NULL;
+    files_mapping eventlog = { 0 };
+    if (watch_interval) {
+        rc = eventlog_watch(refdb);
+        goto out;
+    }
+
+    /*
+     * Map the log so it is parsed in place. Usually the file will reside in
+     * securityfs, and those files do not have a public file size, so they
+     * are read in chunks instead.
+     */
+    bool ret = files_map_path(filename, &eventlog);
+    if (!ret) {
+        rc = tool_rc_general_error;
+        goto out;
+    }
+
+    if (index_path || is_query) {
+        index = eventlog_index_get(&eventlog);
+        if (!index) {
             rc = tool_rc_general_error;
             goto out;
         }
-        eventlog = eventlog_tmp;
-        is_file_read = files_read_bytes_chunk(fileptr, eventlog + size, CHUNK_SIZE, &size);
-    } while (is_file_read);
+    }
 
-    /* Parse eventlog data */
-    bool ret = yaml_eventlog(eventlog, size, eventlog_version);
+    /* Parse eventlog data, queries only parse the events they print */
+    if (is_query) {
+        size_t last = query_last;
+        if (last == SIZE_MAX) {
+            last = tpm2_eventlog_index_count(index) - 1;
+        }
+        ret = yaml_eventlog_query(eventlog.data, index, query_first, last,
+                query_pcrs ? query_pcrs : UINT32_MAX,
+                eventlog_version, refdb);
+    } else {
+        ret = yaml_eventlog(eventlog.data, eventlog.size, eventlog_version,
+                refdb);
+    }
     if (!ret) {
         LOG_ERR("failed to parse tpm2 eventlog");
         rc = tool_rc_general_error;
     }
 
 out:
-    if (fileptr) {
-        fclose(fileptr);
-    }
-
-    if (eventlog) {
-        free(eventlog);
-    }
+    tpm2_eventlog_index_free(index);
+    files_unmap_path(&eventlog);
+    tpm2_refdb_free(refdb);
 
     return rc;
 }
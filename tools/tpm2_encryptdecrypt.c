@@ -15,7 +15,6 @@
 #include "tpm2_auth_util.h"
 #include "tpm2_options.h"
 
-#define MAX_INPUT_DATA_SIZE UINT16_MAX
 #define MAX_SESSIONS 3
 typedef struct tpm_encrypt_decrypt_ctx tpm_encrypt_decrypt_ctx;
 struct tpm_encrypt_decrypt_ctx {
@@ -30,10 +29,16 @@ struct tpm_encrypt_decrypt_ctx {
 
     TPMI_YES_NO is_decrypt;
 
-    uint8_t input_data[MAX_INPUT_DATA_SIZE];
-    uint16_t input_data_size;
-
+    /*
+     * The input is streamed a block at a time, the pkcs7 padding is appended
+     * once the input is exhausted.
+     */
     const char *input_path;
+    FILE *input_file;
+    unsigned long long input_size;
+    bool is_input_done;
+    uint8_t pad_data;
+    uint8_t pad_left;
 
     uint8_t padded_block_len;
     bool is_padding_option_enabled;
@@ -44,6 +49,7 @@ struct tpm_encrypt_decrypt_ctx {
         char *out_path;
     } iv;
 
+    TPM2B_IV iv_buffer;
     TPM2B_IV *iv_in;
 
     /*
@@ -62,14 +68,12 @@ struct tpm_encrypt_decrypt_ctx {
 
 static tpm_encrypt_decrypt_ctx ctx = {
     .mode = TPM2_ALG_NULL,
-    .input_data_size = MAX_INPUT_DATA_SIZE,
     .padded_block_len = TPM2_MAX_SYM_BLOCK_SIZE,
     .is_padding_option_enabled = false,
     .parameter_hash_algorithm = TPM2_ALG_ERROR,
 };
 
-static bool evaluate_pkcs7_padding_requirements(uint16_t remaining_bytes,
-    bool expected) {
+static bool evaluate_pkcs7_padding_requirements(bool expected) {
 
     if (!ctx.is_padding_option_enabled) {
         return false;
@@ -104,47 +108,29 @@ static bool evaluate_pkcs7_padding_requirements(uint16_t remaining_bytes,
         return false;
     }
 
-    /*
-     * Only apply / strip padding to the last block.
-     */
-    bool is_last_block = (remaining_bytes <= TPM2_MAX_DIGEST_BUFFER &&
-        remaining_bytes > 0);
-    if (!is_last_block) {
-        return false;
-    }
-
     LOG_WARN("Processing pkcs7 padding.");
     return true;
 }
 
-static void append_pkcs7_padding_data_to_input(uint8_t *pad_data,
-        uint16_t *in_data_size, uint16_t *remaining_bytes) {
+/*
+ * Only called once the input is exhausted, so the padding goes after the last
+ * block of plaintext.
+ */
+static void append_pkcs7_padding_data_to_input(void) {
 
-    bool test_pad_reqs = evaluate_pkcs7_padding_requirements(*remaining_bytes,
-        false);
-    if (!test_pad_reqs) {
+    if (!ctx.input_size || !evaluate_pkcs7_padding_requirements(false)) {
         return;
     }
 
-    *pad_data = ctx.padded_block_len - (*in_data_size % ctx.padded_block_len);
-
-    memset(&ctx.input_data[ctx.input_data_size], *pad_data, *pad_data);
-
-    if (*pad_data == ctx.padded_block_len) {
-        *remaining_bytes += *pad_data;
-    }
-
-    if (*pad_data < ctx.padded_block_len) {
-        *remaining_bytes = *in_data_size += *pad_data;
-    }
+    ctx.pad_data = ctx.padded_block_len -
+        (ctx.input_size % ctx.padded_block_len);
+    ctx.pad_left = ctx.pad_data;
 }
 
-static void strip_pkcs7_padding_data_from_output(uint8_t *pad_data,
-        TPM2B_MAX_BUFFER *out_data, uint16_t *remaining_bytes) {
+static void strip_pkcs7_padding_data_from_output(TPM2B_MAX_BUFFER *out_data) {
 
-    bool test_pad_reqs = evaluate_pkcs7_padding_requirements(*remaining_bytes,
-        true);
-    if (!test_pad_reqs) {
+    bool test_pad_reqs = evaluate_pkcs7_padding_requirements(true);
+    if (!test_pad_reqs || !out_data->size) {
         return;
     }
 
@@ -155,80 +141,179 @@ static void strip_pkcs7_padding_data_from_output(uint8_t *pad_data,
         LOG_WARN("Encrypted input is not block length aligned.");
     }
 
-    *pad_data = out_data->buffer[out_data->size - 1];
+    uint8_t pad_data = out_data->buffer[out_data->size - 1];
 
-    if (*pad_data > ctx.padded_block_len) {
-      LOG_WARN("Padding data is larger than block length: %d", *pad_data);
+    if (pad_data > ctx.padded_block_len || pad_data > out_data->size) {
+      LOG_WARN("Padding data is larger than block length: %d", pad_data);
       return;
     }
 
-    for (uint8_t offset = *pad_data; offset > 1; --offset) {
-      if (out_data->buffer[out_data->size - offset] != *pad_data) {
+    for (uint8_t offset = pad_data; offset > 1; --offset) {
+      if (out_data->buffer[out_data->size - offset] != pad_data) {
         LOG_WARN("Inconsistent padding within decrypted input");
         return;
       }
     }
 
-    out_data->size -= *pad_data;
+    out_data->size -= pad_data;
 }
 
-static tool_rc encrypt_decrypt(ESYS_CONTEXT *ectx) {
+/*
+ * Fills block with up to TPM2_MAX_DIGEST_BUFFER bytes of input followed by any
+ * pending padding. An empty block marks the end of the input.
+ */
+static bool read_block(TPM2B_MAX_BUFFER *block) {
+
+    block->size = 0;
+    if (!ctx.is_input_done) {
+        block->size = fread(block->buffer, 1, TPM2_MAX_DIGEST_BUFFER,
+            ctx.input_file);
+        if (ferror(ctx.input_file)) {
+            LOG_ERR("Error reading from input file");
+            return false;
+        }
 
-    tool_rc rc = tool_rc_success;
-    uint8_t pad_data = 0;
-    UINT16 data_offset = 0;
-    uint16_t remaining_bytes = ctx.input_data_size;
-    while (remaining_bytes > 0) {
-        TPM2B_MAX_BUFFER in_data = {
-            .size = (remaining_bytes > TPM2_MAX_DIGEST_BUFFER) ?
-                    TPM2_MAX_DIGEST_BUFFER : remaining_bytes,
-        };
-
-        if (pad_data == 0) {
-            append_pkcs7_padding_data_to_input(&pad_data, &in_data.size,
-                &remaining_bytes);
+        ctx.input_size += block->size;
+
+        /* fread() only comes back short at the end of the input */
+        if (block->size < TPM2_MAX_DIGEST_BUFFER) {
+            ctx.is_input_done = true;
+            append_pkcs7_padding_data_to_input();
         }
+    }
+
+    uint16_t room = TPM2_MAX_DIGEST_BUFFER - block->size;
+    uint8_t pad_bytes = ctx.pad_left < room ? ctx.pad_left : room;
+    memset(&block->buffer[block->size], ctx.pad_data, pad_bytes);
+    block->size += pad_bytes;
+    ctx.pad_left -= pad_bytes;
+
+    return true;
+}
+
+static tool_rc calculate_cp_hash(ESYS_CONTEXT *ectx) {
+
+    TPM2B_MAX_BUFFER in_data;
+    TPM2B_MAX_BUFFER next_data;
+    bool result = read_block(&in_data) && read_block(&next_data);
+    if (!result) {
+        LOG_ERR("Failed to read in the input.");
+        return tool_rc_general_error;
+    }
+
+    if (next_data.size) {
+        LOG_ERR("Cannot calculate cpHash for buffer larger than max digest "
+                "buffer.");
+        return tool_rc_general_error;
+    }
+
+    return tpm2_encryptdecrypt(ectx, &ctx.encryption_key.object,
+        ctx.is_decrypt, ctx.mode, ctx.iv_in, &in_data, NULL, NULL,
+        &ctx.cp_hash, ctx.parameter_hash_algorithm);
+}
+
+static tool_rc encrypt_decrypt_block_finish(ESYS_CONTEXT *ectx,
+        const TPM2B_MAX_BUFFER *in_data, TPM2B_MAX_BUFFER **out_data) {
+
+    TPM2B_IV *iv_out = NULL;
+    tool_rc rc = tpm2_encryptdecrypt_finish(ectx, &ctx.encryption_key.object,
+        ctx.is_decrypt, ctx.mode, ctx.iv_in, in_data, out_data, &iv_out);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    /*
+     * Chain iv_out into iv_in for the next block. The last copy is also
+     * output from the tool for further chaining.
+     */
+    if (ctx.mode != TPM2_ALG_ECB) {
+        assert(ctx.iv_in);
+        assert(iv_out);
+        *ctx.iv_in = *iv_out;
+    }
+    free(iv_out);
+
+    return tool_rc_success;
+}
+
+static tool_rc encrypt_decrypt_stream(ESYS_CONTEXT *ectx) {
+
+    /*
+     * Blocks are chained through the IV, so only one block can be with the TPM
+     * at a time. The next block is read while the TPM works on the current
+     * one, and the output of the current one is written while the TPM works on
+     * the next, so memory use stays at two blocks for any input size.
+     */
+    TPM2B_MAX_BUFFER blocks[2];
+    unsigned current = 0;
+    if (!read_block(&blocks[current])) {
+        return tool_rc_general_error;
+    }
 
-        memcpy(in_data.buffer, &ctx.input_data[data_offset], in_data.size);
+    if (!blocks[current].size) {
+        return tool_rc_success;
+    }
+
+    tool_rc rc = tpm2_encryptdecrypt_async(ectx, &ctx.encryption_key.object,
+        ctx.is_decrypt, ctx.mode, ctx.iv_in, &blocks[current]);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    for (;;) {
+        unsigned next = current ^ 1;
+        bool is_read = read_block(&blocks[next]);
 
-        TPM2B_MAX_BUFFER *out_data = 0;
-        TPM2B_IV *iv_out = 0;
-        rc = tpm2_encryptdecrypt(ectx, &ctx.encryption_key.object,
-            ctx.is_decrypt, ctx.mode, ctx.iv_in, &in_data, &out_data, &iv_out,
-            &ctx.cp_hash, ctx.parameter_hash_algorithm);
+        TPM2B_MAX_BUFFER *out_data = NULL;
+        rc = encrypt_decrypt_block_finish(ectx, &blocks[current], &out_data);
         if (rc != tool_rc_success) {
-            goto out;
+            return rc;
         }
-        data_offset += in_data.size;
-
-        if (ctx.is_command_dispatch) {
-            /*
-             * Copy iv_out iv_in to use it in next loop iteration.
-             * This copy is also output from the tool for further chaining.
-             */
-            if (ctx.mode != TPM2_ALG_ECB) {
-                assert(ctx.iv_in);
-                assert(iv_out);
-                *ctx.iv_in = *iv_out;
-                free(iv_out);
-            }
-
-            strip_pkcs7_padding_data_from_output(&pad_data, out_data,
-                    &remaining_bytes);
 
-            bool result = files_write_bytes(ctx.out_file_ptr, out_data->buffer,
-                    out_data->size);
+        if (!is_read) {
             free(out_data);
-            if (!result) {
-                LOG_ERR("Failed to save output data to file");
-                goto out;
+            return tool_rc_general_error;
+        }
+
+        bool is_last_block = !blocks[next].size;
+        if (is_last_block) {
+            strip_pkcs7_padding_data_from_output(out_data);
+        } else {
+            rc = tpm2_encryptdecrypt_async(ectx, &ctx.encryption_key.object,
+                ctx.is_decrypt, ctx.mode, ctx.iv_in, &blocks[next]);
+            if (rc != tool_rc_success) {
+                free(out_data);
+                return rc;
+            }
+        }
+
+        bool result = files_write_bytes(ctx.out_file_ptr, out_data->buffer,
+                out_data->size);
+        free(out_data);
+        if (!result) {
+            LOG_ERR("Failed to save output data to file");
+            if (!is_last_block) {
+                /* collect the block still with the TPM */
+                TPM2B_MAX_BUFFER *discard = NULL;
+                encrypt_decrypt_block_finish(ectx, &blocks[next], &discard);
+                free(discard);
             }
+            return tool_rc_general_error;
         }
 
-        remaining_bytes -= in_data.size;
+        if (is_last_block) {
+            return tool_rc_success;
+        }
+
+        current = next;
     }
+}
+
+static tool_rc encrypt_decrypt(ESYS_CONTEXT *ectx) {
+
+    tool_rc rc = ctx.is_command_dispatch ?
+        encrypt_decrypt_stream(ectx) : calculate_cp_hash(ectx);
 
-out:
     if (ctx.out_file_ptr != stdout) {
         fclose(ctx.out_file_ptr);
     }
@@ -333,16 +418,10 @@ static tool_rc process_inputs(ESYS_CONTEXT *ectx) {
     /*
      * 3. Command specific initializations
      */
-    bool result = files_load_bytes_from_buffer_or_file_or_stdin(0,
-            ctx.input_path, &ctx.input_data_size, ctx.input_data);
-    if (!result) {
-        LOG_ERR("Failed to read in the input.");
-        return tool_rc_general_error;
-    }
-
-    if (ctx.cp_hash_path && ctx.input_data_size > TPM2_MAX_DIGEST_BUFFER) {
-        LOG_ERR("Cannot calculate cpHash for buffer larger than max digest "
-                "buffer.");
+    ctx.input_file = ctx.input_path ? fopen(ctx.input_path, "rb") : stdin;
+    if (!ctx.input_file) {
+        LOG_ERR("Could not open file \"%s\", error: %s", ctx.input_path,
+                strerror(errno));
         return tool_rc_general_error;
     }
 
@@ -350,6 +429,7 @@ static tool_rc process_inputs(ESYS_CONTEXT *ectx) {
         .size = sizeof(iv_start.buffer), .buffer = { 0 },
     };
 
+    bool result;
     if (ctx.iv.in_path) {
         unsigned long file_size;
         result = files_get_file_size_path(ctx.iv.in_path, &file_size);
@@ -374,9 +454,8 @@ static tool_rc process_inputs(ESYS_CONTEXT *ectx) {
     if (ctx.mode == TPM2_ALG_ECB) {
         ctx.iv_in = 0;
     } else {
-        ctx.iv_in = malloc(iv_start.size + sizeof(iv_start));
-        ctx.iv_in->size = iv_start.size;
-        memcpy(ctx.iv_in->buffer, &iv_start.buffer, iv_start.size);
+        ctx.iv_buffer = iv_start;
+        ctx.iv_in = &ctx.iv_buffer;
     }
 
     result = setup_alg_mode(ectx);
@@ -556,7 +635,9 @@ static tool_rc tpm2_tool_onstop(ESYS_CONTEXT *ectx) {
     /*
      * 1. Free objects
      */
-    free(ctx.iv_in);
+    if (ctx.input_file && ctx.input_file != stdin) {
+        fclose(ctx.input_file);
+    }
 
     /*
      * 2. Close authorization sessions
@@ -361,7 +361,7 @@ static tool_rc tpm2_tool_onstop(ESYS_CONTEXT *ectx) {
      * 1. Free objects
      */
     if (ctx.is_arg_session) {
-        tpm2_session_free(&ctx.arg_session);
+        tpm2_session_forget(&ctx.arg_session);
     }
 
     /*
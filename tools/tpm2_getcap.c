@@ -12,6 +12,7 @@
 #include "tpm2_capability.h"
 #include "tpm2_cc_util.h"
 #include "tpm2_tool.h"
+#include "tpm2_writer.h"
 
 /*
  * Older versions of tpm2-tss misspelled these constants' names.
@@ -26,8 +27,8 @@
 #define TPM2_PT_HR_PERSISTENT_AVAIL ((TPM2_PT) (TPM2_PT_VAR + 9))
 #endif
 
-/* convenience macro to convert flags into "1" / "0" strings */
-#define prop_str(val) val ? "1" : "0"
+/* convenience macro to convert flags into 1 / 0 values */
+#define prop_flag(val) ((val) ? 1 : 0)
 
 /* number of elements in the capability_map array */
 #define CAPABILITY_MAP_COUNT \
@@ -142,6 +143,7 @@ typedef struct capability_opts {
     UINT32 count;
     bool list;
     bool ignore_moredata;
+    tpm2_writer_format format;
 } capability_opts_t;
 
 static capability_opts_t options;
@@ -206,13 +208,15 @@ bool sanity_check_capability_opts(void) {
     return false;
 }
 
-static void print_cap_map() {
+static void print_cap_map(tpm2_writer *w) {
 
+    tpm2_writer_seq_begin(w, NULL);
     size_t i;
     for (i = 0; i < CAPABILITY_MAP_COUNT; ++i) {
         const char *capstr = capability_map[i].capability_string;
-        tpm2_tool_output("- %s\n", capstr);
+        tpm2_writer_string(w, NULL, capstr, tpm2_writer_style_plain);
     }
+    tpm2_writer_end(w);
 }
 
 /*
@@ -254,263 +258,245 @@ get_uint32_as_chars(UINT32 value) {
     buf[j] = '\0';
     return buf;
 }
+/*
+ * Print a fixed property that only has a raw value.
+ */
+static void dump_property_raw(tpm2_writer *w, const char *name, UINT32 value) {
+    tpm2_writer_map_begin(w, name);
+    tpm2_writer_hex_upper(w, "raw", value);
+    tpm2_writer_end(w);
+}
+/*
+ * Print a fixed property holding characters packed into its value.
+ */
+static void dump_property_chars(tpm2_writer *w, const char *name,
+        UINT32 value) {
+    tpm2_writer_map_begin(w, name);
+    tpm2_writer_hex_upper(w, "raw", value);
+    tpm2_writer_string(w, "value", get_uint32_as_chars(value),
+            tpm2_writer_style_double_quoted);
+    tpm2_writer_end(w);
+}
 /*
  * Print string representations of the TPMA_MODES.
  */
-static void tpm2_tool_output_tpma_modes(TPMA_MODES modes) {
-    tpm2_tool_output("TPM2_PT_MODES:\n"
-            "  raw: 0x%X\n", modes);
+static void dump_tpma_modes(tpm2_writer *w, TPMA_MODES modes) {
+    tpm2_writer_map_begin(w, "TPM2_PT_MODES");
+    tpm2_writer_hex_upper(w, "raw", modes);
     if (modes & TPMA_MODES_FIPS_140_2)
-        tpm2_tool_output("  value: TPMA_MODES_FIPS_140_2\n");
+        tpm2_writer_string(w, "value", "TPMA_MODES_FIPS_140_2",
+                tpm2_writer_style_plain);
     if (modes & TPMA_MODES_RESERVED1_MASK)
-        tpm2_tool_output(
-                "  value: TPMA_MODES_RESERVED1 (these bits shouldn't be set)\n");
+        tpm2_writer_string(w, "value",
+                "TPMA_MODES_RESERVED1 (these bits shouldn't be set)",
+                tpm2_writer_style_plain);
+    tpm2_writer_end(w);
 }
 /*
  * Print string representation of the TPMA_PERMANENT attributes.
  */
-static void dump_permanent_attrs(TPMA_PERMANENT attrs) {
-    tpm2_tool_output("TPM2_PT_PERMANENT:\n");
-    tpm2_tool_output("  ownerAuthSet:              %s\n",
-            prop_str (attrs & TPMA_PERMANENT_OWNERAUTHSET));
-    tpm2_tool_output("  endorsementAuthSet:        %s\n",
-            prop_str (attrs & TPMA_PERMANENT_ENDORSEMENTAUTHSET));
-    tpm2_tool_output("  lockoutAuthSet:            %s\n",
-            prop_str (attrs & TPMA_PERMANENT_LOCKOUTAUTHSET));
-    tpm2_tool_output("  reserved1:                 %s\n",
-            prop_str (attrs & TPMA_PERMANENT_RESERVED1_MASK));
-    tpm2_tool_output("  disableClear:              %s\n",
-            prop_str (attrs & TPMA_PERMANENT_DISABLECLEAR));
-    tpm2_tool_output("  inLockout:                 %s\n",
-            prop_str (attrs & TPMA_PERMANENT_INLOCKOUT));
-    tpm2_tool_output("  tpmGeneratedEPS:           %s\n",
-            prop_str (attrs & TPMA_PERMANENT_TPMGENERATEDEPS));
-    tpm2_tool_output("  reserved2:                 %s\n",
-            prop_str (attrs & TPMA_PERMANENT_RESERVED2_MASK));
+static void dump_permanent_attrs(tpm2_writer *w, TPMA_PERMANENT attrs) {
+    tpm2_writer_map_begin(w, "TPM2_PT_PERMANENT");
+    tpm2_writer_align(w, 0, 27);
+    tpm2_writer_uint(w, "ownerAuthSet",
+            prop_flag (attrs & TPMA_PERMANENT_OWNERAUTHSET));
+    tpm2_writer_uint(w, "endorsementAuthSet",
+            prop_flag (attrs & TPMA_PERMANENT_ENDORSEMENTAUTHSET));
+    tpm2_writer_uint(w, "lockoutAuthSet",
+            prop_flag (attrs & TPMA_PERMANENT_LOCKOUTAUTHSET));
+    tpm2_writer_uint(w, "reserved1",
+            prop_flag (attrs & TPMA_PERMANENT_RESERVED1_MASK));
+    tpm2_writer_uint(w, "disableClear",
+            prop_flag (attrs & TPMA_PERMANENT_DISABLECLEAR));
+    tpm2_writer_uint(w, "inLockout",
+            prop_flag (attrs & TPMA_PERMANENT_INLOCKOUT));
+    tpm2_writer_uint(w, "tpmGeneratedEPS",
+            prop_flag (attrs & TPMA_PERMANENT_TPMGENERATEDEPS));
+    tpm2_writer_uint(w, "reserved2",
+            prop_flag (attrs & TPMA_PERMANENT_RESERVED2_MASK));
+    tpm2_writer_end(w);
 }
 /*
  * Print string representations of the TPMA_STARTUP_CLEAR attributes.
  */
-static void dump_startup_clear_attrs(TPMA_STARTUP_CLEAR attrs) {
-    tpm2_tool_output("TPM2_PT_STARTUP_CLEAR:\n");
-    tpm2_tool_output("  phEnable:                  %s\n",
-            prop_str (attrs & TPMA_STARTUP_CLEAR_PHENABLE));
-    tpm2_tool_output("  shEnable:                  %s\n",
-            prop_str (attrs & TPMA_STARTUP_CLEAR_SHENABLE));
-    tpm2_tool_output("  ehEnable:                  %s\n",
-            prop_str (attrs & TPMA_STARTUP_CLEAR_EHENABLE));;
-    tpm2_tool_output("  phEnableNV:                %s\n",
-            prop_str (attrs & TPMA_STARTUP_CLEAR_PHENABLENV));
-    tpm2_tool_output("  reserved1:                 %s\n",
-            prop_str (attrs & TPMA_STARTUP_CLEAR_RESERVED1_MASK));
-    tpm2_tool_output("  orderly:                   %s\n",
-            prop_str (attrs & TPMA_STARTUP_CLEAR_ORDERLY));
+static void dump_startup_clear_attrs(tpm2_writer *w, TPMA_STARTUP_CLEAR attrs) {
+    tpm2_writer_map_begin(w, "TPM2_PT_STARTUP_CLEAR");
+    tpm2_writer_align(w, 0, 27);
+    tpm2_writer_uint(w, "phEnable",
+            prop_flag (attrs & TPMA_STARTUP_CLEAR_PHENABLE));
+    tpm2_writer_uint(w, "shEnable",
+            prop_flag (attrs & TPMA_STARTUP_CLEAR_SHENABLE));
+    tpm2_writer_uint(w, "ehEnable",
+            prop_flag (attrs & TPMA_STARTUP_CLEAR_EHENABLE));
+    tpm2_writer_uint(w, "phEnableNV",
+            prop_flag (attrs & TPMA_STARTUP_CLEAR_PHENABLENV));
+    tpm2_writer_uint(w, "reserved1",
+            prop_flag (attrs & TPMA_STARTUP_CLEAR_RESERVED1_MASK));
+    tpm2_writer_uint(w, "orderly",
+            prop_flag (attrs & TPMA_STARTUP_CLEAR_ORDERLY));
+    tpm2_writer_end(w);
 }
 /*
  * Iterate over all fixed properties, call the unique print function for each.
  */
-static void dump_tpm_properties_fixed(TPMS_TAGGED_PROPERTY properties[],
-        size_t count) {
+static void dump_tpm_properties_fixed(tpm2_writer *w,
+        TPMS_TAGGED_PROPERTY properties[], size_t count) {
     size_t i;
-    char *buf;
 
     for (i = 0; i < count; ++i) {
         TPM2_PT property = properties[i].property;
         UINT32 value = properties[i].value;
         switch (property) {
         case TPM2_PT_FAMILY_INDICATOR:
-            buf = get_uint32_as_chars(value);
-            tpm2_tool_output("TPM2_PT_FAMILY_INDICATOR:\n"
-                    "  raw: 0x%X\n"
-                    "  value: \"%s\"\n", value, buf);
+            dump_property_chars(w, "TPM2_PT_FAMILY_INDICATOR", value);
             break;
         case TPM2_PT_LEVEL:
-            tpm2_tool_output("TPM2_PT_LEVEL:\n"
-                    "  raw: %d\n", value);
-            break;
-        case TPM2_PT_REVISION:
-            tpm2_tool_output("TPM2_PT_REVISION:\n"
-                    "  raw: 0x%X\n"
-                    "  value: %.2f\n", value, (float )value / 100);
+            tpm2_writer_map_begin(w, "TPM2_PT_LEVEL");
+            tpm2_writer_uint(w, "raw", value);
+            tpm2_writer_end(w);
+            break;
+        case TPM2_PT_REVISION: {
+            char revision[16];
+            snprintf(revision, sizeof(revision), "%.2f", (float )value / 100);
+            tpm2_writer_map_begin(w, "TPM2_PT_REVISION");
+            tpm2_writer_hex_upper(w, "raw", value);
+            tpm2_writer_number(w, "value", revision);
+            tpm2_writer_end(w);
+        }
             break;
         case TPM2_PT_DAY_OF_YEAR:
-            tpm2_tool_output("TPM2_PT_DAY_OF_YEAR:\n"
-                    "  raw: 0x%X\n", value);
+            dump_property_raw(w, "TPM2_PT_DAY_OF_YEAR", value);
             break;
         case TPM2_PT_YEAR:
-            tpm2_tool_output("TPM2_PT_YEAR:\n"
-                    "  raw: 0x%X\n", value);
+            dump_property_raw(w, "TPM2_PT_YEAR", value);
             break;
         case TPM2_PT_MANUFACTURER: {
             UINT32 he_value = tpm2_util_ntoh_32(value);
-            tpm2_tool_output("TPM2_PT_MANUFACTURER:\n"
-                    "  raw: 0x%X\n"
-                    "  value: \"%.*s\"\n", value, (int )sizeof(value),
-                    (char * )&he_value);
+            const char *manufacturer = (const char *)&he_value;
+            tpm2_writer_map_begin(w, "TPM2_PT_MANUFACTURER");
+            tpm2_writer_hex_upper(w, "raw", value);
+            tpm2_writer_string_len(w, "value", manufacturer,
+                    strnlen(manufacturer, sizeof(value)),
+                    tpm2_writer_style_double_quoted);
+            tpm2_writer_end(w);
         }
             break;
         case TPM2_PT_VENDOR_STRING_1:
-            buf = get_uint32_as_chars(value);
-            tpm2_tool_output("TPM2_PT_VENDOR_STRING_1:\n"
-                    "  raw: 0x%X\n"
-                    "  value: \"%s\"\n", value, buf);
+            dump_property_chars(w, "TPM2_PT_VENDOR_STRING_1", value);
             break;
         case TPM2_PT_VENDOR_STRING_2:
-            buf = get_uint32_as_chars(value);
-            tpm2_tool_output("TPM2_PT_VENDOR_STRING_2:\n"
-                    "  raw: 0x%X\n"
-                    "  value: \"%s\"\n", value, buf);
+            dump_property_chars(w, "TPM2_PT_VENDOR_STRING_2", value);
             break;
         case TPM2_PT_VENDOR_STRING_3:
-            buf = get_uint32_as_chars(value);
-            tpm2_tool_output("TPM2_PT_VENDOR_STRING_3:\n"
-                    "  raw: 0x%X\n"
-                    "  value: \"%s\"\n", value, buf);
+            dump_property_chars(w, "TPM2_PT_VENDOR_STRING_3", value);
             break;
         case TPM2_PT_VENDOR_STRING_4:
-            buf = get_uint32_as_chars(value);
-            tpm2_tool_output("TPM2_PT_VENDOR_STRING_4:\n"
-                    "  raw: 0x%X\n"
-                    "  value: \"%s\"\n", value, buf);
+            dump_property_chars(w, "TPM2_PT_VENDOR_STRING_4", value);
             break;
         case TPM2_PT_VENDOR_TPM_TYPE:
-            tpm2_tool_output("TPM2_PT_VENDOR_TPM_TYPE:\n"
-                    "  raw: 0x%X\n", value);
+            dump_property_raw(w, "TPM2_PT_VENDOR_TPM_TYPE", value);
             break;
         case TPM2_PT_FIRMWARE_VERSION_1:
-            tpm2_tool_output("TPM2_PT_FIRMWARE_VERSION_1:\n"
-                    "  raw: 0x%X\n", value);
+            dump_property_raw(w, "TPM2_PT_FIRMWARE_VERSION_1", value);
             break;
         case TPM2_PT_FIRMWARE_VERSION_2:
-            tpm2_tool_output("TPM2_PT_FIRMWARE_VERSION_2:\n"
-                    "  raw: 0x%X\n", value);
+            dump_property_raw(w, "TPM2_PT_FIRMWARE_VERSION_2", value);
             break;
         case TPM2_PT_INPUT_BUFFER:
-            tpm2_tool_output("TPM2_PT_INPUT_BUFFER:\n"
-                    "  raw: 0x%X\n", value);
+            dump_property_raw(w, "TPM2_PT_INPUT_BUFFER", value);
             break;
         case TPM2_PT_HR_TRANSIENT_MIN:
-            tpm2_tool_output("TPM2_PT_HR_TRANSIENT_MIN:\n"
-                    "  raw: 0x%X\n", value);
+            dump_property_raw(w, "TPM2_PT_HR_TRANSIENT_MIN", value);
             break;
         case TPM2_PT_HR_PERSISTENT_MIN:
-            tpm2_tool_output("TPM2_PT_HR_PERSISTENT_MIN:\n"
-                    "  raw: 0x%X\n", value);
+            dump_property_raw(w, "TPM2_PT_HR_PERSISTENT_MIN", value);
             break;
         case TPM2_PT_HR_LOADED_MIN:
-            tpm2_tool_output("TPM2_PT_HR_LOADED_MIN:\n"
-                    "  raw: 0x%X\n", value);
+            dump_property_raw(w, "TPM2_PT_HR_LOADED_MIN", value);
             break;
         case TPM2_PT_ACTIVE_SESSIONS_MAX:
-            tpm2_tool_output("TPM2_PT_ACTIVE_SESSIONS_MAX:\n"
-                    "  raw: 0x%X\n", value);
+            dump_property_raw(w, "TPM2_PT_ACTIVE_SESSIONS_MAX", value);
             break;
         case TPM2_PT_PCR_COUNT:
-            tpm2_tool_output("TPM2_PT_PCR_COUNT:\n"
-                    "  raw: 0x%X\n", value);
+            dump_property_raw(w, "TPM2_PT_PCR_COUNT", value);
             break;
         case TPM2_PT_PCR_SELECT_MIN:
-            tpm2_tool_output("TPM2_PT_PCR_SELECT_MIN:\n"
-                    "  raw: 0x%X\n", value);
+            dump_property_raw(w, "TPM2_PT_PCR_SELECT_MIN", value);
             break;
         case TPM2_PT_CONTEXT_GAP_MAX:
-            tpm2_tool_output("TPM2_PT_CONTEXT_GAP_MAX:\n"
-                    "  raw: 0x%X\n", value);
+            dump_property_raw(w, "TPM2_PT_CONTEXT_GAP_MAX", value);
             break;
         case TPM2_PT_NV_COUNTERS_MAX:
-            tpm2_tool_output("TPM2_PT_NV_COUNTERS_MAX:\n"
-                    "  raw: 0x%X\n", value);
+            dump_property_raw(w, "TPM2_PT_NV_COUNTERS_MAX", value);
             break;
         case TPM2_PT_NV_INDEX_MAX:
-            tpm2_tool_output("TPM2_PT_NV_INDEX_MAX:\n"
-                    "  raw: 0x%X\n", value);
+            dump_property_raw(w, "TPM2_PT_NV_INDEX_MAX", value);
             break;
         case TPM2_PT_MEMORY:
-            tpm2_tool_output("TPM2_PT_MEMORY:\n"
-                    "  raw: 0x%X\n", value);
+            dump_property_raw(w, "TPM2_PT_MEMORY", value);
             break;
         case TPM2_PT_CLOCK_UPDATE:
-            tpm2_tool_output("TPM2_PT_CLOCK_UPDATE:\n"
-                    "  raw: 0x%X\n", value);
+            dump_property_raw(w, "TPM2_PT_CLOCK_UPDATE", value);
             break;
         case TPM2_PT_CONTEXT_HASH: /* this may be a TPM2_ALG_ID type */
-            tpm2_tool_output("TPM2_PT_CONTEXT_HASH:\n"
-                    "  raw: 0x%X\n", value);
+            dump_property_raw(w, "TPM2_PT_CONTEXT_HASH", value);
             break;
         case TPM2_PT_CONTEXT_SYM: /* this is a TPM2_ALG_ID type */
-            tpm2_tool_output("TPM2_PT_CONTEXT_SYM:\n"
-                    "  raw: 0x%X\n", value);
+            dump_property_raw(w, "TPM2_PT_CONTEXT_SYM", value);
             break;
         case TPM2_PT_CONTEXT_SYM_SIZE:
-            tpm2_tool_output("TPM2_PT_CONTEXT_SYM_SIZE:\n"
-                    "  raw: 0x%X\n", value);
+            dump_property_raw(w, "TPM2_PT_CONTEXT_SYM_SIZE", value);
             break;
         case TPM2_PT_ORDERLY_COUNT:
-            tpm2_tool_output("TPM2_PT_ORDERLY_COUNT:\n"
-                    "  raw: 0x%X\n", value);
+            dump_property_raw(w, "TPM2_PT_ORDERLY_COUNT", value);
             break;
         case TPM2_PT_MAX_COMMAND_SIZE:
-            tpm2_tool_output("TPM2_PT_MAX_COMMAND_SIZE:\n"
-                    "  raw: 0x%X\n", value);
+            dump_property_raw(w, "TPM2_PT_MAX_COMMAND_SIZE", value);
             break;
         case TPM2_PT_MAX_RESPONSE_SIZE:
-            tpm2_tool_output("TPM2_PT_MAX_RESPONSE_SIZE:\n"
-                    "  raw: 0x%X\n", value);
+            dump_property_raw(w, "TPM2_PT_MAX_RESPONSE_SIZE", value);
             break;
         case TPM2_PT_MAX_DIGEST:
-            tpm2_tool_output("TPM2_PT_MAX_DIGEST:\n"
-                    "  raw: 0x%X\n", value);
+            dump_property_raw(w, "TPM2_PT_MAX_DIGEST", value);
             break;
         case TPM2_PT_MAX_OBJECT_CONTEXT:
-            tpm2_tool_output("TPM2_PT_MAX_OBJECT_CONTEXT:\n"
-                    "  raw: 0x%X\n", value);
+            dump_property_raw(w, "TPM2_PT_MAX_OBJECT_CONTEXT", value);
             break;
         case TPM2_PT_MAX_SESSION_CONTEXT:
-            tpm2_tool_output("TPM2_PT_MAX_SESSION_CONTEXT:\n"
-                    "  raw: 0x%X\n", value);
+            dump_property_raw(w, "TPM2_PT_MAX_SESSION_CONTEXT", value);
             break;
         case TPM2_PT_PS_FAMILY_INDICATOR:
-            tpm2_tool_output("TPM2_PT_PS_FAMILY_INDICATOR:\n"
-                    "  raw: 0x%X\n", value);
+            dump_property_raw(w, "TPM2_PT_PS_FAMILY_INDICATOR", value);
             break;
         case TPM2_PT_PS_LEVEL:
-            tpm2_tool_output("TPM2_PT_PS_LEVEL:\n"
-                    "  raw: 0x%X\n", value);
+            dump_property_raw(w, "TPM2_PT_PS_LEVEL", value);
             break;
         case TPM2_PT_PS_REVISION:
-            tpm2_tool_output("TPM2_PT_PS_REVISION:\n"
-                    "  raw: 0x%X\n", value);
+            dump_property_raw(w, "TPM2_PT_PS_REVISION", value);
             break;
         case TPM2_PT_PS_DAY_OF_YEAR:
-            tpm2_tool_output("TPM2_PT_PS_DAY_OF_YEAR:\n"
-                    "  raw: 0x%X\n", value);
+            dump_property_raw(w, "TPM2_PT_PS_DAY_OF_YEAR", value);
             break;
         case TPM2_PT_PS_YEAR:
-            tpm2_tool_output("TPM2_PT_PS_YEAR:\n"
-                    "  raw: 0x%X\n", value);
+            dump_property_raw(w, "TPM2_PT_PS_YEAR", value);
             break;
         case TPM2_PT_SPLIT_MAX:
-            tpm2_tool_output("TPM2_PT_SPLIT_MAX:\n"
-                    "  raw: 0x%X\n", value);
+            dump_property_raw(w, "TPM2_PT_SPLIT_MAX", value);
             break;
         case TPM2_PT_TOTAL_COMMANDS:
-            tpm2_tool_output("TPM2_PT_TOTAL_COMMANDS:\n"
-                    "  raw: 0x%X\n", value);
+            dump_property_raw(w, "TPM2_PT_TOTAL_COMMANDS", value);
             break;
         case TPM2_PT_LIBRARY_COMMANDS:
-            tpm2_tool_output("TPM2_PT_LIBRARY_COMMANDS:\n"
-                    "  raw: 0x%X\n", value);
+            dump_property_raw(w, "TPM2_PT_LIBRARY_COMMANDS", value);
             break;
         case TPM2_PT_VENDOR_COMMANDS:
-            tpm2_tool_output("TPM2_PT_VENDOR_COMMANDS:\n"
-                    "  raw: 0x%X\n", value);
+            dump_property_raw(w, "TPM2_PT_VENDOR_COMMANDS", value);
             break;
         case TPM2_PT_NV_BUFFER_MAX:
-            tpm2_tool_output("TPM2_PT_NV_BUFFER_MAX:\n"
-                    "  raw: 0x%X\n", value);
+            dump_property_raw(w, "TPM2_PT_NV_BUFFER_MAX", value);
             break;
         case TPM2_PT_MODES:
-            tpm2_tool_output_tpma_modes((TPMA_MODES) value);
+            dump_tpma_modes(w, (TPMA_MODES) value);
             break;
         }
     }
@@ -518,8 +504,8 @@ static void dump_tpm_properties_fixed(TPMS_TAGGED_PROPERTY properties[],
 /*
  * Iterate over all variable properties, call the unique print function for each.
  */
-static void dump_tpm_properties_var(TPMS_TAGGED_PROPERTY properties[],
-        size_t count) {
+static void dump_tpm_properties_var(tpm2_writer *w,
+        TPMS_TAGGED_PROPERTY properties[], size_t count) {
     size_t i;
 
     for (i = 0; i < count; ++i) {
@@ -527,70 +513,73 @@ static void dump_tpm_properties_var(TPMS_TAGGED_PROPERTY properties[],
         UINT32 value = properties[i].value;
         switch (property) {
         case TPM2_PT_PERMANENT:
-            dump_permanent_attrs((TPMA_PERMANENT) value);
+            dump_permanent_attrs(w, (TPMA_PERMANENT) value);
             break;
         case TPM2_PT_STARTUP_CLEAR:
-            dump_startup_clear_attrs((TPMA_STARTUP_CLEAR) value);
+            dump_startup_clear_attrs(w, (TPMA_STARTUP_CLEAR) value);
             break;
         case TPM2_PT_HR_NV_INDEX:
-            tpm2_tool_output("TPM2_PT_HR_NV_INDEX: 0x%X\n", value);
+            tpm2_writer_hex_upper(w, "TPM2_PT_HR_NV_INDEX", value);
             break;
         case TPM2_PT_HR_LOADED:
-            tpm2_tool_output("TPM2_PT_HR_LOADED: 0x%X\n", value);
+            tpm2_writer_hex_upper(w, "TPM2_PT_HR_LOADED", value);
             break;
         case TPM2_PT_HR_LOADED_AVAIL:
-            tpm2_tool_output("TPM2_PT_HR_LOADED_AVAIL: 0x%X\n", value);
+            tpm2_writer_hex_upper(w, "TPM2_PT_HR_LOADED_AVAIL", value);
             break;
         case TPM2_PT_HR_ACTIVE:
-            tpm2_tool_output("TPM2_PT_HR_ACTIVE: 0x%X\n", value);
+            tpm2_writer_hex_upper(w, "TPM2_PT_HR_ACTIVE", value);
             break;
         case TPM2_PT_HR_ACTIVE_AVAIL:
-            tpm2_tool_output("TPM2_PT_HR_ACTIVE_AVAIL: 0x%X\n", value);
+            tpm2_writer_hex_upper(w, "TPM2_PT_HR_ACTIVE_AVAIL", value);
             break;
         case TPM2_PT_HR_TRANSIENT_AVAIL:
-            tpm2_tool_output("TPM2_PT_HR_TRANSIENT_AVAIL: 0x%X\n", value);
+            tpm2_writer_hex_upper(w, "TPM2_PT_HR_TRANSIENT_AVAIL", value);
             break;
         case TPM2_PT_HR_PERSISTENT:
-            tpm2_tool_output("TPM2_PT_HR_PERSISTENT: 0x%X\n", value);
+            tpm2_writer_hex_upper(w, "TPM2_PT_HR_PERSISTENT", value);
             break;
         case TPM2_PT_HR_PERSISTENT_AVAIL:
-            tpm2_tool_output("TPM2_PT_HR_PERSISTENT_AVAIL: 0x%X\n", value);
+            tpm2_writer_hex_upper(w, "TPM2_PT_HR_PERSISTENT_AVAIL", value);
             break;
         case TPM2_PT_NV_COUNTERS:
-            tpm2_tool_output("TPM2_PT_NV_COUNTERS: 0x%X\n", value);
+            tpm2_writer_hex_upper(w, "TPM2_PT_NV_COUNTERS", value);
             break;
         case TPM2_PT_NV_COUNTERS_AVAIL:
-            tpm2_tool_output("TPM2_PT_NV_COUNTERS_AVAIL: 0x%X\n", value);
+            tpm2_writer_hex_upper(w, "TPM2_PT_NV_COUNTERS_AVAIL", value);
             break;
         case TPM2_PT_ALGORITHM_SET:
-            tpm2_tool_output("TPM2_PT_ALGORITHM_SET: 0x%X\n", value);
+            tpm2_writer_hex_upper(w, "TPM2_PT_ALGORITHM_SET", value);
             break;
         case TPM2_PT_LOADED_CURVES:
-            tpm2_tool_output("TPM2_PT_LOADED_CURVES: 0x%X\n", value);
+            tpm2_writer_hex_upper(w, "TPM2_PT_LOADED_CURVES", value);
             break;
         case TPM2_PT_LOCKOUT_COUNTER:
-            tpm2_tool_output("TPM2_PT_LOCKOUT_COUNTER: 0x%X\n", value);
+            tpm2_writer_hex_upper(w, "TPM2_PT_LOCKOUT_COUNTER", value);
             break;
         case TPM2_PT_MAX_AUTH_FAIL:
-            tpm2_tool_output("TPM2_PT_MAX_AUTH_FAIL: 0x%X\n", value);
+            tpm2_writer_hex_upper(w, "TPM2_PT_MAX_AUTH_FAIL", value);
             break;
         case TPM2_PT_LOCKOUT_INTERVAL:
-            tpm2_tool_output("TPM2_PT_LOCKOUT_INTERVAL: 0x%X\n", value);
+            tpm2_writer_hex_upper(w, "TPM2_PT_LOCKOUT_INTERVAL", value);
             break;
         case TPM2_PT_LOCKOUT_RECOVERY:
-            tpm2_tool_output("TPM2_PT_LOCKOUT_RECOVERY: 0x%X\n", value);
+            tpm2_writer_hex_upper(w, "TPM2_PT_LOCKOUT_RECOVERY", value);
             break;
         case TPM2_PT_NV_WRITE_RECOVERY:
-            tpm2_tool_output("TPM2_PT_NV_WRITE_RECOVERY: 0x%X\n", value);
+            tpm2_writer_hex_upper(w, "TPM2_PT_NV_WRITE_RECOVERY", value);
             break;
         case TPM2_PT_AUDIT_COUNTER_0:
-            tpm2_tool_output("TPM2_PT_AUDIT_COUNTER_0: 0x%X\n", value);
+            tpm2_writer_hex_upper(w, "TPM2_PT_AUDIT_COUNTER_0", value);
             break;
         case TPM2_PT_AUDIT_COUNTER_1:
-            tpm2_tool_output("TPM2_PT_AUDIT_COUNTER_1: 0x%X\n", value);
+            tpm2_writer_hex_upper(w, "TPM2_PT_AUDIT_COUNTER_1", value);
             break;
-        default:
-            tpm2_tool_output("unknown%X: 0x%X\n", value, value);
+        default: {
+            char key[sizeof("unknown") + 8];
+            snprintf(key, sizeof(key), "unknown%X", value);
+            tpm2_writer_hex_upper(w, key, value);
+        }
             break;
         }
     }
@@ -598,56 +587,62 @@ static void dump_tpm_properties_var(TPMS_TAGGED_PROPERTY properties[],
 /*
  * Print data about TPM2_ALG_ID in human readable form.
  */
-static void dump_algorithm_properties(TPM2_ALG_ID id, TPMA_ALGORITHM alg_attrs) {
+static void dump_algorithm_properties(tpm2_writer *w, TPM2_ALG_ID id,
+        TPMA_ALGORITHM alg_attrs) {
     const char *id_name = tpm2_alg_util_algtostr(id, tpm2_alg_util_flags_any);
     bool is_unknown = id_name == NULL;
     id_name = id_name ? id_name : "unknown";
 
     if (!is_unknown) {
-        tpm2_tool_output("%s:\n", id_name);
+        tpm2_writer_map_begin(w, id_name);
     } else {
         /* If it's unknown, we don't want N unknowns in the map, so
          * make them unknown42, unknown<alg id> since that's unique.
          * We do it this way, as most folks will want to just look up
          * if a given alg via "friendly" name like rsa is supported.
          */
-        tpm2_tool_output("%s%x:\n", id_name, id);
+        char key[sizeof("unknown") + 4];
+        snprintf(key, sizeof(key), "%s%x", id_name, id);
+        tpm2_writer_map_begin(w, key);
     }
-    tpm2_tool_output("  value:      0x%X\n", id);
-    tpm2_tool_output("  asymmetric: %s\n",
-            prop_str (alg_attrs & TPMA_ALGORITHM_ASYMMETRIC));
-    tpm2_tool_output("  symmetric:  %s\n",
-            prop_str (alg_attrs & TPMA_ALGORITHM_SYMMETRIC));
-    tpm2_tool_output("  hash:       %s\n",
-            prop_str (alg_attrs & TPMA_ALGORITHM_HASH));
-    tpm2_tool_output("  object:     %s\n",
-            prop_str (alg_attrs & TPMA_ALGORITHM_OBJECT));
-    tpm2_tool_output("  reserved:   0x%X\n",
+    tpm2_writer_align(w, 0, 12);
+    tpm2_writer_hex_upper(w, "value", id);
+    tpm2_writer_uint(w, "asymmetric",
+            prop_flag (alg_attrs & TPMA_ALGORITHM_ASYMMETRIC));
+    tpm2_writer_uint(w, "symmetric",
+            prop_flag (alg_attrs & TPMA_ALGORITHM_SYMMETRIC));
+    tpm2_writer_uint(w, "hash",
+            prop_flag (alg_attrs & TPMA_ALGORITHM_HASH));
+    tpm2_writer_uint(w, "object",
+            prop_flag (alg_attrs & TPMA_ALGORITHM_OBJECT));
+    tpm2_writer_hex_upper(w, "reserved",
             (alg_attrs & TPMA_ALGORITHM_RESERVED1_MASK) >> 4);
-    tpm2_tool_output("  signing:    %s\n",
-            prop_str (alg_attrs & TPMA_ALGORITHM_SIGNING));
-    tpm2_tool_output("  encrypting: %s\n",
-            prop_str (alg_attrs & TPMA_ALGORITHM_ENCRYPTING));
-    tpm2_tool_output("  method:     %s\n",
-            prop_str (alg_attrs & TPMA_ALGORITHM_METHOD));
+    tpm2_writer_uint(w, "signing",
+            prop_flag (alg_attrs & TPMA_ALGORITHM_SIGNING));
+    tpm2_writer_uint(w, "encrypting",
+            prop_flag (alg_attrs & TPMA_ALGORITHM_ENCRYPTING));
+    tpm2_writer_uint(w, "method",
+            prop_flag (alg_attrs & TPMA_ALGORITHM_METHOD));
+    tpm2_writer_end(w);
 }
 
 /*
  * Iterate over the count TPMS_ALG_PROPERTY entries and dump the
  * TPMA_ALGORITHM attributes for each.
  */
-static void dump_algorithms(TPMS_ALG_PROPERTY alg_properties[], size_t count) {
+static void dump_algorithms(tpm2_writer *w, TPMS_ALG_PROPERTY alg_properties[],
+        size_t count) {
     size_t i;
 
     for (i = 0; i < count; ++i)
-        dump_algorithm_properties(alg_properties[i].alg,
+        dump_algorithm_properties(w, alg_properties[i].alg,
                 alg_properties[i].algProperties);
 }
 
 /*
  * Pretty print the bit fields from the TPMA_CC (UINT32)
  */
-static bool dump_command_attrs(TPMA_CC tpma_cc) {
+static bool dump_command_attrs(tpm2_writer *w, TPMA_CC tpma_cc) {
     const char *value = tpm2_cc_util_to_str(
             tpma_cc & TPMA_CC_COMMANDINDEX_MASK);
     /* not found, make a hex version of it */
@@ -664,61 +659,67 @@ static bool dump_command_attrs(TPMA_CC tpma_cc) {
         value = _buf;
     }
 
-    tpm2_tool_output("%s:\n", value);
-    tpm2_tool_output("  value: 0x%X\n", tpma_cc);
-    tpm2_tool_output("  commandIndex: 0x%x\n",
+    tpm2_writer_map_begin(w, value);
+    tpm2_writer_hex_upper(w, "value", tpma_cc);
+    tpm2_writer_align(w, 0, 14);
+    tpm2_writer_hex(w, "commandIndex",
             tpma_cc & TPMA_CC_COMMANDINDEX_MASK);
-    tpm2_tool_output("  reserved1:    0x%x\n",
+    tpm2_writer_hex(w, "reserved1",
             (tpma_cc & TPMA_CC_RESERVED1_MASK) >> 16);
-    tpm2_tool_output("  nv:           %s\n", prop_str (tpma_cc & TPMA_CC_NV));
-    tpm2_tool_output("  extensive:    %s\n",
-            prop_str (tpma_cc & TPMA_CC_EXTENSIVE));
-    tpm2_tool_output("  flushed:      %s\n",
-            prop_str (tpma_cc & TPMA_CC_FLUSHED));
-    tpm2_tool_output("  cHandles:     0x%x\n",
+    tpm2_writer_uint(w, "nv", prop_flag (tpma_cc & TPMA_CC_NV));
+    tpm2_writer_uint(w, "extensive",
+            prop_flag (tpma_cc & TPMA_CC_EXTENSIVE));
+    tpm2_writer_uint(w, "flushed",
+            prop_flag (tpma_cc & TPMA_CC_FLUSHED));
+    tpm2_writer_hex(w, "cHandles",
             (tpma_cc & TPMA_CC_CHANDLES_MASK) >> TPMA_CC_CHANDLES_SHIFT);
-    tpm2_tool_output("  rHandle:      %s\n",
-            prop_str (tpma_cc & TPMA_CC_RHANDLE));
-    tpm2_tool_output("  V:            %s\n", prop_str (tpma_cc & TPMA_CC_V));
-    tpm2_tool_output("  Res:          0x%x\n",
+    tpm2_writer_uint(w, "rHandle",
+            prop_flag (tpma_cc & TPMA_CC_RHANDLE));
+    tpm2_writer_uint(w, "V", prop_flag (tpma_cc & TPMA_CC_V));
+    tpm2_writer_hex(w, "Res",
             (tpma_cc & TPMA_CC_RES_MASK) >> TPMA_CC_RES_SHIFT);
+    tpm2_writer_end(w);
     return true;
 }
 /*
  * Iterate over an array of TPM2_ECC_CURVEs and dump out a human readable
  * representation of each array member.
  */
-static void dump_ecc_curves(TPM2_ECC_CURVE curve[], UINT32 count) {
+static void dump_ecc_curves(tpm2_writer *w, TPM2_ECC_CURVE curve[],
+        UINT32 count) {
     size_t i;
 
     for (i = 0; i < count; ++i) {
         switch (curve[i]) {
         case TPM2_ECC_NIST_P192:
-            tpm2_tool_output("TPM2_ECC_NIST_P192: 0x%X\n", curve[i]);
+            tpm2_writer_hex_upper(w, "TPM2_ECC_NIST_P192", curve[i]);
             break;
         case TPM2_ECC_NIST_P224:
-            tpm2_tool_output("TPM2_ECC_NIST_P224: 0x%X\n", curve[i]);
+            tpm2_writer_hex_upper(w, "TPM2_ECC_NIST_P224", curve[i]);
             break;
         case TPM2_ECC_NIST_P256:
-            tpm2_tool_output("TPM2_ECC_NIST_P256: 0x%X\n", curve[i]);
+            tpm2_writer_hex_upper(w, "TPM2_ECC_NIST_P256", curve[i]);
             break;
         case TPM2_ECC_NIST_P384:
-            tpm2_tool_output("TPM2_ECC_NIST_P384: 0x%X\n", curve[i]);
+            tpm2_writer_hex_upper(w, "TPM2_ECC_NIST_P384", curve[i]);
             break;
         case TPM2_ECC_NIST_P521:
-            tpm2_tool_output("TPM2_ECC_NIST_P521: 0x%X\n", curve[i]);
+            tpm2_writer_hex_upper(w, "TPM2_ECC_NIST_P521", curve[i]);
             break;
         case TPM2_ECC_BN_P256:
-            tpm2_tool_output("TPM2_ECC_BN_P256: 0x%X\n", curve[i]);
+            tpm2_writer_hex_upper(w, "TPM2_ECC_BN_P256", curve[i]);
             break;
         case TPM2_ECC_BN_P638:
-            tpm2_tool_output("TPM2_ECC_BN_P638: 0x%X\n", curve[i]);
+            tpm2_writer_hex_upper(w, "TPM2_ECC_BN_P638", curve[i]);
             break;
         case TPM2_ECC_SM2_P256:
-            tpm2_tool_output("TPM2_ECC_SM2_P256: 0x%X\n", curve[i]);
+            tpm2_writer_hex_upper(w, "TPM2_ECC_SM2_P256", curve[i]);
             break;
-        default:
-            tpm2_tool_output("unknown%X: 0x%X\n", curve[i], curve[i]);
+        default: {
+            char key[sizeof("unknown") + 4];
+            snprintf(key, sizeof(key), "unknown%X", curve[i]);
+            tpm2_writer_hex_upper(w, key, curve[i]);
+        }
             break;
         }
     }
@@ -727,11 +728,12 @@ static void dump_ecc_curves(TPM2_ECC_CURVE curve[], UINT32 count) {
  * Iterate over an array of TPMA_CCs and dump out a human readable
  * representation of each array member.
  */
-static bool dump_command_attr_array(TPMA_CC command_attributes[], UINT32 count) {
+static bool dump_command_attr_array(tpm2_writer *w,
+        TPMA_CC command_attributes[], UINT32 count) {
     size_t i;
     bool result = true;
     for (i = 0; i < count; ++i)
-        result &= dump_command_attrs(command_attributes[i]);
+        result &= dump_command_attrs(w, command_attributes[i]);
 
     return result;
 }
@@ -739,11 +741,48 @@ static bool dump_command_attr_array(TPMA_CC command_attributes[], UINT32 count)
  * Iterate over an array of TPML_HANDLEs and dump out the handle
  * values.
  */
-static void dump_handles(TPM2_HANDLE handles[], UINT32 count) {
+static void dump_handles(tpm2_writer *w, TPM2_HANDLE handles[], UINT32 count) {
     UINT32 i;
 
+    tpm2_writer_seq_begin(w, NULL);
     for (i = 0; i < count; ++i)
-        tpm2_tool_output("- 0x%X\n", handles[i]);
+        tpm2_writer_hex_upper(w, NULL, handles[i]);
+    tpm2_writer_end(w);
+}
+/*
+ * Print the PCR banks and their allocated PCRs as a list of flow sequences.
+ */
+static bool dump_pcr_selections(tpm2_writer *w,
+        TPML_PCR_SELECTION *pcr_selections) {
+
+    bool result = true;
+    tpm2_writer_seq_begin_indented(w, "selected-pcrs");
+
+    UINT32 i;
+    for (i = 0; i < pcr_selections->count; i++) {
+        TPMS_PCR_SELECTION *selection = &pcr_selections->pcrSelections[i];
+        const char *halgstr = tpm2_alg_util_algtostr(selection->hash,
+                tpm2_alg_util_flags_hash);
+        if (halgstr == NULL) {
+            LOG_ERR("Unsupported hash algorithm 0x%08x", selection->hash);
+            result = false;
+            break;
+        }
+
+        tpm2_writer_map_begin(w, NULL);
+        tpm2_writer_flow_seq_begin(w, halgstr);
+        unsigned j;
+        for (j = 0; j < selection->sizeofSelect * 8; j++) {
+            if ((selection->pcrSelect[j / 8] & 1 << (j % 8)) != 0) {
+                tpm2_writer_uint(w, NULL, j);
+            }
+        }
+        tpm2_writer_end(w);
+        tpm2_writer_end(w);
+    }
+
+    tpm2_writer_end(w);
+    return result;
 }
 /*
  * Query the TPM for TPM capabilities.
@@ -762,36 +801,48 @@ static tool_rc get_tpm_capability_all(ESYS_CONTEXT *context,
  * appropriate print function for the provided 'capability' / 'property'
  * pair or the print routine fails)  then it will return false.
  */
-static bool dump_tpm_capability(TPMU_CAPABILITIES *capabilities) {
+static bool dump_tpm_capability(tpm2_writer *w,
+        TPMU_CAPABILITIES *capabilities) {
 
     bool result = true;
     switch (options.capability) {
     case TPM2_CAP_ALGS:
-        dump_algorithms(capabilities->algorithms.algProperties,
+        tpm2_writer_map_begin(w, NULL);
+        dump_algorithms(w, capabilities->algorithms.algProperties,
                 capabilities->algorithms.count);
+        tpm2_writer_end(w);
         break;
     case TPM2_CAP_COMMANDS:
-        result = dump_command_attr_array(
+        tpm2_writer_map_begin(w, NULL);
+        result = dump_command_attr_array(w,
                 capabilities->command.commandAttributes,
                 capabilities->command.count);
+        tpm2_writer_end(w);
         break;
     case TPM2_CAP_TPM_PROPERTIES:
         switch (options.property) {
         case TPM2_PT_FIXED:
-            dump_tpm_properties_fixed(capabilities->tpmProperties.tpmProperty,
+            tpm2_writer_map_begin(w, NULL);
+            dump_tpm_properties_fixed(w,
+                    capabilities->tpmProperties.tpmProperty,
                     capabilities->tpmProperties.count);
+            tpm2_writer_end(w);
             break;
         case TPM2_PT_VAR:
-            dump_tpm_properties_var(capabilities->tpmProperties.tpmProperty,
+            tpm2_writer_map_begin(w, NULL);
+            dump_tpm_properties_var(w, capabilities->tpmProperties.tpmProperty,
                     capabilities->tpmProperties.count);
+            tpm2_writer_end(w);
             break;
         default:
             return false;
         }
         break;
     case TPM2_CAP_ECC_CURVES:
-        dump_ecc_curves(capabilities->eccCurves.eccCurves,
+        tpm2_writer_map_begin(w, NULL);
+        dump_ecc_curves(w, capabilities->eccCurves.eccCurves,
                 capabilities->eccCurves.count);
+        tpm2_writer_end(w);
         break;
     case TPM2_CAP_HANDLES:
         switch (options.property & TPM2_HR_RANGE_MASK) {
@@ -802,7 +853,7 @@ static bool dump_tpm_capability(TPMU_CAPABILITIES *capabilities) {
         case TPM2_HR_NV_INDEX:
         case TPM2_HT_LOADED_SESSION << TPM2_HR_SHIFT:
         case TPM2_HT_SAVED_SESSION << TPM2_HR_SHIFT:
-            dump_handles(capabilities->handles.handle,
+            dump_handles(w, capabilities->handles.handle,
                     capabilities->handles.count);
             break;
         default:
@@ -810,14 +861,16 @@ static bool dump_tpm_capability(TPMU_CAPABILITIES *capabilities) {
         }
         break;
     case TPM2_CAP_PCRS:
-        pcr_print_pcr_selections(&capabilities->assignedPCR);
+        tpm2_writer_map_begin(w, NULL);
+        result = dump_pcr_selections(w, &capabilities->assignedPCR);
+        tpm2_writer_end(w);
         break;
 #if defined(ESYS_4_0)
     case TPM2_CAP_VENDOR_PROPERTY: {
 
         TPM2B_MAX_CAP_BUFFER *buffer = &capabilities->vendor;
-        tpm2_util_hexdump(buffer->buffer, buffer->size);
-        tpm2_tool_output("\n");
+        tpm2_writer_bytes(w, NULL, buffer->buffer, buffer->size,
+                tpm2_writer_style_plain);
     } break;
 #endif
     default:
@@ -829,14 +882,19 @@ static bool dump_tpm_capability(TPMU_CAPABILITIES *capabilities) {
 
 static bool on_option(char key, char *value) {
 
-    UNUSED(value);
-
     switch (key) {
     case 'l':
         options.list = true;
         break;
     case 1:
         options.ignore_moredata = true;
+        break;
+    case 2:
+        if (!tpm2_writer_format_from_str(value, &options.format)) {
+            LOG_ERR("Unknown output format: %s", value);
+            return false;
+        }
+        break;
     }
 
     return true;
@@ -859,6 +917,7 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
     const struct option topts[] = {
         { "list",            no_argument, NULL, 'l' },
         { "ignore-moredata", no_argument, NULL,  1 },
+        { "format",          required_argument, NULL, 2 },
     };
 
     *opts = tpm2_options_new("l", ARRAY_LEN(topts), topts, on_option, on_arg,
@@ -876,10 +935,13 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *context, tpm2_option_flags flags) {
         return tool_rc_option_error;
     }
 
+    tpm2_writer *w = tpm2_writer_stdout();
+    tpm2_writer_set_format(w, options.format);
+
     /* list known capabilities, ie -l option */
     if (options.list) {
-        print_cap_map();
-        return tool_rc_success;
+        print_cap_map(w);
+        return tpm2_writer_flush(w) ? tool_rc_success : tool_rc_general_error;
     }
 
     /* List a capability, ie <capability group> option */
@@ -895,8 +957,9 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *context, tpm2_option_flags flags) {
         return rc;
     }
 
-    bool result = dump_tpm_capability(&capability_data->data);
+    bool result = dump_tpm_capability(w, &capability_data->data);
     free(capability_data);
+    result &= tpm2_writer_flush(w);
     return result ? tool_rc_success : tool_rc_general_error;
 }
 
@@ -6,11 +6,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "files.h"
 #include "log.h"
 #include "tpm2.h"
 #include "tpm2_capability.h"
+#include "tpm2_queue.h"
 #include "tpm2_tool.h"
 #include "tpm2_alg_util.h"
 #include "tpm2_util.h"
@@ -25,6 +27,8 @@ struct tpm_random_ctx {
     UINT16 num_of_bytes;
     bool force;
     bool hex;
+    bool is_bulk;
+    uint64_t bulk_size;
 
     /*
      * Outputs
@@ -159,27 +163,148 @@ out_skip_output_file:
 
 static tool_rc get_max_random(ESYS_CONTEXT *ectx, UINT32 *value) {
 
-    TPMS_CAPABILITY_DATA *cap_data = NULL;
-    tool_rc rc = tpm2_capability_get(ectx, TPM2_CAP_TPM_PROPERTIES,
-            TPM2_PT_FIXED, TPM2_MAX_TPM_PROPERTIES, &cap_data);
+    tool_rc rc = tpm2_capability_get_fixed_property(ectx, TPM2_PT_MAX_DIGEST,
+        value);
+    if (rc != tool_rc_success) {
+        LOG_ERR("TPM does not have property TPM2_PT_MAX_DIGEST");
+    }
+
+    return rc;
+}
+
+static double elapsed_seconds(const struct timespec *start) {
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec - start->tv_sec) +
+            (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static bool write_random(FILE *out, TPM2B_DIGEST *random) {
+
+    if (!out) {
+        return true;
+    }
+
+    if (ctx.hex) {
+        tpm2_util_hexdump2(out, random->buffer, random->size);
+        return !ferror(out);
+    }
+
+    return files_write_bytes(out, random->buffer, random->size);
+}
+
+static tool_rc get_random_bulk(ESYS_CONTEXT *ectx) {
+
+    /*
+     * Every GetRandom returns at most TPM2_PT_MAX_DIGEST bytes. One request is
+     * kept in flight while the previous response is written out, the aux
+     * sessions are reused for all of them.
+     */
+    UINT32 max = 0;
+    tool_rc rc = get_max_random(ectx, &max);
     if (rc != tool_rc_success) {
         return rc;
     }
 
-    UINT32 i;
-    for (i = 0; i < cap_data->data.tpmProperties.count; i++) {
-        TPMS_TAGGED_PROPERTY *p = &cap_data->data.tpmProperties.tpmProperty[i];
-        if (p->property == TPM2_PT_MAX_DIGEST) {
-            *value = p->value;
-            free(cap_data);
-            return tool_rc_success;
+    UINT16 chunk = max < BUFFER_SIZE(TPM2B_DIGEST, buffer) ?
+        max : BUFFER_SIZE(TPM2B_DIGEST, buffer);
+
+    FILE *out = output_enabled ? stdout : NULL;
+    if (ctx.output_file) {
+        out = fopen(ctx.output_file, "wb+");
+        if (!out) {
+            LOG_ERR("Could not open output file \"%s\", error: %s",
+                    ctx.output_file, strerror(errno));
+            return tool_rc_general_error;
+        }
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    tpm2_queue *queue = tpm2_queue_new(ectx);
+    if (!queue) {
+        rc = tool_rc_general_error;
+    } else if (ctx.bulk_size) {
+        rc = tpm2_queue_getrandom(queue,
+            ctx.bulk_size < chunk ? ctx.bulk_size : chunk,
+            ctx.aux_session_handle[0], ctx.aux_session_handle[1],
+            ctx.aux_session_handle[2], NULL);
+    }
+
+    uint64_t received = 0;
+    while (rc == tool_rc_success && tpm2_queue_pending(queue)) {
+        tpm2_queue_result result;
+        rc = tpm2_queue_wait(queue, &result);
+        if (rc != tool_rc_success) {
+            break;
+        }
+
+        TPM2B_DIGEST *random = result.random;
+        if (!random->size) {
+            LOG_ERR("TPM returned no random bytes");
+            free(random);
+            rc = tool_rc_general_error;
+            break;
+        }
+
+        uint64_t remaining = ctx.bulk_size - received;
+        if (random->size > remaining) {
+            random->size = remaining;
+        }
+        received += random->size;
+
+        /* ask for the next chunk before writing out this one */
+        remaining -= random->size;
+        if (remaining) {
+            rc = tpm2_queue_getrandom(queue,
+                remaining < chunk ? remaining : chunk,
+                ctx.aux_session_handle[0], ctx.aux_session_handle[1],
+                ctx.aux_session_handle[2], NULL);
+            if (rc != tool_rc_success) {
+                free(random);
+                break;
+            }
+        }
+
+        bool is_file_op_success = write_random(out, random);
+        free(random);
+        if (!is_file_op_success) {
+            LOG_ERR("Failed writing random bytes");
+            rc = tool_rc_general_error;
+            break;
         }
     }
 
-    LOG_ERR("TPM does not have property TPM2_PT_MAX_DIGEST");
-    free(cap_data);
+    /* drains the outstanding command, the earlier error wins */
+    tpm2_queue_free(queue);
+
+    if (out && out != stdout) {
+        fclose(out);
+    }
 
-    return tool_rc_general_error;
+    if (rc != tool_rc_success) {
+        LOG_ERR("Failed getrandom after %"PRIu64" bytes", received);
+        return rc;
+    }
+
+    double seconds = elapsed_seconds(&start);
+    LOG_INFO("Generated %"PRIu64" random bytes in %.3f s (%.0f bytes/s)",
+            received, seconds, seconds > 0 ? received / seconds : 0.0);
+
+    return tool_rc_success;
+}
+
+static tool_rc check_options(void) {
+
+    if (ctx.is_bulk && (ctx.cp_hash_path || ctx.rp_hash_path)) {
+        LOG_ERR("Cannot calculate cpHash or rpHash in bulk mode");
+        return tool_rc_option_error;
+    }
+
+    return tool_rc_success;
 }
 
 static tool_rc process_inputs(ESYS_CONTEXT *ectx) {
@@ -217,9 +342,10 @@ static tool_rc process_inputs(ESYS_CONTEXT *ectx) {
      * Per 16.1 of:
      *  - https://trustedcomputinggroup.org/wp-content/uploads/TPM-Rev-2.0-Part-3-Commands-01.38.pdf
      *
-     *  Allow the force flag to override this behavior.
+     *  Allow the force flag to override this behavior. Bulk mode splits the
+     *  request into chunks of this size instead.
      */
-    if (!ctx.force) {
+    if (!ctx.force && !ctx.is_bulk) {
         UINT32 max = 0;
         rc = get_max_random(ectx, &max);
         if (rc != tool_rc_success) {
@@ -288,6 +414,9 @@ static bool on_option(char key, char *value) {
     case 2:
         ctx.rp_hash_path = value;
         break;
+    case 3:
+        ctx.is_bulk = true;
+        break;
     case 'S':
         ctx.aux_session_path[ctx.aux_session_cnt] = value;
         if (ctx.aux_session_cnt < MAX_AUX_SESSIONS) {
@@ -310,7 +439,9 @@ static bool on_args(int argc, char **argv) {
         return false;
     }
 
-    bool result = tpm2_util_string_to_uint16(argv[0], &ctx.num_of_bytes);
+    bool result = ctx.is_bulk ?
+        tpm2_util_string_to_uint64(argv[0], &ctx.bulk_size) :
+        tpm2_util_string_to_uint16(argv[0], &ctx.num_of_bytes);
     if (!result) {
         LOG_ERR("Error converting size to a number, got: \"%s\".", argv[0]);
         return false;
@@ -327,7 +458,8 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
         { "hex",          no_argument,       NULL,  0  },
         { "session",      required_argument, NULL, 'S' },
         { "cphash",       required_argument, NULL,  1  },
-        { "rphash",       required_argument, NULL,  2  }
+        { "rphash",       required_argument, NULL,  2  },
+        { "bulk",         no_argument,       NULL,  3  }
     };
 
     *opts = tpm2_options_new("S:o:f", ARRAY_LEN(topts), topts, on_option, on_args,
@@ -343,11 +475,15 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
     /*
      * 1. Process options
      */
+    tool_rc rc = check_options();
+    if (rc != tool_rc_success) {
+        return rc;
+    }
 
     /*
      * 2. Process inputs
      */
-    tool_rc rc = process_inputs(ectx);
+    rc = process_inputs(ectx);
     if (rc != tool_rc_success) {
         return rc;
     }
@@ -355,6 +491,10 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
     /*
      * 3. TPM2_CC_<command> call
      */
+    if (ctx.is_bulk) {
+        return get_random_bulk(ectx);
+    }
+
     rc = get_random(ectx);
     if (rc != tool_rc_success) {
         return rc;
@@ -31,12 +31,14 @@ static tpm_hash_ctx ctx = {
 static tool_rc hash_and_save(ESYS_CONTEXT *context) {
 
     TPM2B_DIGEST *out_hash;
-    TPMT_TK_HASHCHECK *validation;
+    TPMT_TK_HASHCHECK *validation = NULL;
 
     FILE *out = stdout;
 
+    /* only go through the TPM when the ticket is asked for */
     tool_rc rc = tpm2_hash_file(context, ctx.halg, ctx.hierarchy_value,
-            ctx.input_file, &out_hash, &validation);
+            ctx.input_file, &out_hash,
+            ctx.output_ticket_path ? &validation : NULL);
     if (rc != tool_rc_success) {
         return rc;
     }
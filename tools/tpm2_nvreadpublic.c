@@ -104,10 +104,7 @@ static tool_rc print_nv_public(ESYS_CONTEXT *context, TPMI_RH_NV_INDEX index,
     }
 
     tpm2_tool_output("  name: ");
-    UINT16 i;
-    for (i = 0; i < name->size; i++) {
-        tpm2_tool_output("%02x", name->name[i]);
-    }
+    tpm2_util_hexdump(name->name, name->size);
     tpm2_tool_output("\n");
 
     Esys_Free(name);
@@ -63,8 +63,105 @@ static tpm_nvwrite_ctx ctx = {
     .aux_session_handle[1] = ESYS_TR_NONE,
 };
 
+/*
+ * The attribute nvwritten is set after the first write and so the
+ * HMAC must be calculated again with the new name.
+ * Fixes #2846
+ */
+static tool_rc nv_auth_update(ESYS_CONTEXT *ectx) {
+
+    tool_rc rc = tpm2_session_close(&ctx.auth_hierarchy.object.session);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Failed HMAC auth session clean-up");
+        return rc;
+    }
+
+    rc = tpm2_util_object_load_auth(ectx, ctx.auth_hierarchy.ctx_path,
+    ctx.auth_hierarchy.auth_str, &ctx.auth_hierarchy.object, false,
+    TPM2_HANDLE_FLAGS_NV | TPM2_HANDLE_FLAGS_O | TPM2_HANDLE_FLAGS_P);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Failed updating the auth");
+    }
+
+    return rc;
+}
+
+static void nv_write_chunk(TPM2B_MAX_NV_BUFFER *nv_write_data,
+        UINT16 data_offset) {
+
+    UINT16 left = ctx.data_size - data_offset;
+    nv_write_data->size = left > ctx.max_data_size ? ctx.max_data_size : left;
+
+    LOG_INFO("The data(size=%d) to be written:", nv_write_data->size);
+
+    memcpy(nv_write_data->buffer, &ctx.nv_buffer[data_offset],
+            nv_write_data->size);
+}
+
+/*
+ * Writes all chunks against a single NV index handle. The next chunk is staged
+ * while the TPM works on the current one and is sent as soon as the response
+ * arrives.
+ */
+static tool_rc nv_write_stream(ESYS_CONTEXT *ectx) {
+
+    ESYS_TR nv_handle = ESYS_TR_NONE;
+    tool_rc rc = tpm2_from_tpm_public(ectx, ctx.nv_index, ESYS_TR_NONE,
+        ESYS_TR_NONE, ESYS_TR_NONE, &nv_handle);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    TPM2B_MAX_NV_BUFFER buffers[2];
+    unsigned current = 0;
+    UINT16 data_offset = 0;
+    bool is_nv_auth_updated = false;
+
+    nv_write_chunk(&buffers[current], data_offset);
+    while (true) {
+        rc = tpm2_nvwrite_async(ectx, &ctx.auth_hierarchy.object, nv_handle,
+            &buffers[current], ctx.offset + data_offset,
+            ctx.aux_session_handle[0], ctx.aux_session_handle[1]);
+        if (rc != tool_rc_success) {
+            goto out;
+        }
+        data_offset += buffers[current].size;
+
+        bool is_more = data_offset < ctx.data_size;
+        if (is_more) {
+            nv_write_chunk(&buffers[current ^ 1], data_offset);
+        }
+
+        rc = tpm2_nvwrite_finish(ectx);
+        if (rc != tool_rc_success || !is_more) {
+            goto out;
+        }
+
+        /* ESYS tracks nvwritten on nv_handle, the auth object is separate */
+        if (!is_nv_auth_updated) {
+            rc = nv_auth_update(ectx);
+            if (rc != tool_rc_success) {
+                goto out;
+            }
+            is_nv_auth_updated = true;
+        }
+
+        current ^= 1;
+    }
+
+out:
+    tpm2_close(ectx, &nv_handle);
+
+    return rc;
+}
+
 static tool_rc nv_write(ESYS_CONTEXT *ectx) {
 
+    /* pHash calculations are limited to a single chunk */
+    if (ctx.is_command_dispatch && !ctx.cp_hash_path && !ctx.rp_hash_path) {
+        return nv_write_stream(ectx);
+    }
+
     TPM2B_MAX_NV_BUFFER nv_write_data;
     UINT16 data_offset = 0;
     bool is_nvwritten_set = false;
@@ -79,24 +176,10 @@ static tool_rc nv_write(ESYS_CONTEXT *ectx) {
                 nv_write_data.size);
 
         tool_rc rc = tool_rc_success;
-        /*
-         * The attribute nvwritten is set after the first write and so the
-         * HMAC must be calculated again with the new name.
-         * Fixes #2846
-         */
         if (is_nvwritten_set && !is_nv_auth_updated &&
         ctx.is_command_dispatch) {
-            rc = tpm2_session_close(&ctx.auth_hierarchy.object.session);
-            if (rc != tool_rc_success) {
-                LOG_ERR("Failed HMAC auth session clean-up");
-                return rc;
-            }
-
-            rc = tpm2_util_object_load_auth(ectx, ctx.auth_hierarchy.ctx_path,
-            ctx.auth_hierarchy.auth_str, &ctx.auth_hierarchy.object, false,
-            TPM2_HANDLE_FLAGS_NV | TPM2_HANDLE_FLAGS_O | TPM2_HANDLE_FLAGS_P);
+            rc = nv_auth_update(ectx);
             if (rc != tool_rc_success) {
-                LOG_ERR("Failed updating the auth");
                 return rc;
             }
             is_nv_auth_updated = true;
@@ -3,6 +3,7 @@
 #include "log.h"
 #include "pcr.h"
 #include "tpm2.h"
+#include "tpm2_capability.h"
 #include "tpm2_tool.h"
 #include "tpm2_options.h"
 #include "files.h"
@@ -58,6 +59,15 @@ static tool_rc pcrallocate(ESYS_CONTEXT *ectx) {
         &ctx.pcr_selection, &ctx.cp_hash, ctx.parameter_hash_algorithm);
     if (rc != tool_rc_success) {
         LOG_ERR("Failed TPM2_CC_ECDH_ZGen"); 
+        return rc;
+    }
+
+    /*
+     * The new allocation applies after the next reset, forget the cached one.
+     * Computing the cpHash leaves the TPM untouched.
+     */
+    if (ctx.is_command_dispatch) {
+        tpm2_capability_cache_flush();
     }
 
     return rc;
@@ -11,8 +11,9 @@
 #include "log.h"
 #include "tpm2.h"
 #include "tpm2_alg_util.h"
-#include "tpm2_hierarchy.h"
 #include "tpm2_auth_util.h"
+#include "tpm2_hash.h"
+#include "tpm2_hierarchy.h"
 #include "tpm2_tool.h"
 
 #define MAX_SESSIONS 3
@@ -58,8 +59,8 @@ static tool_rc pcr_hashsequence(ESYS_CONTEXT *ectx) {
 
     /*
      * Size is either unknown because the FILE * is a fifo, or it's too big
-     * to do in a single hash call. Based on the size figure out the chunks
-     * to loop over, if possible. This way we can call Complete with data.
+     * to do in a single hash call. Loop over the chunks and keep the last
+     * one, so we can call Complete with data.
      */
     tool_rc rc = tpm2_hash_sequence_start(ectx, &null_auth, TPM2_ALG_NULL,
             &sequence_handle);
@@ -67,54 +68,11 @@ static tool_rc pcr_hashsequence(ESYS_CONTEXT *ectx) {
         return rc;
     }
 
-    /*
-     * If file size is non-zero we decrement the amount read and terminate the
-     * loop when 1 block is left.
-     *
-     * If file size is reported zero we go till feof.
-     */
-    size_t left = ctx.file_size;
-    bool is_filesize_nonzero = !!ctx.is_input_not_fifo && left;
-
     TPM2B_MAX_BUFFER data;
-    bool done = false;
-    while (!done) {
-
-        size_t bytes_read = fread(data.buffer, 1,
-                BUFFER_SIZE(typeof(data), buffer), ctx.input);
-        if (ferror(ctx.input)) {
-            LOG_ERR("Error reading from input file");
-            return tool_rc_general_error;
-        }
-
-        data.size = bytes_read;
-
-        /* if data was read, update the sequence */
-        rc = tpm2_sequence_update(ectx, sequence_handle, &data);
-        if (rc != tool_rc_success) {
-            return rc;
-        }
-
-        if (is_filesize_nonzero) {
-            left -= bytes_read;
-            if (left <= TPM2_MAX_DIGEST_BUFFER) {
-                done = true;
-                continue;
-            }
-        } else if (feof(ctx.input)) {
-            done = true;
-        }
-    } /* end file read/hash update loop */
-
-    if (is_filesize_nonzero) {
-        data.size = left;
-        bool result = files_read_bytes(ctx.input, data.buffer, left);
-        if (!result) {
-            LOG_ERR("Error reading from input file.");
-            return tool_rc_general_error;
-        }
-    } else {
-        data.size = 0;
+    rc = tpm2_hash_sequence_update_file(ectx, sequence_handle, ctx.input,
+            &data);
+    if (rc != tool_rc_success) {
+        return rc;
     }
 
     return tpm2_event_sequence_complete(ectx, ctx.pcr, sequence_handle,
@@ -205,10 +163,7 @@ static tool_rc process_outputs(ESYS_CONTEXT *ectx) {
             }
         }
 
-        size_t j;
-        for (j = 0; j < size; j++) {
-            tpm2_tool_output("%02x", bytes[j]);
-        }
+        tpm2_util_hexdump(bytes, size);
 
         tpm2_tool_output("\n");
     }
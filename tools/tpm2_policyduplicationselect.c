@@ -69,7 +69,7 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
     };
 
     *opts = tpm2_options_new("S:n:N:L:", ARRAY_LEN(topts), topts, on_option,
-    NULL, 0);
+    NULL, TPM2_OPTIONS_OPTIONAL_SAPI);
 
     return *opts != NULL;
 }
@@ -205,7 +205,7 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
     };
 
     *opts = tpm2_options_new("S:L:", ARRAY_LEN(topts), topts, on_option, on_arg,
-            0);
+            TPM2_OPTIONS_OPTIONAL_SAPI);
 
     return *opts != NULL;
 }
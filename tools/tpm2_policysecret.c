@@ -281,7 +281,7 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
     };
 
     *opts = tpm2_options_new("L:S:c:t:q:x", ARRAY_LEN(topts), topts, on_option,
-            on_arg, 0);
+            on_arg, TPM2_OPTIONS_OPTIONAL_SAPI);
 
     return *opts != 0;
 }
@@ -25,6 +25,8 @@ struct tpm2_policysigned_ctx {
     const char *context_arg;
     tpm2_loaded_object key_context_object;
 
+    const char *key_name_path;
+
     bool is_nonce_tpm;
 
     INT32 expiration;
@@ -90,6 +92,9 @@ static bool on_option(char key, char *value) {
     case 'c':
         ctx.context_arg = value;
         break;
+    case 'n':
+        ctx.key_name_path = value;
+        break;
     case 'q':
         ctx.policy_qualifier_data = value;
         break;
@@ -129,6 +134,7 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
         { "signature",      required_argument, NULL, 's' },
         { "format",         required_argument, NULL, 'f' },
         { "key-context",    required_argument, NULL, 'c' },
+        { "name",           required_argument, NULL, 'n' },
         { "expiration",     required_argument, NULL, 't' },
         { "qualification",  required_argument, NULL, 'q' },
         { "nonce-tpm",      no_argument,       NULL, 'x' },
@@ -138,19 +144,24 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
         { "cphash-input",   required_argument, NULL,  3  },
     };
 
-    *opts = tpm2_options_new("L:S:g:s:f:c:t:q:x", ARRAY_LEN(topts), topts, on_option,
-    NULL, 0);
+    *opts = tpm2_options_new("L:S:g:s:f:c:n:t:q:x", ARRAY_LEN(topts), topts,
+    on_option, NULL, TPM2_OPTIONS_OPTIONAL_SAPI);
 
     return *opts != NULL;
 }
 
 static bool is_input_option_args_valid(void) {
 
-    if (!ctx.context_arg) {
-            LOG_ERR("Must specify verifying key context -c.");
+    if (!ctx.context_arg && !ctx.key_name_path) {
+            LOG_ERR("Must specify verifying key context -c or its name -n.");
             return false;
         }
 
+    if (ctx.context_arg && ctx.key_name_path) {
+        LOG_ERR("Specify either the verifying key context -c or its name -n.");
+        return false;
+    }
+
     if (ctx.raw_data_path) {
         if (ctx.is_nonce_tpm && !ctx.session_path) {
             LOG_ERR("Must specify -S session file.");
@@ -186,16 +197,29 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
         }
     }
 
+    if (!ectx && (!ctx.session_path || ctx.raw_data_path)) {
+        LOG_ERR("Without a TPM only the policy digest of an offline trial "
+                "session can be calculated");
+        return tool_rc_option_error;
+    }
+
     /*
      * For signature verification only object load is needed, not auth.
      */
-    tool_rc tmp_rc = tpm2_util_object_load(ectx, ctx.context_arg,
-            &ctx.key_context_object,
-            TPM2_HANDLES_FLAGS_TRANSIENT|TPM2_HANDLES_FLAGS_PERSISTENT);
-    if (tmp_rc != tool_rc_success) {
-        return tmp_rc;
-    }
+    if (ctx.context_arg) {
+        if (!ectx) {
+            LOG_ERR("The verifying key cannot be loaded without a TPM, specify "
+                    "its name with -n");
+            return tool_rc_option_error;
+        }
 
+        tool_rc tmp_rc = tpm2_util_object_load(ectx, ctx.context_arg,
+                &ctx.key_context_object,
+                TPM2_HANDLES_FLAGS_TRANSIENT|TPM2_HANDLES_FLAGS_PERSISTENT);
+        if (tmp_rc != tool_rc_success) {
+            return tmp_rc;
+        }
+    }
 
     tool_rc rc = tpm2_session_restore(ectx, ctx.session_path, false,
             &ctx.session);
@@ -203,12 +227,18 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
         return rc;
     }
 
+    if (ctx.key_name_path && !tpm2_session_is_offline(ctx.session)) {
+        LOG_ERR("The verifying key name -n is only used with offline trial "
+                "sessions, specify the key context with -c");
+        return tool_rc_option_error;
+    }
+
     TPM2B_TIMEOUT *timeout = NULL;
     TPMT_TK_AUTH *policy_ticket = NULL;
     rc = tpm2_policy_build_policysigned(ectx, ctx.session,
         &ctx.key_context_object, &ctx.signature, ctx.expiration, &timeout,
         &policy_ticket, ctx.policy_qualifier_data, ctx.is_nonce_tpm,
-        ctx.raw_data_path, ctx.cphash_path);
+        ctx.raw_data_path, ctx.cphash_path, ctx.key_name_path);
     if (rc != tool_rc_success) {
         LOG_ERR("Could not build policysigned TPM");
         goto tpm2_tool_onrun_out;
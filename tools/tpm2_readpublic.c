@@ -42,10 +42,7 @@ static tool_rc read_public_and_save(ESYS_CONTEXT *ectx) {
     }
 
     tpm2_tool_output("name: ");
-    UINT16 i;
-    for (i = 0; i < name->size; i++) {
-        tpm2_tool_output("%02x", name->name[i]);
-    }
+    tpm2_util_hexdump(name->name, name->size);
     tpm2_tool_output("\n");
 
     bool ret = true;
@@ -59,9 +56,7 @@ static tool_rc read_public_and_save(ESYS_CONTEXT *ectx) {
     }
 
     tpm2_tool_output("qualified name: ");
-    for (i = 0; i < qualified_name->size; i++) {
-        tpm2_tool_output("%02x", qualified_name->name[i]);
-    }
+    tpm2_util_hexdump(qualified_name->name, qualified_name->size);
     tpm2_tool_output("\n");
 
     tpm2_util_public_to_yaml(public, NULL);
@@ -1,8 +1,12 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "files.h"
 #include "log.h"
@@ -10,6 +14,7 @@
 #include "tpm2_alg_util.h"
 #include "tpm2_convert.h"
 #include "tpm2_hash.h"
+#include "tpm2_openssl.h"
 #include "tpm2_options.h"
 #include "tpm2_tool.h"
 
@@ -26,6 +31,7 @@ struct tpm_sign_ctx {
     } signing_key;
 
     bool is_input_msg_digest;
+    bool is_local_hash;
     BYTE *msg;
     UINT16 length;
     char *input_file;
@@ -53,6 +59,14 @@ struct tpm_sign_ctx {
     TPM2B_DIGEST cp_hash;
     bool is_command_dispatch;
     TPMI_ALG_HASH parameter_hash_algorithm;
+
+    /*
+     * Batch mode
+     */
+    const char *batch_dir;
+    char **batch_inputs;
+    int batch_count;
+    tpm2_hash_pool *hash_pool;
 };
 
 static tpm_sign_ctx ctx = {
@@ -68,6 +82,226 @@ static tool_rc sign(ESYS_CONTEXT *ectx) {
         ctx.parameter_hash_algorithm);
 }
 
+typedef struct sign_batch_item sign_batch_item;
+struct sign_batch_item {
+    const char *path;
+    TPM2B_DIGEST digest;
+    TPMT_TK_HASHCHECK validation;
+};
+
+static double elapsed_seconds(const struct timespec *start) {
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec - start->tv_sec) +
+            (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static tool_rc batch_load_input(ESYS_CONTEXT *ectx, int index,
+        sign_batch_item *item) {
+
+    const char *path = ctx.batch_inputs[index];
+    item->path = path;
+
+    if (ctx.is_input_msg_digest || ctx.is_local_hash) {
+        bool result = true;
+        if (ctx.is_local_hash) {
+            result = tpm2_hash_pool_get(ctx.hash_pool, index, &item->digest);
+        } else {
+            item->digest.size = sizeof(item->digest.buffer);
+            result = files_load_bytes_from_path(path, item->digest.buffer,
+                    &item->digest.size);
+        }
+        if (!result) {
+            return tool_rc_general_error;
+        }
+
+        item->validation.tag = TPM2_ST_HASHCHECK;
+        item->validation.hierarchy = TPM2_RH_NULL;
+        memset(&item->validation.digest, 0, sizeof(item->validation.digest));
+
+        return tool_rc_success;
+    }
+
+    FILE *input = fopen(path, "rb");
+    if (!input) {
+        LOG_ERR("Could not open file \"%s\", error: %s", path,
+                strerror(errno));
+        return tool_rc_general_error;
+    }
+
+    TPM2B_DIGEST *digest = NULL;
+    TPMT_TK_HASHCHECK *validation = NULL;
+    tool_rc rc = tpm2_hash_file(ectx, ctx.halg, TPM2_RH_OWNER, input, &digest,
+            &validation);
+    fclose(input);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Could not hash input \"%s\"", path);
+    } else {
+        item->digest = *digest;
+        item->validation = *validation;
+    }
+
+    free(digest);
+    free(validation);
+
+    return rc;
+}
+
+static const char *batch_name(const char *input_path) {
+
+    const char *name = strrchr(input_path, '/');
+    return name ? name + 1 : input_path;
+}
+
+static int batch_name_cmp(const void *a, const void *b) {
+
+    return strcmp(batch_name(*(char * const *) a),
+            batch_name(*(char * const *) b));
+}
+
+/*
+ * The signatures are saved by the file name of the inputs, two inputs with the
+ * same name in different directories would overwrite each other's signature.
+ */
+static bool batch_names_are_unique(void) {
+
+    char **inputs = malloc(ctx.batch_count * sizeof(*inputs));
+    if (!inputs) {
+        LOG_ERR("oom");
+        return false;
+    }
+    memcpy(inputs, ctx.batch_inputs, ctx.batch_count * sizeof(*inputs));
+    qsort(inputs, ctx.batch_count, sizeof(*inputs), batch_name_cmp);
+
+    bool is_unique = true;
+    int i;
+    for (i = 1; i < ctx.batch_count && is_unique; i++) {
+        is_unique = batch_name_cmp(&inputs[i - 1], &inputs[i]) != 0;
+        if (!is_unique) {
+            LOG_ERR("Inputs \"%s\" and \"%s\" would both be signed to "
+                    "\"%s/%s.sig\"", inputs[i - 1], inputs[i], ctx.batch_dir,
+                    batch_name(inputs[i]));
+        }
+    }
+
+    free(inputs);
+    return is_unique;
+}
+
+static bool batch_save_signature(const char *input_path,
+        TPMT_SIGNATURE *signature) {
+
+    const char *name = batch_name(input_path);
+
+    char path[PATH_MAX];
+    int len = snprintf(path, sizeof(path), "%s/%s.sig", ctx.batch_dir, name);
+    if (len < 0 || (size_t) len >= sizeof(path)) {
+        LOG_ERR("Signature path for \"%s\" is too long", input_path);
+        return false;
+    }
+
+    return tpm2_convert_sig_save(signature, ctx.sig_format, path);
+}
+
+static tool_rc sign_batch(ESYS_CONTEXT *ectx) {
+
+    /*
+     * The key and its auth session are set up once for all inputs. Only one
+     * command can be in flight on an ESYS context, so while the TPM signs one
+     * digest the next digest is loaded and the previous signature is written
+     * out. Messages hashed by the TPM can't overlap, messages hashed locally
+     * are hashed ahead on the hash pool.
+     */
+    sign_batch_item items[2];
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    bool is_overlapped = ctx.is_input_msg_digest || ctx.is_local_hash;
+    if (ctx.is_local_hash) {
+        ctx.hash_pool = tpm2_hash_pool_start(ctx.halg, ctx.batch_inputs,
+                ctx.batch_count, 0);
+        if (!ctx.hash_pool) {
+            return tool_rc_general_error;
+        }
+    }
+
+    int signed_count = 0;
+    tool_rc rc = batch_load_input(ectx, 0, &items[0]);
+    if (rc == tool_rc_success) {
+        rc = tpm2_sign_async(ectx, &ctx.signing_key.object, &items[0].digest,
+                &ctx.in_scheme, &items[0].validation);
+    }
+
+    bool is_request_pending = rc == tool_rc_success;
+    while (is_request_pending) {
+        sign_batch_item *item = &items[signed_count % 2];
+        sign_batch_item *next = &items[(signed_count + 1) % 2];
+        bool has_next = signed_count + 1 < ctx.batch_count;
+
+        if (has_next && is_overlapped) {
+            rc = batch_load_input(ectx, signed_count + 1, next);
+            if (rc != tool_rc_success) {
+                break;
+            }
+        }
+
+        TPMT_SIGNATURE *signature = NULL;
+        rc = tpm2_sign_finish(ectx, &signature);
+        is_request_pending = false;
+        if (rc != tool_rc_success) {
+            LOG_ERR("Could not sign \"%s\"", item->path);
+            break;
+        }
+
+        if (has_next && !is_overlapped) {
+            rc = batch_load_input(ectx, signed_count + 1, next);
+        }
+
+        if (has_next && rc == tool_rc_success) {
+            rc = tpm2_sign_async(ectx, &ctx.signing_key.object, &next->digest,
+                    &ctx.in_scheme, &next->validation);
+            is_request_pending = rc == tool_rc_success;
+        }
+
+        bool is_file_op_success = batch_save_signature(item->path, signature);
+        free(signature);
+        if (!is_file_op_success) {
+            rc = tool_rc_general_error;
+            break;
+        }
+
+        if (rc != tool_rc_success) {
+            break;
+        }
+
+        signed_count++;
+    }
+
+    if (is_request_pending) {
+        /* drain the outstanding command, the earlier error wins */
+        TPMT_SIGNATURE *signature = NULL;
+        tpm2_sign_finish(ectx, &signature);
+        free(signature);
+    }
+
+    tpm2_hash_pool_free(ctx.hash_pool);
+    ctx.hash_pool = NULL;
+
+    if (rc != tool_rc_success) {
+        LOG_ERR("Failed batch sign after %d of %d inputs", signed_count,
+                ctx.batch_count);
+        return rc;
+    }
+
+    double seconds = elapsed_seconds(&start);
+    LOG_INFO("Signed %d inputs in %.3f s (%.1f signatures/s)", signed_count,
+            seconds, seconds > 0 ? signed_count / seconds : 0.0);
+
+    return tool_rc_success;
+}
+
 static tool_rc process_output(ESYS_CONTEXT *ectx) {
 
     UNUSED(ectx);
@@ -140,8 +374,10 @@ static tool_rc process_inputs(ESYS_CONTEXT *ectx) {
             return tool_rc_general_error;
         }
 
-        rc = tpm2_hash_file(ectx, ctx.halg, TPM2_RH_OWNER, input, &ctx.digest,
-                &temp_validation_ticket);
+        /* a NULL hierarchy ticket lets tpm2_hash_file hash in-process */
+        rc = tpm2_hash_file(ectx, ctx.halg,
+                ctx.is_local_hash ? TPM2_RH_NULL : TPM2_RH_OWNER, input,
+                &ctx.digest, &temp_validation_ticket);
         if (input != stdin) {
             fclose(input);
         }
@@ -261,11 +497,54 @@ static tool_rc check_options(ESYS_CONTEXT *ectx) {
         return tool_rc_option_error;
     }
 
-    if (!ctx.output_path && !ctx.cp_hash_path) {
+    if (ctx.batch_dir) {
+        if (!ctx.batch_count) {
+            LOG_ERR("Expected at least one input file in batch mode");
+            return tool_rc_option_error;
+        }
+
+        if (ctx.output_path || ctx.cp_hash_path) {
+            LOG_ERR("Cannot specify option o or --cphash in batch mode");
+            return tool_rc_option_error;
+        }
+
+        if (ctx.is_hash_ticket_specified) {
+            LOG_ERR("A validation ticket can't cover all inputs of a batch");
+            return tool_rc_option_error;
+        }
+
+        if (ctx.in_scheme.scheme == TPM2_ALG_ECDAA) {
+            LOG_ERR("ECDAA signatures need a commit each, not supported in "
+                    "batch mode");
+            return tool_rc_option_error;
+        }
+
+        if (tpm2_session_get_type(ctx.signing_key.object.session) ==
+                TPM2_SE_POLICY) {
+            LOG_ERR("A policy session is satisfied for one signature only, "
+                    "not supported in batch mode");
+            return tool_rc_option_error;
+        }
+
+        if (!batch_names_are_unique()) {
+            return tool_rc_option_error;
+        }
+    } else if (!ctx.output_path && !ctx.cp_hash_path) {
         LOG_ERR("Expected option o");
         return tool_rc_option_error;
     }
 
+    if (ctx.is_local_hash && ctx.is_input_msg_digest) {
+        LOG_ERR("Cannot hash locally, the input is already a digest");
+        return tool_rc_option_error;
+    }
+
+    if (ctx.is_local_hash && !tpm2_openssl_md_from_tpmhalg(ctx.halg)) {
+        LOG_ERR("Cannot hash locally, OpenSSL does not support the hash "
+                "algorithm");
+        return tool_rc_option_error;
+    }
+
     if (!ctx.is_input_msg_digest && ctx.is_hash_ticket_specified) {
         LOG_WARN("Ignoring the specified validation ticket since no TPM "
                  "calculated digest specified.");
@@ -320,6 +599,12 @@ static bool on_option(char key, char *value) {
     case 1:
         ctx.commit_index = value;
         break;
+    case 2:
+        ctx.batch_dir = value;
+        break;
+    case 3:
+        ctx.is_local_hash = true;
+        break;
     case 'f':
         ctx.sig_format = tpm2_convert_sig_fmt_from_optarg(value);
 
@@ -334,6 +619,12 @@ static bool on_option(char key, char *value) {
 
 static bool on_args(int argc, char *argv[]) {
 
+    if (ctx.batch_dir) {
+        ctx.batch_inputs = argv;
+        ctx.batch_count = argc;
+        return true;
+    }
+
     if (argc != 1) {
         LOG_ERR("Expected one input file, got: %d", argc);
         return false;
@@ -357,6 +648,8 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
       { "format",         required_argument, 0, 'f' },
       { "cphash",         required_argument, 0,  0  },
       { "commit-index",   required_argument, 0,  1  },
+      { "batch",          required_argument, 0,  2  },
+      { "local-hash",     no_argument,       0,  3  },
     };
 
     *opts = tpm2_options_new("p:g:dt:o:c:f:s:", ARRAY_LEN(topts), topts,
@@ -378,8 +671,12 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
     }
 
     /*
-     * 2. Process inputs
+     * 2. Process inputs, batch mode loads, signs and saves each input in turn
      */
+    if (ctx.batch_dir) {
+        return sign_batch(ectx);
+    }
+
     rc = process_inputs(ectx);
     if (rc != tool_rc_success) {
         return rc;
@@ -152,18 +152,28 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
     };
 
     *opts = tpm2_options_new("g:G:S:c:n:", ARRAY_LEN(topts), topts, on_option,
-    NULL, 0);
+    NULL, TPM2_OPTIONS_OPTIONAL_SAPI);
 
     return *opts != NULL;
 }
 
-static tool_rc is_input_options_valid(void) {
+static tool_rc is_input_options_valid(ESYS_CONTEXT *ectx) {
 
     if (!ctx.output.path) {
         LOG_ERR("Expected option -S");
         return tool_rc_option_error;
     }
 
+    /*
+     * Without a TPM (-T none) only trial sessions can be started, their policy
+     * digest is then calculated in software by the policy tools.
+     */
+    if (!ectx && (ctx.is_real_policy_session || ctx.is_hmac_session ||
+            ctx.is_session_encryption_possibly_needed || ctx.name_path)) {
+        LOG_ERR("Only trial sessions can be started without a TPM");
+        return tool_rc_option_error;
+    }
+
     /* Trial-session: neither real_policy nor audit/hmac session */
     if (!ctx.is_real_policy_session && !ctx.is_hmac_session &&
     ctx.is_session_encryption_possibly_needed) {
@@ -359,7 +369,7 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
     UNUSED(flags);
 
     //Check input options
-    tool_rc rc = is_input_options_valid();
+    tool_rc rc = is_input_options_valid(ectx);
     if (rc != tool_rc_success) {
         return rc;
     }
@@ -372,7 +382,8 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
 
     //ESAPI call to start session
     tpm2_session *s = NULL;
-    rc = tpm2_session_open(ectx, ctx.session_data, &s);
+    rc = ectx ? tpm2_session_open(ectx, ctx.session_data, &s) :
+            tpm2_session_open_offline(ctx.session_data, &s);
     if (rc != tool_rc_success) {
         return rc;
     }
@@ -1,8 +1,11 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <ctype.h>
+#include <errno.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <openssl/err.h>
 #include <openssl/evp.h>
@@ -11,10 +14,14 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 
+#include "files.h"
 #include "log.h"
+#include "tpm2.h"
 #include "tpm2_errata.h"
 #include "tpm2_options.h"
+#include "tpm2_session.h"
 #include "tpm2_tool.h"
 #include "tpm2_tool_output.h"
 
@@ -27,6 +34,8 @@ static void esys_teardown(ESYS_CONTEXT **esys_context) {
     Esys_Finalize(esys_context);
 }
 
+static TSS2_TCTI_CONTEXT *shell_tcti_unwrap(TSS2_TCTI_CONTEXT *tcti_context);
+
 static void teardown_full(ESYS_CONTEXT **esys_context) {
 
     TSS2_TCTI_CONTEXT *tcti_context = NULL;
@@ -40,6 +49,7 @@ static void teardown_full(ESYS_CONTEXT **esys_context) {
     if (rc != TPM2_RC_SUCCESS)
         return;
     esys_teardown(esys_context);
+    tcti_context = shell_tcti_unwrap(tcti_context);
     Tss2_TctiLdr_Finalize(&tcti_context);
 }
 
@@ -91,21 +101,7 @@ static const char *tpm2_tool_name(const char *arg) {
     return name;
 }
 
-static const tpm2_tool *tpm2_tool_lookup(int *argc, char ***argv)
-{
-    // find the executable name in the path
-    // and skip "tpm2_" prefix if it is present
-    const char *name = tpm2_tool_name((*argv)[0]);
-
-    // if this was invoked as 'tpm2', then try again with the second argument
-    if (strcmp(name, "tpm2") == 0) {
-        if (--(*argc) == 0) {
-            return NULL;
-        }
-        (*argv)++;
-        name = tpm2_tool_name((*argv)[0]);
-    }
-
+static const tpm2_tool *tpm2_tool_find(const char *name) {
 
     // search the tools array for a matching name
     for(unsigned i = 0 ; i < tool_count ; i++)
@@ -123,6 +119,37 @@ static const tpm2_tool *tpm2_tool_lookup(int *argc, char ***argv)
     return NULL;
 }
 
+static bool tpm2_tool_is_shell(int argc, char **argv) {
+
+    const char *name = tpm2_tool_name(argv[0]);
+    if (strcmp(name, "tpm2") == 0) {
+        if (argc < 2) {
+            return false;
+        }
+        name = tpm2_tool_name(argv[1]);
+    }
+
+    return strcmp(name, "shell") == 0;
+}
+
+static const tpm2_tool *tpm2_tool_lookup(int *argc, char ***argv)
+{
+    // find the executable name in the path
+    // and skip "tpm2_" prefix if it is present
+    const char *name = tpm2_tool_name((*argv)[0]);
+
+    // if this was invoked as 'tpm2', then try again with the second argument
+    if (strcmp(name, "tpm2") == 0) {
+        if (--(*argc) == 0) {
+            return NULL;
+        }
+        (*argv)++;
+        name = tpm2_tool_name((*argv)[0]);
+    }
+
+    return tpm2_tool_find(name);
+}
+
 
 /*
  * This program is a template for TPM2 tools that use the SAPI. It does
@@ -132,78 +159,37 @@ static const tpm2_tool *tpm2_tool_lookup(int *argc, char ***argv)
 static struct tool_context {
     ESYS_CONTEXT *ectx;
     tpm2_options *tool_opts;
+    bool is_shell_child;
 } ctx;
 
 static void main_onexit(void) {
 
-    teardown_full(&ctx.ectx);
-    tpm2_options_free(ctx.tool_opts);
-}
-
-int main(int argc, char **argv) {
-
-    /* get rid of:
-     *   owner execute (1)
-     *   group execute (1)
-     *   other write + read + execute (7)
+    /*
+     * Commands forked off by the shell borrow its TCTI and ESAPI context,
+     * the shell process owns them and tears them down.
      */
-    umask(0117);
-
-    bool is_str_tpm2 = (strcmp(argv[0], "tpm2") == 0);
-
-    bool is_one_opt_specified = (argc == 2 && is_str_tpm2);
-
-    bool is_opt_str_help = (is_one_opt_specified &&
-        ((strcmp(argv[1],"--help") == 0) || (strcmp(argv[1],"-h") == 0) ||
-         (strcmp(argv[1],"--help=man") == 0)));
-
-    bool is_no_opts = (is_str_tpm2 && argc == 1);
-
-    if (is_no_opts || is_opt_str_help) {
-        char *options[2] = {"tpm2","--help=man"};
-        tpm2_handle_options(2, options, 0, 0, 0);
-        tool_rc rc = is_no_opts ? tool_rc_option_error : tool_rc_success;
-        exit(rc);
-    }
-
-    bool is_opt_str_help_no_man = (is_one_opt_specified &&
-        (strcmp(argv[1],"--help=no-man") == 0));
-
-    if (is_opt_str_help_no_man) {
-        tpm2_tool_output("Specify [ -v | --version ], [-h | --help] or one of "
-            "the following tool names:\n");
-        for(unsigned i = 0 ; i < tool_count ; i++) {
-            fprintf(stderr, "%s\n", tools[i]->name);
-        }
-
-        exit(tool_rc_success);
-    }
-
-    bool is_opt_str_version = (is_one_opt_specified &&
-        ((strcmp(argv[1],"--version") == 0) || (strcmp(argv[1],"-v") == 0)));
-
-    if (is_opt_str_version) {
-        tpm2_handle_options(argc, argv, 0, 0, 0);
-        exit(tool_rc_success);
+    if (!ctx.is_shell_child) {
+        teardown_full(&ctx.ectx);
     }
+    tpm2_options_free(ctx.tool_opts);
+    ctx.tool_opts = NULL;
+}
 
+/*
+ * Runs a tool through its whole life-cycle and exits with its status. If
+ * ctx.ectx is already set up, its TCTI is reused rather than loading a new
+ * one.
+ */
+static void tpm2_tool_exec(const tpm2_tool *tool, int argc, char **argv)
+    __attribute__((__noreturn__));
 
-    /* don't buffer stdin/stdout/stderr so pipes work */
-    setvbuf (stdin, NULL, _IONBF, 0);
-    setvbuf (stdout, NULL, _IONBF, 0);
-    setvbuf (stderr, NULL, _IONBF, 0);
+static void tpm2_tool_exec(const tpm2_tool *tool, int argc, char **argv) {
 
-    const tpm2_tool * const tool = tpm2_tool_lookup(&argc, &argv);
-    if (!tool) {
-        LOG_ERR("%s: unknown tool. Available tpm2 commands:", argv[0]);
-        for(unsigned i = 0 ; i < tool_count ; i++) {
-            fprintf(stderr, "%s\n", tools[i]->name);
-        }
-        exit(tool_rc_general_error);
+    /* a shell child inherits the handler the shell registered */
+    if (!ctx.is_shell_child) {
+        atexit(main_onexit);
     }
 
-    atexit(main_onexit);
-
     tool_rc ret = tool_rc_general_error;
     if (tool->onstart) {
         bool res = tool->onstart(&ctx.tool_opts);
@@ -217,8 +203,17 @@ int main(int argc, char **argv) {
         atexit(tool->onexit);
     }
 
+    TSS2_TCTI_CONTEXT *shared_tcti = NULL;
+    if (ctx.ectx) {
+        TSS2_RC rval = Esys_GetTcti(ctx.ectx, &shared_tcti);
+        if (rval != TPM2_RC_SUCCESS) {
+            LOG_PERR(Esys_GetTcti, rval);
+            exit(tool_rc_general_error);
+        }
+    }
+
     tpm2_option_flags flags = { .all = 0 };
-    TSS2_TCTI_CONTEXT *tcti = NULL;
+    TSS2_TCTI_CONTEXT *tcti = shared_tcti;
     tpm2_option_code rc = tpm2_handle_options(argc, argv, ctx.tool_opts, &flags,
             &tcti);
     if (rc != tpm2_option_code_continue) {
@@ -242,24 +237,28 @@ int main(int argc, char **argv) {
         tpm2_tool_output_disable();
     }
 
-    if (tcti) {
-        ctx.ectx = ctx_init(tcti);
+    /* the shared context only goes to tools that asked for a TCTI */
+    ESYS_CONTEXT *ectx = NULL;
+    if (tcti && tcti == shared_tcti) {
+        ectx = ctx.ectx;
+    } else if (tcti) {
+        ectx = ctx.ectx = ctx_init(tcti);
         if (!ctx.ectx) {
             exit(tool_rc_tcti_error);
         }
-    }
 
-    if (flags.enable_errata) {
-        tpm2_errata_init(ctx.ectx);
+        if (flags.enable_errata) {
+            tpm2_errata_init(ctx.ectx);
+        }
     }
 
     /*
      * Call the specific tool, all tools implement this function instead of
      * 'main'.
      */
-    ret = tool->onrun(ctx.ectx, flags);
+    ret = tool->onrun(ectx, flags);
     if (tool->onstop) {
-        tool_rc tmp_rc = tool->onstop(ctx.ectx);
+        tool_rc tmp_rc = tool->onstop(ectx);
         /* if onrun() passed, the error code should come from onstop() */
         ret = ret == tool_rc_success ? tmp_rc : ret;
     }
@@ -276,3 +275,766 @@ int main(int argc, char **argv) {
 
     exit(ret);
 }
+
+/*
+ * The shell mode reads tool invocations, one per line, from a script file or
+ * stdin. The TCTI and ESAPI context are set up once and every command runs in
+ * a forked child, so each tool starts out with pristine static state while the
+ * TPM connection, and any errata probing, is shared.
+ */
+#define SHELL_MAX_ARGS 256
+
+/*
+ * Sessions named with TPM2_SESSION_BROKER_PREFIX stay loaded in the TPM and
+ * their ESAPI state is kept in a table of the shell process. Children inherit
+ * the table on fork and report their changes back over a pipe, which the shell
+ * applies once the command is done.
+ */
+typedef struct shell_session shell_session;
+struct shell_session {
+    char *name;
+    UINT8 *data;
+    size_t size;
+    /* the TPM handle of the session, known once it is set */
+    TPM2_HANDLE handle;
+    shell_session *next;
+};
+
+static struct {
+    const char *script_path;
+    shell_session *sessions;
+    FILE *updates;
+    /* the handles the running command reported as loaded */
+    TPM2_HANDLE *handles;
+    size_t handle_count;
+    size_t handle_capacity;
+} shell_ctx;
+
+/*
+ * The commands report what changes over the updates pipe: a record starts
+ * with its type, followed by a session or a handle.
+ */
+typedef enum shell_update shell_update;
+enum shell_update {
+    shell_update_session,
+    shell_update_handle_loaded,
+    shell_update_handle_flushed,
+};
+
+static shell_session **shell_session_find(const char *name) {
+
+    shell_session **entry = &shell_ctx.sessions;
+    while (*entry && strcmp((*entry)->name, name)) {
+        entry = &(*entry)->next;
+    }
+
+    return entry;
+}
+
+static bool shell_session_set(const char *name, const UINT8 *data,
+        size_t size) {
+
+    shell_session **entry = shell_session_find(name);
+    shell_session *s = *entry;
+
+    if (!data) {
+        if (s) {
+            *entry = s->next;
+            free(s->name);
+            free(s->data);
+            free(s);
+        }
+        return true;
+    }
+
+    UINT8 *copy = malloc(size);
+    if (!copy) {
+        LOG_ERR("oom");
+        return false;
+    }
+    memcpy(copy, data, size);
+
+    if (!s) {
+        s = calloc(1, sizeof(*s));
+        if (s) {
+            s->name = strdup(name);
+        }
+        if (!s || !s->name) {
+            LOG_ERR("oom");
+            free(s);
+            free(copy);
+            return false;
+        }
+        *entry = s;
+    }
+
+    free(s->data);
+    s->data = copy;
+    s->size = size;
+
+    /* deserializing is local to ESAPI, it sends no TPM command */
+    s->handle = 0;
+    ESYS_TR tr = ESYS_TR_NONE;
+    tool_rc rc = tpm2_tr_deserialize(ctx.ectx, data, size, &tr);
+    if (rc == tool_rc_success) {
+        Esys_TR_GetTpmHandle(ctx.ectx, tr, &s->handle);
+        Esys_TR_Close(ctx.ectx, &tr);
+    }
+
+    return true;
+}
+
+static bool shell_broker_load(const char *name, const UINT8 **data,
+        size_t *size) {
+
+    shell_session *s = *shell_session_find(name);
+    if (!s) {
+        return false;
+    }
+
+    *data = s->data;
+    *size = s->size;
+
+    return true;
+}
+
+/*
+ * A session update is the name and the state, each prefixed by its size. A
+ * state size of zero removes the session.
+ */
+static bool shell_broker_store(const char *name, const UINT8 *data,
+        size_t size) {
+
+    size_t name_size = strlen(name);
+    bool result = shell_ctx.updates &&
+            files_write_32(shell_ctx.updates, shell_update_session) &&
+            files_write_32(shell_ctx.updates, name_size) &&
+            files_write_bytes(shell_ctx.updates, (UINT8 *) name, name_size) &&
+            files_write_32(shell_ctx.updates, data ? size : 0) &&
+            (!data || files_write_bytes(shell_ctx.updates, (UINT8 *) data,
+                    size)) &&
+            !fflush(shell_ctx.updates);
+    if (!result) {
+        LOG_ERR("Could not report session \"%s\" to the shell", name);
+        return false;
+    }
+
+    return shell_session_set(name, data, size);
+}
+
+static const tpm2_session_broker shell_broker = {
+    .load = shell_broker_load,
+    .store = shell_broker_store,
+};
+
+static void shell_handle_set(TPM2_HANDLE handle, bool is_loaded) {
+
+    size_t i;
+    for (i = 0; i < shell_ctx.handle_count; i++) {
+        if (shell_ctx.handles[i] == handle) {
+            if (!is_loaded) {
+                shell_ctx.handles[i] =
+                        shell_ctx.handles[--shell_ctx.handle_count];
+            }
+            return;
+        }
+    }
+
+    if (!is_loaded) {
+        return;
+    }
+
+    if (shell_ctx.handle_count == shell_ctx.handle_capacity) {
+        size_t capacity = shell_ctx.handle_capacity ?
+                2 * shell_ctx.handle_capacity : 16;
+        TPM2_HANDLE *handles = realloc(shell_ctx.handles,
+                capacity * sizeof(*handles));
+        if (!handles) {
+            LOG_WARN("oom, handle 0x%x will not be flushed", handle);
+            return;
+        }
+        shell_ctx.handles = handles;
+        shell_ctx.handle_capacity = capacity;
+    }
+
+    shell_ctx.handles[shell_ctx.handle_count++] = handle;
+}
+
+static bool shell_read_session_update(FILE *updates) {
+
+    UINT32 name_size;
+    if (!files_read_32(updates, &name_size)) {
+        return false;
+    }
+
+    char *name = calloc(1, name_size + 1);
+    UINT32 size = 0;
+    bool result = name &&
+            files_read_bytes(updates, (UINT8 *) name, name_size) &&
+            files_read_32(updates, &size);
+
+    UINT8 *data = NULL;
+    if (result && size) {
+        data = malloc(size);
+        result = data && files_read_bytes(updates, data, size);
+    }
+
+    result = result && shell_session_set(name, data, size);
+    free(name);
+    free(data);
+
+    return result;
+}
+
+static bool shell_read_updates(FILE *updates) {
+
+    UINT32 type;
+    while (files_read_32(updates, &type)) {
+        bool result = false;
+        UINT32 handle;
+        switch (type) {
+        case shell_update_session:
+            result = shell_read_session_update(updates);
+            break;
+        case shell_update_handle_loaded:
+        case shell_update_handle_flushed:
+            result = files_read_32(updates, &handle);
+            if (result) {
+                shell_handle_set(handle, type == shell_update_handle_loaded);
+            }
+            break;
+        }
+
+        if (!result) {
+            LOG_ERR("Could not read the updates of the command");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void shell_report_handle(TPM2_HANDLE handle, bool is_loaded) {
+
+    if (!shell_ctx.updates) {
+        return;
+    }
+
+    bool result = files_write_32(shell_ctx.updates, is_loaded ?
+            shell_update_handle_loaded : shell_update_handle_flushed) &&
+            files_write_32(shell_ctx.updates, handle) &&
+            !fflush(shell_ctx.updates);
+    if (!result) {
+        LOG_WARN("Could not report handle 0x%x to the shell", handle);
+    }
+}
+
+/*
+ * The shell wraps the TCTI to follow the handles a command loads and flushes
+ * from the responses of the TPM. Commands report them as they go, so what a
+ * command leaves loaded is known without listing the handles of the TPM before
+ * and after it.
+ */
+#define SHELL_TCTI_MAGIC 0x5348454c4c544354ULL
+#define SHELL_TPM_HEADER_SIZE 10
+
+typedef struct shell_tcti shell_tcti;
+struct shell_tcti {
+    TSS2_TCTI_CONTEXT_COMMON_V2 common;
+    TSS2_TCTI_CONTEXT *tcti;
+    /* the command in flight and the handle it operates on */
+    TPM2_CC command_code;
+    TPM2_HANDLE command_handle;
+};
+
+static shell_tcti shell_tcti_ctx;
+
+static UINT32 shell_tcti_get_32(const uint8_t *buf) {
+
+    return (UINT32) buf[0] << 24 | (UINT32) buf[1] << 16 |
+            (UINT32) buf[2] << 8 | buf[3];
+}
+
+static TSS2_TCTI_CONTEXT *shell_tcti_unwrap(TSS2_TCTI_CONTEXT *tcti_context) {
+
+    return tcti_context == (TSS2_TCTI_CONTEXT *) &shell_tcti_ctx ?
+            shell_tcti_ctx.tcti : tcti_context;
+}
+
+static TSS2_RC shell_tcti_transmit(TSS2_TCTI_CONTEXT *tcti_ctx, size_t size,
+        const uint8_t *cmd_buf) {
+
+    shell_tcti *t = (shell_tcti *) tcti_ctx;
+
+    t->command_code = 0;
+    t->command_handle = 0;
+    if (size >= SHELL_TPM_HEADER_SIZE) {
+        t->command_code = shell_tcti_get_32(&cmd_buf[6]);
+        /* the sequence follows the PCR handle */
+        size_t offset = SHELL_TPM_HEADER_SIZE +
+                (t->command_code == TPM2_CC_EventSequenceComplete ? 4 : 0);
+        if (size >= offset + sizeof(TPM2_HANDLE)) {
+            t->command_handle = shell_tcti_get_32(&cmd_buf[offset]);
+        }
+    }
+
+    return Tss2_Tcti_Transmit(t->tcti, size, cmd_buf);
+}
+
+static void shell_tcti_track(shell_tcti *t, const uint8_t *resp_buf,
+        size_t size) {
+
+    TPM2_HANDLE handle = t->command_handle;
+    switch (t->command_code) {
+    case TPM2_CC_CreatePrimary:
+    case TPM2_CC_CreateLoaded:
+    case TPM2_CC_Load:
+    case TPM2_CC_LoadExternal:
+    case TPM2_CC_ContextLoad:
+    case TPM2_CC_StartAuthSession:
+    case TPM2_CC_HMAC_Start:
+    case TPM2_CC_HashSequenceStart:
+        if (size >= SHELL_TPM_HEADER_SIZE + sizeof(TPM2_HANDLE)) {
+            shell_report_handle(
+                    shell_tcti_get_32(&resp_buf[SHELL_TPM_HEADER_SIZE]), true);
+        }
+        break;
+    case TPM2_CC_FlushContext:
+    case TPM2_CC_SequenceComplete:
+    case TPM2_CC_EventSequenceComplete:
+        shell_report_handle(handle, false);
+        break;
+    case TPM2_CC_ContextSave:
+        /* a saved session is no longer loaded, a saved object still is */
+        if (handle >> TPM2_HR_SHIFT == TPM2_HT_HMAC_SESSION ||
+                handle >> TPM2_HR_SHIFT == TPM2_HT_POLICY_SESSION) {
+            shell_report_handle(handle, false);
+        }
+        break;
+    }
+}
+
+static TSS2_RC shell_tcti_receive(TSS2_TCTI_CONTEXT *tcti_ctx, size_t *size,
+        uint8_t *resp_buf, int32_t timeout) {
+
+    shell_tcti *t = (shell_tcti *) tcti_ctx;
+
+    TSS2_RC rc = Tss2_Tcti_Receive(t->tcti, size, resp_buf, timeout);
+    if (rc == TSS2_RC_SUCCESS && resp_buf && *size >= SHELL_TPM_HEADER_SIZE &&
+            shell_tcti_get_32(&resp_buf[6]) == TPM2_RC_SUCCESS) {
+        shell_tcti_track(t, resp_buf, *size);
+    }
+
+    return rc;
+}
+
+static void shell_tcti_finalize(TSS2_TCTI_CONTEXT *tcti_ctx) {
+
+    shell_tcti *t = (shell_tcti *) tcti_ctx;
+    Tss2_Tcti_Finalize(t->tcti);
+}
+
+static TSS2_RC shell_tcti_cancel(TSS2_TCTI_CONTEXT *tcti_ctx) {
+
+    return Tss2_Tcti_Cancel(((shell_tcti *) tcti_ctx)->tcti);
+}
+
+static TSS2_RC shell_tcti_get_poll_handles(TSS2_TCTI_CONTEXT *tcti_ctx,
+        TSS2_TCTI_POLL_HANDLE *handles, size_t *num_handles) {
+
+    return Tss2_Tcti_GetPollHandles(((shell_tcti *) tcti_ctx)->tcti, handles,
+            num_handles);
+}
+
+static TSS2_RC shell_tcti_set_locality(TSS2_TCTI_CONTEXT *tcti_ctx,
+        uint8_t locality) {
+
+    return Tss2_Tcti_SetLocality(((shell_tcti *) tcti_ctx)->tcti, locality);
+}
+
+static TSS2_RC shell_tcti_make_sticky(TSS2_TCTI_CONTEXT *tcti_ctx,
+        TPM2_HANDLE *handle, uint8_t sticky) {
+
+    return Tss2_Tcti_MakeSticky(((shell_tcti *) tcti_ctx)->tcti, handle,
+            sticky);
+}
+
+static TSS2_TCTI_CONTEXT *shell_tcti_wrap(TSS2_TCTI_CONTEXT *tcti) {
+
+    shell_tcti *t = &shell_tcti_ctx;
+    TSS2_TCTI_CONTEXT_COMMON_V2 *tcti_common = &t->common;
+
+    t->tcti = tcti;
+    TSS2_TCTI_MAGIC (tcti_common) = SHELL_TCTI_MAGIC;
+    TSS2_TCTI_VERSION (tcti_common) = 2;
+    TSS2_TCTI_TRANSMIT (tcti_common) = shell_tcti_transmit;
+    TSS2_TCTI_RECEIVE (tcti_common) = shell_tcti_receive;
+    TSS2_TCTI_FINALIZE (tcti_common) = shell_tcti_finalize;
+    TSS2_TCTI_CANCEL (tcti_common) = shell_tcti_cancel;
+    TSS2_TCTI_GET_POLL_HANDLES (tcti_common) = shell_tcti_get_poll_handles;
+    TSS2_TCTI_SET_LOCALITY (tcti_common) = shell_tcti_set_locality;
+    TSS2_TCTI_MAKE_STICKY (tcti_common) = shell_tcti_make_sticky;
+
+    return (TSS2_TCTI_CONTEXT *) t;
+}
+
+/*
+ * Flushes the sessions still held at the end of the script, they would
+ * otherwise stay loaded in TPMs without a resource manager.
+ */
+static void shell_flush_sessions(void) {
+
+    while (shell_ctx.sessions) {
+        shell_session *s = shell_ctx.sessions;
+
+        ESYS_TR handle = ESYS_TR_NONE;
+        tool_rc rc = tpm2_tr_deserialize(ctx.ectx, s->data, s->size, &handle);
+        if (rc == tool_rc_success) {
+            LOG_INFO("Flushing session \"%s\"", s->name);
+            tpm2_flush_context(ctx.ectx, handle, NULL, TPM2_ALG_NULL);
+        }
+
+        shell_session_set(s->name, NULL, 0);
+    }
+}
+
+/*
+ * A resource manager flushes the transient objects and loaded sessions of a
+ * connection when it closes. The commands of the shell share one connection,
+ * so what a command leaves behind is flushed once it is done instead, sessions
+ * held by the shell aside. Context saved sessions are not loaded and are kept
+ * for later commands, like they are across separate tool runs.
+ */
+static bool shell_session_is_held(TPM2_HANDLE handle) {
+
+    shell_session *s;
+    for (s = shell_ctx.sessions; s; s = s->next) {
+        if (s->handle == handle) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void shell_flush_handles(void) {
+
+    TSS2_SYS_CONTEXT *sys_context = NULL;
+    tool_rc rc = tpm2_getsapicontext(ctx.ectx, &sys_context);
+
+    size_t i;
+    for (i = 0; rc == tool_rc_success && i < shell_ctx.handle_count; i++) {
+        TPM2_HANDLE handle = shell_ctx.handles[i];
+        if (shell_session_is_held(handle)) {
+            continue;
+        }
+
+        LOG_INFO("Flushing handle 0x%x left by the command", handle);
+        TSS2_RC rval = Tss2_Sys_FlushContext(sys_context, handle);
+        /* sessions used without continueSession are already gone */
+        if (rval != TPM2_RC_SUCCESS &&
+                (rval & ~(TPM2_RC_N_MASK | TPM2_RC_P)) != TPM2_RC_HANDLE) {
+            LOG_WARN("Could not flush handle 0x%x left by the command, "
+                    "error: 0x%x", handle, rval);
+        }
+    }
+
+    shell_ctx.handle_count = 0;
+}
+
+static bool shell_on_arg(int argc, char **argv) {
+
+    if (argc > 1) {
+        LOG_ERR("Only one script file may be specified, got: %d", argc);
+        return false;
+    }
+
+    shell_ctx.script_path = argv[0];
+
+    return true;
+}
+
+/*
+ * Splits a line in place on whitespace. Single and double quotes group words
+ * and a '#' at the start of a word comments out the rest of the line.
+ */
+static int shell_split_line(char *line, char **argv, int max_args) {
+
+    int argc = 0;
+    char *src = line;
+
+    while (*src) {
+        while (isspace((unsigned char) *src)) {
+            src++;
+        }
+
+        if (!*src || *src == '#') {
+            break;
+        }
+
+        if (argc == max_args) {
+            LOG_ERR("Too many arguments, max is: %d", max_args);
+            return -1;
+        }
+
+        char *dest = src;
+        argv[argc++] = dest;
+
+        char quote = '\0';
+        while (*src && (quote || !isspace((unsigned char) *src))) {
+            if (quote && *src == quote) {
+                quote = '\0';
+            } else if (!quote && (*src == '\'' || *src == '"')) {
+                quote = *src;
+            } else {
+                *dest++ = *src;
+            }
+            src++;
+        }
+
+        if (quote) {
+            LOG_ERR("Unterminated quote in: \"%s\"", argv[argc - 1]);
+            return -1;
+        }
+
+        if (*src) {
+            src++;
+        }
+        *dest = '\0';
+    }
+
+    argv[argc] = NULL;
+
+    return argc;
+}
+
+static int shell_run_command(int argc, char **argv) {
+
+    const tpm2_tool *tool = tpm2_tool_find(tpm2_tool_name(argv[0]));
+    if (!tool) {
+        LOG_ERR("%s: unknown tool", argv[0]);
+        return tool_rc_general_error;
+    }
+
+    int updates[2];
+    if (pipe(updates)) {
+        LOG_ERR("Could not create pipe for \"%s\", error: %s", argv[0],
+                strerror(errno));
+        return tool_rc_general_error;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        LOG_ERR("Could not fork process to run \"%s\", error: %s", argv[0],
+                strerror(errno));
+        close(updates[0]);
+        close(updates[1]);
+        return tool_rc_general_error;
+    }
+
+    if (pid == 0) {
+        close(updates[0]);
+        shell_ctx.updates = fdopen(updates[1], "wb");
+        ctx.is_shell_child = true;
+        ctx.tool_opts = NULL;
+        tpm2_tool_exec(tool, argc, argv);
+    }
+
+    /* drain the updates before waiting, the child may block on a full pipe */
+    close(updates[1]);
+    FILE *f = fdopen(updates[0], "rb");
+    bool result = f && shell_read_updates(f);
+    if (f) {
+        fclose(f);
+    } else {
+        close(updates[0]);
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) == -1) {
+        LOG_ERR("Waiting for \"%s\" failed, error: %s", argv[0],
+                strerror(errno));
+        shell_ctx.handle_count = 0;
+        return tool_rc_general_error;
+    }
+
+    /* after the updates, the sessions the command handed over are known */
+    shell_flush_handles();
+
+    if (!result) {
+        return tool_rc_general_error;
+    }
+
+    return WIFEXITED(status) ? WEXITSTATUS(status) : tool_rc_general_error;
+}
+
+static int shell_run(int argc, char **argv) {
+
+    atexit(main_onexit);
+
+    ctx.tool_opts = tpm2_options_new(NULL, 0, NULL, NULL, shell_on_arg, 0);
+    if (!ctx.tool_opts) {
+        return tool_rc_general_error;
+    }
+
+    tpm2_option_flags flags = { .all = 0 };
+    TSS2_TCTI_CONTEXT *tcti = NULL;
+    tpm2_option_code rc = tpm2_handle_options(argc, argv, ctx.tool_opts,
+            &flags, &tcti);
+    if (rc != tpm2_option_code_continue) {
+        return rc == tpm2_option_code_err ?
+                tool_rc_general_error : tool_rc_success;
+    }
+
+    if (flags.verbose) {
+        log_set_level(log_level_verbose);
+    }
+
+    if (flags.quiet) {
+        tpm2_tool_output_disable();
+    }
+
+    ctx.ectx = ctx_init(shell_tcti_wrap(tcti));
+    if (!ctx.ectx) {
+        Tss2_TctiLdr_Finalize(&tcti);
+        return tool_rc_tcti_error;
+    }
+
+    if (flags.enable_errata) {
+        tpm2_errata_init(ctx.ectx);
+    }
+
+    tpm2_session_set_broker(&shell_broker);
+
+    FILE *script = stdin;
+    if (shell_ctx.script_path) {
+        script = fopen(shell_ctx.script_path, "r");
+        if (!script) {
+            LOG_ERR("Could not open script file \"%s\", error: %s",
+                    shell_ctx.script_path, strerror(errno));
+            return tool_rc_general_error;
+        }
+    }
+
+    /* interactive sessions carry on after a failed command */
+    bool is_interactive = isatty(fileno(script));
+
+    int ret = tool_rc_success;
+    char *line = NULL;
+    size_t line_size = 0;
+    unsigned long line_number = 0;
+    char *cmd_argv[SHELL_MAX_ARGS + 1];
+    while (true) {
+        if (is_interactive) {
+            fprintf(stderr, "tpm2> ");
+        }
+
+        if (getline(&line, &line_size, script) < 0) {
+            break;
+        }
+        line_number++;
+
+        int cmd_argc = shell_split_line(line, cmd_argv, SHELL_MAX_ARGS);
+        if (cmd_argc == 0) {
+            continue;
+        }
+
+        if (cmd_argc > 0 && (!strcmp(cmd_argv[0], "exit") ||
+                !strcmp(cmd_argv[0], "quit"))) {
+            break;
+        }
+
+        int cmd_rc = cmd_argc < 0 ? tool_rc_general_error :
+                shell_run_command(cmd_argc, cmd_argv);
+        if (cmd_rc != tool_rc_success && !is_interactive) {
+            LOG_ERR("%s:%lu: command failed with: %d",
+                    shell_ctx.script_path ? shell_ctx.script_path : "stdin",
+                    line_number, cmd_rc);
+            ret = cmd_rc;
+            break;
+        }
+    }
+
+    free(line);
+    if (script != stdin) {
+        fclose(script);
+    }
+
+    shell_flush_sessions();
+    free(shell_ctx.handles);
+
+    return ret;
+}
+
+int main(int argc, char **argv) {
+
+    /* get rid of:
+     *   owner execute (1)
+     *   group execute (1)
+     *   other write + read + execute (7)
+     */
+    umask(0117);
+
+    bool is_str_tpm2 = (strcmp(argv[0], "tpm2") == 0);
+
+    bool is_one_opt_specified = (argc == 2 && is_str_tpm2);
+
+    bool is_opt_str_help = (is_one_opt_specified &&
+        ((strcmp(argv[1],"--help") == 0) || (strcmp(argv[1],"-h") == 0) ||
+         (strcmp(argv[1],"--help=man") == 0)));
+
+    bool is_no_opts = (is_str_tpm2 && argc == 1);
+
+    if (is_no_opts || is_opt_str_help) {
+        char *options[2] = {"tpm2","--help=man"};
+        tpm2_handle_options(2, options, 0, 0, 0);
+        tool_rc rc = is_no_opts ? tool_rc_option_error : tool_rc_success;
+        exit(rc);
+    }
+
+    bool is_opt_str_help_no_man = (is_one_opt_specified &&
+        (strcmp(argv[1],"--help=no-man") == 0));
+
+    if (is_opt_str_help_no_man) {
+        tpm2_tool_output("Specify [ -v | --version ], [-h | --help] or one of "
+            "the following tool names:\n");
+        for(unsigned i = 0 ; i < tool_count ; i++) {
+            fprintf(stderr, "%s\n", tools[i]->name);
+        }
+
+        exit(tool_rc_success);
+    }
+
+    bool is_opt_str_version = (is_one_opt_specified &&
+        ((strcmp(argv[1],"--version") == 0) || (strcmp(argv[1],"-v") == 0)));
+
+    if (is_opt_str_version) {
+        tpm2_handle_options(argc, argv, 0, 0, 0);
+        exit(tool_rc_success);
+    }
+
+
+    /* don't buffer stdin/stdout/stderr so pipes work */
+    setvbuf (stdin, NULL, _IONBF, 0);
+    setvbuf (stdout, NULL, _IONBF, 0);
+    setvbuf (stderr, NULL, _IONBF, 0);
+
+    if (tpm2_tool_is_shell(argc, argv)) {
+        if (strcmp(tpm2_tool_name(argv[0]), "tpm2") == 0) {
+            argc--;
+            argv++;
+        }
+        exit(shell_run(argc, argv));
+    }
+
+    const tpm2_tool * const tool = tpm2_tool_lookup(&argc, &argv);
+    if (!tool) {
+        LOG_ERR("%s: unknown tool. Available tpm2 commands:", argv[0]);
+        for(unsigned i = 0 ; i < tool_count ; i++) {
+            fprintf(stderr, "%s\n", tools[i]->name);
+        }
+        exit(tool_rc_general_error);
+    }
+
+    tpm2_tool_exec(tool, argc, argv);
+}